@@ -68,9 +68,36 @@ void ApplicationTable::setApplications( const QList<TracedApplicationInfo> &apps
     setUpdatesEnabled( true );
 }
 
+/* Used for the applications stored in the database, which are looked up in
+ * the background; those seen meanwhile are newer, so they are kept as is.
+ */
+void ApplicationTable::addApplications( const QList<TracedApplicationInfo> &apps )
+{
+    setUpdatesEnabled( false );
+    setSortingEnabled( false );
+
+    QList<TracedApplicationInfo>::ConstIterator it, end = apps.end();
+    for ( it = apps.begin(); it != end; ++it ) {
+        TracedApplicationId id;
+        id.pid = it->pid;
+        id.name = it->name;
+        id.startTime = it->startTime;
+
+        if ( !m_items.contains( id ) ) {
+            const int rows = rowCount();
+            setRowCount( rows + 1 );
+            m_items[id] = insertEntry( rows, it->pid, it->name, it->startTime, it->stopTime );
+        }
+    }
+
+    setSortingEnabled( true );
+    setUpdatesEnabled( true );
+}
+
 void ApplicationTable::handleNewTraceEntry( const TraceEntry &entry )
 {
     TracedApplicationId id;
+    id.pid = entry.pid;
     id.name = entry.processName;
     id.startTime = entry.processStartTime;
 
@@ -87,6 +114,7 @@ void ApplicationTable::handleNewTraceEntry( const TraceEntry &entry )
 void ApplicationTable::handleProcessShutdown( const ProcessShutdownEvent &ev )
 {
     TracedApplicationId id;
+    id.pid = ev.pid;
     id.name = ev.name;
     id.startTime = ev.startTime;
 
@@ -37,6 +37,7 @@ public:
     ApplicationTable();
 
     void setApplications( const QList<TracedApplicationInfo> &apps );
+    void addApplications( const QList<TracedApplicationInfo> &apps );
 
 public slots:
     void handleNewTraceEntry( const TraceEntry &entry );
@@ -22,6 +22,7 @@
 #include "entryfilter.h"
 #include "columnsinfo.h"
 #include "../hooklib/tracelib.h"
+#include "../server/database.h"
 #ifdef HAVE_MODELTEST
 #  include "modeltest.h"
 #endif
@@ -32,18 +33,12 @@
 #include <QDateTime>
 #include <QDebug>
 #include <QSqlDriver>
-#include <QSqlError>
-#include <QSqlQuery>
-#include <QSqlRecord>
-#include <QTimer>
+#include <algorithm>
 #include <cassert>
+#include <climits>
 
 // #define DEBUG_MODEL
 
-#ifdef DEBUG_MODEL
-#  include <QTime>
-#endif
-
 typedef QVariant (*DataFormatter)(QSqlDatabase db, const EntryItemModel *model, int row, int column);
 
 static QVariant timeFormatter(QSqlDatabase, const EntryItemModel *model, int row, int column)
@@ -79,10 +74,11 @@ static QVariant stackPositionFormatter(QSqlDatabase, const EntryItemModel *model
 
 static QVariant keyFormatter(QSqlDatabase, const EntryItemModel *model, int row, int column)
 {
-    bool ok;
-    qulonglong i = model->getValue(row, column).toULongLong(&ok);
-    assert(ok);
-    return model->keyName(i);
+    // Entries without a key don't belong to any group
+    const QVariant &v = model->getValue(row, column);
+    if (v.isNull())
+        return QString("<None>");
+    return v;
 }
 
 static const struct {
@@ -102,23 +98,30 @@ static const struct {
     { "Stack Position", stackPositionFormatter }
 };
 
+const int EntryItemModel::PageSize = 100;
+const int EntryItemModel::MaximumCachedPages = 50;
+const int EntryItemModel::CountChunkSize = 10000;
+
 EntryItemModel::EntryItemModel(EntryFilter *filter, ColumnsInfo *ci,
                                QObject *parent )
     : QAbstractTableModel(parent),
-      m_numMatchingEntries(-1),
+      m_hasTextIndex(false),
+      m_textIndexQueryId(-1),
+      m_numMatchingEntries(0),
+      m_lastCountedId(0),
+      m_countQueryId(-1),
+      m_countQueryLimit(0),
+      m_recountNeeded(false),
+      m_findQueryId(-1),
+      m_foundId(0),
       m_numNewEntries(0),
-      m_databasePollingTimer(NULL),
       m_suspended(false),
       m_filter(filter),
-      m_columnsInfo(ci),
-      m_highlightedTraceKeyId(-1)
+      m_columnsInfo(ci)
 {
 #if defined(DEBUG_MODEL) && defined(HAVE_MODELTEST)
     (void)new ModelTest( this, this );
 #endif
-    m_databasePollingTimer = new QTimer(this);
-    m_databasePollingTimer->setSingleShot(true);
-    connect(m_databasePollingTimer, SIGNAL(timeout()), SLOT(insertNewTraceEntries()));
     connect(m_columnsInfo, SIGNAL(changed()), SLOT(updateScannedFieldsList()));
 }
 
@@ -126,27 +129,49 @@ EntryItemModel::~EntryItemModel()
 {
 }
 
-bool EntryItemModel::setDatabase(QSqlDatabase database,
-                                 QString *errMsg)
+void EntryItemModel::setDatabase(QSqlDatabase database,
+                                 QueryWorker *queryWorker)
 {
-    m_databasePollingTimer->stop();
     m_numNewEntries = 0;
-    m_numMatchingEntries = -1;
     m_suspended = false;
 
+    beginResetModel();
+    forgetEntries();
+    if (m_queryWorker) {
+        disconnect(m_queryWorker, 0, this, 0);
+    }
     m_db = database;
-    if (!queryForEntries(errMsg, 0))
-        return false;
-
-    return true;
+    m_queryWorker = queryWorker;
+    connect(m_queryWorker, SIGNAL(queryFinished(int, const QueryWorker::Rows &)),
+            SLOT(handleQueryResults(int, const QueryWorker::Rows &)));
+    connect(m_queryWorker, SIGNAL(queryFailed(int, const QString &)),
+            SLOT(handleQueryFailure(int, const QString &)));
+    m_hasTextIndex = false;
+    m_textIndexQueryId = m_queryWorker->submit(Database::textIndexStatement());
+    queryForEntries();
+    endResetModel();
 }
 
-bool EntryItemModel::queryForEntries(QString *errMsg, int startRow)
+static QString selectStatement(const QStringList &fields,
+                               const QStringList &tables,
+                               const QStringList &predicates)
 {
-#ifdef DEBUG_MODEL
-    qDebug() << "EntryItemModel::queryForEntries: startRow = " << startRow;
-#endif
+    QString statement = "SELECT DISTINCT ";
+    statement += fields.join(", ");
+    statement += " FROM ";
+    statement += tables.join(", ");
+    statement += " WHERE ";
+    statement += predicates.join(" AND ");
+    statement += " ORDER BY trace_entry.id LIMIT ?";
+    return statement;
+}
 
+/* Both statements select entries by their id, starting at the one bound
+ * to the first placeholder, so that no matter how far down the list the
+ * rows are, looking them up only takes an index lookup.
+ */
+void EntryItemModel::buildStatements()
+{
     QStringList tablesToSelectFrom;
     tablesToSelectFrom.append("trace_entry");
 
@@ -167,7 +192,7 @@ bool EntryItemModel::queryForEntries(QString *errMsg, int startRow)
 
         predicates << "trace_entry.traced_thread_id = traced_thread.id"
                    << "traced_thread.process_id = process.id"
-                   << QString("process.id = %1").arg(m_filter->processId());
+                   << QString("process.pid = %1").arg(m_filter->processId());
     }
 
     if (m_filter->threadId() != -1) {
@@ -238,50 +263,11 @@ bool EntryItemModel::queryForEntries(QString *errMsg, int startRow)
     tablesToSelectFrom.removeDuplicates();
     predicates.removeDuplicates();
 
-    QString fromAndWhereClause = "FROM ";
-    fromAndWhereClause += tablesToSelectFrom.join(", ");
-    if (!predicates.isEmpty()) {
-        fromAndWhereClause += " WHERE ";
-        fromAndWhereClause += predicates.join(" AND ");
-    }
-
-    if ( m_numMatchingEntries == -1 ) {
-        QString countQuery = QString( "SELECT DISTINCT trace_entry.id %1 ORDER BY trace_entry.id;" ).arg(fromAndWhereClause);
-#ifdef DEBUG_MODEL
-        QTime t;
-        t.start();
-
-        qDebug() << "Recomputing number of matching entries...";
-        qDebug() << "Query = " << countQuery;
-#endif
-        QSqlQuery q(m_db);
-        q.setForwardOnly(true);
-        if (!q.exec(countQuery)) {
-            *errMsg = m_db.lastError().text();
-            return false;
-        }
-
-        m_idForRow.clear();
-        while (q.next()) {
-            bool ok;
-            m_idForRow.append(q.value(0).toUInt(&ok));
-            assert(ok);
-        }
-        m_numMatchingEntries = m_idForRow.size();
-#ifdef DEBUG_MODEL
-        qDebug() << "Counted " << m_numMatchingEntries << " matching entries in " << t.elapsed() << "ms";
-#endif
-        if (m_numMatchingEntries == 0) {
-            // bail out early if none of the entries matched
-            m_topRow = -1;
-            m_data.clear();
-            updateHighlightedEntries();
-            return true;
-        }
-    }
-
-    assert(startRow >= 0);
-    assert(startRow < m_idForRow.size());
+    m_filterTables = tablesToSelectFrom;
+    m_filterPredicates = predicates;
+    m_countStatement = selectStatement(QStringList() << "trace_entry.id",
+                                       tablesToSelectFrom,
+                                       QStringList(predicates) << "trace_entry.id > ?");
 
     QStringList fieldsToSelect;
     {
@@ -329,7 +315,9 @@ bool EntryItemModel::queryForEntries(QString *errMsg, int startRow)
                 tablesToSelectFrom.append("trace_point");
                 predicates << "trace_entry.trace_point_id = trace_point.id";
             } else if (cn == "Key") {
-                fieldsToSelect.append("trace_point.group_id");
+                // Yields NULL for entries without a key
+                fieldsToSelect.append("(SELECT trace_point_group.name FROM trace_point_group"
+                                      " WHERE trace_point_group.id = trace_point.group_id)");
                 tablesToSelectFrom.append("trace_point");
                 predicates << "trace_entry.trace_point_id = trace_point.id";
             } else if (cn == "Message") {
@@ -343,54 +331,223 @@ bool EntryItemModel::queryForEntries(QString *errMsg, int startRow)
     tablesToSelectFrom.removeDuplicates();
     predicates.removeDuplicates();
 
-    predicates << QString("trace_entry.id >= %1").arg(m_idForRow[startRow]);
+    m_pageStatement = selectStatement(fieldsToSelect, tablesToSelectFrom,
+                                      QStringList(predicates) << "trace_entry.id >= ?");
+}
 
-    QString statement = "SELECT DISTINCT ";
-    statement += fieldsToSelect.join( ", ");
-    statement += " FROM ";
-    statement += tablesToSelectFrom.join(", ");
-    statement += " WHERE ";
-    statement += predicates.join(" AND ");
-    statement += " ORDER BY trace_entry.id LIMIT 100";
+void EntryItemModel::forgetEntries()
+{
+    if (m_queryWorker) {
+        if (m_countQueryId != -1) {
+            m_queryWorker->cancel(m_countQueryId);
+        }
+        QHash<int, int>::ConstIterator it, end = m_pageQueries.constEnd();
+        for (it = m_pageQueries.constBegin(); it != end; ++it) {
+            m_queryWorker->cancel(it.key());
+        }
+        if (m_findQueryId != -1) {
+            m_queryWorker->cancel(m_findQueryId);
+        }
+    }
+    m_countQueryId = -1;
+    m_findQueryId = -1;
+    m_foundId = 0;
+    m_recountNeeded = false;
+    m_pageQueries.clear();
+    m_numMatchingEntries = 0;
+    m_firstIdOfPage.clear();
+    m_lastCountedId = 0;
+    m_pages.clear();
+    m_recentlyUsedPages.clear();
+}
+
+/* Only a page worth of matching entries is counted at first, so that the
+ * first rows show up quickly no matter how large the database is.
+ */
+void EntryItemModel::queryForEntries()
+{
+    forgetEntries();
+    buildStatements();
+    countMoreEntries(PageSize);
+    // Refilled as pages arrive
+    m_highlightedEntryIds.clear();
+}
+
+void EntryItemModel::countMoreEntries(int maximumCount)
+{
+    if (!m_queryWorker)
+        return;
 
 #ifdef DEBUG_MODEL
-    QTime t;
-    t.start();
-    qDebug() << "Selecting data...";
-    qDebug() << "Query = " << statement;
+    qDebug() << "Counting matching entries after " << m_lastCountedId << "...";
+    qDebug() << "Query = " << m_countStatement;
 #endif
+    m_countQueryId = m_queryWorker->submit(m_countStatement,
+                                           QList<QVariant>() << m_lastCountedId << maximumCount);
+    m_countQueryLimit = maximumCount;
+}
 
-    QSqlQuery query(m_db);
-    query.setForwardOnly(true);
-    if (!query.exec(statement)) {
-        *errMsg = m_db.lastError().text();
-        return false;
+/* Results of queries which were submitted before the filter changed are
+ * not waited for anymore, so they are dropped here.
+ */
+void EntryItemModel::handleQueryResults(int queryId, const QueryWorker::Rows &rows)
+{
+    if (queryId == m_textIndexQueryId) {
+        m_textIndexQueryId = -1;
+        m_hasTextIndex = !rows.isEmpty();
+        return;
     }
 
-    {
-        m_topRow = startRow;
+    if (queryId == m_countQueryId) {
+        m_countQueryId = -1;
+#ifdef DEBUG_MODEL
+        qDebug() << "Counted " << rows.size() << " matching entries";
+#endif
+        if (!rows.isEmpty()) {
+            beginInsertRows(QModelIndex(), m_numMatchingEntries, m_numMatchingEntries + rows.size() - 1);
+            appendRows(rows);
+            endInsertRows();
+        }
+        if (rows.size() == m_countQueryLimit || m_recountNeeded) {
+            m_recountNeeded = false;
+            countMoreEntries(CountChunkSize);
+        }
+        showFoundEntry();
+        return;
+    }
 
-        m_data.clear();
-        m_data.reserve(100);
+    if (queryId == m_findQueryId) {
+        m_findQueryId = -1;
+        if (rows.isEmpty()) {
+            emit entryNotFound();
+            return;
+        }
+        m_foundId = rows.first().first().toUInt();
+        showFoundEntry();
+        return;
+    }
 
-        const int numFields = query.record().count();
+    QHash<int, int>::Iterator it = m_pageQueries.find(queryId);
+    if (it != m_pageQueries.end()) {
+        const int pageNumber = it.value();
+        m_pageQueries.erase(it);
+        storePage(pageNumber, rows);
+        showFoundEntry();
+    }
+}
 
-        while (query.next()) {
-            QVector<QVariant> row(numFields);
-            for (int i = 0; i < numFields; ++i) {
-                row[i] = query.value(i);
-            }
-            m_data.append(row);
+void EntryItemModel::handleQueryFailure(int queryId, const QString &errMsg)
+{
+    if (queryId == m_textIndexQueryId) {
+        m_textIndexQueryId = -1;
+    } else if (queryId == m_countQueryId) {
+        m_countQueryId = -1;
+    } else if (queryId == m_findQueryId) {
+        m_findQueryId = -1;
+        emit entryNotFound();
+    } else if (m_pageQueries.remove(queryId) == 0) {
+        return;
+    }
+    qDebug() << "EntryItemModel::handleQueryFailure: failed: " << errMsg;
+}
+
+void EntryItemModel::appendRows(const QueryWorker::Rows &ids)
+{
+    // The last page might have been fetched before it was complete
+    int incompletePage = -1;
+    if (m_numMatchingEntries % PageSize != 0) {
+        incompletePage = m_numMatchingEntries / PageSize;
+    }
+
+    QueryWorker::Rows::ConstIterator it, end = ids.end();
+    for (it = ids.begin(); it != end; ++it) {
+        bool ok;
+        const unsigned int id = it->first().toUInt(&ok);
+        assert(ok);
+        if (m_numMatchingEntries % PageSize == 0) {
+            m_firstIdOfPage.append(id);
         }
+        ++m_numMatchingEntries;
+        m_lastCountedId = id;
+    }
+
+    // What is known of it is shown until the complete page arrived
+    if (incompletePage != -1 && m_pages.contains(incompletePage)) {
+        requestPage(incompletePage);
+    }
+}
+
+const EntryItemModel::Page *EntryItemModel::fetchPage(int pageNumber)
+{
+    QHash<int, Page>::ConstIterator it = m_pages.constFind(pageNumber);
+    if (it == m_pages.constEnd()) {
+        if (m_pageQueries.key(pageNumber, -1) == -1) {
+            requestPage(pageNumber);
+        }
+        return NULL;
+    }
+
+    if (m_recentlyUsedPages.first() != pageNumber) {
+        m_recentlyUsedPages.removeOne(pageNumber);
+        m_recentlyUsedPages.prepend(pageNumber);
+    }
+    return &it.value();
+}
+
+/* A page which is requested again (because more of its entries were
+ * counted) replaces any request still pending for it, since that one
+ * might not see the new entries.
+ */
+void EntryItemModel::requestPage(int pageNumber)
+{
+    assert(pageNumber >= 0);
+    assert(pageNumber < m_firstIdOfPage.size());
+    if (!m_queryWorker)
+        return;
+
+    const int pendingQueryId = m_pageQueries.key(pageNumber, -1);
+    if (pendingQueryId != -1) {
+        m_queryWorker->cancel(pendingQueryId);
+        m_pageQueries.remove(pendingQueryId);
     }
 
 #ifdef DEBUG_MODEL
-    qDebug() << "Selected " << m_data.size() << " rows in " << t.elapsed() << "ms";
+    qDebug() << "Selecting data for page " << pageNumber << "...";
+    qDebug() << "Query = " << m_pageStatement;
 #endif
+    const int queryId = m_queryWorker->submit(m_pageStatement,
+                                              QList<QVariant>() << m_firstIdOfPage[pageNumber] << PageSize);
+    m_pageQueries.insert(queryId, pageNumber);
+}
 
-    updateHighlightedEntries();
+void EntryItemModel::cachePage(int pageNumber, const Page &page)
+{
+    if (m_pages.contains(pageNumber)) {
+        m_recentlyUsedPages.removeOne(pageNumber);
+    } else if (m_pages.size() >= MaximumCachedPages) {
+        m_pages.remove(m_recentlyUsedPages.takeLast());
+    }
+    m_pages.insert(pageNumber, page);
+    m_recentlyUsedPages.prepend(pageNumber);
+}
+
+void EntryItemModel::storePage(int pageNumber, const Page &page)
+{
+    cachePage(pageNumber, page);
+
+    // The rows are about to be repainted anyway
+    collectHighlightedEntries(page, &m_highlightedEntryIds);
+
+    const int firstRow = pageNumber * PageSize;
+    const int lastRow = qMin(firstRow + PageSize, m_numMatchingEntries) - 1;
+    emit dataChanged(index(firstRow, 0), index(lastRow, columnCount() - 1));
+}
 
-    return true;
+bool EntryItemModel::hasRow(int row) const
+{
+    const Page *page = const_cast<EntryItemModel *>(this)->fetchPage(row / PageSize);
+    // Entries might have been archived since they were counted
+    return page && row % PageSize < page->size();
 }
 
 int EntryItemModel::columnCount(const QModelIndex & parent) const
@@ -417,15 +574,15 @@ const QVariant &EntryItemModel::getValue(int row, int column) const
     assert(row >= 0);
     assert(row < m_numMatchingEntries);
     assert(column >= 0);
-    if (row < m_topRow || row >= m_topRow + m_data.size()) {
-        QString errMsg;
-        const_cast<EntryItemModel *>(this)->queryForEntries(&errMsg, row);
+    const Page *page = const_cast<EntryItemModel *>(this)->fetchPage(row / PageSize);
+    const int rowInPage = row % PageSize;
+    if (!page || rowInPage >= page->size()) {
+        static const QVariant invalid;
+        return invalid;
     }
-    assert(row >= m_topRow);
-    assert(row < m_topRow + m_data.size());
-    const QVector<QVariant> &rowData = m_data[row - m_topRow];
+    const QVector<QVariant> &rowData = (*page)[rowInPage];
     assert(column < rowData.size());
-    return m_data[row - m_topRow][column];
+    return rowData[column];
 }
 
 QVariant EntryItemModel::data(const QModelIndex& index, int role) const
@@ -439,6 +596,8 @@ QVariant EntryItemModel::data(const QModelIndex& index, int role) const
         if (!m_columnsInfo->isVisible(index.column()))
             return QVariant();
         int realColumn = m_columnsInfo->unmap(index.column());
+        if (!hasRow(index.row()))
+            return QVariant();
 
         int dbField = index.column() + 1; // id field is used in header
 
@@ -483,16 +642,102 @@ QVariant EntryItemModel::headerData(int section, Qt::Orientation orientation,
     return QAbstractTableModel::headerData(section, orientation, role);
 }
 
+/* Entries sent by the server are shown without asking the database for
+ * them, unless older entries still need to be counted first. Entries are
+ * sent in the order they were stored, so those which were already counted
+ * can be told apart by their id.
+ */
 void EntryItemModel::handleNewTraceEntry(const TraceEntry &e)
 {
     // Ignore entries that don't match the current filter
     if (!m_filter->matches(e))
         return;
+    if (e.id <= m_lastCountedId)
+        return;
+
+    if (m_suspended) {
+        ++m_numNewEntries;
+    } else if (m_countQueryId != -1) {
+        m_recountNeeded = true;
+    } else {
+        appendEntry(e);
+    }
+}
 
+/* Entries which the server skipped were stored before any entry it sends
+ * afterwards, so they are counted like the ones received while suspended.
+ */
+void EntryItemModel::handleSkippedTraceEntries()
+{
     ++m_numNewEntries;
-    if (!m_suspended && !m_databasePollingTimer->isActive()) {
-        m_databasePollingTimer->start(200);
+    if (!m_suspended)
+        insertNewTraceEntries();
+}
+
+void EntryItemModel::appendEntry(const TraceEntry &e)
+{
+    const int row = m_numMatchingEntries;
+    const int pageNumber = row / PageSize;
+
+    beginInsertRows(QModelIndex(), row, row);
+    if (row % PageSize == 0) {
+        m_firstIdOfPage.append(e.id);
+        cachePage(pageNumber, Page());
+    }
+    ++m_numMatchingEntries;
+    m_lastCountedId = e.id;
+
+    QHash<int, Page>::Iterator it = m_pages.find(pageNumber);
+    if (m_pageQueries.key(pageNumber, -1) != -1) {
+        // The pending lookup might not see the entry yet
+        requestPage(pageNumber);
+    } else if (it != m_pages.end() && it->size() == row % PageSize) {
+        Page newRows;
+        newRows.append(rowForEntry(e));
+        it->append(newRows.first());
+        collectHighlightedEntries(newRows, &m_highlightedEntryIds);
+    } else if (it != m_pages.end()) {
+        requestPage(pageNumber);
+    }
+    // Pages which are not cached are looked up when scrolled to
+    endInsertRows();
+}
+
+// Needs to match the fields selected by the page statement
+QVector<QVariant> EntryItemModel::rowForEntry(const TraceEntry &e) const
+{
+    QVector<QVariant> row;
+    row.append(e.id);
+
+    const QList<int> visibleColumns = m_columnsInfo->visibleColumns();
+    QList<int>::ConstIterator it, end = visibleColumns.end();
+    for (it = visibleColumns.begin(); it != end; ++it) {
+        const QString cn = m_columnsInfo->columnName(*it);
+        if (cn == "Time") {
+            row.append(e.timestamp.toMSecsSinceEpoch());
+        } else if (cn == "Application") {
+            row.append(e.processName);
+        } else if (cn == "PID") {
+            row.append(e.pid);
+        } else if (cn == "Thread") {
+            row.append(e.tid);
+        } else if (cn == "File") {
+            row.append(e.path);
+        } else if (cn == "Line") {
+            row.append(qulonglong(e.lineno));
+        } else if (cn == "Function") {
+            row.append(e.function);
+        } else if (cn == "Type") {
+            row.append(e.type);
+        } else if (cn == "Key") {
+            row.append(e.groupName.isNull() ? QVariant() : QVariant(e.groupName));
+        } else if (cn == "Message") {
+            row.append(e.message);
+        } else if (cn == "Stack Position") {
+            row.append(qulonglong(e.stackPosition));
+        }
     }
+    return row;
 }
 
 void EntryItemModel::suspend()
@@ -510,12 +755,14 @@ void EntryItemModel::clear()
 {
     beginResetModel();
     m_numNewEntries = 0;
-    m_numMatchingEntries = 0;
+    forgetEntries();
     endResetModel();
 }
 
 unsigned int EntryItemModel::idForIndex(const QModelIndex &index)
 {
+    if (!hasRow(index.row()))
+        return 0;
     bool ok;
     const unsigned int id = getValue(index.row(), 0).toUInt(&ok);
     assert(ok);
@@ -526,26 +773,20 @@ void EntryItemModel::insertNewTraceEntries()
 {
     if (m_numNewEntries == 0)
         return;
+    m_numNewEntries = 0;
 
-    beginInsertRows(QModelIndex(), m_numMatchingEntries, m_numMatchingEntries + m_numNewEntries - 1);
-    m_numMatchingEntries = -1;
-    QString errorMsg;
-    if (!queryForEntries(&errorMsg, 0)) {
-        qDebug() << "EntryItemModel::insertNewTraceEntries: failed: " << errorMsg;
+    // New entries have larger ids than all entries counted so far
+    if (m_countQueryId == -1) {
+        countMoreEntries(CountChunkSize);
+    } else {
+        m_recountNeeded = true;
     }
-    endInsertRows();
-
-    m_numNewEntries = 0;
 }
 
 void EntryItemModel::reApplyFilter()
 {
-    m_numMatchingEntries = -1;
     beginResetModel();
-    QString errorMsg;
-    if (!queryForEntries(&errorMsg, 0)) {
-        qDebug() << "EntryItemModel::reApplyFilter: failed: " << errorMsg;
-    }
+    queryForEntries();
     endResetModel();
 }
 
@@ -588,21 +829,13 @@ void EntryItemModel::highlightTraceKey(const QString &traceKey)
 {
     if ( m_highlightedTraceKey != traceKey ) {
         m_highlightedTraceKey = traceKey;
-
-        QSqlQuery q(m_db);
-        q.setForwardOnly(true);
-        if (q.exec(QString("SELECT trace_point_group.id FROM trace_point_group WHERE trace_point_group.name = '%1'").arg(traceKey))) {
-            q.next();
-            m_highlightedTraceKeyId = q.value(0).toInt();
-        }
         updateHighlightedEntries();
     }
 }
 
-void EntryItemModel::updateHighlightedEntries()
+void EntryItemModel::collectHighlightedEntries(const Page &page,
+                                               QSet<unsigned int> *ids) const
 {
-    QSet<unsigned int> entriesToHighlight;
-
     int traceKeyColumn = -1;
     if ( !m_highlightedTraceKey.isEmpty() ) {
         const QList<int> visibleColumns = m_columnsInfo->visibleColumns();
@@ -616,8 +849,8 @@ void EntryItemModel::updateHighlightedEntries()
         }
     }
 
-    QVector<QVector<QVariant> >::ConstIterator it, end = m_data.end();
-    for ( it = m_data.begin(); it != end; ++it ) {
+    Page::ConstIterator it, end = page.end();
+    for ( it = page.begin(); it != end; ++it ) {
         const QVector<QVariant> &row = *it;
 
         bool ok;
@@ -628,17 +861,27 @@ void EntryItemModel::updateHighlightedEntries()
         for ( fieldIdxIt = m_scannedFields.begin(); fieldIdxIt != fieldIdxEnd; ++fieldIdxIt ) {
             const QVariant &v = row[*fieldIdxIt + 1];
             if ( m_lastSearchTerm.exactMatch( v.toString() ) ) {
-                entriesToHighlight.insert(entryId);
+                ids->insert(entryId);
             }
         }
 
         if ( traceKeyColumn != -1 ) {
             const QVariant &v = row[traceKeyColumn + 1];
-            if ( v.toInt() == m_highlightedTraceKeyId ) {
-                entriesToHighlight.insert(entryId);
+            if ( v.toString() == m_highlightedTraceKey ) {
+                ids->insert(entryId);
             }
         }
     }
+}
+
+void EntryItemModel::updateHighlightedEntries()
+{
+    QSet<unsigned int> entriesToHighlight;
+
+    QHash<int, Page>::ConstIterator it, end = m_pages.constEnd();
+    for ( it = m_pages.constBegin(); it != end; ++it ) {
+        collectHighlightedEntries( it.value(), &entriesToHighlight );
+    }
 
     if ( entriesToHighlight != m_highlightedEntryIds ) {
         m_highlightedEntryIds = entriesToHighlight;
@@ -664,22 +907,141 @@ void EntryItemModel::updateScannedFieldsList()
     }
 }
 
-QString EntryItemModel::keyName(int id) const
+void EntryItemModel::setCellFont(const QFont &font)
 {
-    if (id == 0) {
-        return QString("<None>");
+    m_cellFont = font;
+}
+
+void EntryItemModel::findEntry(const QString &term, const QModelIndex &start,
+                               bool forward)
+{
+    if (!m_queryWorker)
+        return;
+
+    if (m_findQueryId != -1) {
+        m_queryWorker->cancel(m_findQueryId);
     }
-    QSqlQuery q(m_db);
-    q.setForwardOnly(true);
-    if (!q.exec(QString("SELECT trace_point_group.name FROM trace_point_group WHERE trace_point_group.id = %1").arg(id))) {
-        return "";
+    m_foundId = 0;
+
+    unsigned int startId = forward ? 0 : UINT_MAX;
+    if (start.isValid()) {
+        const int row = start.row();
+        if (hasRow(row)) {
+            startId = getValue(row, 0).toUInt();
+        } else {
+            // Close enough while the page is still being fetched
+            startId = m_firstIdOfPage[row / PageSize];
+        }
     }
-    q.next();
-    return q.value(0).toString();
+
+    QList<QVariant> bindValues;
+    const QString statement = findStatement(term, startId, forward, &bindValues);
+#ifdef DEBUG_MODEL
+    qDebug() << "Finding entry from " << startId << "...";
+    qDebug() << "Query = " << statement;
+#endif
+    m_findQueryId = m_queryWorker->submit(statement, bindValues);
 }
 
-void EntryItemModel::setCellFont(const QFont &font)
+/* With the full-text index, entries are looked up in the order of their
+ * ids in the index, so that the search stops at the first match. Terms
+ * shorter than three characters don't make up a single trigram though,
+ * all entries are scanned then - as they are without an index.
+ */
+QString EntryItemModel::findStatement(const QString &term, unsigned int startId,
+                                      bool forward, QList<QVariant> *bindValues) const
 {
-    m_cellFont = font;
+    QString pattern = term;
+    pattern.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+    pattern = "%" + pattern + "%";
+
+    QString idField;
+    QStringList tables;
+    QStringList predicates;
+    if (m_hasTextIndex) {
+        idField = "entry_text.rowid";
+        tables << "entry_text";
+        if (term.length() >= 3) {
+            QString phrase = term;
+            phrase.replace("\"", "\"\"");
+            predicates << "entry_text MATCH ?";
+            bindValues->append(QString("\"%1\"").arg(phrase));
+        } else {
+            predicates << "(entry_text.message LIKE ? ESCAPE '\\'"
+                          " OR entry_text.function LIKE ? ESCAPE '\\'"
+                          " OR entry_text.file LIKE ? ESCAPE '\\'"
+                          " OR entry_text.variables LIKE ? ESCAPE '\\')";
+            *bindValues << pattern << pattern << pattern << pattern;
+        }
+        // Joining the entries is costly if segments are attached
+        if (!m_filterPredicates.isEmpty()) {
+            tables << m_filterTables;
+            predicates << "trace_entry.id = entry_text.rowid" << m_filterPredicates;
+        }
+    } else {
+        idField = "trace_entry.id";
+        tables << m_filterTables << "trace_point" << "function_name" << "path_name";
+        predicates << m_filterPredicates
+                   << "trace_entry.trace_point_id = trace_point.id"
+                   << "trace_point.function_id = function_name.id"
+                   << "trace_point.path_id = path_name.id"
+                   << "(trace_entry.message LIKE ? ESCAPE '\\'"
+                      " OR function_name.name LIKE ? ESCAPE '\\'"
+                      " OR path_name.name LIKE ? ESCAPE '\\'"
+                      " OR EXISTS (SELECT 1 FROM variable WHERE variable.trace_entry_id = trace_entry.id"
+                      " AND variable.value LIKE ? ESCAPE '\\'))";
+        *bindValues << pattern << pattern << pattern << pattern;
+        tables.removeDuplicates();
+        predicates.removeDuplicates();
+    }
+    predicates << QString("%1 %2 ?").arg(idField).arg(forward ? ">" : "<");
+    bindValues->append(startId);
+
+    return QString("SELECT %1 FROM %2 WHERE %3 ORDER BY %1 %4 LIMIT 1")
+        .arg(idField)
+        .arg(tables.join(", "))
+        .arg(predicates.join(" AND "))
+        .arg(forward ? "ASC" : "DESC");
+}
+
+/* The found entry passes the filter, so it is one of the matching entries
+ * once they have been counted up to it.
+ */
+void EntryItemModel::showFoundEntry()
+{
+    if (m_foundId == 0)
+        return;
+
+    if (m_foundId > m_lastCountedId) {
+        // Counting stopped short of it, e.g. since the model is suspended
+        if (m_countQueryId == -1) {
+            m_foundId = 0;
+            emit entryNotFound();
+        }
+        return;
+    }
+
+    const int pageNumber = std::upper_bound(m_firstIdOfPage.constBegin(),
+                                            m_firstIdOfPage.constEnd(),
+                                            m_foundId) - m_firstIdOfPage.constBegin() - 1;
+    if (pageNumber >= 0) {
+        const Page *page = fetchPage(pageNumber);
+        if (!page)
+            return;
+        for (int i = 0; i < page->size(); ++i) {
+            if (page->at(i).first().toUInt() == m_foundId) {
+                m_foundId = 0;
+                emit entryFound(index(pageNumber * PageSize + i, 0));
+                return;
+            }
+        }
+        // Fetched before all of its entries were counted, fetched again
+        if (m_pageQueries.key(pageNumber, -1) != -1)
+            return;
+    }
+
+    // Archived in the meantime
+    m_foundId = 0;
+    emit entryNotFound();
 }
 
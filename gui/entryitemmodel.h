@@ -20,27 +20,39 @@
 #ifndef ENTRYITEMMODEL_H
 #define ENTRYITEMMODEL_H
 
+#include "queryworker.h"
 #include "searchwidget.h"
 
 #include <QAbstractTableModel>
+#include <QHash>
+#include <QPointer>
 #include <QSet>
 #include <QSqlDatabase>
 
-class QTimer;
-
 struct TraceEntry;
 class EntryFilter;
 class ColumnsInfo;
 
+/* Matching entries are counted in chunks in the background, remembering
+ * the id of the first entry of every page of rows. Pages are fetched when
+ * needed by looking up entries starting at that id; only a limited number
+ * of them is kept. All of these queries are run by a QueryWorker; rows
+ * whose page did not arrive yet are shown empty. Entries received from the
+ * server while following the trace are appended to the last page directly.
+ */
 class EntryItemModel : public QAbstractTableModel
 {
     Q_OBJECT
 public:
+    static const int PageSize;
+    static const int MaximumCachedPages;
+    // Number of matching entries looked up at a time while counting
+    static const int CountChunkSize;
+
     EntryItemModel(EntryFilter *filter, ColumnsInfo *ci, QObject *parent = 0);
     ~EntryItemModel();
 
-    bool setDatabase(QSqlDatabase database,
-                     QString *errMsg);
+    void setDatabase(QSqlDatabase database, QueryWorker *queryWorker);
 
     int columnCount(const QModelIndex & parent = QModelIndex()) const;
     int rowCount(const QModelIndex & parent = QModelIndex()) const;
@@ -59,12 +71,22 @@ public:
     unsigned int idForIndex(const QModelIndex &index);
     const QVariant &getValue(int row, int column) const;
 
-    QString keyName(int id) const;
-
     void setCellFont(const QFont &font);
 
+    /* Looks for the closest entry after (or before) the given one which
+     * passes the filter and contains the term in its message, function,
+     * file or variable values. The full-text index is used if the database
+     * has one; the outcome is signalled once the row is known.
+     */
+    void findEntry(const QString &term, const QModelIndex &start, bool forward);
+
+signals:
+    void entryFound(const QModelIndex &index);
+    void entryNotFound();
+
 public slots:
     void handleNewTraceEntry(const TraceEntry &e);
+    void handleSkippedTraceEntries();
     void reApplyFilter();
     void highlightEntries(const QString &term,
                           const QStringList &fields,
@@ -74,18 +96,58 @@ public slots:
 private slots:
     void insertNewTraceEntries();
     void updateScannedFieldsList();
+    void handleQueryResults(int queryId, const QueryWorker::Rows &rows);
+    void handleQueryFailure(int queryId, const QString &errMsg);
 
 private:
-    bool queryForEntries(QString *errMsg, int startRow);
+    typedef QVector<QVector<QVariant> > Page;
+
+    void queryForEntries();
+    void buildStatements();
+    void forgetEntries();
+    void countMoreEntries(int maximumCount);
+    void appendRows(const QueryWorker::Rows &ids);
+    void appendEntry(const TraceEntry &e);
+    QVector<QVariant> rowForEntry(const TraceEntry &e) const;
+    const Page *fetchPage(int pageNumber);
+    void requestPage(int pageNumber);
+    void cachePage(int pageNumber, const Page &page);
+    void storePage(int pageNumber, const Page &page);
+    bool hasRow(int row) const;
+    void collectHighlightedEntries(const Page &page,
+                                   QSet<unsigned int> *ids) const;
     void updateHighlightedEntries();
+    QString findStatement(const QString &term, unsigned int startId, bool forward,
+                          QList<QVariant> *bindValues) const;
+    void showFoundEntry();
 
     QSqlDatabase m_db;
+    QPointer<QueryWorker> m_queryWorker;
+    // Looked up once per database; entries are scanned until it is known
+    bool m_hasTextIndex;
+    int m_textIndexQueryId;
+    QString m_countStatement;
+    QString m_pageStatement;
+    // What entries need to pass the filter, without the fields to show
+    QStringList m_filterTables;
+    QStringList m_filterPredicates;
     int m_numMatchingEntries;
-    int m_topRow;
-    QVector<QVector<QVariant> > m_data;
-    QVector<unsigned int> m_idForRow;
+    QVector<unsigned int> m_firstIdOfPage;
+    unsigned int m_lastCountedId;
+    int m_countQueryId;
+    int m_countQueryLimit;
+    // Entries were stored while counting
+    bool m_recountNeeded;
+    QHash<int, Page> m_pages;
+    // Page numbers by id of the query fetching them
+    QHash<int, int> m_pageQueries;
+    // Most recently used first
+    QList<int> m_recentlyUsedPages;
+    int m_findQueryId;
+    // Shown as soon as its row is known
+    unsigned int m_foundId;
+    // Entries received while suspended
     unsigned int m_numNewEntries;
-    QTimer *m_databasePollingTimer;
     bool m_suspended;
     EntryFilter *m_filter;
     ColumnsInfo *m_columnsInfo;
@@ -94,7 +156,6 @@ private:
     QStringList m_scannedFieldNames;
     QList<int> m_scannedFields;
     QString m_highlightedTraceKey;
-    int m_highlightedTraceKeyId;
     QFont m_cellFont;
 };
 
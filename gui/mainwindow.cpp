@@ -25,6 +25,7 @@
 #include "filterform.h"
 #include "settingsform.h"
 #include "entryitemmodel.h"
+#include "queryworker.h"
 #include "watchtree.h"
 #include "columnsinfo.h"
 #include "storageview.h"
@@ -54,11 +55,9 @@ QByteArray serializeDatagram( DatagramType type, const ValueType *v )
 {
     QByteArray payload;
     {
-        static const quint32 ProtocolVersion = 1;
-
         QDataStream stream( &payload, QIODevice::WriteOnly );
         stream.setVersion( QDataStream::Qt_4_0 );
-        stream << MagicServerProtocolCookie << ProtocolVersion << (quint8)type;
+        stream << MagicServerProtocolCookie << ServerProtocolVersion << (quint8)type;
         if ( v ) {
             stream << *v;
         }
@@ -68,7 +67,7 @@ QByteArray serializeDatagram( DatagramType type, const ValueType *v )
     {
         QDataStream stream( &data, QIODevice::WriteOnly );
         stream.setVersion( QDataStream::Qt_4_0 );
-        stream << (quint16)payload.size();
+        stream << (quint32)payload.size();
         data.append( payload );
     }
 
@@ -85,7 +84,8 @@ QByteArray serializeServerDatagram( ServerDatagramType type, const T &v ) {
 }
 
 ServerSocket::ServerSocket(QObject *parent)
-    : QTcpSocket(parent)
+    : QTcpSocket(parent),
+      m_nextPayloadSize(0)
 {
     connect(this, SIGNAL(readyRead()), SLOT(handleIncomingData()));
 }
@@ -97,15 +97,14 @@ void ServerSocket::handleIncomingData()
     stream.setVersion(QDataStream::Qt_4_0);
 
     while (true) {
-        static quint16 nextPayloadSize = 0;
-        if (nextPayloadSize == 0) {
-            if (bytesAvailable() < sizeof(nextPayloadSize)) {
+        if (m_nextPayloadSize == 0) {
+            if (bytesAvailable() < sizeof(m_nextPayloadSize)) {
                 return;
             }
-            stream >> nextPayloadSize;
+            stream >> m_nextPayloadSize;
         }
 
-        if (bytesAvailable() < nextPayloadSize) {
+        if (bytesAvailable() < m_nextPayloadSize) {
             return;
         }
 
@@ -118,7 +117,11 @@ void ServerSocket::handleIncomingData()
 
         quint32 protocolVersion;
         stream >> protocolVersion;
-        assert(protocolVersion == 1);
+        if (protocolVersion != ServerProtocolVersion) {
+            qWarning() << "Disconnecting from server using unsupported protocol version" << protocolVersion;
+            disconnectFromHost();
+            return;
+        }
 
         quint8 datagramType;
         stream >> datagramType;
@@ -144,8 +147,26 @@ void ServerSocket::handleIncomingData()
             case DatabaseNukeFinishedDatagram:
                 emit databaseWasNuked();
                 break;
+            case SegmentsChangedDatagram:
+                emit segmentsChanged();
+                break;
+            case TraceEntriesDatagram: {
+                QList<TraceEntry> entries;
+                stream >> entries;
+                QList<TraceEntry>::ConstIterator it, end = entries.end();
+                for (it = entries.begin(); it != end; ++it) {
+                    emit traceEntryReceived(*it);
+                }
+                break;
+            }
+            case TraceEntriesSkippedDatagram: {
+                quint32 numEntries;
+                stream >> numEntries;
+                emit traceEntriesSkipped(numEntries);
+                break;
+            }
         }
-        nextPayloadSize = 0;
+        m_nextPayloadSize = 0;
     }
 }
 
@@ -162,6 +183,10 @@ MainWindow::MainWindow(Settings *settings,
                        QWidget *parent, Qt::WindowFlags flags)
     : QMainWindow(parent, flags),
       m_settings(settings),
+      m_queryWorker(NULL),
+      m_traceKeysQueryId(-1),
+      m_applicationsQueryId(-1),
+      m_backtraceQueryId(-1),
       m_entryItemModel(NULL),
       m_watchTree(NULL),
       m_serverSocket(NULL),
@@ -264,6 +289,12 @@ bool MainWindow::setDatabase(const QString &databaseFileName, QString *errMsg)
     if (m_entryItemModel) {
 	delete m_entryItemModel; m_entryItemModel = NULL;
     }
+    if (m_queryWorker) {
+        delete m_queryWorker; m_queryWorker = NULL;
+    }
+    m_traceKeysQueryId = -1;
+    m_applicationsQueryId = -1;
+    m_backtraceQueryId = -1;
 
     if (QFile::exists(databaseFileName)) {
         m_db = Database::open(databaseFileName, errMsg);
@@ -273,24 +304,26 @@ bool MainWindow::setDatabase(const QString &databaseFileName, QString *errMsg)
     if (!m_db.isValid())
         return false;
 
-    QStringList traceKeysNames = Database::seenGroupIds(m_db);
-    tracePointsSearchWidget->setTraceKeys(traceKeysNames);
-    m_filterForm->setTraceKeys(traceKeysNames);
+    /* Everything which might take a while is queried in the background;
+     * the worker attaches the segments to its own connection.
+     */
+    m_queryWorker = new QueryWorker(m_db, this);
+    connect(m_queryWorker, SIGNAL(queryFinished(int, const QueryWorker::Rows &)),
+            this, SLOT(handleQueryResults(int, const QueryWorker::Rows &)));
+    connect(m_queryWorker, SIGNAL(queryFailed(int, const QString &)),
+            this, SLOT(handleQueryFailure(int, const QString &)));
+    m_queryWorker->start();
 
     m_entryItemModel = new EntryItemModel(m_settings->entryFilter(),
                                           m_settings->columnsInfo(), this);
-    if (!m_entryItemModel->setDatabase(m_db, errMsg)) {
-	delete m_entryItemModel; m_entryItemModel = NULL;
-        return false;
-    }
-
-    if (!m_watchTree->setDatabase(m_db, errMsg)) {
-	delete m_entryItemModel; m_entryItemModel = NULL;
-        return false;
-    }
+    m_entryItemModel->setDatabase(m_db, m_queryWorker);
+    m_watchTree->setQueryWorker(m_queryWorker);
 
-    tracePointsSearchWidget->setTraceKeys(traceKeysNames);
-    m_applicationTable->setApplications(Database::tracedApplications(m_db));
+    tracePointsSearchWidget->setTraceKeys(QStringList());
+    m_filterForm->setTraceKeys(QStringList());
+    queryForTraceKeys();
+    m_applicationTable->setApplications(QList<TracedApplicationInfo>());
+    m_applicationsQueryId = m_queryWorker->submit(Database::tracedApplicationsStatement());
 
     if (m_serverSocket) {
         connect(m_serverSocket, SIGNAL(traceEntryReceived(const TraceEntry &)),
@@ -299,6 +332,10 @@ bool MainWindow::setDatabase(const QString &databaseFileName, QString *errMsg)
                 m_applicationTable, SLOT(handleProcessShutdown(const ProcessShutdownEvent &)));
         connect(m_serverSocket, SIGNAL(databaseWasNuked()),
                 this, SLOT(databaseWasNuked()));
+        connect(m_serverSocket, SIGNAL(segmentsChanged()),
+                this, SLOT(attachSegments()));
+        connect(m_serverSocket, SIGNAL(traceEntriesSkipped(quint32)),
+                this, SLOT(catchUpWithDatabase()));
     }
     connect( tracePointsSearchWidget, SIGNAL( searchCriteriaChanged( const QString &,
                                                                      const QStringList &,
@@ -308,6 +345,14 @@ bool MainWindow::setDatabase(const QString &databaseFileName, QString *errMsg)
                                                        SearchWidget::MatchType ) ) );
     connect(tracePointsSearchWidget, SIGNAL(activeTraceKeyChanged(const QString &)),
             m_entryItemModel, SLOT(highlightTraceKey(const QString &)));
+    connect(tracePointsSearchWidget, SIGNAL(findNextRequested(const QString &)),
+            this, SLOT(findNextEntry(const QString &)));
+    connect(tracePointsSearchWidget, SIGNAL(findPreviousRequested(const QString &)),
+            this, SLOT(findPreviousEntry(const QString &)));
+    connect(m_entryItemModel, SIGNAL(entryFound(const QModelIndex &)),
+            this, SLOT(showFoundEntry(const QModelIndex &)));
+    connect(m_entryItemModel, SIGNAL(entryNotFound()),
+            this, SLOT(reportEntryNotFound()));
 
     connect( tracePointsClear, SIGNAL(clicked()),
              this, SLOT(clearTracePoints()));
@@ -774,6 +819,11 @@ void MainWindow::clearTracePoints()
         tracePointsClear->setEnabled( false );
         m_serverSocket->write( serializeServerDatagram( DatabaseNukeDatagram ) );
     } else {
+        // Clearing the segments, too
+        QString errMsg;
+        if ( !Database::attachSegments( m_db, &errMsg ) ) {
+            qWarning() << "Failed to attach segments of" << m_db.databaseName() << ":" << errMsg;
+        }
         Database::trimTo( m_db, 0 );
         databaseWasNuked();
     }
@@ -781,18 +831,130 @@ void MainWindow::clearTracePoints()
 
 void MainWindow::databaseWasNuked()
 {
+    // Segments are dropped when nuking or archiving
+    attachSegments();
     m_entryItemModel->clear();
     m_watchTree->reApplyFilter();
     tracePointsSearchWidget->setTraceKeys( QStringList() );
     m_filterForm->setTraceKeys( QStringList() );
+    if ( m_traceKeysQueryId != -1 ) {
+        m_queryWorker->cancel( m_traceKeysQueryId );
+        m_traceKeysQueryId = -1;
+    }
     m_applicationTable->setApplications( QList<TracedApplicationInfo>() );
+    if ( m_applicationsQueryId != -1 ) {
+        m_queryWorker->cancel( m_applicationsQueryId );
+        m_applicationsQueryId = -1;
+    }
     tracePointsClear->setEnabled( true );
 }
 
+/* Entries which were not sent by the server are picked up from the
+ * database in the background, without starting over. Their applications
+ * show up in the table with the next entry or shutdown event received.
+ */
+void MainWindow::catchUpWithDatabase()
+{
+    m_entryItemModel->handleSkippedTraceEntries();
+    m_watchTree->handleSkippedTraceEntries();
+}
+
+void MainWindow::attachSegments()
+{
+    m_queryWorker->attachSegments();
+}
+
+/* Trace keys which are stored already are added to the ones seen in the
+ * entries received meanwhile.
+ */
+void MainWindow::queryForTraceKeys()
+{
+    if ( m_traceKeysQueryId != -1 ) {
+        m_queryWorker->cancel( m_traceKeysQueryId );
+    }
+    m_traceKeysQueryId = m_queryWorker->submit( Database::seenGroupIdsStatement() );
+}
+
+void MainWindow::handleQueryResults( int queryId, const QueryWorker::Rows &rows )
+{
+    if ( queryId == m_traceKeysQueryId ) {
+        m_traceKeysQueryId = -1;
+        QStringList groupIds;
+        QueryWorker::Rows::ConstIterator it, end = rows.end();
+        for ( it = rows.begin(); it != end; ++it ) {
+            groupIds.append( it->first().toString() );
+        }
+        tracePointsSearchWidget->addTraceKeys( groupIds );
+        m_filterForm->addTraceKeys( groupIds );
+    } else if ( queryId == m_applicationsQueryId ) {
+        m_applicationsQueryId = -1;
+        QList<TracedApplicationInfo> apps;
+        QueryWorker::Rows::ConstIterator it, end = rows.end();
+        for ( it = rows.begin(); it != end; ++it ) {
+            apps.append( Database::tracedApplication( *it ) );
+        }
+        m_applicationTable->addApplications( apps );
+    } else if ( queryId == m_backtraceQueryId ) {
+        m_backtraceQueryId = -1;
+        showBacktrace( rows );
+    }
+}
+
+void MainWindow::handleQueryFailure( int queryId, const QString &errMsg )
+{
+    if ( queryId == m_traceKeysQueryId ) {
+        m_traceKeysQueryId = -1;
+    } else if ( queryId == m_applicationsQueryId ) {
+        m_applicationsQueryId = -1;
+    } else if ( queryId == m_backtraceQueryId ) {
+        m_backtraceQueryId = -1;
+        showError( tr( "Backtrace" ),
+                   tr( "Failed to retrieve backtrace for trace entry: %1" ).arg( errMsg ) );
+        return;
+    } else {
+        return;
+    }
+    qWarning() << "MainWindow::handleQueryFailure: failed: " << errMsg;
+}
+
+void MainWindow::findNextEntry(const QString &term)
+{
+    m_entryItemModel->findEntry(term, tracePointsView->currentIndex(), true);
+}
+
+void MainWindow::findPreviousEntry(const QString &term)
+{
+    m_entryItemModel->findEntry(term, tracePointsView->currentIndex(), false);
+}
+
+void MainWindow::showFoundEntry(const QModelIndex &index)
+{
+    tracePointsView->setCurrentIndex(index);
+    tracePointsView->scrollTo(index, QAbstractItemView::PositionAtCenter);
+}
+
+void MainWindow::reportEntryNotFound()
+{
+    statusBar()->showMessage(tr("No further matching trace entry found."), 2000);
+}
+
 void MainWindow::traceEntryDoubleClicked(const QModelIndex &index)
 {
     const unsigned int id = m_entryItemModel->idForIndex(index);
-    const QList<StackFrame> backtrace = Database::backtraceForEntry(m_db, id);
+    // Only the backtrace of the entry double-clicked last is shown
+    if ( m_backtraceQueryId != -1 ) {
+        m_queryWorker->cancel( m_backtraceQueryId );
+    }
+    m_backtraceQueryId = m_queryWorker->submit( Database::backtraceStatement( id ) );
+}
+
+void MainWindow::showBacktrace( const QueryWorker::Rows &rows )
+{
+    QList<StackFrame> backtrace;
+    QueryWorker::Rows::ConstIterator rowIt, rowEnd = rows.end();
+    for ( rowIt = rows.begin(); rowIt != rowEnd; ++rowIt ) {
+        backtrace.append( Database::stackFrame( *rowIt ) );
+    }
     if ( backtrace.isEmpty() ) {
         QMessageBox::information( this,
                                   tr( "Backtrace" ),
@@ -834,9 +996,14 @@ void MainWindow::addNewTraceKey( const QString &id )
 
 void MainWindow::handleNewTraceEntry( const TraceEntry &e )
 {
+    QStringList groupIds;
     QList<TraceKey>::ConstIterator it, end = e.traceKeys.end();
     for ( it = e.traceKeys.begin(); it != end; ++it ) {
         m_filterForm->enableTraceKeyByDefault( ( *it ).name, ( *it ).enabled );
+        groupIds.append( ( *it ).name );
+    }
+    if ( !e.groupName.isNull() ) {
+        groupIds.append( e.groupName );
     }
 
     // This trick used to update filtered keys check boxes state.
@@ -848,10 +1015,10 @@ void MainWindow::handleNewTraceEntry( const TraceEntry &e )
     if (!firstEntryPassed) {
         m_filterForm->setTraceKeys(QStringList());
         firstEntryPassed = true;
+        // Keys of the entries stored before; later ones come with the entries
+        queryForTraceKeys();
     }
 
-    // ### reduce number of database queries through caching
-    const QStringList groupIds = Database::seenGroupIds( m_db );
     tracePointsSearchWidget->addTraceKeys( groupIds );
     m_filterForm->addTraceKeys( groupIds );
 
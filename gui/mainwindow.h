@@ -27,6 +27,7 @@
 #include <QStyledItemDelegate>
 #include "ui_mainwindow.h"
 #include "settings.h"
+#include "queryworker.h"
 
 class ApplicationTable;
 class EntryItemModel;
@@ -51,9 +52,15 @@ signals:
     void traceEntryReceived(const TraceEntry &entry);
     void processShutdown(const ProcessShutdownEvent &ev);
     void databaseWasNuked();
+    void segmentsChanged();
+    // The server didn't send entries since the GUI didn't keep up
+    void traceEntriesSkipped(quint32 numEntries);
 
 private slots:
     void handleIncomingData();
+
+private:
+    quint32 m_nextPayloadSize;
 };
 
 class CustomDateTimeFormattingDelegate : public QStyledItemDelegate
@@ -112,15 +119,29 @@ private slots:
     void automaticServerOutput();
     void handleNewTraceEntry(const TraceEntry &e);
     void databaseWasNuked();
+    void attachSegments();
+    void catchUpWithDatabase();
+    void findNextEntry(const QString &term);
+    void findPreviousEntry(const QString &term);
+    void showFoundEntry(const QModelIndex &index);
+    void reportEntryNotFound();
+    void handleQueryResults(int queryId, const QueryWorker::Rows &rows);
+    void handleQueryFailure(int queryId, const QString &errMsg);
 
 private:
     bool openConfigurationFile(const QString &fileName);
     void showError(const QString &title, const QString &message);
     bool startAutomaticServer();
     void stopAutomaticServer();
+    void queryForTraceKeys();
+    void showBacktrace(const QueryWorker::Rows &rows);
 
     Settings* const m_settings;
     QSqlDatabase m_db;
+    QueryWorker *m_queryWorker;
+    int m_traceKeysQueryId;
+    int m_applicationsQueryId;
+    int m_backtraceQueryId;
     EntryItemModel* m_entryItemModel;
     WatchTree* m_watchTree;
     FilterForm *m_filterForm;
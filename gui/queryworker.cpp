@@ -0,0 +1,260 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "queryworker.h"
+
+#include "../server/database.h"
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlDriver>
+#include <QSqlRecord>
+
+#ifdef HAVE_SQLITE3
+#  include <sqlite3.h>
+#endif
+
+static QAtomicInt g_lastQueryId;
+
+/* The SQLite library linked in can only take the handle of the connection
+ * if the driver uses the same version, rather than a different one built
+ * into the driver plugin.
+ */
+static sqlite3 *interruptibleHandle(QSqlDatabase db)
+{
+#ifdef HAVE_SQLITE3
+    const QVariant handle = db.driver()->handle();
+    if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0) {
+        return NULL;
+    }
+    QSqlQuery query(db);
+    if (!query.exec("SELECT sqlite_version();") || !query.next() ||
+        query.value(0).toString() != QLatin1String(sqlite3_libversion())) {
+        return NULL;
+    }
+    return *static_cast<sqlite3 * const *>(handle.constData());
+#else
+    Q_UNUSED(db);
+    return NULL;
+#endif
+}
+
+QueryWorker::QueryWorker(QSqlDatabase db, QObject *parent)
+    : QThread(parent),
+      m_db(db),
+      m_runningQueryId(-1),
+      m_runningQueryCancelled(false),
+      m_interruptibleHandle(NULL),
+      m_stopRequested(false)
+{
+    qRegisterMetaType<QueryWorker::Rows>("QueryWorker::Rows");
+}
+
+QueryWorker::~QueryWorker()
+{
+    stop();
+}
+
+int QueryWorker::submit(const QString &statement,
+                        const QList<QVariant> &bindValues)
+{
+    Command command(Command::RunQuery);
+    command.queryId = g_lastQueryId.fetchAndAddOrdered(1) + 1;
+    command.statement = statement;
+    command.bindValues = bindValues;
+    enqueue(command);
+    return command.queryId;
+}
+
+void QueryWorker::cancel(int queryId)
+{
+    QMutexLocker locker(&m_mutex);
+    if (queryId == m_runningQueryId) {
+        m_runningQueryCancelled = true;
+        interruptRunningQuery();
+        return;
+    }
+    QQueue<Command>::Iterator it, end = m_queue.end();
+    for (it = m_queue.begin(); it != end; ++it) {
+        if (it->queryId == queryId) {
+            m_queue.erase(it);
+            break;
+        }
+    }
+}
+
+void QueryWorker::attachSegments()
+{
+    enqueue(Command(Command::AttachSegments));
+}
+
+void QueryWorker::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopRequested = true;
+        m_queue.clear();
+        m_runningQueryCancelled = true;
+        interruptRunningQuery();
+        m_queueNotEmpty.wakeAll();
+    }
+    wait();
+}
+
+bool QueryWorker::canInterrupt() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_interruptibleHandle != NULL;
+}
+
+// Called with the mutex held, which keeps the connection open meanwhile
+void QueryWorker::interruptRunningQuery()
+{
+#ifdef HAVE_SQLITE3
+    if (m_interruptibleHandle && m_runningQueryId != -1) {
+        sqlite3_interrupt(m_interruptibleHandle);
+    }
+#endif
+}
+
+void QueryWorker::enqueue(const Command &command)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_stopRequested) {
+        return;
+    }
+    m_queue.enqueue(command);
+    m_queueNotEmpty.wakeOne();
+}
+
+bool QueryWorker::isCancelled(int queryId) const
+{
+    QMutexLocker locker(&m_mutex);
+    return queryId == m_runningQueryId && m_runningQueryCancelled;
+}
+
+void QueryWorker::execute(QSqlDatabase db, const Command &command)
+{
+    if (command.type == Command::AttachSegments) {
+        QString errMsg;
+        if (!Database::attachSegments(db, &errMsg)) {
+            qWarning() << "Failed to attach segments of" << db.databaseName() << ":" << errMsg;
+        }
+        return;
+    }
+
+    // Interrupting only affects statements which started already
+    if (isCancelled(command.queryId)) {
+        return;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    bool result = query.prepare(command.statement);
+    if (result) {
+        QList<QVariant>::ConstIterator it, end = command.bindValues.end();
+        for (it = command.bindValues.begin(); it != end; ++it) {
+            query.addBindValue(*it);
+        }
+        result = query.exec();
+    }
+    if (!result) {
+        // Interrupted, if it was cancelled meanwhile
+        if (!isCancelled(command.queryId)) {
+            emit queryFailed(command.queryId, query.lastError().text());
+        }
+        return;
+    }
+
+    Rows rows;
+    const int numFields = query.record().count();
+    while (query.next()) {
+        // Stepping through the rows is what takes the time
+        if (isCancelled(command.queryId)) {
+            return;
+        }
+        QVector<QVariant> row(numFields);
+        for (int i = 0; i < numFields; ++i) {
+            row[i] = query.value(i);
+        }
+        rows.append(row);
+    }
+    if (isCancelled(command.queryId)) {
+        return;
+    }
+    if (query.lastError().isValid()) {
+        emit queryFailed(command.queryId, query.lastError().text());
+        return;
+    }
+    emit queryFinished(command.queryId, rows);
+}
+
+void QueryWorker::run()
+{
+    const QString connectionName = m_db.connectionName() + "-reader";
+    {
+        QString errMsg;
+        QSqlDatabase db = QSqlDatabase::cloneDatabase(m_db, connectionName);
+        db.setConnectOptions("QSQLITE_OPEN_READONLY");
+        if (!db.open()) {
+            errMsg = db.lastError().text();
+            qWarning() << "Failed to open database for running queries:" << errMsg;
+        } else {
+            if (!Database::attachSegments(db, &errMsg)) {
+                qWarning() << "Failed to attach segments of" << db.databaseName() << ":" << errMsg;
+            }
+            sqlite3 *handle = interruptibleHandle(db);
+            QMutexLocker locker(&m_mutex);
+            m_interruptibleHandle = handle;
+        }
+
+        while (true) {
+            Command command;
+            {
+                QMutexLocker locker(&m_mutex);
+                while (m_queue.isEmpty() && !m_stopRequested) {
+                    m_queueNotEmpty.wait(&m_mutex);
+                }
+                if (m_stopRequested) {
+                    break;
+                }
+                command = m_queue.dequeue();
+                m_runningQueryId = command.queryId;
+                m_runningQueryCancelled = false;
+            }
+
+            if (db.isOpen()) {
+                execute(db, command);
+            } else if (command.type == Command::RunQuery) {
+                emit queryFailed(command.queryId, errMsg);
+            }
+
+            QMutexLocker locker(&m_mutex);
+            m_runningQueryId = -1;
+        }
+
+        QMutexLocker locker(&m_mutex);
+        m_interruptibleHandle = NULL;
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+}
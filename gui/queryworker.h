@@ -0,0 +1,106 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUERYWORKER_H
+#define QUERYWORKER_H
+
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QSqlDatabase>
+#include <QThread>
+#include <QVariant>
+#include <QVector>
+#include <QWaitCondition>
+
+struct sqlite3;
+
+/* Runs queries in a thread of its own, using a read-only connection to the
+ * database, so that the GUI stays responsive no matter how long they take.
+ * Queries are run in the order they were submitted. Every query gets a
+ * number which is unique among all workers and which is passed along with
+ * its results. A cancelled query reports no results; since results might
+ * already be on their way though, receivers should only accept the ones
+ * they are still waiting for.
+ *
+ * Where possible, a cancelled query is interrupted right away; otherwise
+ * it stops before stepping to its next row.
+ */
+class QueryWorker : public QThread
+{
+    Q_OBJECT
+public:
+    typedef QVector<QVector<QVariant> > Rows;
+
+    explicit QueryWorker(QSqlDatabase db, QObject *parent = 0);
+    ~QueryWorker();
+
+    int submit(const QString &statement,
+               const QList<QVariant> &bindValues = QList<QVariant>());
+    void cancel(int queryId);
+
+    // Makes queries submitted afterwards see the segments listed right now
+    void attachSegments();
+
+    // Drops all queued queries and terminates the thread
+    void stop();
+
+    // Whether running statements are interrupted when they are cancelled
+    bool canInterrupt() const;
+
+signals:
+    void queryFinished(int queryId, const QueryWorker::Rows &rows);
+    void queryFailed(int queryId, const QString &errMsg);
+
+protected:
+    virtual void run();
+
+private:
+    struct Command
+    {
+        enum Type {
+            RunQuery,
+            AttachSegments
+        };
+
+        Command(Type type_ = RunQuery) : type(type_), queryId(-1) { }
+
+        Type type;
+        int queryId;
+        QString statement;
+        QList<QVariant> bindValues;
+    };
+
+    void enqueue(const Command &command);
+    void execute(QSqlDatabase db, const Command &command);
+    bool isCancelled(int queryId) const;
+    void interruptRunningQuery();
+
+    QSqlDatabase m_db;
+    mutable QMutex m_mutex;
+    QWaitCondition m_queueNotEmpty;
+    QQueue<Command> m_queue;
+    int m_runningQueryId;
+    bool m_runningQueryCancelled;
+    // Set while the connection of the thread is open, if it can be interrupted
+    sqlite3 *m_interruptibleHandle;
+    bool m_stopRequested;
+};
+
+#endif // !defined(QUERYWORKER_H)
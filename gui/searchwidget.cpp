@@ -67,6 +67,8 @@ void UnlabelledLineEdit::paintEvent( QPaintEvent *e )
 SearchWidget::SearchWidget( QWidget *parent )
     : QWidget( parent ),
     m_lineEdit( 0 ),
+    m_findPreviousButton( 0 ),
+    m_findNextButton( 0 ),
     m_buttonLayout( 0 )
 {
     m_activeTraceKeyComboLabel = new QLabel( tr( "Trace Key:" ) );
@@ -79,8 +81,23 @@ SearchWidget::SearchWidget( QWidget *parent )
     m_lineEdit = new UnlabelledLineEdit( this );
     connect( m_lineEdit, SIGNAL( textEdited( const QString & ) ),
              this, SLOT( termEdited( const QString & ) ) );
+    connect( m_lineEdit, SIGNAL( returnPressed() ),
+             this, SLOT( emitFindNext() ) );
     m_lineEdit->setPlaceholderText( "Search trace data..." );
 
+    // Finding looks at all entries, not just the ones shown right now
+    const QString findToolTip = tr( "Finds entries containing the term in their message, function, file or variable values" );
+    m_findPreviousButton = new QPushButton( tr( "Previous" ), this );
+    m_findPreviousButton->setToolTip( findToolTip );
+    m_findPreviousButton->setEnabled( false );
+    connect( m_findPreviousButton, SIGNAL( clicked() ),
+             this, SLOT( emitFindPrevious() ) );
+    m_findNextButton = new QPushButton( tr( "Next" ), this );
+    m_findNextButton->setToolTip( findToolTip );
+    m_findNextButton->setEnabled( false );
+    connect( m_findNextButton, SIGNAL( clicked() ),
+             this, SLOT( emitFindNext() ) );
+
     m_strictMatch = new QRadioButton( tr( "Strict" ), this );
     m_strictMatch->setChecked( true );
     connect( m_strictMatch, SIGNAL( clicked() ),
@@ -106,11 +123,18 @@ SearchWidget::SearchWidget( QWidget *parent )
     m_modifierLayout->addWidget( m_wildcardMatch );
     m_modifierLayout->addWidget( m_regexpMatch );
 
+    QHBoxLayout *termLayout = new QHBoxLayout;
+    termLayout->setMargin( 0 );
+    termLayout->setSpacing( 2 );
+    termLayout->addWidget( m_lineEdit );
+    termLayout->addWidget( m_findPreviousButton );
+    termLayout->addWidget( m_findNextButton );
+
     QGridLayout *layout = new QGridLayout( this );
     layout->setMargin( 0 );
     layout->addWidget( m_activeTraceKeyComboLabel, 0, 0 );
     layout->addWidget( m_activeTraceKeyCombo, 0, 1 );
-    layout->addWidget( m_lineEdit, 0, 2 );
+    layout->addLayout( termLayout, 0, 2 );
     layout->addLayout( m_buttonLayout, 1, 2 );
     layout->addLayout( m_modifierLayout, 0, 3, 2, 3 );
 }
@@ -145,6 +169,20 @@ void SearchWidget::emitSearchCriteria()
     emit searchCriteriaChanged( m_lineEdit->text(), selectedFields, matchType );
 }
 
+void SearchWidget::emitFindNext()
+{
+    if ( !m_lineEdit->text().isEmpty() ) {
+        emit findNextRequested( m_lineEdit->text() );
+    }
+}
+
+void SearchWidget::emitFindPrevious()
+{
+    if ( !m_lineEdit->text().isEmpty() ) {
+        emit findPreviousRequested( m_lineEdit->text() );
+    }
+}
+
 void SearchWidget::termEdited( const QString &newTerm )
 {
     QList<QPushButton *>::ConstIterator it, end = m_fieldButtons.end();
@@ -154,6 +192,8 @@ void SearchWidget::termEdited( const QString &newTerm )
     m_strictMatch->setVisible( !newTerm.isEmpty() );
     m_wildcardMatch->setVisible( !newTerm.isEmpty() );
     m_regexpMatch->setVisible( !newTerm.isEmpty() );
+    m_findPreviousButton->setEnabled( !newTerm.isEmpty() );
+    m_findNextButton->setEnabled( !newTerm.isEmpty() );
     emitSearchCriteria();
 }
 
@@ -209,7 +249,9 @@ void SearchWidget::setFields( const QStringList &fields )
 
     setMinimumWidth( m_activeTraceKeyComboLabel->sizeHint().width() +
                      m_activeTraceKeyCombo->sizeHint().width() +
-                     qMax( width, m_lineEdit->minimumWidth() ) +
+                     qMax( width, m_lineEdit->minimumWidth() +
+                                  m_findPreviousButton->sizeHint().width() +
+                                  m_findNextButton->sizeHint().width() ) +
                      m_wildcardMatch->sizeHint().width() );
 }
 
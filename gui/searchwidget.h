@@ -66,14 +66,20 @@ signals:
                                 const QStringList &fields,
                                 SearchWidget::MatchType matchType );
     void activeTraceKeyChanged( const QString &activeKey );
+    void findNextRequested( const QString &term );
+    void findPreviousRequested( const QString &term );
 
 private slots:
     void termEdited( const QString &term );
     void traceKeyChanged( const QString &key );
     void emitSearchCriteria();
+    void emitFindNext();
+    void emitFindPrevious();
 
 private:
     UnlabelledLineEdit *m_lineEdit;
+    QPushButton *m_findPreviousButton;
+    QPushButton *m_findNextButton;
     QList<QPushButton *> m_fieldButtons;
     QHBoxLayout *m_buttonLayout;
     QVBoxLayout *m_modifierLayout;
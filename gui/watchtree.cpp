@@ -3,13 +3,9 @@
 #include "entryfilter.h"
 #include "../server/server.h"
 
-#include <QSqlError>
-#include <QSqlQuery>
-#include <QTimer>
-
 WatchTree::WatchTree(EntryFilter *filter, QWidget *parent)
     : QTreeWidget( parent ),
-    m_databasePollingTimer( 0 ),
+    m_queryId( -1 ),
     m_dirty( true ),
     m_suspended(false),
     m_filter(filter)
@@ -26,10 +22,10 @@ WatchTree::WatchTree(EntryFilter *filter, QWidget *parent)
         headerItem()->setData( i, Qt::DisplayRole, tr( columns[i] ) );
     }
 
-    m_databasePollingTimer = new QTimer(this);
-    m_databasePollingTimer->setSingleShot(true);
-    connect(m_databasePollingTimer, SIGNAL(timeout()),
-            SLOT(showNewTraceEntriesFireAndForget()));
+    m_applicationIcon = QIcon(":/icons/application-x-executable.png");
+    m_sourceFileIcon = QIcon(":/icons/text-x-csrc.png");
+    m_functionIcon = QIcon(":/icons/application-sxw.png");
+
     connect(m_filter, SIGNAL(changed()), SLOT(reApplyFilter()));
 }
 
@@ -48,13 +44,24 @@ WatchTree::~WatchTree()
     deleteItemMap( m_applicationItems );
 }
 
-bool WatchTree::setDatabase( QSqlDatabase database,
-                             QString *errMsg )
+void WatchTree::setQueryWorker( QueryWorker *queryWorker )
 {
-    m_db = database;
-    m_dirty = true;
+    if ( m_queryWorker ) {
+        if ( m_queryId != -1 ) {
+            m_queryWorker->cancel( m_queryId );
+        }
+        disconnect( m_queryWorker, 0, this, 0 );
+    }
+    m_queryId = -1;
+    m_entriesDuringQuery.clear();
+    m_queryWorker = queryWorker;
+    connect( m_queryWorker, SIGNAL( queryFinished( int, const QueryWorker::Rows & ) ),
+             SLOT( handleQueryResults( int, const QueryWorker::Rows & ) ) );
+    connect( m_queryWorker, SIGNAL( queryFailed( int, const QString & ) ),
+             SLOT( handleQueryFailure( int, const QString & ) ) );
 
-    return showNewTraceEntries( errMsg );
+    m_dirty = true;
+    showNewTraceEntries();
 }
 
 void WatchTree::suspend()
@@ -65,10 +72,7 @@ void WatchTree::suspend()
 void WatchTree::resume()
 {
     m_suspended = false;
-    QString errMsg;
-    if (!showNewTraceEntries(&errMsg)) {
-        qDebug() << "WatchTree::resume: failed: " << errMsg;
-    }
+    showNewTraceEntries();
 }
 
 void WatchTree::handleNewTraceEntry( const TraceEntry &e )
@@ -79,10 +83,26 @@ void WatchTree::handleNewTraceEntry( const TraceEntry &e )
         return;
     }
 
-    m_dirty = true;
-    if ( !m_suspended && !m_databasePollingTimer->isActive() ) {
-        m_databasePollingTimer->start( 250 );
+    // The tree is refreshed from the database when it is shown again
+    if ( m_suspended || !isVisible() ) {
+        m_dirty = true;
+        return;
+    }
+
+    if ( m_queryId != -1 ) {
+        m_entriesDuringQuery.append( e );
+        return;
     }
+
+    setUpdatesEnabled( false );
+    showVariables( e );
+    setUpdatesEnabled( true );
+}
+
+// Entries which the server skipped are read when the tree is refreshed next
+void WatchTree::handleSkippedTraceEntries()
+{
+    m_dirty = true;
 }
 
 static QString filterClause(EntryFilter *f)
@@ -107,14 +127,17 @@ void WatchTree::showEvent(QShowEvent *e)
     return QTreeWidget::showEvent(e);
 }
 
-bool WatchTree::showNewTraceEntries( QString *errMsg )
+/* The database is only queried when the tree missed entries, i.e. when it
+ * is shown again or after the filter changed.
+ */
+void WatchTree::showNewTraceEntries()
 {
-    if ( !m_dirty || !isVisible() ) {
-        return true;
+    if ( !m_dirty || !isVisible() || !m_queryWorker ) {
+        return;
     }
 
-    if ( !isVisible() ) {
-        return true;
+    if ( m_queryId != -1 ) {
+        return;
     }
 
     QString statement;
@@ -171,121 +194,150 @@ bool WatchTree::showNewTraceEntries( QString *errMsg )
                 " ORDER BY"
                 "  process.name";
 
-    QSqlQuery query( m_db );
-    bool result = query.exec( statement );
-    if (!result) {
-        *errMsg = query.lastError().text();
-        return false;
+    m_queryId = m_queryWorker->submit( statement );
+    m_dirty = false;
+}
+
+void WatchTree::handleQueryResults( int queryId, const QueryWorker::Rows &rows )
+{
+    // Results of a query submitted before the filter changed are dropped
+    if ( queryId != m_queryId ) {
+        return;
     }
+    m_queryId = -1;
 
     setUpdatesEnabled( false );
 
-    QIcon iconExe(":/icons/application-x-executable.png");
-    QIcon iconSrc(":/icons/text-x-csrc.png");
-    QIcon iconFunc(":/icons/application-sxw.png");
-
-    while ( query.next() ) {
-        TreeItem *applicationItem = 0;
-        {
-            const QString application = QString( "%1 (PID %2)" )
-                                            .arg( query.value( 0 ).toString() )
-                                            .arg( query.value( 1 ).toString() );
-            ItemMap::ConstIterator it = m_applicationItems.find( application );
-            if ( it != m_applicationItems.end() ) {
-                applicationItem = *it;
-            } else {
-                applicationItem = new TreeItem( new QTreeWidgetItem( this,
-                                                       QStringList() << application ) );
-                applicationItem->item->setIcon(0, iconExe);
-                m_applicationItems[ application ] = applicationItem;
-            }
-        }
+    QueryWorker::Rows::ConstIterator it, end = rows.end();
+    for ( it = rows.begin(); it != end; ++it ) {
+        const QVector<QVariant> &row = *it;
+        showVariable( row[ 0 ].toString(), row[ 1 ].toUInt(),
+                      row[ 2 ].toString(),
+                      row[ 4 ].toString(), row[ 3 ].toULongLong(),
+                      row[ 5 ].toString(), row[ 6 ].toInt(), row[ 7 ].toString() );
+    }
 
-        TreeItem *sourceFileItem = 0;
-        {
-            const QString sourceFile = query.value( 2 ).toString();
-            ItemMap::ConstIterator it = applicationItem->children.find( sourceFile );
-            if ( it != applicationItem->children.end() ) {
-                sourceFileItem = *it;
-            } else {
-                sourceFileItem = new TreeItem( new QTreeWidgetItem( applicationItem->item,
-                                                      QStringList() << sourceFile ) );
-                sourceFileItem->item->setIcon(0, iconSrc);
-                applicationItem->children[ sourceFile ] = sourceFileItem;
-            }
-        }
+    // The results might not include these yet
+    QList<TraceEntry>::ConstIterator entryIt, entryEnd = m_entriesDuringQuery.end();
+    for ( entryIt = m_entriesDuringQuery.begin(); entryIt != entryEnd; ++entryIt ) {
+        showVariables( *entryIt );
+    }
+    m_entriesDuringQuery.clear();
 
-        TreeItem *functionItem = 0;
-        {
-            const QString function = QString( "%1 (line %2)" )
-                                        .arg( query.value( 4 ).toString() )
-                                        .arg( query.value( 3 ).toString() );
-            ItemMap::ConstIterator it = sourceFileItem->children.find( function );
-            if ( it != sourceFileItem->children.end() ) {
-                functionItem = *it;
-            } else {
-                functionItem = new TreeItem( new QTreeWidgetItem( sourceFileItem->item,
-                                                    QStringList() << function ) );
-                functionItem->item->setIcon(0, iconFunc);
-                sourceFileItem->children[ function ] = functionItem;
-            }
+    setUpdatesEnabled( true );
 
-        }
+    if ( !m_suspended ) {
+        showNewTraceEntries();
+    }
+}
+
+void WatchTree::showVariables( const TraceEntry &e )
+{
+    QList<Variable>::ConstIterator it, end = e.variables.end();
+    for ( it = e.variables.begin(); it != end; ++it ) {
+        showVariable( e.processName, e.pid, e.path, e.function, e.lineno,
+                      it->name, it->type, it->value );
+    }
+}
 
-        TreeItem *variableItem = 0;
-        {
-            const QString varName = query.value( 5 ).toString();
-            ItemMap::ConstIterator it = functionItem->children.find( varName );
-            if ( it != functionItem->children.end() ) {
-                variableItem = *it;
-            } else {
-                using TRACELIB_NAMESPACE_IDENT(VariableType);
-                const VariableType::Value varType = static_cast<VariableType::Value>( query.value( 6 ).toInt() );
-                variableItem = new TreeItem( new QTreeWidgetItem( functionItem->item,
-                                                    QStringList() << varName
-                                                                  << VariableType::valueAsString( varType ) ) );
-                functionItem->children[ varName ] = variableItem;
-            }
+void WatchTree::showVariable( const QString &processName, unsigned int pid,
+                              const QString &sourceFile,
+                              const QString &functionName, unsigned long line,
+                              const QString &varName, int varType,
+                              const QString &varValue )
+{
+    TreeItem *applicationItem = 0;
+    {
+        const QString application = QString( "%1 (PID %2)" )
+                                        .arg( processName )
+                                        .arg( pid );
+        ItemMap::ConstIterator it = m_applicationItems.find( application );
+        if ( it != m_applicationItems.end() ) {
+            applicationItem = *it;
+        } else {
+            applicationItem = new TreeItem( new QTreeWidgetItem( this,
+                                                   QStringList() << application ) );
+            applicationItem->item->setIcon(0, m_applicationIcon);
+            m_applicationItems[ application ] = applicationItem;
         }
+    }
 
-        const QString currentValue = variableItem->item->data( 2, Qt::DisplayRole ).toString();
-        const QString varValue = query.value( 7 ).toString();
-        if ( currentValue != varValue ) {
-            variableItem->item->setData( 3, Qt::DisplayRole, currentValue );
-            variableItem->item->setData( 3, Qt::ToolTipRole, currentValue );
-            variableItem->item->setData( 2, Qt::DisplayRole, varValue );
-            variableItem->item->setData( 2, Qt::ToolTipRole, varValue );
+    TreeItem *sourceFileItem = 0;
+    {
+        ItemMap::ConstIterator it = applicationItem->children.find( sourceFile );
+        if ( it != applicationItem->children.end() ) {
+            sourceFileItem = *it;
+        } else {
+            sourceFileItem = new TreeItem( new QTreeWidgetItem( applicationItem->item,
+                                                  QStringList() << sourceFile ) );
+            sourceFileItem->item->setIcon(0, m_sourceFileIcon);
+            applicationItem->children[ sourceFile ] = sourceFileItem;
         }
     }
 
-    setUpdatesEnabled( true );
+    TreeItem *functionItem = 0;
+    {
+        const QString function = QString( "%1 (line %2)" )
+                                    .arg( functionName )
+                                    .arg( line );
+        ItemMap::ConstIterator it = sourceFileItem->children.find( function );
+        if ( it != sourceFileItem->children.end() ) {
+            functionItem = *it;
+        } else {
+            functionItem = new TreeItem( new QTreeWidgetItem( sourceFileItem->item,
+                                                QStringList() << function ) );
+            functionItem->item->setIcon(0, m_functionIcon);
+            sourceFileItem->children[ function ] = functionItem;
+        }
 
-    m_dirty = false;
+    }
+
+    TreeItem *variableItem = 0;
+    {
+        ItemMap::ConstIterator it = functionItem->children.find( varName );
+        if ( it != functionItem->children.end() ) {
+            variableItem = *it;
+        } else {
+            using TRACELIB_NAMESPACE_IDENT(VariableType);
+            variableItem = new TreeItem( new QTreeWidgetItem( functionItem->item,
+                                                QStringList() << varName
+                                                              << VariableType::valueAsString( static_cast<VariableType::Value>( varType ) ) ) );
+            functionItem->children[ varName ] = variableItem;
+        }
+    }
 
-    return true;
+    const QString currentValue = variableItem->item->data( 2, Qt::DisplayRole ).toString();
+    if ( currentValue != varValue ) {
+        variableItem->item->setData( 3, Qt::DisplayRole, currentValue );
+        variableItem->item->setData( 3, Qt::ToolTipRole, currentValue );
+        variableItem->item->setData( 2, Qt::DisplayRole, varValue );
+        variableItem->item->setData( 2, Qt::ToolTipRole, varValue );
+    }
 }
 
-// for use as a slot
 // ### better replace all stderr output in this file with a signal to
 // ### be handled by the main window.
-void WatchTree::showNewTraceEntriesFireAndForget()
+void WatchTree::handleQueryFailure( int queryId, const QString &errMsg )
 {
-    QString errMsg;
-    if (!showNewTraceEntries(&errMsg)) {
-        qDebug() << "WatchTree::reApplyFilter: failed: " << errMsg;
+    if ( queryId != m_queryId ) {
+        return;
     }
+    m_queryId = -1;
+    qDebug() << "WatchTree::showNewTraceEntries: failed: " << errMsg;
 }
 
 void WatchTree::reApplyFilter()
 {
+    if ( m_queryWorker && m_queryId != -1 ) {
+        m_queryWorker->cancel( m_queryId );
+    }
+    m_queryId = -1;
+    m_entriesDuringQuery.clear();
     m_dirty = true;
 
     deleteItemMap( m_applicationItems );
     m_applicationItems.clear();
     clear();
 
-    QString errMsg;
-    if (!showNewTraceEntries(&errMsg)) {
-        qDebug() << "WatchTree::reApplyFilter: failed: " << errMsg;
-    }
+    showNewTraceEntries();
 }
@@ -20,11 +20,15 @@
 #ifndef WATCHTREE_H
 #define WATCHTREE_H
 
-#include <QSqlDatabase>
+#include "queryworker.h"
+#include "../server/database.h"
+
+#include <QIcon>
 #include <QTreeWidget>
+#include <QList>
 #include <QMap>
+#include <QPointer>
 
-struct TraceEntry;
 class EntryFilter;
 
 struct TreeItem;
@@ -44,26 +48,39 @@ public:
     WatchTree(EntryFilter *filter, QWidget *parent = 0);
     virtual ~WatchTree();
 
-    bool setDatabase( QSqlDatabase database,
-                      QString *errMsg );
+    void setQueryWorker( QueryWorker *queryWorker );
 
 public slots:
     void suspend();
     void resume();
     void handleNewTraceEntry( const TraceEntry &e );
+    void handleSkippedTraceEntries();
     void reApplyFilter();
 
 protected:
     virtual void showEvent(QShowEvent *e);
 
 private slots:
-    void showNewTraceEntriesFireAndForget();
+    void showNewTraceEntries();
+    void handleQueryResults( int queryId, const QueryWorker::Rows &rows );
+    void handleQueryFailure( int queryId, const QString &errMsg );
 
 private:
-    bool showNewTraceEntries( QString *errMsg );
+    void showVariables( const TraceEntry &e );
+    void showVariable( const QString &processName, unsigned int pid,
+                       const QString &sourceFile,
+                       const QString &functionName, unsigned long line,
+                       const QString &varName, int varType,
+                       const QString &varValue );
+
     ItemMap m_applicationItems;
-    QSqlDatabase m_db;
-    QTimer *m_databasePollingTimer;
+    QIcon m_applicationIcon;
+    QIcon m_sourceFileIcon;
+    QIcon m_functionIcon;
+    QPointer<QueryWorker> m_queryWorker;
+    int m_queryId;
+    // Shown once the results of the running query are in
+    QList<TraceEntry> m_entriesDuringQuery;
     bool m_dirty;
     bool m_suspended;
     EntryFilter *m_filter;
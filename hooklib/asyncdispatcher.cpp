@@ -0,0 +1,499 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "asyncdispatcher.h"
+#include "backtrace.h"
+#include "log.h"
+#include "timehelper.h" // for now
+#include "trace.h"
+#include "variabledumping.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+namespace {
+
+/* Hands a captured variable to the serializer; the object it was converted
+ * from may be gone by now.
+ */
+class DispatchedVariable : public AbstractVariable
+{
+public:
+    DispatchedVariable( const char *name, const VariableValue &value )
+        : m_name( name ), m_value( value ) { }
+
+    virtual const char *name() const { return m_name; }
+    virtual VariableValue value() const { return m_value; }
+
+private:
+    const char *m_name;
+    const VariableValue m_value;
+};
+
+VariableValue capturedValue( const CapturedTraceEntry &entry, const CapturedVariable &v )
+{
+    switch ( v.type ) {
+        case VariableType::Number:
+            if ( v.isSignedNumber ) {
+                return VariableValue::numberValue( static_cast<vlonglong>( v.value.number ) );
+            }
+            return VariableValue::numberValue( v.value.number );
+        case VariableType::Boolean:
+            return VariableValue::booleanValue( v.value.boolean );
+        case VariableType::Float:
+            return VariableValue::floatValue( v.value.float_ );
+        default:
+            return VariableValue::stringValue( entry.text + v.value.stringOffset );
+    }
+}
+
+void deleteVariables( VariableSnapshot *variables )
+{
+    for ( size_t i = 0; i < variables->size(); ++i ) {
+        delete ( *variables )[i];
+    }
+    delete variables;
+}
+
+/* Appends s to the text of the entry, cutting it off if necessary. Returns
+ * false if not even an empty string fits anymore.
+ */
+bool appendText( CapturedTraceEntry *entry, size_t *textSize, const char *s )
+{
+    const size_t available = entry->textCapacity - *textSize;
+    if ( available == 0 ) {
+        entry->truncated = true;
+        return false;
+    }
+    size_t len = strlen( s );
+    if ( len >= available ) {
+        len = available - 1;
+        entry->truncated = true;
+    }
+    memcpy( entry->text + *textSize, s, len );
+    entry->text[*textSize + len] = '\0';
+    *textSize += len + 1;
+    return true;
+}
+
+void captureVariables( CapturedTraceEntry *entry, size_t maximumVariables, size_t *textSize,
+                       VariableSnapshot *variables )
+{
+    for ( size_t i = 0; i < variables->size(); ++i ) {
+        if ( entry->numVariables == maximumVariables ) {
+            entry->truncated = true;
+            return;
+        }
+
+        const AbstractVariable *v = ( *variables )[i];
+        const VariableValue value = v->value();
+        CapturedVariable &captured = entry->variables[entry->numVariables];
+        captured.name = v->name();
+        captured.type = value.type();
+        captured.isSignedNumber = false;
+        switch ( value.type() ) {
+            case VariableType::Number:
+                captured.value.number = value.asNumber();
+                captured.isSignedNumber = value.isSignedNumber();
+                break;
+            case VariableType::Boolean:
+                captured.value.boolean = value.asBoolean();
+                break;
+            case VariableType::Float:
+                captured.value.float_ = value.asFloat();
+                break;
+            default:
+                captured.type = VariableType::String;
+                captured.value.stringOffset = *textSize;
+                if ( !appendText( entry, textSize, value.asString() ) ) {
+                    continue;
+                }
+                break;
+        }
+        ++entry->numVariables;
+    }
+}
+
+size_t roundUpToPowerOfTwo( size_t n )
+{
+    size_t result = 1;
+    while ( result < n ) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Number of units of the payload area needed for the given number of bytes
+size_t payloadUnits( size_t size )
+{
+    return ( size + sizeof( CapturedVariable ) - 1 ) / sizeof( CapturedVariable );
+}
+
+}
+
+const size_t CapturedTraceEntry::TextCapacity;
+const size_t CapturedTraceEntry::MaximumVariables;
+const size_t CapturedTraceEntry::MaximumPayloadSize;
+const size_t TraceEntryQueue::PayloadPerEntry;
+
+TraceEntryQueue::TraceEntryQueue( size_t capacity )
+    : m_entries( roundUpToPowerOfTwo( capacity ) ),
+    m_mask( m_entries.size() - 1 ),
+    m_payload( roundUpToPowerOfTwo( max( payloadUnits( m_entries.size() * PayloadPerEntry ),
+                                         2 * payloadUnits( CapturedTraceEntry::MaximumPayloadSize ) ) ) ),
+    m_payloadMask( m_payload.size() - 1 ),
+    m_payloadHead( 0 ),
+    m_payloadSkipped( 0 ),
+    m_reportedDrops( 0 )
+{
+}
+
+TraceEntryQueue::~TraceEntryQueue()
+{
+    while ( CapturedTraceEntry *entry = front() ) {
+        delete entry->backtrace;
+        pop();
+    }
+}
+
+CapturedTraceEntry *TraceEntryQueue::beginPush()
+{
+    const size_t head = m_head.load();
+    if ( head - m_tail.load() > m_mask ) {
+        m_dropped.fetchAndAdd( 1 );
+        return 0;
+    }
+    CapturedTraceEntry *entry = &m_entries[head & m_mask];
+
+    /* If there's more room at the start of the payload area than at its
+     * end, and the end is too small for any payload, the end is left out.
+     */
+    const size_t available = m_payload.size() - ( m_payloadHead - m_payloadTail.load() );
+    size_t position = m_payloadHead & m_payloadMask;
+    const size_t untilEnd = m_payload.size() - position;
+    size_t room = available;
+    m_payloadSkipped = 0;
+    if ( available > untilEnd ) {
+        if ( untilEnd * sizeof( CapturedVariable ) >= CapturedTraceEntry::MaximumPayloadSize ||
+             untilEnd >= available - untilEnd ) {
+            room = untilEnd;
+        } else {
+            m_payloadSkipped = untilEnd;
+            room = available - untilEnd;
+            position = 0;
+        }
+    }
+    entry->variables = &m_payload[position];
+    entry->payloadCapacity = min( room * sizeof( CapturedVariable ), CapturedTraceEntry::MaximumPayloadSize );
+    entry->payloadSize = 0;
+    return entry;
+}
+
+void TraceEntryQueue::commitPush()
+{
+    const size_t head = m_head.load();
+    CapturedTraceEntry &entry = m_entries[head & m_mask];
+    m_payloadHead += m_payloadSkipped + payloadUnits( entry.payloadSize );
+    entry.payloadEnd = m_payloadHead;
+    m_head.store( head + 1 );
+}
+
+CapturedTraceEntry *TraceEntryQueue::front()
+{
+    const size_t tail = m_tail.load();
+    if ( tail == m_head.load() ) {
+        return 0;
+    }
+    return &m_entries[tail & m_mask];
+}
+
+void TraceEntryQueue::pop()
+{
+    const size_t tail = m_tail.load();
+    m_payloadTail.store( m_entries[tail & m_mask].payloadEnd );
+    m_tail.store( tail + 1 );
+}
+
+// Consumer side only; yields the number of entries dropped since the last call.
+size_t TraceEntryQueue::takeDroppedEntries()
+{
+    const size_t dropped = m_dropped.load();
+    const size_t delta = dropped - m_reportedDrops;
+    m_reportedDrops = dropped;
+    return delta;
+}
+
+AsyncDispatcher::AsyncDispatcher( Trace *trace, Log *log )
+    : m_trace( trace ),
+    m_log( log ),
+    m_queueStorage( new ThreadLocalStorage( &AsyncDispatcher::orphanQueue ) )
+{
+    m_queueSize.store( DispatchConfiguration::DefaultQueueSize );
+    m_flushInterval.store( DispatchConfiguration::DefaultFlushInterval );
+}
+
+AsyncDispatcher::~AsyncDispatcher()
+{
+    m_enabled.store( 0 );
+
+    /* Threads which saw the dispatcher enabled just before may still be
+     * capturing an entry into their queue; don't pull it from under them.
+     * Queues registered after this scan see m_closed set, see enqueue().
+     */
+    m_closed.fetchAndAdd( 1 );
+    {
+        MutexLocker queuesLocker( m_queuesMutex );
+        vector<TraceEntryQueue *>::iterator it, end = m_queues.end();
+        for ( it = m_queues.begin(); it != end; ++it ) {
+            while ( ( *it )->isInUse() ) {
+                Thread::sleep( 1 );
+            }
+        }
+    }
+
+    if ( m_running.load() ) {
+        m_running.store( 0 );
+        wait();
+    }
+    flush();
+
+    /* Release the thread-local storage first so that threads exiting from
+     * now on don't touch the queues deleted below.
+     */
+    delete m_queueStorage;
+    m_queueStorage = 0;
+
+    MutexLocker queuesLocker( m_queuesMutex );
+    vector<TraceEntryQueue *>::iterator it, end = m_queues.end();
+    for ( it = m_queues.begin(); it != end; ++it ) {
+        delete *it;
+    }
+    m_queues.clear();
+}
+
+void AsyncDispatcher::configure( const DispatchConfiguration &cfg )
+{
+    m_queueSize.store( cfg.queueSize );
+    m_flushInterval.store( cfg.flushInterval > 0 ? cfg.flushInterval : 1 );
+
+    if ( cfg.mode != DispatchConfiguration::Asynchronous ) {
+        m_enabled.store( 0 );
+        flush();
+        return;
+    }
+
+    if ( !m_running.load() ) {
+        m_running.store( 1 );
+        if ( !start() ) {
+            m_running.store( 0 );
+            m_log->writeError( "Tracelib: failed to start dispatcher thread, tracing synchronously" );
+            return;
+        }
+    }
+    m_enabled.store( 1 );
+}
+
+/* The queue is marked as in use before checking whether the dispatcher
+ * is closed. The destructor reads the marks with read-modify-write
+ * operations after setting m_closed, so each of them either sees the mark
+ * or is ordered before it, and then this thread sees m_closed set. Unlike
+ * a counter shared by all threads, the mark costs no contention.
+ */
+void AsyncDispatcher::enqueue( const TracePoint *tracePoint, size_t stackPosition, const char *msg,
+                               VariableSnapshot *variables, Backtrace *backtrace )
+{
+    if ( m_closed.load() ) {
+        delete backtrace;
+        return;
+    }
+
+    TraceEntryQueue *queue = queueForCurrentThread();
+    queue->beginUse();
+    if ( m_closed.load() ) {
+        queue->endUse();
+        delete backtrace;
+        return;
+    }
+
+    if ( CapturedTraceEntry *entry = queue->beginPush() ) {
+        entry->tracePoint = tracePoint;
+        entry->threadId = getCurrentThreadId();
+        entry->timeStamp = now();
+        entry->stackPosition = stackPosition;
+        entry->backtrace = backtrace;
+        entry->truncated = false;
+        entry->numVariables = 0;
+
+        // The variables come first, the text takes the rest of the payload
+        size_t maximumVariables = 0;
+        if ( variables ) {
+            maximumVariables = min( min( variables->size(), CapturedTraceEntry::MaximumVariables ),
+                                    entry->payloadCapacity / sizeof( CapturedVariable ) );
+        }
+        entry->text = reinterpret_cast<char *>( entry->variables + maximumVariables );
+        entry->textCapacity = min( entry->payloadCapacity - maximumVariables * sizeof( CapturedVariable ),
+                                   CapturedTraceEntry::TextCapacity );
+
+        size_t textSize = 0;
+        entry->hasMessage = msg && appendText( entry, &textSize, msg );
+        entry->hasVariables = variables != 0;
+        if ( variables ) {
+            captureVariables( entry, maximumVariables, &textSize, variables );
+        }
+        entry->payloadSize = maximumVariables * sizeof( CapturedVariable ) + textSize;
+        queue->commitPush();
+    } else {
+        delete backtrace;
+    }
+
+    queue->endUse();
+}
+
+void AsyncDispatcher::flush()
+{
+    MutexLocker drainLocker( m_drainMutex );
+    drain();
+}
+
+/* For the crash handler, which may run on a thread which is draining the
+ * queues already; hence the queues are only drained if that doesn't mean
+ * waiting for the drain mutex.
+ */
+bool AsyncDispatcher::tryFlush()
+{
+    if ( m_drainingThread.load() == getCurrentThreadId() || !m_drainMutex.tryLock() ) {
+        return false;
+    }
+    drain();
+    m_drainMutex.unlock();
+    return true;
+}
+
+void AsyncDispatcher::run()
+{
+    while ( m_running.load() ) {
+        size_t dispatched;
+        {
+            MutexLocker drainLocker( m_drainMutex );
+            dispatched = drain();
+        }
+        if ( dispatched == 0 ) {
+            Thread::sleep( static_cast<unsigned int>( m_flushInterval.load() ) );
+        }
+    }
+}
+
+// Must be called with m_drainMutex held.
+size_t AsyncDispatcher::drain()
+{
+    m_drainingThread.store( getCurrentThreadId() );
+    {
+        MutexLocker queuesLocker( m_queuesMutex );
+        m_drainQueues = m_queues;
+    }
+
+    size_t dispatched = 0;
+    size_t dropped = 0;
+    size_t truncated = 0;
+    vector<TraceEntryQueue *>::iterator it, end = m_drainQueues.end();
+    for ( it = m_drainQueues.begin(); it != end; ++it ) {
+        TraceEntryQueue *queue = *it;
+
+        /* An orphaned queue won't receive any further entries, so once it
+         * has been emptied after seeing the flag it can go away.
+         */
+        const bool orphaned = queue->isOrphaned();
+
+        while ( const CapturedTraceEntry *entry = queue->front() ) {
+            if ( entry->truncated ) {
+                ++truncated;
+            }
+            dispatch( *entry );
+            queue->pop();
+            ++dispatched;
+        }
+        dropped += queue->takeDroppedEntries();
+
+        if ( orphaned ) {
+            MutexLocker queuesLocker( m_queuesMutex );
+            m_queues.erase( std::find( m_queues.begin(), m_queues.end(), queue ) );
+            delete queue;
+        }
+    }
+
+    if ( dropped > 0 ) {
+        m_log->writeError( "Tracelib: dispatcher queue overflow, dropped %lu trace entries",
+                           static_cast<unsigned long>( dropped ) );
+        m_trace->addDroppedEntries( dropped );
+    }
+    if ( truncated > 0 ) {
+        m_log->writeError( "Tracelib: message or variables of %lu trace entries did not fit into the dispatcher queue and were cut off",
+                           static_cast<unsigned long>( truncated ) );
+    }
+
+    m_drainingThread.store( 0 );
+    return dispatched;
+}
+
+void AsyncDispatcher::dispatch( const CapturedTraceEntry &captured )
+{
+    VariableSnapshot *variables = 0;
+    if ( captured.hasVariables ) {
+        variables = new VariableSnapshot;
+        for ( size_t i = 0; i < captured.numVariables; ++i ) {
+            const CapturedVariable &v = captured.variables[i];
+            ( *variables ) << new DispatchedVariable( v.name, capturedValue( captured, v ) );
+        }
+    }
+
+    {
+        TraceEntry entry( captured.tracePoint, captured.threadId, captured.timeStamp,
+                          captured.stackPosition, captured.hasMessage ? captured.text : 0 );
+        entry.variables = variables;
+        entry.backtrace = captured.backtrace; // deleted by TraceEntry
+        m_trace->addEntry( entry );
+    }
+    if ( variables ) {
+        deleteVariables( variables );
+    }
+}
+
+TraceEntryQueue *AsyncDispatcher::queueForCurrentThread()
+{
+    TraceEntryQueue *queue = static_cast<TraceEntryQueue *>( m_queueStorage->value() );
+    if ( !queue ) {
+        queue = new TraceEntryQueue( m_queueSize.load() );
+        m_queueStorage->setValue( queue );
+        MutexLocker queuesLocker( m_queuesMutex );
+        m_queues.push_back( queue );
+    }
+    return queue;
+}
+
+void AsyncDispatcher::orphanQueue( void *queue )
+{
+    static_cast<TraceEntryQueue *>( queue )->markOrphaned();
+}
+
+TRACELIB_NAMESPACE_END
+
@@ -0,0 +1,190 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_ASYNCDISPATCHER_H
+#define TRACELIB_ASYNCDISPATCHER_H
+
+#include "tracelib_config.h"
+#include "atomic.h"
+#include "configuration.h" // for DispatchConfiguration
+#include "getcurrentthreadid.h"
+#include "mutex.h"
+#include "thread.h"
+#include "variabledumping.h" // for VariableType
+#include "config.h" // for uint64_t
+
+#include <vector>
+
+TRACELIB_NAMESPACE_BEGIN
+
+class Backtrace;
+class Log;
+class Trace;
+struct TracePoint;
+
+/* The value of a variable, converted on the traced thread. String values
+ * are stored in the text of the entry.
+ */
+struct CapturedVariable
+{
+    const char *name; // the stringified macro argument, lives forever
+    VariableType::Value type;
+    bool isSignedNumber;
+    union {
+        vulonglong number;
+        bool boolean;
+        long double float_;
+        size_t stringOffset;
+    } value;
+};
+
+/* The raw data captured on the traced thread. Everything which references
+ * memory owned by the caller of the trace macros is copied into the
+ * payload of the entry, which lives in the payload area of its queue, so
+ * that capturing it doesn't allocate. The payload holds the variables
+ * followed by the text; text which doesn't fit is cut off and variables
+ * beyond MaximumVariables are left out.
+ */
+struct CapturedTraceEntry
+{
+    static const size_t TextCapacity = 256;
+    static const size_t MaximumVariables = 8;
+    static const size_t MaximumPayloadSize = MaximumVariables * sizeof( CapturedVariable ) + TextCapacity;
+
+    const TracePoint *tracePoint;
+    ThreadId threadId;
+    uint64_t timeStamp;
+    size_t stackPosition;
+    Backtrace *backtrace;
+    bool hasMessage;
+    bool hasVariables;
+    bool truncated;
+    size_t numVariables;
+    CapturedVariable *variables;
+    char *text; // the message, followed by the string values
+    size_t textCapacity;
+    // Room available to the producer and the part of it which it used
+    size_t payloadCapacity;
+    size_t payloadSize;
+    // Position in the payload area up to which popping the entry frees it
+    size_t payloadEnd;
+};
+
+/* Bounded single-producer/single-consumer ring of captured entries. The
+ * producer is the traced thread owning the queue, the consumer is whoever
+ * holds the dispatcher's drain mutex. Entries are filled in and dispatched
+ * in place. Their payloads are stored one after another in a second ring
+ * which holds PayloadPerEntry bytes per entry; an entry's payload is never
+ * split, and it gets less room than it might use if that ring is full.
+ */
+class TraceEntryQueue
+{
+public:
+    static const size_t PayloadPerEntry = 64;
+
+    explicit TraceEntryQueue( size_t capacity );
+    ~TraceEntryQueue();
+
+    /* Yields 0 if the queue is full. The payload of the entry may take up
+     * to payloadCapacity bytes at 'variables'; commitPush() makes the entry
+     * visible and keeps payloadSize bytes of it.
+     */
+    CapturedTraceEntry *beginPush();
+    void commitPush();
+    // Yields 0 if the queue is empty; pop() releases the entry.
+    CapturedTraceEntry *front();
+    void pop();
+
+    size_t takeDroppedEntries();
+
+    void markOrphaned() { m_orphaned.store( 1 ); }
+    bool isOrphaned() const { return m_orphaned.load() != 0; }
+
+    // Set by the producer while it accesses the queue, see AsyncDispatcher::enqueue()
+    void beginUse() { m_inUse.fetchAndAdd( 1 ); }
+    void endUse() { m_inUse.store( 0 ); }
+    bool isInUse() { return m_inUse.fetchAndAdd( 0 ) != 0; }
+
+private:
+    TraceEntryQueue( const TraceEntryQueue &other ); // disabled
+    void operator=( const TraceEntryQueue &rhs ); // disabled
+
+    std::vector<CapturedTraceEntry> m_entries;
+    size_t m_mask;
+    // Counted in units of a variable, so that variables are aligned
+    std::vector<CapturedVariable> m_payload;
+    size_t m_payloadMask;
+    size_t m_payloadHead; // producer only
+    size_t m_payloadSkipped; // end of the payload area left out by beginPush()
+    char m_headPadding[64];
+    AtomicCounter m_head;
+    AtomicCounter m_inUse;
+    char m_tailPadding[64];
+    AtomicCounter m_tail;
+    AtomicCounter m_payloadTail;
+    AtomicCounter m_dropped;
+    AtomicCounter m_orphaned;
+    size_t m_reportedDrops;
+};
+
+/* Takes serialization and output off the traced threads: visitTracePoint()
+ * only captures the entry into a per-thread queue, a background thread
+ * drains all queues and hands the entries to Trace::addEntry().
+ */
+class AsyncDispatcher : private Thread
+{
+public:
+    AsyncDispatcher( Trace *trace, Log *log );
+    virtual ~AsyncDispatcher();
+
+    void configure( const DispatchConfiguration &cfg );
+    bool isEnabled() const { return m_enabled.load() != 0; }
+
+    void enqueue( const TracePoint *tracePoint, size_t stackPosition, const char *msg,
+                  VariableSnapshot *variables, Backtrace *backtrace );
+    void flush();
+    bool tryFlush();
+
+private:
+    virtual void run();
+
+    size_t drain();
+    void dispatch( const CapturedTraceEntry &entry );
+    TraceEntryQueue *queueForCurrentThread();
+    static void orphanQueue( void *queue );
+
+    Trace *m_trace;
+    Log *m_log;
+    ThreadLocalStorage *m_queueStorage;
+    Mutex m_queuesMutex;
+    std::vector<TraceEntryQueue *> m_queues;
+    Mutex m_drainMutex;
+    std::vector<TraceEntryQueue *> m_drainQueues;
+    AtomicCounter m_drainingThread; // 0 unless some thread is in drain()
+    AtomicCounter m_closed;
+    AtomicCounter m_enabled;
+    AtomicCounter m_running;
+    AtomicCounter m_queueSize;
+    AtomicCounter m_flushInterval;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_ASYNCDISPATCHER_H)
+
@@ -0,0 +1,280 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_ATOMIC_H
+#define TRACELIB_ATOMIC_H
+
+#include "tracelib_config.h"
+#include "config.h" // for uint64_t
+
+#include <stddef.h>
+
+#ifdef _MSC_VER
+#  include <windows.h>
+#  include <intrin.h>
+#endif
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* Word-sized atomic counter. All operations are sequentially consistent
+ * except for load(), which has acquire semantics, and store(), which has
+ * release semantics. That is all the lock-free queues in this library need.
+ */
+class AtomicCounter
+{
+public:
+    explicit AtomicCounter( size_t v = 0 ) : m_value( v ) { }
+
+    inline size_t load() const;
+    inline void store( size_t v );
+    inline size_t fetchAndAdd( size_t v );
+    inline bool testAndSet( size_t expected, size_t desired );
+
+private:
+    AtomicCounter( const AtomicCounter &other ); // disabled
+    void operator=( const AtomicCounter &rhs ); // disabled
+
+    volatile size_t m_value;
+};
+
+template <typename T>
+class AtomicPointer
+{
+public:
+    explicit AtomicPointer( T *p = 0 ) : m_value( p ) { }
+
+    inline T *load() const;
+    inline void store( T *p );
+    inline T *fetchAndStore( T *p );
+    inline bool testAndSet( T *expected, T *desired );
+
+private:
+    AtomicPointer( const AtomicPointer &other ); // disabled
+    void operator=( const AtomicPointer &rhs ); // disabled
+
+    T * volatile m_value;
+};
+
+/* Operations on plain memory which cannot hold one of the above classes,
+ * e.g. because it's part of a memory-mapped file. Same memory ordering as
+ * the corresponding member functions.
+ */
+inline size_t atomicLoad( const volatile size_t *p );
+inline void atomicStore( volatile size_t *p, size_t v );
+inline bool atomicTestAndSet( volatile size_t *p, size_t expected, size_t desired );
+inline uint64_t atomicLoad64( const volatile uint64_t *p );
+inline bool atomicTestAndSet64( volatile uint64_t *p, uint64_t expected, uint64_t desired );
+inline void atomicStore32( volatile unsigned int *p, unsigned int v );
+
+#if defined(__GNUC__)
+
+size_t AtomicCounter::load() const
+{
+    return __atomic_load_n( &m_value, __ATOMIC_ACQUIRE );
+}
+
+void AtomicCounter::store( size_t v )
+{
+    __atomic_store_n( &m_value, v, __ATOMIC_RELEASE );
+}
+
+size_t AtomicCounter::fetchAndAdd( size_t v )
+{
+    return __atomic_fetch_add( &m_value, v, __ATOMIC_SEQ_CST );
+}
+
+bool AtomicCounter::testAndSet( size_t expected, size_t desired )
+{
+    return __atomic_compare_exchange_n( &m_value, &expected, desired, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+template <typename T>
+T *AtomicPointer<T>::load() const
+{
+    return __atomic_load_n( &m_value, __ATOMIC_ACQUIRE );
+}
+
+template <typename T>
+void AtomicPointer<T>::store( T *p )
+{
+    __atomic_store_n( &m_value, p, __ATOMIC_RELEASE );
+}
+
+template <typename T>
+T *AtomicPointer<T>::fetchAndStore( T *p )
+{
+    return __atomic_exchange_n( &m_value, p, __ATOMIC_SEQ_CST );
+}
+
+template <typename T>
+bool AtomicPointer<T>::testAndSet( T *expected, T *desired )
+{
+    return __atomic_compare_exchange_n( &m_value, &expected, desired, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+size_t atomicLoad( const volatile size_t *p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+void atomicStore( volatile size_t *p, size_t v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+bool atomicTestAndSet( volatile size_t *p, size_t expected, size_t desired )
+{
+    return __atomic_compare_exchange_n( p, &expected, desired, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+uint64_t atomicLoad64( const volatile uint64_t *p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+bool atomicTestAndSet64( volatile uint64_t *p, uint64_t expected, uint64_t desired )
+{
+    return __atomic_compare_exchange_n( p, &expected, desired, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+void atomicStore32( volatile unsigned int *p, unsigned int v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+#elif defined(_MSC_VER)
+
+/* MSVC gives volatile accesses acquire/release semantics, so plain loads
+ * and stores only need to keep the compiler from reordering them.
+ */
+size_t AtomicCounter::load() const
+{
+    const size_t v = m_value;
+    _ReadWriteBarrier();
+    return v;
+}
+
+void AtomicCounter::store( size_t v )
+{
+    _ReadWriteBarrier();
+    m_value = v;
+}
+
+size_t AtomicCounter::fetchAndAdd( size_t v )
+{
+#ifdef _WIN64
+    return (size_t)::InterlockedExchangeAdd64( (volatile LONGLONG *)&m_value, (LONGLONG)v );
+#else
+    return (size_t)::InterlockedExchangeAdd( (volatile LONG *)&m_value, (LONG)v );
+#endif
+}
+
+bool AtomicCounter::testAndSet( size_t expected, size_t desired )
+{
+#ifdef _WIN64
+    return (size_t)::InterlockedCompareExchange64( (volatile LONGLONG *)&m_value, (LONGLONG)desired, (LONGLONG)expected ) == expected;
+#else
+    return (size_t)::InterlockedCompareExchange( (volatile LONG *)&m_value, (LONG)desired, (LONG)expected ) == expected;
+#endif
+}
+
+template <typename T>
+T *AtomicPointer<T>::load() const
+{
+    T *p = m_value;
+    _ReadWriteBarrier();
+    return p;
+}
+
+template <typename T>
+void AtomicPointer<T>::store( T *p )
+{
+    _ReadWriteBarrier();
+    m_value = p;
+}
+
+template <typename T>
+T *AtomicPointer<T>::fetchAndStore( T *p )
+{
+    return static_cast<T *>( ::InterlockedExchangePointer( (PVOID volatile *)&m_value, p ) );
+}
+
+template <typename T>
+bool AtomicPointer<T>::testAndSet( T *expected, T *desired )
+{
+    return ::InterlockedCompareExchangePointer( (PVOID volatile *)&m_value, desired, expected ) == expected;
+}
+
+size_t atomicLoad( const volatile size_t *p )
+{
+    const size_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+void atomicStore( volatile size_t *p, size_t v )
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+bool atomicTestAndSet( volatile size_t *p, size_t expected, size_t desired )
+{
+#ifdef _WIN64
+    return (size_t)::InterlockedCompareExchange64( (volatile LONGLONG *)p, (LONGLONG)desired, (LONGLONG)expected ) == expected;
+#else
+    return (size_t)::InterlockedCompareExchange( (volatile LONG *)p, (LONG)desired, (LONG)expected ) == expected;
+#endif
+}
+
+uint64_t atomicLoad64( const volatile uint64_t *p )
+{
+#ifdef _WIN64
+    const uint64_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+#else
+    // 64 bit loads are not atomic on 32 bit x86
+    return (uint64_t)::InterlockedCompareExchange64( (volatile LONGLONG *)p, 0, 0 );
+#endif
+}
+
+bool atomicTestAndSet64( volatile uint64_t *p, uint64_t expected, uint64_t desired )
+{
+    return (uint64_t)::InterlockedCompareExchange64( (volatile LONGLONG *)p, (LONGLONG)desired, (LONGLONG)expected ) == expected;
+}
+
+void atomicStore32( volatile unsigned int *p, unsigned int v )
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+#else
+#  error "Unsupported compiler!"
+#endif
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_ATOMIC_H)
+
@@ -0,0 +1,90 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_BINARYFORMAT_H
+#define TRACELIB_BINARYFORMAT_H
+
+#include "tracelib_config.h"
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* Wire format written by BinarySerializer and read by the trace daemon.
+ *
+ * The stream is a sequence of records. Each record starts with a four byte
+ * payload size followed by a one byte record type; all integers are little
+ * endian. Strings are referenced by ids which are defined by a StringRecord
+ * earlier in the same stream; id 0 means 'no string'.
+ *
+ * StreamHeaderRecord:         u32 magic, u16 version
+ * StringRecord:               u32 id, u32 length, <length> bytes UTF-8
+ * TraceKeysRecord:            u32 count, count * ( u8 enabled, u32 name )
+ * StorageConfigurationRecord: u64 maximum size, u16 shrink by, u32 archive dir
+ * TraceEntryRecord:           u32 pid, u64 process start time, u64 thread id,
+ *                             u64 time, u64 stack position, u32 process name,
+ *                             u32 group, u8 type, u32 line, u32 file,
+ *                             u32 function, u8 flags, then
+ *                             - if HasMessage: u32 length, <length> bytes
+ *                             - if HasVariables: u16 count, count * ( u32 name,
+ *                               u8 type, value ) with the value being
+ *                               u32 length + bytes for strings, u8 signed +
+ *                               u64 for numbers, an IEEE double in a u64 for
+ *                               floats and u8 for booleans
+ *                             - if HasBacktrace: u16 depth, depth * ( u32 module,
+ *                               u32 function, u64 offset, u32 file, u32 line )
+ * ShutdownEventRecord:        u32 pid, u64 start time, u64 end time,
+ *                             u32 process name
+ *
+ * A stream header resets all string ids, it's written whenever a new
+ * stream (e.g. a new connection) starts. Trace keys and the storage
+ * configuration are only sent when they changed and apply to all
+ * following entries.
+ *
+ * Readers reject records with a payload larger than MaximumRecordSize
+ * instead of buffering data for them indefinitely.
+ */
+namespace BinaryFormat
+{
+
+static const unsigned int Magic = 0x46424c54; // "TLBF"
+static const unsigned short Version = 1;
+static const unsigned int RecordHeaderSize = 5;
+static const unsigned int MaximumRecordSize = 64 * 1024 * 1024;
+static const unsigned int NoString = 0;
+
+enum RecordType {
+    StreamHeaderRecord = 1,
+    StringRecord = 2,
+    TraceKeysRecord = 3,
+    StorageConfigurationRecord = 4,
+    TraceEntryRecord = 5,
+    ShutdownEventRecord = 6
+};
+
+enum TraceEntryFlags {
+    HasMessage = 0x1,
+    HasVariables = 0x2,
+    HasBacktrace = 0x4
+};
+
+}
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_BINARYFORMAT_H)
+
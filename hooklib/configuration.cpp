@@ -185,6 +185,13 @@ bool Configuration::readProcessElement( TiXmlElement *processElement )
             continue;
         }
 
+        if ( e->ValueStr() == "pipeline" ) {
+            if ( !readPipelineElement( e ) ) {
+                return false;
+            }
+            continue;
+        }
+
         if ( e->ValueStr() == "output" ) {
             if ( m_configuredOutput ) {
                 m_log->writeError( "Tracelib Configuration: while reading %s: found multiple <output> elements in <process> element.", m_fileName.c_str() );
@@ -200,6 +207,10 @@ bool Configuration::readProcessElement( TiXmlElement *processElement )
 
         m_log->writeError( "Tracelib Configuration: while reading %s: unexpected child element '%s' found inside <process>.", m_fileName.c_str(), processElement->Value() );
     }
+
+    if ( m_configuredOutput && m_configuredSerializer ) {
+        m_configuredOutput->setBinaryData( m_configuredSerializer->isBinary() );
+    }
     return true;
 }
 
@@ -229,6 +240,11 @@ const StorageConfiguration &Configuration::storageConfiguration() const
     return m_storageConfiguration;
 }
 
+const DispatchConfiguration &Configuration::dispatchConfiguration() const
+{
+    return m_dispatchConfiguration;
+}
+
 const vector<TracePointSet *> &Configuration::configuredTracePointSets() const
 {
     return m_configuredTracePointSets;
@@ -418,6 +434,14 @@ Serializer *Configuration::createSerializerFromElement( TiXmlElement *e )
         return serializer;
     }
 
+    if ( serializerType == "binary" ) {
+        if ( e->FirstChildElement() ) {
+            m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <serializer> element of type binary found; ignoring this.", m_fileName.c_str(), e->FirstChildElement()->Value() );
+        }
+        m_log->writeStatus( "Tracelib Configuration: using binary serializer" );
+        return new BinarySerializer;
+    }
+
     m_log->writeError( "Tracelib Configuration: while reading %s: <serializer> element with unknown type '%s' found.", m_fileName.c_str(), serializerType.c_str() );
     return 0;
 }
@@ -483,6 +507,8 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
         std::string filename;
         bool overwriteExistingFile = true;
         bool relativePathIsRelativeToUserHome = false;
+        FileFlushPolicy flushPolicy;
+        FileRotationPolicy rotationPolicy;
         for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
             if ( optionElement->ValueStr() != "option" ) {
                 m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <output> element of type file found.", m_fileName.c_str(), optionElement->Value() );
@@ -501,6 +527,25 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
                 overwriteExistingFile = getText( optionElement ) == "true";
             } else if ( optionName == "relativeToUserHome" ) {
                 relativePathIsRelativeToUserHome = getText( optionElement ) == "true";
+            } else if ( optionName == "bufferSize" ) {
+                istringstream str( getText( optionElement ) );
+                str >> flushPolicy.bufferSize; // XXX Error handling for non-numeric values
+            } else if ( optionName == "flushInterval" ) {
+                istringstream str( getText( optionElement ) );
+                str >> flushPolicy.flushInterval; // XXX Error handling for non-numeric values
+            } else if ( optionName == "flushOnError" ) {
+                flushPolicy.flushOnError = getText( optionElement ) == "true";
+            } else if ( optionName == "maximumSize" ) {
+                istringstream str( getText( optionElement ) );
+                str >> rotationPolicy.maximumSize; // XXX Error handling for non-numeric values
+            } else if ( optionName == "maximumAge" ) {
+                istringstream str( getText( optionElement ) );
+                str >> rotationPolicy.maximumAge; // XXX Error handling for non-numeric values
+            } else if ( optionName == "generations" ) {
+                istringstream str( getText( optionElement ) );
+                str >> rotationPolicy.generations; // XXX Error handling for non-numeric values
+            } else if ( optionName == "compress" ) {
+                rotationPolicy.compress = getText( optionElement ) == "true";
             } else {
                 m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in file output; ignoring this.", m_fileName.c_str(), optionName.c_str() );
                 continue;
@@ -526,13 +571,20 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
                 filename = sstr.str();
             }
         }
-        m_log->writeStatus( "Tracelib Configuration: using file output to %s", filename.c_str() );
-        return new FileOutput( m_log, filename );
+        m_log->writeStatus( "Tracelib Configuration: using file output to %s (buffer size=%lu, flush interval=%u)",
+                            filename.c_str(), (unsigned long)flushPolicy.bufferSize, flushPolicy.flushInterval );
+        if ( rotationPolicy.isEnabled() ) {
+            m_log->writeStatus( "Tracelib Configuration: rotating %s (maximum size=%lu, maximum age=%u, generations=%u)",
+                                filename.c_str(), (unsigned long)rotationPolicy.maximumSize,
+                                rotationPolicy.maximumAge, rotationPolicy.generations );
+        }
+        return new FileOutput( m_log, filename, flushPolicy, rotationPolicy );
     }
 
     if ( outputType == "tcp" ) {
         string hostname;
         unsigned short port = TRACELIB_DEFAULT_PORT;
+        NetworkQueuePolicy queuePolicy;
         for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
             if ( optionElement->ValueStr() != "option" ) {
                 m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <output> element of type tcp found.", m_fileName.c_str(), optionElement->Value() );
@@ -550,6 +602,25 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
             } else if ( optionName == "port" ) {
                 istringstream str( getText( optionElement ) );
                 str >> port; // XXX Error handling for non-numeric port numbers
+            } else if ( optionName == "maximumQueueSize" ) {
+                istringstream str( getText( optionElement ) );
+                str >> queuePolicy.maximumSize; // XXX Error handling for non-numeric values
+            } else if ( optionName == "maximumQueueEntries" ) {
+                istringstream str( getText( optionElement ) );
+                str >> queuePolicy.maximumEntries; // XXX Error handling for non-numeric values
+            } else if ( optionName == "overflowPolicy" ) {
+                const string policy = getText( optionElement );
+                if ( policy == "block" ) {
+                    queuePolicy.overflowPolicy = NetworkQueuePolicy::Block;
+                } else if ( policy == "dropNewest" ) {
+                    queuePolicy.overflowPolicy = NetworkQueuePolicy::DropNewest;
+                } else if ( policy == "dropOldest" ) {
+                    queuePolicy.overflowPolicy = NetworkQueuePolicy::DropOldest;
+                } else if ( policy == "dropLowSeverity" ) {
+                    queuePolicy.overflowPolicy = NetworkQueuePolicy::DropLowSeverity;
+                } else {
+                    m_log->writeError( "Tracelib Configuration: while reading %s: Unknown overflow policy '%s' found in tcp output; ignoring this.", m_fileName.c_str(), policy.c_str() );
+                }
             } else {
                 m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in tcp output; ignoring this.", m_fileName.c_str(), optionName.c_str() );
                 continue;
@@ -567,13 +638,104 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
         }
 
         m_log->writeStatus( "Tracelib Configuration: using TCP/IP output, remote = %s:%d", hostname.c_str(), port );
-        return new NetworkOutput( m_log, hostname.c_str(), port );
+        return new NetworkOutput( m_log, hostname.c_str(), port, queuePolicy );
+    }
+
+    if ( outputType == "ringbuffer" ) {
+        string filename;
+        uint64_t size = RingBufferOutput::DefaultSize;
+        bool relativePathIsRelativeToUserHome = false;
+        for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
+            if ( optionElement->ValueStr() != "option" ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <output> element of type ringbuffer found.", m_fileName.c_str(), optionElement->Value() );
+                return 0;
+            }
+
+            string optionName;
+            if ( optionElement->QueryStringAttribute( "name", &optionName ) != TIXML_SUCCESS ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Failed to read name property of <option> element; ignoring this.", m_fileName.c_str() );
+                continue;
+            }
+
+            if ( optionName == "filename" ) {
+                filename = getText( optionElement ); // XXX Consider encoding issues
+            } else if ( optionName == "size" ) {
+                istringstream str( getText( optionElement ) );
+                str >> size; // XXX Error handling for non-numeric values
+            } else if ( optionName == "relativeToUserHome" ) {
+                relativePathIsRelativeToUserHome = getText( optionElement ) == "true";
+            } else {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in ringbuffer output; ignoring this.", m_fileName.c_str(), optionName.c_str() );
+                continue;
+            }
+        }
+
+        if ( filename.empty() ) {
+            m_log->writeError( "Tracelib Configuration: while reading %s: No 'filename' option specified for <output> element of type ringbuffer.", m_fileName.c_str() );
+            return 0;
+        }
+        if ( !isAbsolute( filename ) && relativePathIsRelativeToUserHome ) {
+            filename = userHome() + pathSeparator() + filename;
+        }
+        m_log->writeStatus( "Tracelib Configuration: using ring buffer output to %s (size=%lu)",
+                            filename.c_str(), (unsigned long)size );
+        return new RingBufferOutput( m_log, filename, size );
     }
 
     m_log->writeError( "Tracelib Configuration: while reading %s: Unknown type '%s' specified for <output> element", m_fileName.c_str(), outputType.c_str() );
     return 0;
 }
 
+bool Configuration::readPipelineElement( TiXmlElement *e )
+{
+    string pipelineType;
+    if ( e->QueryStringAttribute( "type", &pipelineType ) != TIXML_SUCCESS ) {
+        m_log->writeError( "Tracelib Configuration: while reading %s: Failed to read type property of <pipeline> element.", m_fileName.c_str() );
+        return false;
+    }
+
+    if ( pipelineType == "sync" ) {
+        m_dispatchConfiguration.mode = DispatchConfiguration::Synchronous;
+    } else if ( pipelineType == "async" ) {
+        m_dispatchConfiguration.mode = DispatchConfiguration::Asynchronous;
+    } else {
+        m_log->writeError( "Tracelib Configuration: while reading %s: <pipeline> element with unknown type '%s' found.", m_fileName.c_str(), pipelineType.c_str() );
+        return false;
+    }
+
+    for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
+        if ( optionElement->ValueStr() != "option" ) {
+            m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <pipeline> element found.", m_fileName.c_str(), optionElement->Value() );
+            return false;
+        }
+
+        string optionName;
+        if ( optionElement->QueryStringAttribute( "name", &optionName ) != TIXML_SUCCESS ) {
+            m_log->writeError( "Tracelib Configuration: while reading %s: Failed to read name property of <option> element; ignoring this.", m_fileName.c_str() );
+            continue;
+        }
+
+        if ( optionName == "queueSize" ) {
+            istringstream str( getText( optionElement ) );
+            str >> m_dispatchConfiguration.queueSize; // XXX Error handling for non-numeric values
+            if ( m_dispatchConfiguration.queueSize == 0 ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: invalid 'queueSize' option in <pipeline> element; using default.", m_fileName.c_str() );
+                m_dispatchConfiguration.queueSize = DispatchConfiguration::DefaultQueueSize;
+            }
+        } else if ( optionName == "flushInterval" ) {
+            istringstream str( getText( optionElement ) );
+            str >> m_dispatchConfiguration.flushInterval; // XXX Error handling for non-numeric values
+        } else {
+            m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in <pipeline> element; ignoring this.", m_fileName.c_str(), optionName.c_str() );
+            continue;
+        }
+    }
+
+    m_log->writeStatus( "Tracelib Configuration: using %s trace pipeline (queue size=%lu, flush interval=%u)",
+                        pipelineType.c_str(), m_dispatchConfiguration.queueSize, m_dispatchConfiguration.flushInterval );
+    return true;
+}
+
 bool Configuration::readStorageElement( TiXmlElement *storageElem )
 {
     bool haveMaximumSize = false;
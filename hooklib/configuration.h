@@ -49,6 +49,26 @@ struct StorageConfiguration {
     std::string archiveDirectoryName;
 };
 
+struct DispatchConfiguration {
+    enum Mode {
+        Synchronous,
+        Asynchronous
+    };
+
+    static const unsigned long DefaultQueueSize = 1024;
+    static const unsigned int DefaultFlushInterval = 10;
+
+    DispatchConfiguration()
+        : mode( Synchronous ),
+          queueSize( DefaultQueueSize ),
+          flushInterval( DefaultFlushInterval )
+    { }
+
+    Mode mode;
+    unsigned long queueSize;
+    unsigned int flushInterval;
+};
+
 struct TraceKey
 {
     TraceKey() : enabled( true ) { }
@@ -70,6 +90,7 @@ public:
     static Configuration *fromMarkup( const std::string &markup, Log *log );
 
     const StorageConfiguration &storageConfiguration() const;
+    const DispatchConfiguration &dispatchConfiguration() const;
     const std::vector<TracePointSet *> &configuredTracePointSets() const;
     Serializer *configuredSerializer();
     Output *configuredOutput();
@@ -89,6 +110,7 @@ private:
     bool readProcessElement( TiXmlElement *e );
     bool readTraceKeysElement( TiXmlElement *e );
     bool readStorageElement( TiXmlElement *e );
+    bool readPipelineElement( TiXmlElement *e );
 
     std::string m_fileName;
     std::vector<TracePointSet *> m_configuredTracePointSets;
@@ -97,6 +119,7 @@ private:
     Log *m_log;
     std::vector<TraceKey> m_configuredTraceKeys;
     StorageConfiguration m_storageConfiguration;
+    DispatchConfiguration m_dispatchConfiguration;
 };
 
 TRACELIB_NAMESPACE_END
@@ -16,12 +16,13 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
  */
-
 #include "eventthread_unix.h"
-#include "mutex.h"
+#include "atomic.h"
+#include "config.h"
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,8 +31,17 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_EPOLL_H
+#  include <sys/epoll.h>
+#else
+#  include <poll.h>
+#endif
+#ifdef HAVE_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif
 #include <list>
 #include <map>
+#include <vector>
 
 static bool operator < ( const timeval &tv1, const timeval &tv2 )
 {
@@ -46,10 +56,102 @@ typedef struct _TimeOut { EventObserver *observer; int timeout; } TimeOut;
 typedef std::list<TimeOut> TimeOutList;
 typedef std::map<timeval, TimeOutList> TimeOutMap;
 
-static const char PostTask = 'p';
-static const char SendTask = 's';
 static const char NoError = '0';
 
+struct ReadyFd {
+    int fd;
+    bool readable;
+    bool writable;
+};
+
+/* Lock-free queue of tasks for the event thread, with any number of
+ * producers. Producers push onto a stack; the event thread takes the whole
+ * stack at once and reverses it, which restores the order of submission.
+ */
+class TaskQueue
+{
+public:
+    // Returns true if the queue was empty, i.e. the event thread needs a
+    // wakeup.
+    bool push( Task *task )
+    {
+        Task *head;
+        do {
+            head = m_head.load();
+            task->m_next = head;
+        } while ( !m_head.testAndSet( head, task ) );
+        return head == 0;
+    }
+
+    Task *takeAll()
+    {
+        Task *reversed = 0;
+        Task *task = m_head.fetchAndStore( 0 );
+        while ( task ) {
+            Task *next = task->m_next;
+            task->m_next = reversed;
+            reversed = task;
+            task = next;
+        }
+        return reversed;
+    }
+
+private:
+    AtomicPointer<Task> m_head;
+};
+
+/* Wraps a task passed to sendTask() and lets the sending thread wait
+ * until the event thread ran it.
+ */
+class SynchronousTask : public Task
+{
+public:
+    SynchronousTask( Task *task ) : m_task( task ), m_result( 0 )
+    {
+        pthread_mutex_init( &m_mutex, NULL );
+        pthread_cond_init( &m_cond, NULL );
+    }
+
+    ~SynchronousTask()
+    {
+        pthread_cond_destroy( &m_cond );
+        pthread_mutex_destroy( &m_mutex );
+    }
+
+    void *exec( EventContext *ctx )
+    {
+        void *result = m_task->exec( ctx );
+        pthread_mutex_lock( &m_mutex );
+        m_result = result;
+        m_done.store( 1 );
+        pthread_cond_signal( &m_cond );
+        pthread_mutex_unlock( &m_mutex );
+        return result;
+    }
+
+    void *wait()
+    {
+        // Most tasks are quick; avoid going to sleep if possible.
+        for ( int i = 0; i < SpinCount && !m_done.load(); ++i ) {
+            sched_yield();
+        }
+        pthread_mutex_lock( &m_mutex );
+        while ( !m_done.load() ) {
+            pthread_cond_wait( &m_cond, &m_mutex );
+        }
+        pthread_mutex_unlock( &m_mutex );
+        return m_result;
+    }
+
+private:
+    static const int SpinCount = 100;
+
+    Task *m_task;
+    void *m_result;
+    AtomicCounter m_done;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+};
 
 class EventContext : public FileEventObserver
 {
@@ -59,18 +161,31 @@ public:
 
     void handleEvent( EventContext*, Event *event );
 
+    bool isValid() const { return event_list_thread != 0; }
     int countMonitors();
-    int getFDSets( fd_set *rfds, fd_set *wfds );
+    void enqueueTask( Task *task );
+
+    void updateWatch( int fd );
+    int waitForEvents( int timeout, std::vector<ReadyFd> &ready );
 
     pthread_t event_list_thread;
     bool keep_running;
 
-    int command_pipe[2];
+    TaskQueue tasks;
+    WakeupChannel wakeup;
     int confirm_pipe[2];
-    Mutex pipe_mutex;
 
     FileObserverList m_read_list;
     FileObserverList m_write_list;
+    std::vector<int> m_failed_fds; // could not be watched
+
+#ifdef HAVE_EPOLL_H
+    int epoll_fd;
+    std::vector<epoll_event> m_epoll_events;
+#else
+    std::vector<pollfd> m_poll_fds;
+#endif
+    std::vector<ReadyFd> m_ready;
 
     TimeOutMap m_timeout_map;
 };
@@ -96,71 +211,64 @@ static void closePipe( int *fd )
     fd[0] = fd[1] = -1;
 }
 
-static int getFDSet( FileObserverList &list, fd_set *fds )
-{
-    int max = -1;
-    FD_ZERO( fds );
-    const FileObserverList::iterator e = list.end();
-    for ( FileObserverList::iterator it = list.begin(); it != e; ++it ) {
-        FD_SET( it->first, fds );
-        if ( it->first > max )
-            max = it->first;
-
-    }
-    return max;
-}
-
-static int
-handleFDSet( EventContext *ctx, FileObserverList &list, fd_set *fds, FileEvent::EventWatch watch )
+static int handleReadyFds( EventContext *ctx, const std::vector<ReadyFd> &ready )
 {
     int handled = 0;
 
-    const FileObserverList::iterator e = list.end();
-    for ( FileObserverList::iterator it = list.begin(); it != e; ) {
-        int fd = it->first;
-        EventObserver *obs = it->second;
-        ++it;
-        if ( FD_ISSET( fd, fds ) ) {
-            FileEvent event( fd, 0, watch );
-            obs->handleEvent( ctx, &event );
-            ++handled;
+    /* Observers may add or remove observers while handling an event, so
+     * look up the observer for every event.
+     */
+    const std::vector<ReadyFd>::const_iterator e = ready.end();
+    for ( std::vector<ReadyFd>::const_iterator it = ready.begin(); it != e; ++it ) {
+        if ( it->readable ) {
+            FileObserverList::iterator obs = ctx->m_read_list.find( it->fd );
+            if ( obs != ctx->m_read_list.end() ) {
+                FileEvent event( it->fd, 0, FileEvent::FileRead );
+                obs->second->handleEvent( ctx, &event );
+                ++handled;
+            }
+        }
+        if ( it->writable ) {
+            FileObserverList::iterator obs = ctx->m_write_list.find( it->fd );
+            if ( obs != ctx->m_write_list.end() ) {
+                FileEvent event( it->fd, 0, FileEvent::FileWrite );
+                obs->second->handleEvent( ctx, &event );
+                ++handled;
+            }
         }
     }
 
     return handled;
 }
 
-static bool
-handleError( EventContext *ctx, FileObserverList &list, FileEvent::EventWatch watch )
+// Reports file descriptors which could not be watched to their observers.
+static bool handleErrors( EventContext *ctx )
 {
-    const FileObserverList::iterator e = list.end();
-    for ( FileObserverList::iterator it = list.begin(); it != e; ++it ) {
-        int fd = it->first;
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
-
-        fd_set fds;
-        FD_ZERO( &fds );
-        FD_SET( fd, &fds );
+    if ( ctx->m_failed_fds.empty() ) {
+        return false;
+    }
 
-        int retval;
-        do {
-            if ( FileEvent::FileRead == watch )
-                retval = select( fd + 1, &fds, NULL, 0L, &tv );
-            else
-                retval = select( fd + 1, NULL, &fds, 0L, &tv );
-        } while ( retval < 0 && errno == EINTR );
-
-        if ( retval < 0 && errno != EINTR ) {
-            EventObserver *observer = it->second;
-            list.erase( it );
-            FileEvent event( fd, errno, FileEvent::Error );
+    std::vector<int> failed;
+    failed.swap( ctx->m_failed_fds );
+    const std::vector<int>::const_iterator e = failed.end();
+    for ( std::vector<int>::const_iterator it = failed.begin(); it != e; ++it ) {
+        EventObserver *observer = 0;
+        FileObserverList::iterator obs = ctx->m_read_list.find( *it );
+        if ( obs != ctx->m_read_list.end() ) {
+            observer = obs->second;
+            ctx->m_read_list.erase( obs );
+        }
+        obs = ctx->m_write_list.find( *it );
+        if ( obs != ctx->m_write_list.end() ) {
+            observer = obs->second;
+            ctx->m_write_list.erase( obs );
+        }
+        if ( observer ) {
+            FileEvent event( *it, EBADF, FileEvent::Error );
             observer->handleEvent( ctx, &event );
-            return true;
         }
     }
-    return false;
+    return true;
 }
 
 static void
@@ -243,10 +351,13 @@ static void handleTimeout( EventContext *ctx, const timeval &now )
     }
 }
 
-static int processFds( EventContext *data, int nds, fd_set *rfds, fd_set *wfds )
+static int processFds( EventContext *data )
 {
-    timeval tv;
-    timeval *cur = NULL;
+    if ( handleErrors( data ) ) {
+        return 0;
+    }
+
+    int timeout = -1;
     TimeOutMap::iterator it = data->m_timeout_map.begin();
     if ( it != data->m_timeout_map.end() ) {
         timeval now;
@@ -255,31 +366,24 @@ static int processFds( EventContext *data, int nds, fd_set *rfds, fd_set *wfds )
 
         it = data->m_timeout_map.begin();
         if ( it != data->m_timeout_map.end() ) {
+            timeval tv;
             timersub( &it->first, &now, &tv );
-            cur = &tv;
+            // Round up, waking up early would just mean another iteration
+            timeout = tv.tv_sec < 0 ? 0 : tv.tv_sec * 1000 + ( tv.tv_usec + 999 ) / 1000;
         }
     }
 
-    int retval = select( nds, rfds, wfds, NULL, cur );
+    int retval = data->waitForEvents( timeout, data->m_ready );
     if ( retval == -1 ) {
         if ( errno != EINTR ) {
-            if ( !handleError( data, data->m_read_list, FileEvent::FileRead ) &&
-                    !handleError( data, data->m_write_list, FileEvent::FileWrite ) ) {
-                fprintf( stderr, "Unknown error in %s: %s\n",
-                        __FUNCTION__,
-                        strerror( errno ) );
-                return -1;
-            }
+            fprintf( stderr, "Unknown error in %s: %s\n",
+                    __FUNCTION__,
+                    strerror( errno ) );
+            return -1;
         }
         retval = 0; // tell caller we didn't do anything
     } else if ( retval > 0 ) {
-        if ( FD_ISSET( data->command_pipe[0], rfds ) ) {
-            FileEvent event( data->command_pipe[0], 0, FileEvent::FileRead );
-            data->handleEvent( data, &event );
-        } else {
-            handleFDSet( data, data->m_read_list, rfds, FileEvent::FileRead );
-            handleFDSet( data, data->m_write_list, wfds, FileEvent::FileWrite );
-        }
+        handleReadyFds( data, data->m_ready );
     }
     return retval;
 }
@@ -290,58 +394,103 @@ static void *unixEventProc( void *user_data )
 
     write( data->confirm_pipe[1], &NoError, 1 );
 
-    fd_set rfds;
-    fd_set wfds;
-
-    int nds = data->getFDSets( &rfds, &wfds );
-    while ( data->keep_running && nds > 0 ) {
-        if ( processFds( data, nds, &rfds, &wfds ) < 0 )
+    while ( data->keep_running ) {
+        if ( processFds( data ) < 0 )
             break;
+    }
+
+    return NULL;
+}
 
-        nds = data->getFDSets( &rfds, &wfds );
+WakeupChannel::WakeupChannel()
+{
+#ifdef HAVE_EVENTFD_H
+    m_fds[0] = m_fds[1] = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+#else
+    if ( pipe( m_fds ) == 0 ) {
+        fcntl( m_fds[0], F_SETFL, fcntl( m_fds[0], F_GETFL ) | O_NONBLOCK );
+        fcntl( m_fds[1], F_SETFL, fcntl( m_fds[1], F_GETFL ) | O_NONBLOCK );
+    } else {
+        m_fds[0] = m_fds[1] = -1;
     }
+#endif
+}
 
-    write( data->confirm_pipe[1], &NoError, 1 );
+WakeupChannel::~WakeupChannel()
+{
+    if ( m_fds[0] != -1 ) {
+        ::close( m_fds[0] );
+    }
+    if ( m_fds[1] != m_fds[0] ) {
+        ::close( m_fds[1] );
+    }
+}
 
-    return NULL;
+void WakeupChannel::wake()
+{
+#ifdef HAVE_EVENTFD_H
+    const uint64_t value = 1;
+#else
+    const char value = 1;
+#endif
+    // A full pipe means that a wakeup is pending anyway.
+    while ( ::write( m_fds[1], &value, sizeof( value ) ) == -1 && errno == EINTR )
+        ;
 }
 
-EventContext::EventContext() : keep_running( true )
+void WakeupChannel::reset()
 {
-    if ( pipe( command_pipe ) != 0 ) {
-        command_pipe[0] = command_pipe[1] = -1;
+    char buf[64];
+    while ( ::read( m_fds[0], buf, sizeof( buf ) ) > 0 )
+        ;
+}
+
+EventContext::EventContext() : event_list_thread( 0 ), keep_running( true )
+{
+    confirm_pipe[0] = confirm_pipe[1] = -1;
+#ifdef HAVE_EPOLL_H
+    epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    if ( epoll_fd == -1 ) {
+        fprintf( stderr, "%s %s", __FUNCTION__, strerror( errno ) );
+        return;
+    }
+#endif
+    if ( wakeup.fd() == -1 ) {
         fprintf( stderr, "%s %s", __FUNCTION__, strerror( errno ) );
         return;
     }
     if ( pipe( confirm_pipe ) != 0 ) {
         confirm_pipe[0] = confirm_pipe[1] = -1;
         fprintf( stderr, "%s %s", __FUNCTION__, strerror( errno ) );
-        goto pipe1_out;
+        return;
     }
 
-    m_read_list[command_pipe[0]] = this;
+    m_read_list[wakeup.fd()] = this;
+    updateWatch( wakeup.fd() );
 
     if ( pthread_create( &event_list_thread, NULL, unixEventProc, this ) ) {
         fprintf( stderr, "Couldn't create the event thread" );
         event_list_thread = 0;
-        goto pipe2_out;
+        return;
     }
 
     char response;
-    if ( read( confirm_pipe[0], &response, 1 ) == 1 ) {
-        return; // success
+    if ( read( confirm_pipe[0], &response, 1 ) != 1 ) {
+        pthread_detach( event_list_thread );
+        event_list_thread = 0;
     }
-
-pipe2_out:
-    closePipe( confirm_pipe );
-pipe1_out:
-    closePipe( command_pipe );
 }
 
 EventContext::~EventContext()
 {
-    closePipe( command_pipe );
-    closePipe( confirm_pipe );
+    if ( confirm_pipe[0] != -1 ) {
+        closePipe( confirm_pipe );
+    }
+#ifdef HAVE_EPOLL_H
+    if ( epoll_fd != -1 ) {
+        close( epoll_fd );
+    }
+#endif
 }
 
 int EventContext::countMonitors()
@@ -350,39 +499,133 @@ int EventContext::countMonitors()
     return m_read_list.size() + m_write_list.size() - 1 + m_timeout_map.size();
 }
 
-int EventContext::getFDSets( fd_set *rfds, fd_set *wfds )
+void EventContext::enqueueTask( Task *task )
 {
-    int rmax = getFDSet( m_read_list, rfds );
-    int wmax = getFDSet( m_write_list, wfds );
+    if ( tasks.push( task ) ) {
+        wakeup.wake();
+    }
+}
 
-    return 1 + ( rmax > wmax ? rmax : wmax );
+#ifdef HAVE_EPOLL_H
+// Makes the watched events of fd match the observer lists.
+void EventContext::updateWatch( int fd )
+{
+    epoll_event ev;
+    memset( &ev, 0, sizeof( ev ) );
+    ev.data.fd = fd;
+    if ( m_read_list.find( fd ) != m_read_list.end() ) {
+        ev.events |= EPOLLIN;
+    }
+    if ( m_write_list.find( fd ) != m_write_list.end() ) {
+        ev.events |= EPOLLOUT;
+    }
+
+    if ( ev.events == 0 ) {
+        // Fails harmlessly if the file descriptor was closed already
+        epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, &ev );
+        return;
+    }
+    // A closed file descriptor vanishes from the epoll set, and its number
+    // may be reused by the time it is watched again.
+    if ( epoll_ctl( epoll_fd, EPOLL_CTL_MOD, fd, &ev ) == -1 &&
+         ( errno != ENOENT || epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == -1 ) ) {
+        m_failed_fds.push_back( fd );
+    }
+}
+#else
+// The poll() set is rebuilt from the observer lists for every call.
+void EventContext::updateWatch( int )
+{
 }
+#endif
 
+// Waits up to timeout milliseconds (forever if negative) and fills ready
+// with the file descriptors that can be read from or written to.
+int EventContext::waitForEvents( int timeout, std::vector<ReadyFd> &ready )
+{
+    ready.clear();
+
+#ifdef HAVE_EPOLL_H
+    const size_t watched = m_read_list.size() + m_write_list.size();
+    if ( m_epoll_events.size() < watched ) {
+        m_epoll_events.resize( watched );
+    }
+    const int count = epoll_wait( epoll_fd, &m_epoll_events[0], m_epoll_events.size(), timeout );
+    for ( int i = 0; i < count; ++i ) {
+        const unsigned int events = m_epoll_events[i].events;
+        // Like select(), report errors and hangups as readiness; the
+        // observers find out about them when reading or writing.
+        ReadyFd r;
+        r.fd = m_epoll_events[i].data.fd;
+        r.readable = ( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) != 0;
+        r.writable = ( events & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) != 0;
+        ready.push_back( r );
+    }
+    return count;
+#else
+    m_poll_fds.clear();
+    FileObserverList::const_iterator r = m_read_list.begin(), re = m_read_list.end();
+    FileObserverList::const_iterator w = m_write_list.begin(), we = m_write_list.end();
+    while ( r != re || w != we ) {
+        pollfd p;
+        p.revents = 0;
+        if ( w == we || ( r != re && r->first < w->first ) ) {
+            p.fd = r->first;
+            p.events = POLLIN;
+            ++r;
+        } else if ( r == re || w->first < r->first ) {
+            p.fd = w->first;
+            p.events = POLLOUT;
+            ++w;
+        } else {
+            p.fd = r->first;
+            p.events = POLLIN | POLLOUT;
+            ++r;
+            ++w;
+        }
+        m_poll_fds.push_back( p );
+    }
+
+    const int count = poll( &m_poll_fds[0], m_poll_fds.size(), timeout );
+    if ( count <= 0 ) {
+        return count;
+    }
+    const std::vector<pollfd>::const_iterator e = m_poll_fds.end();
+    for ( std::vector<pollfd>::const_iterator it = m_poll_fds.begin(); it != e; ++it ) {
+        if ( it->revents & POLLNVAL ) {
+            m_failed_fds.push_back( it->fd );
+        } else if ( it->revents ) {
+            ReadyFd r;
+            r.fd = it->fd;
+            r.readable = ( it->revents & ( POLLIN | POLLERR | POLLHUP ) ) && ( it->events & POLLIN );
+            r.writable = ( it->revents & ( POLLOUT | POLLERR | POLLHUP ) ) && ( it->events & POLLOUT );
+            ready.push_back( r );
+        }
+    }
+    return ready.size();
+#endif
+}
+
+// Runs the tasks queued by postTask() and sendTask().
 void EventContext::handleEvent( EventContext*, Event *event )
 {
     FileEvent *fe = (FileEvent *)event;
     if ( FileEvent::Error == fe->watch ) {
-        /* TODO: handle unlikely error with pipe communication */
+        /* TODO: handle unlikely error with wakeup channel */
         fprintf( stderr, "%s: %s\n", __FUNCTION__, strerror( fe->err ) );
-    } else {
-        char cmd;
-        if ( read( fe->fd, &cmd, sizeof ( cmd ) ) == sizeof ( cmd ) ) {
-            Task *task;
-            switch ( cmd ) {
-            case 'p':
-                if ( read( fe->fd, &task, sizeof( task ) ) == sizeof( task ) ) {
-                    task->exec( this );
-                    delete task;
-                }
-                break;
-            case 's':
-                if ( read( fe->fd, &task, sizeof( task ) ) == sizeof( task ) ) {
-                    void *result = task->exec( this );
-                    write( confirm_pipe[1], &result, sizeof ( result ) );
-                }
-                break;
-            }
+        return;
+    }
+
+    wakeup.reset();
+    Task *task = tasks.takeAll();
+    while ( task ) {
+        Task *next = task->m_next;
+        const bool posted = task->m_posted;
+        task->exec( this );
+        if ( posted ) {
+            delete task;
         }
+        task = next;
     }
 }
 
@@ -396,6 +639,7 @@ void *AddIOObserverTask::exec( EventContext *data )
     if ( watch_flags & FileEvent::FileWrite ) {
         data->m_write_list[fd] = observer;
     }
+    data->updateWatch( fd );
     return NULL;
 }
 
@@ -407,6 +651,7 @@ void *RemoveIOObserverTask::exec( EventContext *data )
     if ( watch_flags & FileEvent::FileWrite ) {
         data->m_write_list.erase( fd );
     }
+    data->updateWatch( fd );
     return (void *)(long) data->countMonitors();
 }
 
@@ -443,24 +688,22 @@ EventThreadUnix::~EventThreadUnix()
 void EventThreadUnix::postTask( Task *task )
 {
     if ( running() ) {
-        MutexLocker locker( d->pipe_mutex );
-        write( d->command_pipe[1], &PostTask, sizeof ( PostTask ) );
-        write( d->command_pipe[1], &task, sizeof ( task ) );
+        task->m_posted = true;
+        d->enqueueTask( task );
     }
 }
 
 void *EventThreadUnix::sendTask( Task *task )
 {
     if ( running() ) {
-        MutexLocker locker( d->pipe_mutex );
-
-        write( d->command_pipe[1], &SendTask, sizeof ( SendTask ) );
-        write( d->command_pipe[1], &task, sizeof ( task ) );
-
-        void *response;
-        read( d->confirm_pipe[0], &response, sizeof ( response ) );
+        // Waiting for ourselves would never end
+        if ( pthread_equal( pthread_self(), d->event_list_thread ) ) {
+            return task->exec( d );
+        }
 
-        return response;
+        SynchronousTask synchronousTask( task );
+        d->enqueueTask( &synchronousTask );
+        return synchronousTask.wait();
     }
     return NULL;
 }
@@ -478,14 +721,20 @@ void EventThreadUnix::commandChannels( int *in, int *out )
 
 bool EventThreadUnix::running()
 {
-    return m_self && m_self->d->command_pipe[1] > -1;
+    return m_self && m_self->d->isValid();
 }
 
 void EventThreadUnix::stop()
 {
     EndEventLoopTask task;
     if ( sendTask( &task ) ) {
-        pthread_detach( d->event_list_thread );
+        // The event thread must not touch the context anymore once it
+        // is deleted.
+        if ( pthread_equal( pthread_self(), d->event_list_thread ) ) {
+            pthread_detach( d->event_list_thread );
+        } else {
+            pthread_join( d->event_list_thread, NULL );
+        }
         d->event_list_thread = 0;
     }
 }
@@ -500,17 +749,12 @@ ThreadId EventThreadUnix::threadId() const
 
 int EventThreadUnix::processEvents( EventContext *ctx )
 {
-    fd_set rfds;
-    fd_set wfds;
-    int nds = ctx->getFDSets( &rfds, &wfds );
-
-    if ( !ctx->keep_running || nds <= 0 )
+    if ( !ctx->keep_running )
         return -1;
 
-    return processFds( ctx, nds, &rfds, &wfds );
+    return processFds( ctx );
 }
 
 EventThreadUnix *EventThreadUnix::m_self;
 
 TRACELIB_NAMESPACE_END
-
@@ -86,9 +86,18 @@ public:
 class Task
 {
 public:
+    Task() : m_next( 0 ), m_posted( false ) {}
     virtual ~Task() {}
 
     virtual void *exec( EventContext* ) = 0;
+
+private:
+    friend class TaskQueue;
+    friend class EventContext;
+    friend class EventThreadUnix;
+
+    Task *m_next; // links the tasks waiting for the event thread
+    bool m_posted; // deleted by the event thread after running it
 };
 
 class AddIOObserverTask : public Task
@@ -135,6 +144,26 @@ public:
     virtual void *exec( EventContext* );
 };
 
+/* Lets other threads wake up the event thread, or a thread waiting for an
+ * event thread observer; an eventfd where available, a pipe otherwise.
+ */
+class WakeupChannel
+{
+public:
+    WakeupChannel();
+    ~WakeupChannel();
+
+    int fd() const { return m_fds[0]; }
+    void wake();
+    void reset();
+
+private:
+    WakeupChannel( const WakeupChannel &other ); // disabled
+    void operator=( const WakeupChannel &rhs ); // disabled
+
+    int m_fds[2];
+};
+
 class EventThreadUnix
 {
 public:
@@ -0,0 +1,80 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+bool FileOutput::openFile( bool truncate )
+{
+    if ( m_fd == -1 ) {
+        m_fd = ::open( m_filename.c_str(), O_WRONLY | O_CREAT | ( truncate ? O_TRUNC : O_APPEND ), 0666 );
+    }
+    return m_fd != -1;
+}
+
+void FileOutput::closeFile()
+{
+    if ( m_fd != -1 ) {
+        ::close( m_fd );
+        m_fd = -1;
+    }
+}
+
+bool FileOutput::writeChunks( Chunk *chunks, int count )
+{
+    iovec iov[3];
+    for ( int i = 0; i < count; ++i ) {
+        iov[i].iov_base = const_cast<char *>( chunks[i].data );
+        iov[i].iov_len = chunks[i].size;
+    }
+
+    iovec *pending = iov;
+    while ( count > 0 ) {
+        ssize_t written = ::writev( m_fd, pending, count );
+        if ( written == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return false;
+        }
+
+        // Skip whatever was written completely and resume partial writes.
+        while ( count > 0 && (size_t)written >= pending->iov_len ) {
+            written -= pending->iov_len;
+            ++pending;
+            --count;
+        }
+        if ( count > 0 ) {
+            pending->iov_base = static_cast<char *>( pending->iov_base ) + written;
+            pending->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+TRACELIB_NAMESPACE_END
+
@@ -0,0 +1,68 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+bool FileOutput::openFile( bool truncate )
+{
+    if ( m_fd == -1 ) {
+        // Text data keeps the CRLF translation which fopen( "w" ) used to do.
+        const int mode = isBinaryData() ? _O_BINARY : _O_TEXT;
+        m_fd = _open( m_filename.c_str(), _O_WRONLY | _O_CREAT | ( truncate ? _O_TRUNC : _O_APPEND ) | mode,
+                      _S_IREAD | _S_IWRITE );
+    }
+    return m_fd != -1;
+}
+
+void FileOutput::closeFile()
+{
+    if ( m_fd != -1 ) {
+        _close( m_fd );
+        m_fd = -1;
+    }
+}
+
+bool FileOutput::writeChunks( Chunk *chunks, int count )
+{
+    for ( int i = 0; i < count; ++i ) {
+        const char *data = chunks[i].data;
+        size_t remaining = chunks[i].size;
+        while ( remaining > 0 ) {
+            const unsigned int toWrite = remaining > 0x40000000 ? 0x40000000 : (unsigned int)remaining;
+            const int written = _write( m_fd, data, toWrite );
+            if ( written == -1 ) {
+                return false;
+            }
+            data += written;
+            remaining -= written;
+        }
+    }
+    return true;
+}
+
+TRACELIB_NAMESPACE_END
+
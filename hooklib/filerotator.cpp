@@ -0,0 +1,198 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filerotator.h"
+#include "log.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sstream>
+
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+FileRotator::FileRotator( Log *log, const string &fileName, unsigned int generations, bool compress )
+    : m_log( log ),
+    m_fileName( fileName ),
+    m_generations( generations ),
+    m_compress( compress && supportsCompression() )
+{
+    if ( compress && !m_compress ) {
+        m_log->writeError( "Tracelib was built without zlib; rotated segments of %s are not compressed",
+                           m_fileName.c_str() );
+    }
+    m_running.store( 1 );
+}
+
+FileRotator::~FileRotator()
+{
+    {
+        MutexLocker locker( m_segmentsMutex );
+        m_running.store( 0 );
+        m_segmentAdded.wakeAll();
+    }
+    wait();
+    while ( processNextSegment() )
+        ;
+}
+
+bool FileRotator::supportsCompression()
+{
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FileRotator::addSegment( const string &segmentFileName )
+{
+    {
+        MutexLocker locker( m_segmentsMutex );
+        m_segments.push_back( segmentFileName );
+        m_segmentAdded.wakeAll();
+    }
+
+    // Without a thread, do the work right away rather than never.
+    if ( !isRunning() ) {
+        processNextSegment();
+    }
+}
+
+void FileRotator::run()
+{
+    while ( m_running.load() ) {
+        if ( !processNextSegment() ) {
+            waitForSegment();
+        }
+    }
+}
+
+// Blocks until a segment is queued or the rotator is destroyed.
+void FileRotator::waitForSegment()
+{
+    MutexLocker locker( m_segmentsMutex );
+    while ( m_segments.empty() && m_running.load() ) {
+        m_segmentAdded.wait( m_segmentsMutex );
+    }
+}
+
+bool FileRotator::processNextSegment()
+{
+    string segmentFileName;
+    {
+        MutexLocker locker( m_segmentsMutex );
+        if ( m_segments.empty() ) {
+            return false;
+        }
+        segmentFileName = m_segments.front();
+        m_segments.pop_front();
+    }
+
+    shiftGenerations();
+
+    if ( m_generations == 0 ) {
+        remove( segmentFileName.c_str() );
+        return true;
+    }
+
+    if ( m_compress ) {
+        const string compressedFileName = generationFileName( 1, true );
+        if ( compressFile( segmentFileName, compressedFileName ) ) {
+            remove( segmentFileName.c_str() );
+            return true;
+        }
+        m_log->writeError( "Failed to compress %s; keeping it uncompressed", segmentFileName.c_str() );
+        remove( compressedFileName.c_str() );
+    }
+
+    const string targetFileName = generationFileName( 1, false );
+    if ( rename( segmentFileName.c_str(), targetFileName.c_str() ) != 0 ) {
+        m_log->writeError( "Failed to rename %s to %s: %s", segmentFileName.c_str(),
+                           targetFileName.c_str(), strerror( errno ) );
+    }
+    return true;
+}
+
+// Makes room for a new first generation; the last generation is dropped.
+void FileRotator::shiftGenerations()
+{
+    for ( unsigned int generation = m_generations; generation > 0; --generation ) {
+        for ( int compressed = 0; compressed < 2; ++compressed ) {
+            const string fileName = generationFileName( generation, compressed != 0 );
+            if ( generation == m_generations ) {
+                remove( fileName.c_str() );
+            } else {
+                // Fails harmlessly if the generation does not exist (yet).
+                rename( fileName.c_str(), generationFileName( generation + 1, compressed != 0 ).c_str() );
+            }
+        }
+    }
+}
+
+string FileRotator::generationFileName( unsigned int generation, bool compressed ) const
+{
+    ostringstream str;
+    str << m_fileName << '.' << generation;
+    if ( compressed ) {
+        str << ".gz";
+    }
+    return str.str();
+}
+
+#ifdef HAVE_ZLIB
+bool FileRotator::compressFile( const string &source, const string &destination )
+{
+    FILE *in = fopen( source.c_str(), "rb" );
+    if ( !in ) {
+        return false;
+    }
+    gzFile out = gzopen( destination.c_str(), "wb" );
+    if ( !out ) {
+        fclose( in );
+        return false;
+    }
+
+    bool success = true;
+    char buf[65536];
+    size_t bytesRead;
+    while ( success && ( bytesRead = fread( buf, 1, sizeof( buf ), in ) ) > 0 ) {
+        success = gzwrite( out, buf, (unsigned int)bytesRead ) == (int)bytesRead;
+    }
+    success = !ferror( in ) && success;
+
+    fclose( in );
+    return gzclose( out ) == Z_OK && success;
+}
+#else
+bool FileRotator::compressFile( const string &, const string & )
+{
+    return false;
+}
+#endif
+
+TRACELIB_NAMESPACE_END
+
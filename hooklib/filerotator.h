@@ -0,0 +1,78 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_FILEROTATOR_H
+#define TRACELIB_FILEROTATOR_H
+
+#include "tracelib_config.h"
+#include "atomic.h"
+#include "mutex.h"
+#include "thread.h"
+
+#include <deque>
+#include <string>
+
+TRACELIB_NAMESPACE_BEGIN
+
+class Log;
+
+/* Moves completed segments of a rotating FileOutput into place on a
+ * background thread. For every segment, older generations are shifted
+ * ('trace.log.1' becomes 'trace.log.2' and so on), the oldest one is
+ * removed and the segment becomes 'trace.log.1' - optionally compressed
+ * to 'trace.log.1.gz'.
+ */
+class FileRotator : private Thread
+{
+public:
+    FileRotator( Log *log, const std::string &fileName, unsigned int generations, bool compress );
+
+    // Processes all segments which are still queued before returning.
+    virtual ~FileRotator();
+
+    using Thread::start;
+
+    void addSegment( const std::string &segmentFileName );
+
+    static bool supportsCompression();
+
+protected:
+    virtual void run();
+
+private:
+    bool processNextSegment();
+    void waitForSegment();
+    void shiftGenerations();
+    bool compressFile( const std::string &source, const std::string &destination );
+    std::string generationFileName( unsigned int generation, bool compressed ) const;
+
+    Log *m_log;
+    std::string m_fileName;
+    unsigned int m_generations;
+    bool m_compress;
+    Mutex m_segmentsMutex;
+    std::deque<std::string> m_segments;
+    WaitCondition m_segmentAdded; // signalled with m_segmentsMutex held
+    AtomicCounter m_running;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_FILEROTATOR_H)
+
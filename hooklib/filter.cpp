@@ -24,6 +24,11 @@
 #include "3rdparty/wildcmp/wildcmp.h"
 #include "3rdparty/pcre-8.10/pcrecpp.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
 #include <assert.h>
 
 using namespace std;
@@ -86,6 +91,11 @@ bool PathFilter::acceptsTracePoint( const TracePoint *tracePoint )
     return false;
 }
 
+void PathFilter::compile( FilterProgram *program ) const
+{
+    program->emitPath( m_matchingMode, m_path );
+}
+
 FunctionFilter::FunctionFilter()
     : m_rx( 0 )
 {
@@ -118,6 +128,11 @@ bool FunctionFilter::acceptsTracePoint( const TracePoint *tracePoint )
     return false;
 }
 
+void FunctionFilter::compile( FilterProgram *program ) const
+{
+    program->emitFunction( m_matchingMode, m_function );
+}
+
 GroupFilter::GroupFilter()
     : m_mode( Blacklist )
 {
@@ -152,6 +167,11 @@ bool GroupFilter::acceptsTracePoint( const TracePoint *tracePoint )
     return result;
 }
 
+void GroupFilter::compile( FilterProgram *program ) const
+{
+    program->emitGroup( m_mode, m_groups );
+}
+
 ConjunctionFilter::~ConjunctionFilter()
 {
     deleteRange( m_filters.begin(), m_filters.end() );
@@ -173,6 +193,16 @@ bool ConjunctionFilter::acceptsTracePoint( const TracePoint *tracePoint )
     return true;
 }
 
+void ConjunctionFilter::compile( FilterProgram *program ) const
+{
+    const size_t instruction = program->beginJunction( true );
+    vector<Filter *>::const_iterator it, end = m_filters.end();
+    for ( it = m_filters.begin(); it != end; ++it ) {
+        ( *it )->compile( program );
+    }
+    program->endJunction( instruction );
+}
+
 DisjunctionFilter::~DisjunctionFilter()
 {
     deleteRange( m_filters.begin(), m_filters.end() );
@@ -194,5 +224,586 @@ bool DisjunctionFilter::acceptsTracePoint( const TracePoint *tracePoint )
     return false;
 }
 
+void DisjunctionFilter::compile( FilterProgram *program ) const
+{
+    const size_t instruction = program->beginJunction( false );
+    vector<Filter *>::const_iterator it, end = m_filters.end();
+    for ( it = m_filters.begin(); it != end; ++it ) {
+        ( *it )->compile( program );
+    }
+    program->endJunction( instruction );
+}
+
+const size_t FilterProgram::NoMatch;
+
+#ifdef _WIN32
+static const bool PathsAreCaseSensitive = false;
+#else
+static const bool PathsAreCaseSensitive = true;
+#endif
+
+/* Returns the longest run of characters which every string matched by the
+ * given wildcard must contain.
+ */
+static string requiredLiteralOfWildcard( const string &wildcard )
+{
+    string best, run;
+    string::const_iterator it, end = wildcard.end();
+    for ( it = wildcard.begin(); it != end; ++it ) {
+        if ( *it == '*' || *it == '?' ) {
+            if ( run.size() > best.size() ) {
+                best = run;
+            }
+            run.clear();
+        } else {
+            run += *it;
+        }
+    }
+    return run.size() > best.size() ? run : best;
+}
+
+/* Same for a regular expression. This only understands the most common
+ * constructs and gives up (returning an empty string) on anything fancy
+ * such as top-level alternatives, inline options, escape sequences taking
+ * arguments (like \x41 or \p{Lu}) or POSIX classes within brackets. Groups
+ * are skipped.
+ */
+static string requiredLiteralOfRegExp( const string &rx )
+{
+    if ( rx.find( "(?" ) != string::npos || rx.find( "\\Q" ) != string::npos ) {
+        return string();
+    }
+
+    string best, run;
+    int depth = 0;
+    string::size_type i = 0;
+    while ( i < rx.size() ) {
+        const char c = rx[i];
+        bool endOfRun = true;
+        if ( c == '|' && depth == 0 ) {
+            return string();
+        } else if ( c == '\\' && i + 1 < rx.size() ) {
+            const char escaped = rx[i + 1];
+            if ( isalnum( (unsigned char)escaped ) ) {
+                return string();
+            }
+            if ( depth == 0 ) {
+                run += escaped;
+                endOfRun = false;
+            }
+            i += 2;
+        } else if ( c == '[' ) {
+            string::size_type j = i + 1;
+            if ( j < rx.size() && rx[j] == '^' ) {
+                ++j;
+            }
+            if ( j < rx.size() && rx[j] == ']' ) {
+                ++j;
+            }
+            while ( j < rx.size() && rx[j] != ']' ) {
+                if ( rx[j] == '[' && j + 1 < rx.size() &&
+                     ( rx[j + 1] == ':' || rx[j + 1] == '.' || rx[j + 1] == '=' ) ) {
+                    return string();
+                }
+                if ( rx[j] == '\\' ) {
+                    ++j;
+                }
+                ++j;
+            }
+            i = j + 1;
+        } else if ( c == '*' || c == '?' || c == '{' ) {
+            // The preceding character is optional.
+            if ( !run.empty() ) {
+                run.erase( run.size() - 1 );
+            }
+            if ( c == '{' ) {
+                const string::size_type closingBrace = rx.find( '}', i );
+                i = closingBrace == string::npos ? rx.size() : closingBrace + 1;
+            } else {
+                ++i;
+            }
+        } else if ( c == '(' ) {
+            ++depth;
+            ++i;
+        } else if ( c == ')' ) {
+            --depth;
+            ++i;
+        } else if ( c == '+' || c == '.' || c == '^' || c == '$' ) {
+            ++i;
+        } else {
+            if ( depth == 0 ) {
+                run += c;
+                endOfRun = false;
+            }
+            ++i;
+        }
+
+        if ( endOfRun ) {
+            if ( run.size() > best.size() ) {
+                best = run;
+            }
+            run.clear();
+        }
+    }
+    return run.size() > best.size() ? run : best;
+}
+
+FilterProgram::StringTable::StringTable( bool caseSensitive )
+    : m_caseSensitive( caseSensitive )
+{
+}
+
+size_t FilterProgram::StringTable::insert( const string &s )
+{
+    string key = s;
+    if ( !m_caseSensitive ) {
+        transform( key.begin(), key.end(), key.begin(), ::tolower );
+    }
+    map<string, size_t>::const_iterator it = m_ids.find( key );
+    if ( it != m_ids.end() ) {
+        return it->second;
+    }
+    m_strings.push_back( s );
+    m_ids[key] = m_strings.size() - 1;
+    return m_strings.size() - 1;
+}
+
+struct FilterProgram::StringTable::IndexLess
+{
+    explicit IndexLess( const StringTable *table_ ) : table( table_ ) { }
+
+    bool operator()( size_t a, size_t b ) const {
+        return table->compare( table->m_strings[a].c_str(), table->m_strings[b].c_str() ) < 0;
+    }
+
+    const StringTable *table;
+};
+
+void FilterProgram::StringTable::finalize()
+{
+    m_sortedIndices.resize( m_strings.size() );
+    for ( size_t i = 0; i < m_strings.size(); ++i ) {
+        m_sortedIndices[i] = i;
+    }
+    sort( m_sortedIndices.begin(), m_sortedIndices.end(), IndexLess( this ) );
+    m_ids.clear();
+}
+
+size_t FilterProgram::StringTable::find( const char *s ) const
+{
+    size_t lo = 0, hi = m_sortedIndices.size();
+    while ( lo < hi ) {
+        const size_t mid = lo + ( hi - lo ) / 2;
+        const int result = compare( m_strings[m_sortedIndices[mid]].c_str(), s );
+        if ( result == 0 ) {
+            return m_sortedIndices[mid];
+        }
+        if ( result < 0 ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NoMatch;
+}
+
+int FilterProgram::StringTable::compare( const char *a, const char *b ) const
+{
+    if ( m_caseSensitive ) {
+        return strcmp( a, b );
+    }
+    while ( *a && tolower( (unsigned char)*a ) == tolower( (unsigned char)*b ) ) {
+        ++a;
+        ++b;
+    }
+    return tolower( (unsigned char)*a ) - tolower( (unsigned char)*b );
+}
+
+FilterProgram::PatternTable::PatternTable( bool caseSensitive )
+    : m_caseSensitive( caseSensitive )
+{
+}
+
+FilterProgram::PatternTable::~PatternTable()
+{
+    vector<Pattern>::iterator it, end = m_patterns.end();
+    for ( it = m_patterns.begin(); it != end; ++it ) {
+        delete it->rx;
+    }
+}
+
+size_t FilterProgram::PatternTable::insert( MatchingMode matchingMode, const string &pattern )
+{
+    for ( size_t i = 0; i < m_patterns.size(); ++i ) {
+        if ( m_patterns[i].matchingMode == matchingMode && m_patterns[i].text == pattern ) {
+            return i;
+        }
+    }
+
+    Pattern p;
+    p.matchingMode = matchingMode;
+    p.text = pattern;
+    p.rx = 0;
+    p.prefiltered = false;
+    if ( matchingMode == RegExpMatch ) {
+        p.rx = new pcrecpp::RE( pattern.c_str(), pcrecpp::RE_Options().set_caseless( !m_caseSensitive ) );
+    }
+    m_patterns.push_back( p );
+    return m_patterns.size() - 1;
+}
+
+/* Builds an Aho-Corasick automaton from the literals required by the
+ * patterns, so that a single pass over a string tells which patterns
+ * might match it at all.
+ */
+void FilterProgram::PatternTable::finalize()
+{
+    vector<map<unsigned char, size_t> > trie( 1 );
+    vector<vector<size_t> > outputs( 1 );
+    for ( size_t i = 0; i < m_patterns.size(); ++i ) {
+        Pattern &p = m_patterns[i];
+        string literal = p.matchingMode == WildcardMatch ? requiredLiteralOfWildcard( p.text )
+                                                         : requiredLiteralOfRegExp( p.text );
+        if ( literal.empty() || ( p.rx && !p.rx->error().empty() ) ) {
+            continue;
+        }
+        if ( !m_caseSensitive ) {
+            transform( literal.begin(), literal.end(), literal.begin(), ::tolower );
+        }
+
+        size_t state = 0;
+        string::const_iterator it, end = literal.end();
+        for ( it = literal.begin(); it != end; ++it ) {
+            map<unsigned char, size_t>::const_iterator edge = trie[state].find( (unsigned char)*it );
+            if ( edge != trie[state].end() ) {
+                state = edge->second;
+            } else {
+                trie.push_back( map<unsigned char, size_t>() );
+                outputs.push_back( vector<size_t>() );
+                trie[state][(unsigned char)*it] = trie.size() - 1;
+                state = trie.size() - 1;
+            }
+        }
+        outputs[state].push_back( i );
+        p.prefiltered = true;
+    }
+
+    m_states.resize( trie.size() );
+    m_states[0].failure = 0;
+
+    // Breadth-first, so that failure states are complete before they are used.
+    vector<size_t> queue( 1, 0 );
+    for ( size_t head = 0; head < queue.size(); ++head ) {
+        const size_t state = queue[head];
+        m_states[state].firstEdge = m_edges.size();
+        map<unsigned char, size_t>::const_iterator it, end = trie[state].end();
+        for ( it = trie[state].begin(); it != end; ++it ) {
+            Edge edge;
+            edge.c = it->first;
+            edge.target = it->second;
+            m_edges.push_back( edge );
+            queue.push_back( it->second );
+
+            size_t failure = 0;
+            if ( state != 0 ) {
+                failure = m_states[state].failure;
+                while ( true ) {
+                    const size_t next = transition( failure, it->first );
+                    if ( next != NoMatch ) {
+                        failure = next;
+                        break;
+                    }
+                    if ( failure == 0 ) {
+                        break;
+                    }
+                    failure = m_states[failure].failure;
+                }
+            }
+            m_states[it->second].failure = failure;
+            outputs[it->second].insert( outputs[it->second].end(),
+                                        outputs[failure].begin(), outputs[failure].end() );
+        }
+        m_states[state].edgeCount = m_edges.size() - m_states[state].firstEdge;
+        m_states[state].firstOutput = m_outputs.size();
+        m_outputs.insert( m_outputs.end(), outputs[state].begin(), outputs[state].end() );
+        m_states[state].outputCount = m_outputs.size() - m_states[state].firstOutput;
+    }
+}
+
+size_t FilterProgram::PatternTable::transition( size_t state, unsigned char c ) const
+{
+    const Edge *edge = m_edges.empty() ? 0 : &m_edges[0] + m_states[state].firstEdge;
+    const Edge *end = edge + m_states[state].edgeCount;
+    for ( ; edge != end; ++edge ) {
+        if ( edge->c == c ) {
+            return edge->target;
+        }
+    }
+    return NoMatch;
+}
+
+void FilterProgram::PatternTable::prefilter( const char *s, vector<signed char> *results ) const
+{
+    results->resize( m_patterns.size() );
+    for ( size_t i = 0; i < m_patterns.size(); ++i ) {
+        ( *results )[i] = m_patterns[i].prefiltered ? 0 : -1;
+    }
+
+    size_t state = 0;
+    for ( ; *s; ++s ) {
+        const unsigned char c = m_caseSensitive ? (unsigned char)*s : (unsigned char)tolower( (unsigned char)*s );
+        while ( true ) {
+            const size_t next = transition( state, c );
+            if ( next != NoMatch ) {
+                state = next;
+                break;
+            }
+            if ( state == 0 ) {
+                break;
+            }
+            state = m_states[state].failure;
+        }
+
+        const State &st = m_states[state];
+        for ( size_t i = st.firstOutput; i < st.firstOutput + st.outputCount; ++i ) {
+            ( *results )[m_outputs[i]] = -1;
+        }
+    }
+}
+
+bool FilterProgram::PatternTable::matches( size_t id, const char *s ) const
+{
+    const Pattern &p = m_patterns[id];
+    switch ( p.matchingMode ) {
+        case RegExpMatch:
+            return p.rx->FullMatch( s );
+        case WildcardMatch:
+            if ( m_caseSensitive ) {
+                return wildcmp( p.text.c_str(), s ) != 0;
+            }
+            return wildicmp( p.text.c_str(), s ) != 0;
+        case StrictMatch:
+            break;
+    }
+    assert( !"Unreachable" );
+    return false;
+}
+
+/* Everything about one trace point which more than one instruction might
+ * need is looked up at most once.
+ */
+struct FilterProgram::EvaluationState
+{
+    enum { Unknown = -1 };
+
+    explicit EvaluationState( const TracePoint *tracePoint )
+        : sourceFile( tracePoint->sourceFile ? tracePoint->sourceFile : "" ),
+        functionName( tracePoint->functionName ? tracePoint->functionName : "" ),
+        groupName( tracePoint->groupName ? tracePoint->groupName : "" ),
+        pathLiteral( NoMatch ),
+        functionLiteral( NoMatch ),
+        groupId( NoMatch ),
+        havePathLiteral( false ),
+        haveFunctionLiteral( false ),
+        haveGroupId( false )
+    { }
+
+    const char *sourceFile;
+    const char *functionName;
+    const char *groupName;
+    size_t pathLiteral;
+    size_t functionLiteral;
+    size_t groupId;
+    bool havePathLiteral;
+    bool haveFunctionLiteral;
+    bool haveGroupId;
+    vector<signed char> pathPatternResults; // 1, 0 or Unknown per pattern
+    vector<signed char> functionPatternResults;
+};
+
+FilterProgram::FilterProgram()
+    : m_pathLiterals( PathsAreCaseSensitive ),
+    m_functionLiterals( true ),
+    m_groupNames( true ),
+    m_pathPatterns( PathsAreCaseSensitive ),
+    m_functionPatterns( true )
+{
+}
+
+FilterProgram::~FilterProgram()
+{
+}
+
+void FilterProgram::addFilter( const Filter *filter )
+{
+    if ( !filter ) {
+        m_entryPoints.push_back( NoMatch );
+        m_signature += "0;";
+        return;
+    }
+    m_entryPoints.push_back( m_instructions.size() );
+    filter->compile( this );
+    m_signature += ';';
+}
+
+void FilterProgram::finalize()
+{
+    m_pathLiterals.finalize();
+    m_functionLiterals.finalize();
+    m_groupNames.finalize();
+    m_pathPatterns.finalize();
+    m_functionPatterns.finalize();
+}
+
+size_t FilterProgram::match( const TracePoint *tracePoint ) const
+{
+    EvaluationState state( tracePoint );
+    for ( size_t i = 0; i < m_entryPoints.size(); ++i ) {
+        if ( m_entryPoints[i] != NoMatch && evaluate( m_entryPoints[i], state ) ) {
+            return i;
+        }
+    }
+    return NoMatch;
+}
+
+void FilterProgram::emitPath( MatchingMode matchingMode, const string &path )
+{
+    appendToSignature( "prw"[matchingMode], path );
+
+    Instruction insn;
+    if ( matchingMode == StrictMatch ) {
+        insn.opcode = PathLiteral;
+        insn.operand = m_pathLiterals.insert( path );
+    } else {
+        insn.opcode = PathPattern;
+        insn.operand = m_pathPatterns.insert( matchingMode, path );
+    }
+    insn.end = m_instructions.size() + 1;
+    m_instructions.push_back( insn );
+}
+
+void FilterProgram::emitFunction( MatchingMode matchingMode, const string &function )
+{
+    appendToSignature( "fRW"[matchingMode], function );
+
+    Instruction insn;
+    if ( matchingMode == StrictMatch ) {
+        insn.opcode = FunctionLiteral;
+        insn.operand = m_functionLiterals.insert( function );
+    } else {
+        insn.opcode = FunctionPattern;
+        insn.operand = m_functionPatterns.insert( matchingMode, function );
+    }
+    insn.end = m_instructions.size() + 1;
+    m_instructions.push_back( insn );
+}
+
+void FilterProgram::emitGroup( GroupFilter::Mode mode, const vector<string> &groups )
+{
+    m_signature += mode == GroupFilter::Whitelist ? "g(" : "G(";
+    vector<size_t> groupSet;
+    vector<string>::const_iterator it, end = groups.end();
+    for ( it = groups.begin(); it != end; ++it ) {
+        appendToSignature( 'k', *it );
+        groupSet.push_back( m_groupNames.insert( *it ) );
+    }
+    m_signature += ')';
+    sort( groupSet.begin(), groupSet.end() );
+
+    Instruction insn;
+    insn.opcode = mode == GroupFilter::Whitelist ? GroupWhitelist : GroupBlacklist;
+    insn.operand = m_groupSets.size();
+    insn.end = m_instructions.size() + 1;
+    m_groupSets.push_back( groupSet );
+    m_instructions.push_back( insn );
+}
+
+size_t FilterProgram::beginJunction( bool conjunction )
+{
+    m_signature += conjunction ? "&(" : "|(";
+    Instruction insn;
+    insn.opcode = conjunction ? And : Or;
+    insn.operand = 0;
+    insn.end = 0;
+    m_instructions.push_back( insn );
+    return m_instructions.size() - 1;
+}
+
+void FilterProgram::endJunction( size_t instruction )
+{
+    m_instructions[instruction].end = m_instructions.size();
+    m_signature += ')';
+}
+
+void FilterProgram::appendToSignature( char tag, const string &text )
+{
+    char buf[32];
+    sprintf( buf, "%c%lu:", tag, (unsigned long)text.size() );
+    m_signature += buf;
+    m_signature += text;
+}
+
+bool FilterProgram::evaluate( size_t pc, EvaluationState &state ) const
+{
+    const Instruction &insn = m_instructions[pc];
+    switch ( insn.opcode ) {
+        case And:
+            for ( size_t child = pc + 1; child < insn.end; child = m_instructions[child].end ) {
+                if ( !evaluate( child, state ) ) {
+                    return false;
+                }
+            }
+            return true;
+        case Or:
+            for ( size_t child = pc + 1; child < insn.end; child = m_instructions[child].end ) {
+                if ( evaluate( child, state ) ) {
+                    return true;
+                }
+            }
+            return false;
+        case PathLiteral:
+            if ( !state.havePathLiteral ) {
+                state.pathLiteral = m_pathLiterals.find( state.sourceFile );
+                state.havePathLiteral = true;
+            }
+            return state.pathLiteral == insn.operand;
+        case FunctionLiteral:
+            if ( !state.haveFunctionLiteral ) {
+                state.functionLiteral = m_functionLiterals.find( state.functionName );
+                state.haveFunctionLiteral = true;
+            }
+            return state.functionLiteral == insn.operand;
+        case PathPattern:
+            if ( state.pathPatternResults.empty() ) {
+                m_pathPatterns.prefilter( state.sourceFile, &state.pathPatternResults );
+            }
+            if ( state.pathPatternResults[insn.operand] == EvaluationState::Unknown ) {
+                state.pathPatternResults[insn.operand] = m_pathPatterns.matches( insn.operand, state.sourceFile ) ? 1 : 0;
+            }
+            return state.pathPatternResults[insn.operand] != 0;
+        case FunctionPattern:
+            if ( state.functionPatternResults.empty() ) {
+                m_functionPatterns.prefilter( state.functionName, &state.functionPatternResults );
+            }
+            if ( state.functionPatternResults[insn.operand] == EvaluationState::Unknown ) {
+                state.functionPatternResults[insn.operand] = m_functionPatterns.matches( insn.operand, state.functionName ) ? 1 : 0;
+            }
+            return state.functionPatternResults[insn.operand] != 0;
+        case GroupWhitelist:
+        case GroupBlacklist: {
+            if ( !state.haveGroupId ) {
+                state.groupId = m_groupNames.find( state.groupName );
+                state.haveGroupId = true;
+            }
+            const vector<size_t> &groupSet = m_groupSets[insn.operand];
+            const bool inSet = state.groupId != NoMatch &&
+                               binary_search( groupSet.begin(), groupSet.end(), state.groupId );
+            return insn.opcode == GroupWhitelist ? inSet : !inSet;
+        }
+    }
+    assert( !"Unreachable" );
+    return false;
+}
+
 TRACELIB_NAMESPACE_END
 
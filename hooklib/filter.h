@@ -22,6 +22,7 @@
 
 #include "tracelib_config.h"
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -32,6 +33,7 @@ namespace pcrecpp {
 TRACELIB_NAMESPACE_BEGIN
 
 struct TracePoint;
+class FilterProgram;
 
 class Filter
 {
@@ -39,6 +41,7 @@ public:
     virtual ~Filter();
 
     virtual bool acceptsTracePoint( const TracePoint *tracePoint ) = 0;
+    virtual void compile( FilterProgram *program ) const = 0;
 
 protected:
     Filter();
@@ -63,6 +66,7 @@ public:
     void setPath( MatchingMode matchingMode, const std::string &path );
 
     virtual bool acceptsTracePoint( const TracePoint *tracePoint );
+    virtual void compile( FilterProgram *program ) const;
 
 private:
     MatchingMode m_matchingMode;
@@ -79,6 +83,7 @@ public:
     void setFunction( MatchingMode matchingMode, const std::string &function );
 
     virtual bool acceptsTracePoint( const TracePoint *tracePoint );
+    virtual void compile( FilterProgram *program ) const;
 
 private:
     MatchingMode m_matchingMode;
@@ -99,6 +104,7 @@ public:
     void addGroupName( const std::string &group );
 
     virtual bool acceptsTracePoint( const TracePoint *tracePoint );
+    virtual void compile( FilterProgram *program ) const;
 
 private:
     Mode m_mode;
@@ -113,6 +119,7 @@ public:
     void addFilter( Filter *filter );
 
     virtual bool acceptsTracePoint( const TracePoint *tracePoint );
+    virtual void compile( FilterProgram *program ) const;
 
 private:
     std::vector<Filter *> m_filters;
@@ -126,11 +133,152 @@ public:
     void addFilter( Filter *filter );
 
     virtual bool acceptsTracePoint( const TracePoint *tracePoint );
+    virtual void compile( FilterProgram *program ) const;
 
 private:
     std::vector<Filter *> m_filters;
 };
 
+/* A set of filter trees compiled into a flat instruction array, so that
+ * evaluating them does not need any virtual calls. Literal paths, function
+ * names and trace keys are resolved with a single binary search per trace
+ * point. The literals which regular expressions and wildcards require are
+ * put into one automaton; a single pass over the path (or function name)
+ * rules out all patterns whose literal does not occur in it.
+ *
+ * A compiled program is immutable and may be used by any number of
+ * threads concurrently.
+ */
+class FilterProgram
+{
+public:
+    static const size_t NoMatch = (size_t)-1;
+
+    FilterProgram();
+    ~FilterProgram();
+
+    /* Appends a filter; the index of the first filter accepting a trace
+     * point is what match() yields. A null filter never matches. The
+     * filter is compiled immediately and not referenced afterwards.
+     */
+    void addFilter( const Filter *filter );
+    void finalize();
+
+    size_t match( const TracePoint *tracePoint ) const;
+
+    /* Identical for any two programs compiled from equivalent filters, so
+     * that results of match() may be reused across configurations.
+     */
+    const std::string &signature() const { return m_signature; }
+
+    // Used by the Filter::compile() implementations.
+    void emitPath( MatchingMode matchingMode, const std::string &path );
+    void emitFunction( MatchingMode matchingMode, const std::string &function );
+    void emitGroup( GroupFilter::Mode mode, const std::vector<std::string> &groups );
+    size_t beginJunction( bool conjunction );
+    void endJunction( size_t instruction );
+
+private:
+    FilterProgram( const FilterProgram &other );
+    void operator=( const FilterProgram &rhs );
+
+    enum Opcode {
+        And,
+        Or,
+        PathLiteral,
+        FunctionLiteral,
+        PathPattern,
+        FunctionPattern,
+        GroupWhitelist,
+        GroupBlacklist
+    };
+
+    struct Instruction {
+        Opcode opcode;
+        size_t operand;
+        size_t end; // index of the first instruction after this subtree
+    };
+
+    class StringTable
+    {
+    public:
+        explicit StringTable( bool caseSensitive );
+
+        size_t insert( const std::string &s );
+        void finalize();
+        size_t find( const char *s ) const;
+
+    private:
+        int compare( const char *a, const char *b ) const;
+
+        struct IndexLess;
+        friend struct IndexLess;
+
+        bool m_caseSensitive;
+        std::vector<std::string> m_strings;
+        std::vector<size_t> m_sortedIndices;
+        std::map<std::string, size_t> m_ids; // only needed while compiling
+    };
+
+    class PatternTable
+    {
+    public:
+        explicit PatternTable( bool caseSensitive );
+        ~PatternTable();
+
+        size_t insert( MatchingMode matchingMode, const std::string &pattern );
+        void finalize();
+
+        size_t size() const { return m_patterns.size(); }
+        void prefilter( const char *s, std::vector<signed char> *results ) const;
+        bool matches( size_t id, const char *s ) const;
+
+    private:
+        struct Pattern {
+            MatchingMode matchingMode;
+            std::string text;
+            pcrecpp::RE *rx;
+            bool prefiltered; // has a required literal in the automaton
+        };
+
+        struct State {
+            size_t failure;
+            size_t firstEdge;
+            size_t edgeCount;
+            size_t firstOutput;
+            size_t outputCount;
+        };
+
+        struct Edge {
+            unsigned char c;
+            size_t target;
+        };
+
+        size_t transition( size_t state, unsigned char c ) const;
+
+        bool m_caseSensitive;
+        std::vector<Pattern> m_patterns;
+        std::vector<State> m_states;
+        std::vector<Edge> m_edges;
+        std::vector<size_t> m_outputs; // pattern ids
+    };
+
+    struct EvaluationState;
+
+    bool evaluate( size_t pc, EvaluationState &state ) const;
+    void appendToSignature( char tag, const std::string &text );
+
+    std::vector<Instruction> m_instructions;
+    std::vector<size_t> m_entryPoints; // NoMatch for null filters
+    StringTable m_pathLiterals;
+    StringTable m_functionLiterals;
+    StringTable m_groupNames;
+    PatternTable m_pathPatterns;
+    PatternTable m_functionPatterns;
+    std::vector<std::vector<size_t> > m_groupSets; // sorted m_groupNames ids
+    std::string m_signature;
+};
+
 TRACELIB_NAMESPACE_END
 
 #endif // !defined(TRACELIB_FILTER_H)
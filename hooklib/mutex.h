@@ -25,14 +25,18 @@
 TRACELIB_NAMESPACE_BEGIN
 
 struct MutexHandle;
+struct WaitConditionHandle;
 
 class Mutex
 {
+    friend class WaitCondition;
+
 public:
     Mutex();
     ~Mutex();
 
     void lock();
+    bool tryLock();
     void unlock();
 
 private:
@@ -55,6 +59,27 @@ private:
     Mutex &m_mutex;
 };
 
+/* Lets threads sleep until another thread changes the state protected by
+ * a mutex. wait() must be called with the mutex locked; it is unlocked
+ * while waiting and locked again before returning. Spurious wakeups are
+ * possible, so callers check their condition in a loop.
+ */
+class WaitCondition
+{
+public:
+    WaitCondition();
+    ~WaitCondition();
+
+    void wait( Mutex &mutex );
+    void wakeAll();
+
+private:
+    WaitCondition( const WaitCondition &other ); // disabled
+    void operator=( const WaitCondition &rhs ); // disabled
+
+    WaitConditionHandle *m_handle;
+};
+
 TRACELIB_NAMESPACE_END
 
 #endif // !defined(TRACELIB_MUTEX_H)
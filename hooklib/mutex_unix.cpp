@@ -43,10 +43,40 @@ void Mutex::lock()
     pthread_mutex_lock( &m_handle->mutex );
 }
 
+bool Mutex::tryLock()
+{
+    return pthread_mutex_trylock( &m_handle->mutex ) == 0;
+}
+
 void Mutex::unlock()
 {
     pthread_mutex_unlock( &m_handle->mutex );
 }
 
+struct WaitConditionHandle {
+    pthread_cond_t cond;
+};
+
+WaitCondition::WaitCondition() : m_handle( new WaitConditionHandle )
+{
+    pthread_cond_init( &m_handle->cond, NULL );
+}
+
+WaitCondition::~WaitCondition()
+{
+    pthread_cond_destroy( &m_handle->cond );
+    delete m_handle;
+}
+
+void WaitCondition::wait( Mutex &mutex )
+{
+    pthread_cond_wait( &m_handle->cond, &mutex.m_handle->mutex );
+}
+
+void WaitCondition::wakeAll()
+{
+    pthread_cond_broadcast( &m_handle->cond );
+}
+
 TRACELIB_NAMESPACE_END
 
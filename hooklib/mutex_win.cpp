@@ -43,10 +43,39 @@ void Mutex::lock()
     ::EnterCriticalSection( &m_handle->section );
 }
 
+bool Mutex::tryLock()
+{
+    return ::TryEnterCriticalSection( &m_handle->section ) != FALSE;
+}
+
 void Mutex::unlock()
 {
     ::LeaveCriticalSection( &m_handle->section );
 }
 
+struct WaitConditionHandle {
+    CONDITION_VARIABLE cond;
+};
+
+WaitCondition::WaitCondition() : m_handle( new WaitConditionHandle )
+{
+    ::InitializeConditionVariable( &m_handle->cond );
+}
+
+WaitCondition::~WaitCondition()
+{
+    delete m_handle;
+}
+
+void WaitCondition::wait( Mutex &mutex )
+{
+    ::SleepConditionVariableCS( &m_handle->cond, &mutex.m_handle->section, INFINITE );
+}
+
+void WaitCondition::wakeAll()
+{
+    ::WakeAllConditionVariable( &m_handle->cond );
+}
+
 TRACELIB_NAMESPACE_END
 
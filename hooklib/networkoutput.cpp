@@ -92,9 +92,10 @@ static size_t writeTo( int fd, const char *data, const int length, Log *log )
     return (size_t)written;
 }
 
-NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port )
+NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port,
+                              const NetworkQueuePolicy &queuePolicy )
     : m_host( host ), m_port( port ), m_socket( -1 ), m_log( log ),
-    m_lastConnectionAttemptFailed( false ), d( 0 )
+    d( 0 ), m_lastConnectionAttemptFailed( false ), m_queuePolicy( queuePolicy )
 {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -144,6 +145,17 @@ void NetworkOutput::write( const vector<char> &data )
     }
 }
 
+// Data is sent right away, so there is no queue which could overflow.
+void NetworkOutput::writeEntry( const vector<char> &data, TracePointType::Value )
+{
+    write( data );
+}
+
+size_t NetworkOutput::takeDroppedEntries()
+{
+    return 0;
+}
+
 void NetworkOutput::close()
 {
 #ifdef _WIN32
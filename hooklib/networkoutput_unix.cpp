@@ -19,7 +19,9 @@
 
 #include "output.h"
 #include "log.h"
+#include "atomic.h"
 #include "eventthread_unix.h"
+#include "config.h"
 
 #include <arpa/inet.h>
 #include <string.h>
@@ -28,21 +30,112 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <time.h>
 
-#include <list>
+#include <deque>
 
 using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
 
+struct QueuedBuffer {
+    std::vector<char> data;
+    TracePointType::Value type;
+    size_t generation; // incremented whenever the stream is restarted
+    QueuedBuffer *next;
+};
+
+typedef std::deque<QueuedBuffer *> BufferList;
+
+/* Lock-free queue with any number of producers and a single consumer.
+ * Producers push onto a stack; the consumer takes the whole stack at once
+ * and reverses it, which restores the order in which buffers were pushed.
+ */
+class BufferQueue
+{
+public:
+    // Returns true if the queue was empty, i.e. the consumer needs a wakeup.
+    bool push( QueuedBuffer *buffer )
+    {
+        QueuedBuffer *head;
+        do {
+            head = m_head.load();
+            buffer->next = head;
+        } while ( !m_head.testAndSet( head, buffer ) );
+        return head == 0;
+    }
+
+    // Returns the buffers most recently pushed first
+    QueuedBuffer *takeAll()
+    {
+        return m_head.fetchAndStore( 0 );
+    }
+
+    void takeAll( BufferList &list )
+    {
+        QueuedBuffer *reversed = 0;
+        QueuedBuffer *buffer = takeAll();
+        while ( buffer ) {
+            QueuedBuffer *next = buffer->next;
+            buffer->next = reversed;
+            reversed = buffer;
+            buffer = next;
+        }
+        for ( ; reversed; reversed = reversed->next ) {
+            list.push_back( reversed );
+        }
+    }
+
+private:
+    AtomicPointer<QueuedBuffer> m_head;
+};
+
+// Buffers with lower ranks are dropped first by the DropLowSeverity policy.
+static int severityRank( TracePointType::Value type )
+{
+    switch ( type ) {
+        case TracePointType::Debug:
+            return 0;
+        case TracePointType::Watch:
+            return 1;
+        case TracePointType::Log:
+            return 2;
+        default:
+            return 3; // Error entries and data which is not an entry
+    }
+}
+
+/* Sent and dropped buffers are handed back to NetworkOutput for the next
+ * entries, so that queueing an entry doesn't allocate anything once enough
+ * buffers went around. Buffers which grew beyond this are freed instead.
+ */
+static const size_t MaximumSpareBufferSize = 64 * 1024;
+
 class NetworkOutputPrivate : public FileEventObserver {
 public:
-    typedef std::list< std::vector<char> * > BufferList;
+    // Used by NetworkOutput calling thread(s) and the event thread
+    const NetworkQueuePolicy policy;
+    BufferQueue queue;
+    WakeupChannel wakeup;
+    AtomicCounter failed;
+    AtomicCounter queuedBytes; // also counts buffers not taken from queue yet
+    AtomicCounter queuedEntries;
+    AtomicCounter dropped;
+    AtomicCounter restartRequested;
+    AtomicCounter trimRequested;
+    BufferQueue releasedBuffers;
+    bool binaryData; // set before the event thread sees the socket
+    // Signalled whenever queued data was sent or dropped
+    pthread_mutex_t spaceMutex;
+    pthread_cond_t spaceAvailable;
 
     // Only used in event thread
     BufferList buffers;
+    size_t discardedGeneration;
     string host;
     unsigned short port;
     bool notify_on_close;
@@ -68,35 +161,37 @@ public:
         Failure
     };
     NetworkOutputState network_state;
+    size_t generation;
+    size_t reportedDrops;
+    QueuedBuffer *spareBuffers;
 
-    NetworkOutputPrivate( const string h, unsigned short p, Log *log );
+    NetworkOutputPrivate( const string h, unsigned short p, Log *log,
+                          const NetworkQueuePolicy &queuePolicy );
     ~NetworkOutputPrivate();
 
+    bool isOverLimit( size_t additionalBytes, size_t additionalEntries ) const;
+
     // Only used in NetworkOutput calling thread
     void connect();
     void close();
+    void waitForSpace( size_t additionalBytes );
+    QueuedBuffer *takeSpareBuffer();
 
     // Only used in event thread
     void clear();
     void addObserver( EventContext *ctx, int watch );
     void removeObserver( EventContext *ctx, int watch );
     void endClosing( EventContext *ctx );
-    bool write( EventContext *ctx, std::vector<char>* buffer );
+    void takeQueuedBuffers( EventContext *ctx );
+    bool takeBuffers();
+    void dropBuffer( QueuedBuffer *buf );
+    void releaseBuffer( QueuedBuffer *buf );
+    void trimBuffers();
+    bool writeBuffers( int fd );
+    void signalSpaceAvailable();
     void handleEvent( EventContext*, Event *event );
 };
 
-class WriteDataTask : public Task
-{
-    NetworkOutputPrivate *observer;
-    vector<char> *data;
-public:
-    WriteDataTask( NetworkOutputPrivate *obs, vector<char> *d )
-        : observer( obs ), data( d )
-    {}
-
-    void *exec( EventContext* );
-};
-
 class SocketClosingTask : public Task
 {
     NetworkOutputPrivate *observer;
@@ -108,8 +203,12 @@ public:
 };
 
 
-NetworkOutputPrivate::NetworkOutputPrivate( const string h, unsigned short p, Log *_log )
- : host( h ),
+NetworkOutputPrivate::NetworkOutputPrivate( const string h, unsigned short p, Log *_log,
+                                            const NetworkQueuePolicy &queuePolicy )
+ : policy( queuePolicy ),
+   binaryData( false ),
+   discardedGeneration( 0 ),
+   host( h ),
    port( p ),
    notify_on_close( true ),
    m_socket( -1 ),
@@ -117,12 +216,82 @@ NetworkOutputPrivate::NetworkOutputPrivate( const string h, unsigned short p, Lo
    buf_pos( 0),
    watching( FileEvent::Error ),
    state( NotConnected ),
-   network_state( Idle )
-{}
+   network_state( Idle ),
+   generation( 1 ),
+   reportedDrops( 0 ),
+   spareBuffers( 0 )
+{
+    pthread_mutex_init( &spaceMutex, NULL );
+    pthread_cond_init( &spaceAvailable, NULL );
+}
+
+static void deleteBuffers( QueuedBuffer *buf )
+{
+    while ( buf ) {
+        QueuedBuffer *next = buf->next;
+        delete buf;
+        buf = next;
+    }
+}
 
 NetworkOutputPrivate::~NetworkOutputPrivate()
 {
     close();
+    deleteBuffers( spareBuffers );
+    deleteBuffers( releasedBuffers.takeAll() );
+    pthread_cond_destroy( &spaceAvailable );
+    pthread_mutex_destroy( &spaceMutex );
+}
+
+bool NetworkOutputPrivate::isOverLimit( size_t additionalBytes, size_t additionalEntries ) const
+{
+    return ( policy.maximumSize > 0 &&
+             queuedBytes.load() + additionalBytes > policy.maximumSize ) ||
+           ( policy.maximumEntries > 0 &&
+             queuedEntries.load() + additionalEntries > policy.maximumEntries );
+}
+
+/* Blocks until the queue has room for the given data; an entry exceeding
+ * the limits on its own is queued anyway once everything else was sent.
+ * The event thread signals whenever it sent or dropped data; the timeout
+ * merely guards against missing the signal of a failing connection.
+ */
+void NetworkOutputPrivate::waitForSpace( size_t additionalBytes )
+{
+    pthread_mutex_lock( &spaceMutex );
+    while ( queuedEntries.load() > 0 && isOverLimit( additionalBytes, 1 ) && !failed.load() ) {
+        timespec timeout;
+        clock_gettime( CLOCK_REALTIME, &timeout );
+        timeout.tv_nsec += 100 * 1000 * 1000;
+        if ( timeout.tv_nsec >= 1000 * 1000 * 1000 ) {
+            timeout.tv_nsec -= 1000 * 1000 * 1000;
+            ++timeout.tv_sec;
+        }
+        pthread_cond_timedwait( &spaceAvailable, &spaceMutex, &timeout );
+    }
+    pthread_mutex_unlock( &spaceMutex );
+}
+
+// Wakes up writers waiting for room in the queue.
+// Reuses a buffer released by the event thread if there is one
+QueuedBuffer *NetworkOutputPrivate::takeSpareBuffer()
+{
+    if ( !spareBuffers ) {
+        spareBuffers = releasedBuffers.takeAll();
+        if ( !spareBuffers ) {
+            return new QueuedBuffer;
+        }
+    }
+    QueuedBuffer *buf = spareBuffers;
+    spareBuffers = buf->next;
+    return buf;
+}
+
+void NetworkOutputPrivate::signalSpaceAvailable()
+{
+    pthread_mutex_lock( &spaceMutex );
+    pthread_cond_broadcast( &spaceAvailable );
+    pthread_mutex_unlock( &spaceMutex );
 }
 
 void NetworkOutputPrivate::connect()
@@ -134,6 +303,7 @@ void NetworkOutputPrivate::connect()
     struct hostent *he = gethostbyname( host.c_str() );
     if ( !he ) {
         log->writeError( "connect: host '%s' not found\n", host.c_str() );
+        failed.store( 1 );
         return;
     }
 
@@ -147,15 +317,18 @@ void NetworkOutputPrivate::connect()
 
     if ( ::connect( m_socket, (const sockaddr *)&server, sizeof ( server ) ) == -1 &&
             errno == EINPROGRESS ) {
+        // Set before the event thread gets to see the socket
+        state = Connecting;
         watching = FileEvent::FileReadWrite;
         EventThreadUnix::self()->postTask(
                 new AddIOObserverTask( m_socket, this, watching ) );
-
-        state = Connecting;
+        EventThreadUnix::self()->postTask(
+                new AddIOObserverTask( wakeup.fd(), this, FileEvent::FileRead ) );
     } else {
         log->writeError( "connect to %s: %s", host.c_str(), strerror( errno ) );
         ::close( m_socket );
         m_socket = -1;
+        failed.store( 1 );
     }
 }
 
@@ -171,38 +344,190 @@ void NetworkOutputPrivate::removeObserver( EventContext *ctx, int watch )
     watching &= ~watch;
 }
 
+// Moves the buffers queued by NetworkOutput::write into the list of
+// buffers to send.
+void NetworkOutputPrivate::takeQueuedBuffers( EventContext *ctx )
+{
+    wakeup.reset();
+
+    if ( !takeBuffers() ) {
+        return;
+    }
+
+    if ( state <= NotConnected || state >= Closing ) {
+        clear();
+        return;
+    }
+    if ( !( watching & FileEvent::FileWrite ) ) {
+        buf_pos = 0;
+        addObserver( ctx, FileEvent::FileWrite );
+    }
+}
+
+// Moves the queued buffers to the list of buffers to send and applies the
+// overflow policy. Returns false if there were no queued buffers.
+bool NetworkOutputPrivate::takeBuffers()
+{
+    const bool trim = trimRequested.testAndSet( 1, 0 );
+    const size_t previousCount = buffers.size();
+    queue.takeAll( buffers );
+    const bool tookBuffers = buffers.size() > previousCount;
+    if ( trim || ( discardedGeneration > 0 && tookBuffers ) ) {
+        trimBuffers();
+        signalSpaceAvailable();
+    }
+    return tookBuffers;
+}
+
+void NetworkOutputPrivate::dropBuffer( QueuedBuffer *buf )
+{
+    queuedBytes.fetchAndAdd( -buf->data.size() );
+    queuedEntries.fetchAndAdd( -1 );
+    dropped.fetchAndAdd( 1 );
+
+    /* Binary data sent later in the same stream may refer to data in the
+     * dropped buffer, so the rest of the stream has to go, too, and a new
+     * stream needs to be started.
+     */
+    if ( binaryData ) {
+        if ( buf->generation > discardedGeneration ) {
+            discardedGeneration = buf->generation;
+        }
+        restartRequested.store( 1 );
+    }
+    releaseBuffer( buf );
+}
+
+void NetworkOutputPrivate::releaseBuffer( QueuedBuffer *buf )
+{
+    if ( buf->data.capacity() > MaximumSpareBufferSize ) {
+        delete buf;
+        return;
+    }
+    releasedBuffers.push( buf );
+}
+
+/* Drops buffers until the queue is within its limits again. Buffers of
+ * binary streams which lost data are dropped in any case. The front buffer
+ * is never dropped once sending it started.
+ *
+ * Only the buffers taken from the queue so far are considered; producers
+ * which keep exceeding the limits request another trim.
+ */
+void NetworkOutputPrivate::trimBuffers()
+{
+    const bool dropOnOverflow = policy.overflowPolicy == NetworkQueuePolicy::DropOldest ||
+                                policy.overflowPolicy == NetworkQueuePolicy::DropLowSeverity;
+    const int lowestRank = policy.overflowPolicy == NetworkQueuePolicy::DropLowSeverity ? 0 : 3;
+
+    size_t bytes = 0;
+    BufferList::iterator it, end = buffers.end();
+    for ( it = buffers.begin(); it != end; ++it ) {
+        bytes += ( *it )->data.size();
+    }
+    size_t entries = buffers.size();
+
+    for ( int rank = lowestRank; rank <= 3; ++rank ) {
+        BufferList kept;
+        end = buffers.end();
+        for ( it = buffers.begin(); it != end; ++it ) {
+            QueuedBuffer *buf = *it;
+            const bool sending = it == buffers.begin() && buf_pos > 0;
+            const bool overflow = dropOnOverflow &&
+                                  ( rank == 3 || severityRank( buf->type ) == rank ) &&
+                                  ( ( policy.maximumSize > 0 && bytes > policy.maximumSize ) ||
+                                    ( policy.maximumEntries > 0 && entries > policy.maximumEntries ) );
+            if ( !sending && ( overflow || buf->generation <= discardedGeneration ) ) {
+                bytes -= buf->data.size();
+                --entries;
+                dropBuffer( buf );
+            } else {
+                kept.push_back( buf );
+            }
+        }
+        buffers.swap( kept );
+    }
+}
+
+// Sends as much of the pending buffers as the socket accepts, gathering
+// many buffers into a single writev call. Returns false on errors.
+bool NetworkOutputPrivate::writeBuffers( int fd )
+{
+    static const int MaxBuffersPerCall = 64;
+
+    bool wroteAnything = false;
+    while ( !buffers.empty() ) {
+        iovec iov[MaxBuffersPerCall];
+        int count = 0;
+        size_t requested = 0;
+        for ( BufferList::const_iterator it = buffers.begin();
+              it != buffers.end() && count < MaxBuffersPerCall; ++it, ++count ) {
+            const vector<char> &data = ( *it )->data;
+            const size_t offset = count == 0 ? buf_pos : 0;
+            iov[count].iov_base = const_cast<char *>( &data[0] ) + offset;
+            iov[count].iov_len = data.size() - offset;
+            requested += iov[count].iov_len;
+        }
+
+        ssize_t nr = ::writev( fd, iov, count );
+        if ( nr < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( nr <= 0 ) {
+            // Nothing written at all although select() claimed the socket
+            // to be writable: the connection is gone.
+            if ( wroteAnything ) {
+                signalSpaceAvailable();
+            }
+            return wroteAnything || ( nr < 0 && errno == EAGAIN );
+        }
+        wroteAnything = true;
+        const size_t written = nr;
+
+        while ( nr > 0 ) {
+            QueuedBuffer *buf = buffers.front();
+            const ssize_t remaining = buf->data.size() - buf_pos;
+            if ( nr < remaining ) {
+                buf_pos += nr;
+                break;
+            }
+            nr -= remaining;
+            queuedBytes.fetchAndAdd( -buf->data.size() );
+            queuedEntries.fetchAndAdd( -1 );
+            releaseBuffer( buf );
+            buffers.pop_front();
+            buf_pos = 0;
+        }
+
+        if ( written < requested ) {
+            break; // socket buffer is full
+        }
+    }
+    if ( wroteAnything ) {
+        signalSpaceAvailable();
+    }
+    return true;
+}
+
 void NetworkOutputPrivate::handleEvent( EventContext *ctx, Event *event )
 {
     if ( event->eventType() == Event::FileEventType ) {
         FileEvent *fe = (FileEvent *)event;
-        if ( FileEvent::FileWrite == fe->watch ) {
+        if ( fe->fd == wakeup.fd() ) {
+            if ( FileEvent::FileRead == fe->watch ) {
+                takeQueuedBuffers( ctx );
+            }
+        } else if ( FileEvent::FileWrite == fe->watch ) {
             if ( Connecting == state ) {
                 state = Connected;
                 removeObserver( ctx, FileEvent::FileRead );
             }
-            if ( buffers.size() ) {
-                int total_written = 0;
-                BufferList::iterator e = buffers.end();
-                for ( BufferList::iterator it = buffers.begin(); it != e; ) {
-                    vector<char> *buf = *it;
-
-                    int nr = ::write( fe->fd, &(*buf)[0] + buf_pos, buf->size() - buf_pos );
-                    if ( nr <= 0 )
-                        break;
-
-                    total_written += nr;
-                    buf_pos += nr;
-                    if ( buf_pos != (ssize_t)buf->size() )
-                        break;
-
-                    delete buf;
-                    it = buffers.erase( it );
-                    buf_pos = 0;
-                }
-                if ( !total_written ) {
-                    clear(); // clears buffers, FileWrite observer below removed
-                    state = Error;
-                }
+            // Pick up whatever was queued meanwhile so that it goes out
+            // in the same writev call.
+            takeBuffers();
+            if ( buffers.size() && !writeBuffers( fe->fd ) ) {
+                clear(); // clears buffers, FileWrite observer below removed
+                state = Error;
             }
             if ( buffers.size() == 0 ) {
                 removeObserver( ctx, FileEvent::FileWrite );
@@ -232,20 +557,6 @@ void NetworkOutputPrivate::handleEvent( EventContext *ctx, Event *event )
     }
 }
 
-bool NetworkOutputPrivate::write( EventContext *ctx, std::vector<char>* buffer )
-{
-    if ( state > NotConnected && state < Closing ) {
-        buffers.push_back( buffer );
-        if ( !(watching & FileEvent::FileWrite ) ) {
-            buf_pos = 0;
-            addObserver( ctx, FileEvent::FileWrite );
-        }
-        return true;
-    }
-    delete buffer;
-    return false;
-}
-
 void NetworkOutputPrivate::close()
 {
     if ( EventThreadUnix::self()->threadId() == getCurrentThreadId() ) {
@@ -255,6 +566,7 @@ void NetworkOutputPrivate::close()
         SocketClosingTask( this ).exec( ctx );
         while (NetworkOutputPrivate::Connected == state )
             EventThreadUnix::processEvents( ctx );
+        RemoveIOObserverTask( wakeup.fd(), this, FileEvent::FileRead ).exec( ctx );
         notify_on_close = old_notify_on_close;
     } else {
         EventThreadUnix::self()->postTask( new SocketClosingTask( this ) );
@@ -266,6 +578,9 @@ void NetworkOutputPrivate::close()
         read( in, &response, sizeof ( response ) );
 
         clear();
+
+        // Lets the event thread end if nothing else needs it anymore
+        RemoveIOObserverTask( wakeup.fd(), this, FileEvent::FileRead ).checkForLast();
     }
 }
 
@@ -289,29 +604,37 @@ void NetworkOutputPrivate::endClosing( EventContext *ctx )
 
 void NetworkOutputPrivate::clear()
 {
+    // Makes NetworkOutput stop queueing data
+    failed.store( 1 );
+
     if ( m_socket > -1 ) {
         ::close( m_socket );
         m_socket = -1;
         state = NotConnected;
     }
+    queue.takeAll( buffers );
     BufferList::iterator e = buffers.end();
-    for ( BufferList::iterator it = buffers.begin(); it != e; ) {
-        delete *it;
-        it = buffers.erase( it );
+    for ( BufferList::iterator it = buffers.begin(); it != e; ++it ) {
+        queuedBytes.fetchAndAdd( -( *it )->data.size() );
+        queuedEntries.fetchAndAdd( -1 );
+        releaseBuffer( *it );
     }
-}
-
-
-void *WriteDataTask::exec( EventContext *ctx )
-{
-    return observer->write( ctx, data )
-        ? (void*)(long)NetworkOutputPrivate::Opened
-        : (void*)(long)NetworkOutputPrivate::Failure;
+    // Never sent, so they count as dropped like those dropped by the policy
+    if ( !buffers.empty() ) {
+        dropped.fetchAndAdd( buffers.size() );
+        if ( binaryData ) {
+            restartRequested.store( 1 );
+        }
+    }
+    buffers.clear();
+    signalSpaceAvailable();
 }
 
 
 void *SocketClosingTask::exec( EventContext *ctx )
 {
+    // Everything queued before closing still needs to be sent
+    observer->takeQueuedBuffers( ctx );
     if ( observer->buffers.size() > 0 ) {
         // try for 10s to flush remaining buffers
         observer->state = NetworkOutputPrivate::Closing;
@@ -323,9 +646,11 @@ void *SocketClosingTask::exec( EventContext *ctx )
 }
 
 
-NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port )
+NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port,
+                              const NetworkQueuePolicy &queuePolicy )
     : m_host( host ), m_port( port ), m_socket( -1 ), m_log( log ),
-    d( new NetworkOutputPrivate( host, port, log ) )
+    d( new NetworkOutputPrivate( host, port, log, queuePolicy ) ),
+    m_queuePolicy( queuePolicy )
 {
 }
 
@@ -336,28 +661,81 @@ NetworkOutput::~NetworkOutput()
 
 bool NetworkOutput::open()
 {
-    if ( d->network_state == NetworkOutputPrivate::Idle )
+    if ( d->network_state == NetworkOutputPrivate::Idle ) {
+        d->binaryData = isBinaryData();
         d->connect();
+    }
+
+    // Data was dropped; the caller starts a new stream from here on.
+    if ( d->restartRequested.testAndSet( 1, 0 ) ) {
+        ++d->generation;
+    }
 
     return NetworkOutputPrivate::Opened == d->network_state;
 }
 
 bool NetworkOutput::canWrite() const
 {
-    return NetworkOutputPrivate::Opened == d->network_state;
-    //return d->m_socket != -1;
+    return NetworkOutputPrivate::Opened == d->network_state && !d->failed.load() &&
+           !d->restartRequested.load();
 }
 
 void NetworkOutput::write( const vector<char> &data )
 {
-    if ( NetworkOutputPrivate::Opened == d->network_state ) {
-        vector<char> *buf = new vector<char>( data );
-        //buf->swap( data );
-        WriteDataTask task( d, buf );
-        d->network_state =
-            (NetworkOutputPrivate::NetworkOutputState)(long)
-            EventThreadUnix::self()->sendTask( &task );
+    writeEntry( data, TracePointType::None );
+}
+
+/* Hands the data to the event thread without waiting for it; the event
+ * thread is only woken up if it is not busy with earlier data anyway, or
+ * if it needs to make room in the queue.
+ */
+void NetworkOutput::writeEntry( const vector<char> &data, TracePointType::Value type )
+{
+    if ( NetworkOutputPrivate::Opened != d->network_state || data.empty() ) {
+        return;
+    }
+    if ( d->failed.load() ) {
+        d->network_state = NetworkOutputPrivate::Failure;
+        return;
     }
+
+    bool trim = false;
+    if ( d->isOverLimit( data.size(), 1 ) ) {
+        switch ( m_queuePolicy.overflowPolicy ) {
+            case NetworkQueuePolicy::Block:
+                d->waitForSpace( data.size() );
+                break;
+            case NetworkQueuePolicy::DropNewest:
+                d->dropped.fetchAndAdd( 1 );
+                if ( isBinaryData() ) {
+                    // Later entries might refer to data of this one.
+                    d->restartRequested.store( 1 );
+                }
+                return;
+            case NetworkQueuePolicy::DropOldest:
+            case NetworkQueuePolicy::DropLowSeverity:
+                trim = d->trimRequested.testAndSet( 0, 1 );
+                break;
+        }
+    }
+
+    QueuedBuffer *buf = d->takeSpareBuffer();
+    buf->data.assign( data.begin(), data.end() );
+    buf->type = type;
+    buf->generation = d->generation;
+    d->queuedBytes.fetchAndAdd( data.size() );
+    d->queuedEntries.fetchAndAdd( 1 );
+    if ( d->queue.push( buf ) || trim ) {
+        d->wakeup.wake();
+    }
+}
+
+size_t NetworkOutput::takeDroppedEntries()
+{
+    const size_t dropped = d->dropped.load();
+    const size_t delta = dropped - d->reportedDrops;
+    d->reportedDrops = dropped;
+    return delta;
 }
 
 void NetworkOutput::close()
@@ -19,16 +19,22 @@
 
 #include "output.h"
 #include "log.h"
+#include "atomic.h"
+#include "filerotator.h"
+#include "thread.h"
+#include "timehelper.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sstream>
 
 using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
 
 Output::Output()
+    : m_binaryData( false )
 {
 }
 
@@ -36,51 +42,258 @@ Output::~Output()
 {
 }
 
+void Output::writeEntry( const vector<char> &data, TracePointType::Value )
+{
+    write( data );
+}
+
 void StdoutOutput::write( const vector<char> &data )
 {
-    vector<char> nullTerminatedData = data;
-    nullTerminatedData.push_back( '\0' );
-    fprintf(stdout, "%s\n", &nullTerminatedData[0]);
+    if ( !data.empty() ) {
+        fwrite( &data[0], 1, data.size(), stdout );
+    }
+    if ( !isBinaryData() ) {
+        fputc( '\n', stdout );
+    }
     fflush(stdout);
 }
 
-FileOutput::FileOutput( Log *log, const string& filename )
-    : m_filename( filename ), m_file( 0 ), m_log( log )
+/* Writes out buffered data of a FileOutput once it is older than the
+ * configured flush interval, so that a quiet application does not leave
+ * entries sitting in the buffer indefinitely.
+ */
+class FileFlusher : private Thread
+{
+public:
+    explicit FileFlusher( FileOutput *output );
+    virtual ~FileFlusher();
+
+    using Thread::start;
+
+protected:
+    virtual void run();
+
+private:
+    FileOutput *m_output;
+    AtomicCounter m_running;
+};
+
+FileFlusher::FileFlusher( FileOutput *output )
+    : m_output( output )
+{
+    m_running.store( 1 );
+}
+
+FileFlusher::~FileFlusher()
 {
+    m_running.store( 0 );
+    wait();
 }
 
-FileOutput::~FileOutput()
+void FileFlusher::run()
 {
-    if( m_file ) {
-        fclose(m_file);
+    // Sleep in short slices so that shutting down does not have to wait
+    // for a long flush interval to pass.
+    const unsigned int slice = m_output->m_flushPolicy.flushInterval < 100
+                             ? m_output->m_flushPolicy.flushInterval
+                             : 100;
+    while ( m_running.load() ) {
+        Thread::sleep( slice );
+        m_output->flushExpiredBuffer();
     }
-    m_file = 0;
+}
+
+FileOutput::FileOutput( Log *log, const string& filename, const FileFlushPolicy &flushPolicy,
+                        const FileRotationPolicy &rotationPolicy )
+    : m_filename( filename ),
+    m_fd( -1 ),
+    m_log( log ),
+    m_flushPolicy( flushPolicy ),
+    m_lastFlushTime( 0 ),
+    m_flusher( 0 ),
+    m_rotationPolicy( rotationPolicy ),
+    m_fileSize( 0 ),
+    m_openTime( 0 ),
+    m_segmentCount( 0 ),
+    m_rotator( 0 )
+{
+    if ( m_flushPolicy.flushInterval > 0 && m_flushPolicy.bufferSize == 0 ) {
+        m_flushPolicy.bufferSize = DefaultBufferSize;
+    }
+    m_buffer.reserve( m_flushPolicy.bufferSize );
+}
+
+FileOutput::~FileOutput()
+{
+    delete m_flusher;
+    flush();
+    closeFile();
+    delete m_rotator;
     m_filename = "";
     m_log = 0;
 }
 
+// rotate() closes the file from whichever thread writes the entry due for it.
 bool FileOutput::canWrite() const
 {
-    return m_file != 0;
+    MutexLocker locker( m_bufferMutex );
+    return m_fd != -1;
 }
 
 bool FileOutput::open()
 {
-    m_file = fopen( m_filename.c_str(), "w" );
-    if( !m_file ) {
-        m_log->writeError( "Failed to open file!: %s", strerror( errno ) );
-        return false;
+    {
+        MutexLocker locker( m_bufferMutex );
+        if ( !openFile( true ) ) {
+            m_log->writeError( "Failed to open file!: %s", strerror( errno ) );
+            return false;
+        }
+        m_lastFlushTime = m_openTime = now();
+        m_fileSize = 0;
+    }
+    if ( m_rotationPolicy.isEnabled() && !m_rotator ) {
+        m_rotator = new FileRotator( m_log, m_filename, m_rotationPolicy.generations,
+                                     m_rotationPolicy.compress );
+        if ( !m_rotator->start() ) {
+            m_log->writeError( "Failed to start rotation thread for file %s; rotating "
+                               "files will block the application", m_filename.c_str() );
+        }
+    }
+    if ( m_flushPolicy.flushInterval > 0 && !m_flusher ) {
+        m_flusher = new FileFlusher( this );
+        if ( !m_flusher->start() ) {
+            m_log->writeError( "Failed to start flush thread for file %s; buffered "
+                               "data is only written once %u bytes were collected",
+                               m_filename.c_str(), (unsigned int)m_flushPolicy.bufferSize );
+        }
     }
     return true;
 }
 
 void FileOutput::write( const vector<char> &data )
 {
-    if( m_file ) {
-        vector<char> nullTerminatedData = data;
-        nullTerminatedData.push_back( '\0' );
-        fprintf( m_file, "%s\n", &nullTerminatedData[0] );
-        fflush( m_file );
+    MutexLocker locker( m_bufferMutex );
+    if ( m_fd == -1 ) {
+        return;
+    }
+
+    const bool appendNewline = !isBinaryData();
+    const size_t size = data.size() + ( appendNewline ? 1 : 0 );
+    if ( m_buffer.size() + size <= m_flushPolicy.bufferSize ) {
+        m_buffer.insert( m_buffer.end(), data.begin(), data.end() );
+        if ( appendNewline ) {
+            m_buffer.push_back( '\n' );
+        }
+        if ( m_buffer.size() == m_flushPolicy.bufferSize ) {
+            writeBuffer( 0, 0 );
+        }
+    } else {
+        // The entry does not fit anymore; write the buffered data and the new
+        // entry in one go instead of copying the entry into the buffer first.
+        writeBuffer( data.empty() ? 0 : &data[0], data.size() );
+    }
+
+    if ( rotationDue() ) {
+        rotate();
+    }
+}
+
+// Requires m_bufferMutex to be locked.
+bool FileOutput::rotationDue() const
+{
+    if ( m_rotationPolicy.maximumSize > 0 &&
+         m_fileSize + m_buffer.size() >= m_rotationPolicy.maximumSize ) {
+        return true;
+    }
+    if ( m_rotationPolicy.maximumAge > 0 &&
+         now() - m_openTime >= (uint64_t)m_rotationPolicy.maximumAge * 1000 ) {
+        return true;
+    }
+    return false;
+}
+
+/* Completes the current file and hands it to the rotator thread. Only the
+ * rename happens here, compressing and shifting older generations is done
+ * in the background. Afterwards canWrite() returns false, which makes the
+ * trace reopen the output and start a new stream; that way every file is
+ * complete in itself. Requires m_bufferMutex to be locked.
+ */
+void FileOutput::rotate()
+{
+    if ( !m_buffer.empty() ) {
+        writeBuffer( 0, 0 );
+    }
+    closeFile();
+
+    ostringstream str;
+    str << m_filename << ".rotating." << ++m_segmentCount;
+    const string segmentFileName = str.str();
+    if ( rename( m_filename.c_str(), segmentFileName.c_str() ) != 0 ) {
+        m_log->writeError( "Failed to rotate file %s: %s; disabling rotation", m_filename.c_str(), strerror( errno ) );
+        m_rotationPolicy.maximumSize = 0;
+        m_rotationPolicy.maximumAge = 0;
+        openFile( false );
+        return;
+    }
+    m_rotator->addSegment( segmentFileName );
+}
+
+// Writes out the buffer contents, followed by the given data (and a
+// newline for text data). Requires m_bufferMutex to be locked.
+void FileOutput::writeBuffer( const char *data, size_t size )
+{
+    static const char newline = '\n';
+
+    Chunk chunks[3];
+    int count = 0;
+    if ( !m_buffer.empty() ) {
+        chunks[count].data = &m_buffer[0];
+        chunks[count].size = m_buffer.size();
+        ++count;
+    }
+    if ( data ) {
+        chunks[count].data = data;
+        chunks[count].size = size;
+        ++count;
+        if ( !isBinaryData() ) {
+            chunks[count].data = &newline;
+            chunks[count].size = 1;
+            ++count;
+        }
+    }
+
+    if ( count > 0 && !writeChunks( chunks, count ) ) {
+        m_log->writeError( "Failed to write to file %s: %s", m_filename.c_str(), strerror( errno ) );
+    }
+    for ( int i = 0; i < count; ++i ) {
+        m_fileSize += chunks[i].size;
+    }
+    m_buffer.clear();
+    m_lastFlushTime = now();
+}
+
+void FileOutput::flushExpiredBuffer()
+{
+    MutexLocker locker( m_bufferMutex );
+    if ( m_fd != -1 && !m_buffer.empty() &&
+         now() - m_lastFlushTime >= m_flushPolicy.flushInterval ) {
+        writeBuffer( 0, 0 );
+    }
+}
+
+void FileOutput::flush()
+{
+    MutexLocker locker( m_bufferMutex );
+    if ( m_fd != -1 && !m_buffer.empty() ) {
+        writeBuffer( 0, 0 );
+    }
+}
+
+void FileOutput::writeEntry( const vector<char> &data, TracePointType::Value type )
+{
+    write( data );
+    if ( type == TracePointType::Error && m_flushPolicy.flushOnError ) {
+        flush();
     }
 }
 
@@ -97,6 +310,41 @@ void MultiplexingOutput::write( const vector<char> &data )
     }
 }
 
+void MultiplexingOutput::writeEntry( const vector<char> &data, TracePointType::Value type )
+{
+    vector<Output *>::const_iterator it, end = m_outputs.end();
+    for ( it = m_outputs.begin(); it != end; ++it ) {
+        ( *it )->writeEntry( data, type );
+    }
+}
+
+void MultiplexingOutput::flush()
+{
+    vector<Output *>::const_iterator it, end = m_outputs.end();
+    for ( it = m_outputs.begin(); it != end; ++it ) {
+        ( *it )->flush();
+    }
+}
+
+size_t MultiplexingOutput::takeDroppedEntries()
+{
+    size_t dropped = 0;
+    vector<Output *>::const_iterator it, end = m_outputs.end();
+    for ( it = m_outputs.begin(); it != end; ++it ) {
+        dropped += ( *it )->takeDroppedEntries();
+    }
+    return dropped;
+}
+
+void MultiplexingOutput::setBinaryData( bool binaryData )
+{
+    Output::setBinaryData( binaryData );
+    vector<Output *>::const_iterator it, end = m_outputs.end();
+    for ( it = m_outputs.begin(); it != end; ++it ) {
+        ( *it )->setBinaryData( binaryData );
+    }
+}
+
 MultiplexingOutput::~MultiplexingOutput()
 {
     vector<Output *>::const_iterator it, end = m_outputs.end();
@@ -21,6 +21,9 @@
 #define TRACELIB_OUTPUT_H
 
 #include "tracelib_config.h"
+#include "config.h" // for uint64_t
+#include "mutex.h"
+#include "tracepoint.h"
 
 #include <stdio.h>
 #include <string>
@@ -30,6 +33,8 @@ TRACELIB_NAMESPACE_BEGIN
 
 class Log;
 class NetworkOutputPrivate;
+class FileFlusher;
+class FileRotator;
 
 class Output
 {
@@ -40,12 +45,37 @@ public:
     virtual bool canWrite() const { return true; }
     virtual void write( const std::vector<char> &data ) = 0;
 
+    /* Used for the data of trace entries (as opposed to e.g. the shutdown
+     * event) so that outputs can take the type of the trace point into
+     * account.
+     */
+    virtual void writeEntry( const std::vector<char> &data, TracePointType::Value type );
+
+    /* Outputs which buffer data internally write it out when flush() is
+     * called.
+     */
+    virtual void flush() { }
+
+    /* Outputs which may have to discard trace entries return the number
+     * of entries discarded since the last call.
+     */
+    virtual size_t takeDroppedEntries() { return 0; }
+
+    /* Text outputs terminate each written chunk with a newline, which
+     * would corrupt the data of binary serializers.
+     */
+    virtual void setBinaryData( bool binaryData ) { m_binaryData = binaryData; }
+
 protected:
     Output();
 
+    bool isBinaryData() const { return m_binaryData; }
+
 private:
     Output( const Output &rhs );
     void operator=( const Output &other );
+
+    bool m_binaryData;
 };
 
 class StdoutOutput : public Output
@@ -54,17 +84,88 @@ public:
     virtual void write( const std::vector<char> &data );
 };
 
+struct FileFlushPolicy
+{
+    FileFlushPolicy() : bufferSize( 0 ), flushInterval( 0 ), flushOnError( true ) { }
+
+    // Number of bytes to collect before writing them out; 0 means that
+    // every entry is written right away (unless flushInterval is set).
+    size_t bufferSize;
+
+    // Maximum number of milliseconds buffered data is held back; 0 means
+    // that there is no time limit.
+    unsigned int flushInterval;
+
+    // Write out buffered data right after an Error trace point was hit.
+    bool flushOnError;
+};
+
+struct FileRotationPolicy
+{
+    FileRotationPolicy() : maximumSize( 0 ), maximumAge( 0 ), generations( 5 ), compress( false ) { }
+
+    bool isEnabled() const { return maximumSize > 0 || maximumAge > 0; }
+
+    // Start a new file once the current one reached this many bytes;
+    // 0 means that there is no size limit.
+    uint64_t maximumSize;
+
+    // Start a new file once the current one is this many seconds old;
+    // 0 means that there is no age limit.
+    unsigned int maximumAge;
+
+    // Number of completed files to keep around.
+    unsigned int generations;
+
+    // gzip-compress completed files.
+    bool compress;
+};
+
 class FileOutput : public Output
 {
+    friend class FileFlusher;
+
+    struct Chunk {
+        const char *data;
+        size_t size;
+    };
+
     std::string m_filename;
-    FILE* m_file;
+    int m_fd;
     Log *m_log;
+    FileFlushPolicy m_flushPolicy;
+    std::vector<char> m_buffer;
+    uint64_t m_lastFlushTime;
+    mutable Mutex m_bufferMutex; // protects m_fd, m_buffer and m_lastFlushTime
+    FileFlusher *m_flusher;
+    FileRotationPolicy m_rotationPolicy;
+    uint64_t m_fileSize;
+    uint64_t m_openTime;
+    unsigned int m_segmentCount;
+    FileRotator *m_rotator;
+
+    // Implemented in the platform specific fileoutput_*.cpp files.
+    bool openFile( bool truncate );
+    void closeFile();
+    bool writeChunks( Chunk *chunks, int count );
+
+    void writeBuffer( const char *data, size_t size );
+    void flushExpiredBuffer();
+    bool rotationDue() const;
+    void rotate();
+
 public:
-    FileOutput( Log *erroLog, const std::string& filename );
+    static const size_t DefaultBufferSize = 65536;
+
+    FileOutput( Log *erroLog, const std::string& filename,
+                const FileFlushPolicy &flushPolicy = FileFlushPolicy(),
+                const FileRotationPolicy &rotationPolicy = FileRotationPolicy() );
     virtual ~FileOutput();
     virtual void write( const std::vector<char> &data );
     virtual bool open();
     virtual bool canWrite() const;
+    virtual void writeEntry( const std::vector<char> &data, TracePointType::Value type );
+    virtual void flush();
 };
 
 class MultiplexingOutput : public Output
@@ -75,11 +176,75 @@ public:
     void addOutput( Output *output );
 
     virtual void write( const std::vector<char> &data );
+    virtual void writeEntry( const std::vector<char> &data, TracePointType::Value type );
+    virtual void flush();
+    virtual size_t takeDroppedEntries();
+    virtual void setBinaryData( bool binaryData );
 
 private:
     std::vector<Output *> m_outputs;
 };
 
+/* Flight recorder: keeps the most recent trace data in a fixed-size,
+ * memory-mapped file which is used as a circular buffer (see
+ * ringbufferformat.h). Writing does not involve any system calls, and
+ * since the operating system owns the mapped pages the data survives a
+ * crash of the process.
+ */
+class RingBufferOutput : public Output
+{
+    std::string m_filename;
+    uint64_t m_capacity;
+    Log *m_log;
+    char *m_data;
+    uint64_t m_streamStart;
+    bool m_streamStartPending;
+    bool m_restartRequested;
+    bool m_reportedOversizedEntry;
+
+    // Implemented in the platform specific ringbufferoutput_*.cpp files.
+    bool mapFile();
+    void unmapFile();
+
+    char *reserve( uint64_t span, uint64_t *position );
+
+public:
+    static const uint64_t DefaultSize = 4 * 1024 * 1024;
+    static const uint64_t MinimumSize = 4096;
+
+    RingBufferOutput( Log *log, const std::string &filename, uint64_t size = DefaultSize );
+    virtual ~RingBufferOutput();
+
+    virtual bool open();
+    virtual bool canWrite() const;
+    virtual void write( const std::vector<char> &data );
+};
+
+struct NetworkQueuePolicy
+{
+    enum OverflowPolicy {
+        Block,
+        DropNewest,
+        DropOldest,
+        DropLowSeverity
+    };
+
+    static const size_t DefaultMaximumSize = 16 * 1024 * 1024;
+
+    NetworkQueuePolicy() : maximumSize( DefaultMaximumSize ), maximumEntries( 0 ), overflowPolicy( DropOldest ) { }
+
+    // Number of bytes which may be waiting to be sent; 0 means that there
+    // is no limit.
+    size_t maximumSize;
+
+    // Number of entries which may be waiting to be sent; 0 means that
+    // there is no limit.
+    size_t maximumEntries;
+
+    // What to do with new entries while the queue is full.
+    OverflowPolicy overflowPolicy;
+};
+
 class NetworkOutput : public Output
 {
     std::string m_host;
@@ -88,16 +253,20 @@ class NetworkOutput : public Output
     Log *m_log;
     NetworkOutputPrivate *d;
     bool m_lastConnectionAttemptFailed;
+    NetworkQueuePolicy m_queuePolicy;
 
     void close();
 
 public:
-    NetworkOutput( Log *log, const std::string &remoteHost, unsigned short remotePort );
+    NetworkOutput( Log *log, const std::string &remoteHost, unsigned short remotePort,
+                   const NetworkQueuePolicy &queuePolicy = NetworkQueuePolicy() );
     virtual ~NetworkOutput();
 
     virtual bool open();
     virtual bool canWrite() const;
     virtual void write( const std::vector<char> &data );
+    virtual void writeEntry( const std::vector<char> &data, TracePointType::Value type );
+    virtual size_t takeDroppedEntries();
 };
 
 TRACELIB_NAMESPACE_END
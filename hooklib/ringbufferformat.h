@@ -0,0 +1,97 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_RINGBUFFERFORMAT_H
+#define TRACELIB_RINGBUFFERFORMAT_H
+
+#include "tracelib_config.h"
+#include "config.h" // for uint64_t
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* Layout of the memory-mapped files written by RingBufferOutput and read
+ * by ringbuffer2trace. All integers are in the byte order of the machine
+ * which wrote the file.
+ *
+ * The file starts with a FileHeader, followed by 'capacity' bytes of data
+ * which are used as a circular buffer. Positions are counted in bytes
+ * written since the file was created; a position p is stored at offset
+ * FileHeaderSize + p % capacity. 'head' is the position at which the next
+ * record will be stored.
+ *
+ * Records start at positions aligned to RecordAlignment and never wrap
+ * around the end of the data area; if a record does not fit anymore, the
+ * rest of the data area is covered by a padding record (or left alone if
+ * it is too small to even hold a record header). Each record consists of a
+ * RecordHeader and 'size' bytes of output data. The header's 'flags' are
+ * written last: a record without the Committed flag is incomplete. The
+ * 'position' field repeats the record's own position, which allows finding
+ * the oldest record which has not been overwritten yet.
+ *
+ * A StreamStart record is the first one written after the output was
+ * (re)opened; for binary data, the serializer starts a new stream with it.
+ */
+namespace RingBufferFormat
+{
+
+static const unsigned int Magic = 0x42524c54; // "TLRB"
+static const unsigned int Version = 1;
+
+enum FileFlags {
+    BinaryData = 0x1
+};
+
+struct FileHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int flags;
+    unsigned int headerSize;
+    uint64_t capacity;
+    uint64_t head;
+    char reserved[32];
+};
+
+static const unsigned int FileHeaderSize = 64;
+
+enum RecordFlags {
+    Committed = 0x1,
+    StreamStart = 0x2,
+    Padding = 0x4
+};
+
+struct RecordHeader {
+    unsigned int size;
+    unsigned int flags;
+    uint64_t position;
+};
+
+static const unsigned int RecordHeaderSize = 16;
+static const unsigned int RecordAlignment = 8;
+
+inline uint64_t recordSpan( uint64_t dataSize )
+{
+    return ( RecordHeaderSize + dataSize + RecordAlignment - 1 ) & ~(uint64_t)( RecordAlignment - 1 );
+}
+
+}
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_RINGBUFFERFORMAT_H)
+
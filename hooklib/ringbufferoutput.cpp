@@ -0,0 +1,159 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+#include "log.h"
+#include "atomic.h"
+#include "ringbufferformat.h"
+
+#include <string.h>
+#include <errno.h>
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+using namespace RingBufferFormat;
+
+RingBufferOutput::RingBufferOutput( Log *log, const string &filename, uint64_t size )
+    : m_filename( filename ),
+    m_capacity( size & ~(uint64_t)( RecordAlignment - 1 ) ),
+    m_log( log ),
+    m_data( 0 ),
+    m_streamStart( 0 ),
+    m_streamStartPending( true ),
+    m_restartRequested( false ),
+    m_reportedOversizedEntry( false )
+{
+    if ( m_capacity < MinimumSize ) {
+        m_capacity = MinimumSize;
+    }
+}
+
+RingBufferOutput::~RingBufferOutput()
+{
+    unmapFile();
+}
+
+bool RingBufferOutput::canWrite() const
+{
+    return m_data && !m_restartRequested;
+}
+
+bool RingBufferOutput::open()
+{
+    if ( !m_data ) {
+        if ( !mapFile() ) {
+            m_log->writeError( "Failed to map ring buffer file %s: %s", m_filename.c_str(), strerror( errno ) );
+            return false;
+        }
+
+        FileHeader *header = reinterpret_cast<FileHeader *>( m_data );
+        header->version = Version;
+        header->flags = isBinaryData() ? BinaryData : 0;
+        header->headerSize = FileHeaderSize;
+        header->capacity = m_capacity;
+        header->head = 0;
+        atomicStore32( &header->magic, Magic );
+    }
+
+    // The caller starts a new stream with the next record.
+    m_streamStartPending = true;
+    m_restartRequested = false;
+    return true;
+}
+
+// Claims space for a record of the given span in the buffer, covering the
+// end of the data area with a padding record if the span does not fit.
+char *RingBufferOutput::reserve( uint64_t span, uint64_t *position )
+{
+    FileHeader *header = reinterpret_cast<FileHeader *>( m_data );
+    uint64_t head, padding;
+    do {
+        head = atomicLoad64( &header->head );
+        const uint64_t offset = head % m_capacity;
+        padding = offset + span > m_capacity ? m_capacity - offset : 0;
+    } while ( !atomicTestAndSet64( &header->head, head, head + padding + span ) );
+
+    if ( padding >= RecordHeaderSize ) {
+        RecordHeader *paddingRecord = reinterpret_cast<RecordHeader *>( m_data + FileHeaderSize + head % m_capacity );
+        paddingRecord->size = (unsigned int)( padding - RecordHeaderSize );
+        paddingRecord->position = head;
+        atomicStore32( &paddingRecord->flags, Committed | Padding );
+    }
+
+    *position = head + padding;
+    return m_data + FileHeaderSize + *position % m_capacity;
+}
+
+void RingBufferOutput::write( const vector<char> &data )
+{
+    if ( !m_data ) {
+        return;
+    }
+
+    const bool appendNewline = !isBinaryData();
+    const uint64_t size = data.size() + ( appendNewline ? 1 : 0 );
+    const uint64_t span = recordSpan( size );
+
+    // Entries which would displace half of the buffer at once are not worth it.
+    if ( span > m_capacity / 2 ) {
+        if ( !m_reportedOversizedEntry ) {
+            m_log->writeError( "Dropping trace entry of %lu bytes; it does not fit into ring buffer %s",
+                               (unsigned long)size, m_filename.c_str() );
+            m_reportedOversizedEntry = true;
+        }
+        return;
+    }
+
+    uint64_t position;
+    char *p = reserve( span, &position );
+
+    // Mark the record as incomplete before touching anything else, the
+    // space might still contain a committed record from an earlier round.
+    RecordHeader *record = reinterpret_cast<RecordHeader *>( p );
+    atomicStore32( &record->flags, 0 );
+    record->size = (unsigned int)size;
+    record->position = position;
+    if ( !data.empty() ) {
+        memcpy( p + RecordHeaderSize, &data[0], data.size() );
+    }
+    if ( appendNewline ) {
+        p[RecordHeaderSize + data.size()] = '\n';
+    }
+
+    unsigned int flags = Committed;
+    if ( m_streamStartPending ) {
+        flags |= StreamStart;
+        m_streamStart = position;
+        m_streamStartPending = false;
+    }
+    atomicStore32( &record->flags, flags );
+
+    /* Binary streams refer to data sent at the beginning of the stream. Ask
+     * for a new stream well before the last stream start is overwritten, so
+     * that the buffer always contains a stream which can be decoded.
+     */
+    if ( isBinaryData() && position + span - m_streamStart > m_capacity / 2 ) {
+        m_restartRequested = true;
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
@@ -0,0 +1,69 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+#include "ringbufferformat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+bool RingBufferOutput::mapFile()
+{
+    const int fd = ::open( m_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666 );
+    if ( fd == -1 ) {
+        return false;
+    }
+
+    // Truncating first makes sure the data area is all zeroes.
+    const off_t fileSize = RingBufferFormat::FileHeaderSize + m_capacity;
+    if ( ftruncate( fd, fileSize ) == -1 ) {
+        const int error = errno;
+        ::close( fd );
+        errno = error;
+        return false;
+    }
+
+    void *p = mmap( 0, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    const int error = errno;
+    // The mapping keeps the file open
+    ::close( fd );
+    if ( p == MAP_FAILED ) {
+        errno = error;
+        return false;
+    }
+    m_data = static_cast<char *>( p );
+    return true;
+}
+
+void RingBufferOutput::unmapFile()
+{
+    if ( m_data ) {
+        munmap( m_data, RingBufferFormat::FileHeaderSize + m_capacity );
+        m_data = 0;
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
@@ -0,0 +1,66 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+#include "ringbufferformat.h"
+
+#include <errno.h>
+#include <windows.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+bool RingBufferOutput::mapFile()
+{
+    HANDLE file = ::CreateFileA( m_filename.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( file == INVALID_HANDLE_VALUE ) {
+        errno = EACCES;
+        return false;
+    }
+
+    // CREATE_ALWAYS truncated the file, so the mapping is all zeroes.
+    const uint64_t fileSize = RingBufferFormat::FileHeaderSize + m_capacity;
+    HANDLE mapping = ::CreateFileMappingA( file, NULL, PAGE_READWRITE,
+                                          (DWORD)( fileSize >> 32 ), (DWORD)fileSize, NULL );
+    void *p = 0;
+    if ( mapping ) {
+        p = ::MapViewOfFile( mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)fileSize );
+        // The view keeps the mapping and the file open
+        ::CloseHandle( mapping );
+    }
+    ::CloseHandle( file );
+    if ( !p ) {
+        errno = ENOMEM;
+        return false;
+    }
+    m_data = static_cast<char *>( p );
+    return true;
+}
+
+void RingBufferOutput::unmapFile()
+{
+    if ( m_data ) {
+        ::UnmapViewOfFile( m_data );
+        m_data = 0;
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
@@ -18,17 +18,23 @@
  */
 
 #include "serializer.h"
+#include "binaryformat.h"
 #include "trace.h"
 #include "tracepoint.h"
 #include "configuration.h"
 #include "timehelper.h" // for timeToString
 
-#include <string.h> // for strlen
+#include <stdio.h> // for snprintf
+#include <string.h> // for strlen, strcmp, memcpy
 
-#include <sstream>
+#include <algorithm>
 
 #include <assert.h>
 
+#ifdef _MSC_VER
+#  define snprintf _snprintf
+#endif
+
 using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
@@ -41,6 +47,111 @@ Serializer::~Serializer()
 {
 }
 
+/* The serializers append to a buffer which is reused for all entries, so
+ * none of the helpers below allocate memory once the buffer grew large
+ * enough.
+ */
+static void appendText( vector<char> &buf, const char *s, size_t len )
+{
+    buf.insert( buf.end(), s, s + len );
+}
+
+static void appendText( vector<char> &buf, const char *s )
+{
+    appendText( buf, s, strlen( s ) );
+}
+
+static void appendText( vector<char> &buf, const string &s )
+{
+    appendText( buf, s.data(), s.size() );
+}
+
+static void appendDecimal( vector<char> &buf, vulonglong v )
+{
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = static_cast<char>( '0' + v % 10 );
+        v /= 10;
+    } while ( v != 0 );
+    while ( n > 0 ) {
+        buf.push_back( digits[--n] );
+    }
+}
+
+static void appendSignedDecimal( vector<char> &buf, vlonglong v )
+{
+    if ( v < 0 ) {
+        buf.push_back( '-' );
+        appendDecimal( buf, static_cast<vulonglong>( -( v + 1 ) ) + 1 );
+    } else {
+        appendDecimal( buf, static_cast<vulonglong>( v ) );
+    }
+}
+
+static void appendHex( vector<char> &buf, vulonglong v )
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    char digits[16];
+    size_t n = 0;
+    do {
+        digits[n++] = hexDigits[v & 0xf];
+        v >>= 4;
+    } while ( v != 0 );
+    while ( n > 0 ) {
+        buf.push_back( digits[--n] );
+    }
+}
+
+// Same formatting as writing the value to a std::ostream
+static void appendFloat( vector<char> &buf, long double v )
+{
+    char str[64];
+    const int len = snprintf( str, sizeof( str ), "%Lg", v );
+    if ( len > 0 ) {
+        appendText( buf, str, min( static_cast<size_t>( len ), sizeof( str ) - 1 ) );
+    }
+}
+
+static void appendTime( vector<char> &buf, uint64_t t )
+{
+    char str[TimeStringSize];
+    timeToString( t, str );
+    appendText( buf, str );
+}
+
+// Appends the given text in a CDATA section, splitting it where it contains the CDATA end token.
+static void appendCData( vector<char> &buf, const char *s, size_t len )
+{
+    static const char endToken[] = "]]>";
+    static const char splitEndToken[] = "]]]]><![CDATA[>";
+
+    appendText( buf, "<![CDATA[" );
+    const char *end = s + len;
+    const char *tokenEnd = endToken + strlen( endToken );
+    for ( const char *pos = s; ; ) {
+        const char *match = search( pos, end, endToken, tokenEnd );
+        if ( match == end ) {
+            appendText( buf, pos, end - pos );
+            break;
+        }
+        appendText( buf, pos, match - pos );
+        appendText( buf, splitEndToken );
+        pos = match + strlen( endToken );
+    }
+    appendText( buf, "]]>" );
+}
+
+static void appendCData( vector<char> &buf, const char *s )
+{
+    appendCData( buf, s, strlen( s ) );
+}
+
+static void appendCData( vector<char> &buf, const string &s )
+{
+    appendCData( buf, s.data(), s.size() );
+}
+
 PlaintextSerializer::PlaintextSerializer()
     : m_showTimestamp( true )
 {
@@ -51,86 +162,121 @@ void PlaintextSerializer::setTimestampsShown( bool timestamps )
     m_showTimestamp = timestamps;
 }
 
-vector<char> PlaintextSerializer::serialize( const TraceEntry &entry )
+void PlaintextSerializer::serialize( const TraceEntry &entry, vector<char> &buf )
 {
-    ostringstream str;
-
     if ( m_showTimestamp ) {
-        str << timeToString( entry.timeStamp ) << ": ";
+        appendTime( buf, entry.timeStamp );
+        appendText( buf, ": " );
     }
 
-    str << "Process " << entry.process.id << " [started at " << timeToString( entry.process.startTime ) << "] (Thread " << entry.threadId << "): ";
+    appendText( buf, "Process " );
+    appendDecimal( buf, entry.process.id );
+    appendText( buf, " [started at " );
+    appendTime( buf, entry.process.startTime );
+    appendText( buf, "] (Thread " );
+    appendDecimal( buf, entry.threadId );
+    appendText( buf, "): " );
 
     switch ( entry.tracePoint->type ) {
         case TracePointType::Error:
-            str << "[ERROR]";
+            appendText( buf, "[ERROR]" );
             break;
         case TracePointType::Debug:
-            str << "[DEBUG]";
+            appendText( buf, "[DEBUG]" );
             break;
         case TracePointType::Log:
-            str << "[LOG]";
+            appendText( buf, "[LOG]" );
             break;
         case TracePointType::Watch:
-            str << "[WATCH]";
+            appendText( buf, "[WATCH]" );
             break;
         default:
             assert( !"Unreachable" );
     }
 
     if ( entry.message ) {
-        str << " '" << entry.message << "'";
+        appendText( buf, " '" );
+        appendText( buf, entry.message );
+        appendText( buf, "'" );
     }
 
-    str << " " << entry.tracePoint->sourceFile << ":" << entry.tracePoint->lineno << ": " << entry.tracePoint->functionName;
+    appendText( buf, " " );
+    appendText( buf, entry.tracePoint->sourceFile );
+    appendText( buf, ":" );
+    appendDecimal( buf, entry.tracePoint->lineno );
+    appendText( buf, ": " );
+    appendText( buf, entry.tracePoint->functionName );
 
     if ( entry.variables && entry.variables->size() > 0 ) {
-        str << "; Variables: { ";
+        appendText( buf, "; Variables: { " );
         for ( size_t i = 0; i < entry.variables->size(); ++i ) {
             AbstractVariable *v = (*entry.variables)[i];
-            str << v->name() << "=" << convertVariableValue( v->value() ) << " ";
+            appendText( buf, v->name() );
+            appendText( buf, "=" );
+            appendVariableValue( buf, v->value() );
+            appendText( buf, " " );
         }
-        str << "}";
+        appendText( buf, "}" );
     }
 
     if ( entry.backtrace ) {
-        str << "; Backtrace: { ";
+        appendText( buf, "; Backtrace: { " );
         for ( size_t i = 0; i  < entry.backtrace->depth(); ++i ) {
             const StackFrame &frame = entry.backtrace->frame( i );
-            str << "#" << i << ": in " << frame.module <<
-                               ": " << frame.function << "+0x" << hex << frame.functionOffset
-                               << " (" << frame.sourceFile << ":" << frame.lineNumber << ") ";
+            appendText( buf, "#" );
+            appendDecimal( buf, i );
+            appendText( buf, ": in " );
+            appendText( buf, frame.module );
+            appendText( buf, ": " );
+            appendText( buf, frame.function );
+            appendText( buf, "+0x" );
+            appendHex( buf, frame.functionOffset );
+            appendText( buf, " (" );
+            appendText( buf, frame.sourceFile );
+            appendText( buf, ":" );
+            appendDecimal( buf, frame.lineNumber );
+            appendText( buf, ") " );
         }
-        str << "}";
+        appendText( buf, "}" );
     }
-
-    const string result = str.str();
-
-    return vector<char>( result.begin(), result.end() );
 }
 
-vector<char> PlaintextSerializer::serialize( const ProcessShutdownEvent &ev )
+void PlaintextSerializer::serialize( const ProcessShutdownEvent &ev, vector<char> &buf )
 {
-    ostringstream str;
-    str << timeToString( ev.shutdownTime ) << ": Process " << ev.process->id
-        << " [started at " << timeToString( ev.process->startTime ) << "]"
-        << " finished";
-
-    const string result = str.str();
-
-    return vector<char>( result.begin(), result.end() );
+    appendTime( buf, ev.shutdownTime );
+    appendText( buf, ": Process " );
+    appendDecimal( buf, ev.process->id );
+    appendText( buf, " [started at " );
+    appendTime( buf, ev.process->startTime );
+    appendText( buf, "] finished" );
 }
 
-// From variabledumping.cpp, cannot easily share through the variabledumping header
-// as that would make STL part of our API which is problematic
-extern std::string stringRep( const VariableValue &v );
-
-string PlaintextSerializer::convertVariableValue( const VariableValue &v ) const
+// Mirrors stringRep() from variabledumping.cpp
+void PlaintextSerializer::appendVariableValue( vector<char> &buf, const VariableValue &v ) const
 {
-    ostringstream str;
-    str << stringRep ( v );
-    str << " <" << VariableType::valueAsString( v.type() ) << ">";
-    return str.str();
+    switch ( v.type() ) {
+        case VariableType::String:
+            appendText( buf, v.asString() );
+            break;
+        case VariableType::Number:
+            if ( v.isSignedNumber() ) {
+                appendSignedDecimal( buf, static_cast<vlonglong>( v.asNumber() ) );
+            } else {
+                appendDecimal( buf, v.asNumber() );
+            }
+            break;
+        case VariableType::Float:
+            appendFloat( buf, v.asFloat() );
+            break;
+        case VariableType::Boolean:
+            appendText( buf, v.asBoolean() ? "true" : "false" );
+            break;
+        default:
+            assert( !"Unreachable" );
+    }
+    appendText( buf, " <" );
+    appendText( buf, VariableType::valueAsString( v.type() ) );
+    appendText( buf, ">" );
 }
 
 XMLSerializer::XMLSerializer()
@@ -143,169 +289,455 @@ void XMLSerializer::setBeautifiedOutput( bool beautifiedOutput )
     m_beautifiedOutput = beautifiedOutput;
 }
 
-static std::string splitCDataEndToken( const std::string& input )
+void XMLSerializer::appendIndent( vector<char> &buf, int level ) const
 {
-    std::string copy = input;
-    static const char endToken[] = "]]>";
-    static const char splitEndToken[] = "]]]]><![CDATA[>";
-    static const size_t endTokenLength = strlen( endToken );
-    static const size_t splitEndTokenLength = strlen( splitEndToken );
-    size_t pos = 0;
-    while ( ( pos = copy.find( endToken, pos ) ) != std::string::npos ) {
-        copy.replace( pos, endTokenLength, splitEndToken );
-        pos += splitEndTokenLength;
+    if ( m_beautifiedOutput ) {
+        buf.push_back( '\n' );
+        buf.insert( buf.end(), level * 2, ' ' );
     }
-    return copy;
 }
 
-vector<char> XMLSerializer::serialize( const TraceEntry &entry )
+void XMLSerializer::serialize( const TraceEntry &entry, vector<char> &buf )
 {
-    ostringstream str;
-    str << "<traceentry pid=\"" << entry.process.id << "\" process_starttime=\"" << entry.process.startTime << "\" tid=\"" << entry.threadId << "\" time=\"" << entry.timeStamp << "\">";
-
-    std::string indent;
-    if ( m_beautifiedOutput ) {
-        indent = "\n  ";
-    }
+    appendText( buf, "<traceentry pid=\"" );
+    appendDecimal( buf, entry.process.id );
+    appendText( buf, "\" process_starttime=\"" );
+    appendDecimal( buf, entry.process.startTime );
+    appendText( buf, "\" tid=\"" );
+    appendDecimal( buf, entry.threadId );
+    appendText( buf, "\" time=\"" );
+    appendDecimal( buf, entry.timeStamp );
+    appendText( buf, "\">" );
 
     static string myProcessName = Configuration::currentProcessName();
-    str << indent << "<processname><![CDATA[" << splitCDataEndToken( myProcessName ) << "]]></processname>";
-
-    str << indent << "<stackposition>" << entry.stackPosition << "</stackposition>";
+    appendIndent( buf, 1 );
+    appendText( buf, "<processname>" );
+    appendCData( buf, myProcessName );
+    appendText( buf, "</processname>" );
+
+    appendIndent( buf, 1 );
+    appendText( buf, "<stackposition>" );
+    appendDecimal( buf, entry.stackPosition );
+    appendText( buf, "</stackposition>" );
     if ( entry.tracePoint->groupName ) {
-        str << indent << "<group>" << entry.tracePoint->groupName << "</group>";
+        appendIndent( buf, 1 );
+        appendText( buf, "<group>" );
+        appendText( buf, entry.tracePoint->groupName );
+        appendText( buf, "</group>" );
     }
     if ( !entry.process.availableTraceKeys.empty() ) {
-        str << indent << "<tracekeys>";
-        if ( m_beautifiedOutput ) {
-            indent = "\n    ";
-        }
+        appendIndent( buf, 1 );
+        appendText( buf, "<tracekeys>" );
         vector<TraceKey>::const_iterator it, end = entry.process.availableTraceKeys.end();
         for ( it = entry.process.availableTraceKeys.begin(); it != end; ++it ) {
-            str << indent << "<key enabled=\"" << ( it->enabled ? "true" : "false" ) << "\"><![CDATA[" << splitCDataEndToken( it->name ) << "]]></key>";
-        }
-        if ( m_beautifiedOutput ) {
-            indent = "\n  ";
+            appendIndent( buf, 2 );
+            appendText( buf, it->enabled ? "<key enabled=\"true\">" : "<key enabled=\"false\">" );
+            appendCData( buf, it->name );
+            appendText( buf, "</key>" );
         }
-        str << indent << "</tracekeys>";
+        appendIndent( buf, 1 );
+        appendText( buf, "</tracekeys>" );
     }
-    str << indent << "<type>" << entry.tracePoint->type << "</type>";
-    str << indent << "<location lineno=\"" << entry.tracePoint->lineno << "\"><![CDATA[" << splitCDataEndToken( entry.tracePoint->sourceFile ) << "]]></location>";
-    str << indent << "<function><![CDATA[" << splitCDataEndToken( entry.tracePoint->functionName ) << "]]></function>";
+    appendIndent( buf, 1 );
+    appendText( buf, "<type>" );
+    appendDecimal( buf, entry.tracePoint->type );
+    appendText( buf, "</type>" );
+    appendIndent( buf, 1 );
+    appendText( buf, "<location lineno=\"" );
+    appendDecimal( buf, entry.tracePoint->lineno );
+    appendText( buf, "\">" );
+    appendCData( buf, entry.tracePoint->sourceFile );
+    appendText( buf, "</location>" );
+    appendIndent( buf, 1 );
+    appendText( buf, "<function>" );
+    appendCData( buf, entry.tracePoint->functionName );
+    appendText( buf, "</function>" );
     if ( entry.variables ) {
-        str << indent << "<variables>";
-        if ( m_beautifiedOutput ) {
-            indent = "\n    ";
-        }
+        appendIndent( buf, 1 );
+        appendText( buf, "<variables>" );
         for ( size_t i = 0; i < entry.variables->size(); ++i ) {
             AbstractVariable *v = (*entry.variables)[i];
-            str << indent << convertVariable( v->name(), v->value() );
+            appendIndent( buf, 2 );
+            appendVariable( buf, v->name(), v->value() );
         }
-        if ( m_beautifiedOutput ) {
-            indent = "\n  ";
-        }
-        str << indent << "</variables>";
+        appendIndent( buf, 1 );
+        appendText( buf, "</variables>" );
     }
 
     if ( entry.backtrace ) {
-        str << indent << "<backtrace>";
+        appendIndent( buf, 1 );
+        appendText( buf, "<backtrace>" );
         for ( size_t i = 0; i  < entry.backtrace->depth(); ++i ) {
             const StackFrame &frame = entry.backtrace->frame( i );
 
-            if ( m_beautifiedOutput ) {
-                indent = "\n    ";
-            }
-            str << indent << "<frame>";
-
-            if ( m_beautifiedOutput ) {
-                indent = "\n      ";
-            }
-            str << indent << "<module><![CDATA[" << splitCDataEndToken( frame.module ) << "]]></module>";
-            str << indent << "<function offset=\"" << frame.functionOffset << "\"><![CDATA[" << splitCDataEndToken( frame.function ) << "]]></function>";
-            str << indent << "<location lineno=\"" << frame.lineNumber << "\"><![CDATA[" << splitCDataEndToken( frame.sourceFile ) << "]]></location>";
-
-            if ( m_beautifiedOutput ) {
-                indent = "\n    ";
-            }
-            str << indent << "</frame>";
+            appendIndent( buf, 2 );
+            appendText( buf, "<frame>" );
+
+            appendIndent( buf, 3 );
+            appendText( buf, "<module>" );
+            appendCData( buf, frame.module );
+            appendText( buf, "</module>" );
+            appendIndent( buf, 3 );
+            appendText( buf, "<function offset=\"" );
+            appendDecimal( buf, frame.functionOffset );
+            appendText( buf, "\">" );
+            appendCData( buf, frame.function );
+            appendText( buf, "</function>" );
+            appendIndent( buf, 3 );
+            appendText( buf, "<location lineno=\"" );
+            appendDecimal( buf, frame.lineNumber );
+            appendText( buf, "\">" );
+            appendCData( buf, frame.sourceFile );
+            appendText( buf, "</location>" );
+
+            appendIndent( buf, 2 );
+            appendText( buf, "</frame>" );
         }
-        if ( m_beautifiedOutput ) {
-            indent = "\n  ";
-        }
-        str << indent << "</backtrace>";
+        appendIndent( buf, 1 );
+        appendText( buf, "</backtrace>" );
     }
 
     if ( entry.message ) {
-        str << indent << "<message><![CDATA[" << splitCDataEndToken( entry.message ) << "]]></message>";
+        appendIndent( buf, 1 );
+        appendText( buf, "<message>" );
+        appendCData( buf, entry.message );
+        appendText( buf, "</message>" );
     }
 
-    str << indent << "<storageconfiguration"
-                  << " maxSize=\"" << m_cfg.maximumTraceSize << "\""
-                  << " shrinkBy=\"" << m_cfg.shrinkPercentage << "\""
-                  << ">";
-    if ( m_beautifiedOutput ) {
-        indent += "  ";
-    }
-    str << indent << "<![CDATA[" << splitCDataEndToken( m_cfg.archiveDirectoryName ) << "]]>";
+    appendIndent( buf, 1 );
+    appendText( buf, "<storageconfiguration maxSize=\"" );
+    appendDecimal( buf, m_cfg.maximumTraceSize );
+    appendText( buf, "\" shrinkBy=\"" );
+    appendDecimal( buf, m_cfg.shrinkPercentage );
+    appendText( buf, "\">" );
+    appendIndent( buf, 2 );
+    appendCData( buf, m_cfg.archiveDirectoryName );
+    appendIndent( buf, 1 );
+    appendText( buf, "</storageconfiguration>" );
+
+    appendIndent( buf, 0 );
+    appendText( buf, "</traceentry>" );
     if ( m_beautifiedOutput ) {
-        indent = "\n  ";
+        buf.push_back( '\n' );
     }
-    str << indent << "</storageconfiguration>";
-
-    if ( m_beautifiedOutput ) {
-        indent = "\n";
-    }
-    str << indent << "</traceentry>";
-    if ( m_beautifiedOutput ) {
-        str << "\n";
-    }
-
-    const string result = str.str();
-    return vector<char>( result.begin(), result.end() );
 }
 
-vector<char> XMLSerializer::serialize( const ProcessShutdownEvent &ev )
+void XMLSerializer::serialize( const ProcessShutdownEvent &ev, vector<char> &buf )
 {
-    ostringstream str;
-    str << "<shutdownevent pid=\"" << ev.process->id << "\" starttime=\"" << ev.process->startTime << "\" endtime=\"" << ev.shutdownTime << "\">";
+    appendText( buf, "<shutdownevent pid=\"" );
+    appendDecimal( buf, ev.process->id );
+    appendText( buf, "\" starttime=\"" );
+    appendDecimal( buf, ev.process->startTime );
+    appendText( buf, "\" endtime=\"" );
+    appendDecimal( buf, ev.shutdownTime );
+    appendText( buf, "\">" );
 
     static string myProcessName = Configuration::currentProcessName();
-    str << "<![CDATA[" << splitCDataEndToken( myProcessName ) << "]]>";
+    appendCData( buf, myProcessName );
 
-    str << "</shutdownevent>";
-
-    const string result = str.str();
-    return vector<char>( result.begin(), result.end() );
+    appendText( buf, "</shutdownevent>" );
 }
 
-string XMLSerializer::convertVariable( const char *n, const VariableValue &v ) const
+void XMLSerializer::appendVariable( vector<char> &buf, const char *n, const VariableValue &v ) const
 {
-    ostringstream str;
-    str << "<variable name=\"" << n << "\" ";
+    appendText( buf, "<variable name=\"" );
+    appendText( buf, n );
+    appendText( buf, "\" " );
     switch ( v.type() ) {
         case VariableType::String:
-            str << "type=\"string\"><![CDATA[" << splitCDataEndToken( v.asString() ) << "]]>";
+            appendText( buf, "type=\"string\">" );
+            appendCData( buf, v.asString() );
             break;
         case VariableType::Number:
-            str << "type=\"number\">";
+            appendText( buf, "type=\"number\">" );
             if( v.isSignedNumber() ) {
-                str << static_cast<vlonglong>( v.asNumber() );
+                appendSignedDecimal( buf, static_cast<vlonglong>( v.asNumber() ) );
             } else {
-                str << v.asNumber();
+                appendDecimal( buf, v.asNumber() );
             }
             break;
         case VariableType::Float:
-            str << "type=\"float\">" << v.asFloat();
+            appendText( buf, "type=\"float\">" );
+            appendFloat( buf, v.asFloat() );
             break;
         case VariableType::Boolean:
-            str << "type=\"boolean\">" << v.asBoolean();
+            appendText( buf, "type=\"boolean\">" );
+            appendText( buf, v.asBoolean() ? "1" : "0" );
             break;
         default:
             assert( !"Unreachable" );
     }
-    str << "</variable>";
-    return str.str();
+    appendText( buf, "</variable>" );
 }
 
-TRACELIB_NAMESPACE_END
+static void appendUInt8( vector<char> &buf, unsigned char v )
+{
+    buf.push_back( static_cast<char>( v ) );
+}
+
+static void appendUInt16( vector<char> &buf, unsigned short v )
+{
+    buf.push_back( static_cast<char>( v & 0xff ) );
+    buf.push_back( static_cast<char>( ( v >> 8 ) & 0xff ) );
+}
+
+static void appendUInt32( vector<char> &buf, unsigned int v )
+{
+    for ( int i = 0; i < 4; ++i ) {
+        buf.push_back( static_cast<char>( ( v >> ( i * 8 ) ) & 0xff ) );
+    }
+}
+
+static void appendUInt64( vector<char> &buf, uint64_t v )
+{
+    for ( int i = 0; i < 8; ++i ) {
+        buf.push_back( static_cast<char>( ( v >> ( i * 8 ) ) & 0xff ) );
+    }
+}
+
+static void appendString( vector<char> &buf, const char *s, size_t len )
+{
+    appendUInt32( buf, static_cast<unsigned int>( len ) );
+    buf.insert( buf.end(), s, s + len );
+}
+
+// Writes the record header with a placeholder size, see endRecord().
+static size_t beginRecord( vector<char> &buf, BinaryFormat::RecordType type )
+{
+    const size_t start = buf.size();
+    appendUInt32( buf, 0 );
+    appendUInt8( buf, type );
+    return start;
+}
+
+static void endRecord( vector<char> &buf, size_t start )
+{
+    const unsigned int size = static_cast<unsigned int>( buf.size() - start - BinaryFormat::RecordHeaderSize );
+    for ( int i = 0; i < 4; ++i ) {
+        buf[start + i] = static_cast<char>( ( size >> ( i * 8 ) ) & 0xff );
+    }
+}
+
+static bool operator==( const TraceKey &lhs, const TraceKey &rhs )
+{
+    return lhs.enabled == rhs.enabled && lhs.name == rhs.name;
+}
+
+BinarySerializer::BinarySerializer()
+    : m_streamStarted( false ),
+    m_storageConfigurationSent( false )
+{
+}
+
+void BinarySerializer::setStorageConfiguration( const StorageConfiguration &cfg )
+{
+    m_cfg = cfg;
+    m_storageConfigurationSent = false;
+}
+
+void BinarySerializer::restartStream()
+{
+    m_streamStarted = false;
+}
+
+void BinarySerializer::startStream( vector<char> &buf )
+{
+    m_stringIds.clear();
+    m_strings.clear();
+    m_literalIds.clear();
+    m_sentTraceKeys.clear();
+    m_storageConfigurationSent = false;
+
+    const size_t start = beginRecord( buf, BinaryFormat::StreamHeaderRecord );
+    appendUInt32( buf, BinaryFormat::Magic );
+    appendUInt16( buf, BinaryFormat::Version );
+    endRecord( buf, start );
+
+    m_streamStarted = true;
+}
+
+/* Yields the id of the given string; strings not seen before in this
+ * stream are assigned a new id which is defined by a record appended to
+ * the given buffer.
+ */
+unsigned int BinarySerializer::stringId( vector<char> &buf, const string &s )
+{
+    map<string, unsigned int>::const_iterator it = m_stringIds.find( s );
+    if ( it != m_stringIds.end() ) {
+        return it->second;
+    }
+
+    const unsigned int id = static_cast<unsigned int>( m_strings.size() ) + 1;
+    it = m_stringIds.insert( make_pair( s, id ) ).first;
+    m_strings.push_back( &it->first );
+
+    const size_t start = beginRecord( buf, BinaryFormat::StringRecord );
+    appendUInt32( buf, id );
+    appendString( buf, s.data(), s.size() );
+    endRecord( buf, start );
+    return id;
+}
+
+/* Most strings (file and function names of trace points, variable names)
+ * are literals, so look them up by address first to avoid constructing a
+ * std::string. The contents are compared as well in case the address got
+ * reused, e.g. by unloading and loading a library.
+ */
+unsigned int BinarySerializer::stringId( vector<char> &buf, const char *s )
+{
+    map<const char *, unsigned int>::const_iterator it = m_literalIds.find( s );
+    if ( it != m_literalIds.end() && strcmp( m_strings[it->second - 1]->c_str(), s ) == 0 ) {
+        return it->second;
+    }
+
+    const unsigned int id = stringId( buf, string( s ) );
+    m_literalIds[s] = id;
+    return id;
+}
 
+void BinarySerializer::sendTraceKeys( vector<char> &buf, const vector<TraceKey> &keys )
+{
+    vector<unsigned int> nameIds;
+    vector<TraceKey>::const_iterator it, end = keys.end();
+    for ( it = keys.begin(); it != end; ++it ) {
+        nameIds.push_back( stringId( buf, it->name ) );
+    }
+
+    const size_t start = beginRecord( buf, BinaryFormat::TraceKeysRecord );
+    appendUInt32( buf, static_cast<unsigned int>( keys.size() ) );
+    for ( size_t i = 0; i < keys.size(); ++i ) {
+        appendUInt8( buf, keys[i].enabled ? 1 : 0 );
+        appendUInt32( buf, nameIds[i] );
+    }
+    endRecord( buf, start );
+
+    m_sentTraceKeys = keys;
+}
+
+void BinarySerializer::sendStorageConfiguration( vector<char> &buf )
+{
+    const unsigned int archiveDirId = stringId( buf, m_cfg.archiveDirectoryName );
+
+    const size_t start = beginRecord( buf, BinaryFormat::StorageConfigurationRecord );
+    appendUInt64( buf, m_cfg.maximumTraceSize );
+    appendUInt16( buf, m_cfg.shrinkPercentage );
+    appendUInt32( buf, archiveDirId );
+    endRecord( buf, start );
+
+    m_storageConfigurationSent = true;
+}
+
+void BinarySerializer::serialize( const TraceEntry &entry, vector<char> &buf )
+{
+    if ( !m_streamStarted ) {
+        startStream( buf );
+    }
+    if ( !m_storageConfigurationSent ) {
+        sendStorageConfiguration( buf );
+    }
+    if ( !( m_sentTraceKeys.size() == entry.process.availableTraceKeys.size() &&
+            equal( m_sentTraceKeys.begin(), m_sentTraceKeys.end(), entry.process.availableTraceKeys.begin() ) ) ) {
+        sendTraceKeys( buf, entry.process.availableTraceKeys );
+    }
+
+    static const string myProcessName = Configuration::currentProcessName();
+
+    /* Any new strings are defined in 'buf' while the entry itself is
+     * assembled in m_record, which is appended after the definitions.
+     */
+    m_record.clear();
+    const size_t start = beginRecord( m_record, BinaryFormat::TraceEntryRecord );
+    appendUInt32( m_record, entry.process.id );
+    appendUInt64( m_record, entry.process.startTime );
+    appendUInt64( m_record, entry.threadId );
+    appendUInt64( m_record, entry.timeStamp );
+    appendUInt64( m_record, entry.stackPosition );
+    appendUInt32( m_record, stringId( buf, myProcessName ) );
+    appendUInt32( m_record, entry.tracePoint->groupName ? stringId( buf, entry.tracePoint->groupName )
+                                                         : BinaryFormat::NoString );
+    appendUInt8( m_record, entry.tracePoint->type );
+    appendUInt32( m_record, entry.tracePoint->lineno );
+    appendUInt32( m_record, stringId( buf, entry.tracePoint->sourceFile ) );
+    appendUInt32( m_record, stringId( buf, entry.tracePoint->functionName ) );
+
+    unsigned char flags = 0;
+    if ( entry.message ) {
+        flags |= BinaryFormat::HasMessage;
+    }
+    if ( entry.variables ) {
+        flags |= BinaryFormat::HasVariables;
+    }
+    if ( entry.backtrace ) {
+        flags |= BinaryFormat::HasBacktrace;
+    }
+    appendUInt8( m_record, flags );
+
+    if ( entry.message ) {
+        appendString( m_record, entry.message, strlen( entry.message ) );
+    }
+
+    if ( entry.variables ) {
+        appendUInt16( m_record, static_cast<unsigned short>( entry.variables->size() ) );
+        for ( size_t i = 0; i < entry.variables->size(); ++i ) {
+            AbstractVariable *var = (*entry.variables)[i];
+            const VariableValue v = var->value();
+            appendUInt32( m_record, stringId( buf, var->name() ) );
+            appendUInt8( m_record, v.type() );
+            switch ( v.type() ) {
+                case VariableType::String:
+                    appendString( m_record, v.asString(), strlen( v.asString() ) );
+                    break;
+                case VariableType::Number:
+                    appendUInt8( m_record, v.isSignedNumber() ? 1 : 0 );
+                    appendUInt64( m_record, v.asNumber() );
+                    break;
+                case VariableType::Float: {
+                    const double d = static_cast<double>( v.asFloat() );
+                    uint64_t bits;
+                    memcpy( &bits, &d, sizeof( bits ) );
+                    appendUInt64( m_record, bits );
+                    break;
+                }
+                case VariableType::Boolean:
+                    appendUInt8( m_record, v.asBoolean() ? 1 : 0 );
+                    break;
+                default:
+                    assert( !"Unreachable" );
+            }
+        }
+    }
+
+    if ( entry.backtrace ) {
+        appendUInt16( m_record, static_cast<unsigned short>( entry.backtrace->depth() ) );
+        for ( size_t i = 0; i < entry.backtrace->depth(); ++i ) {
+            const StackFrame &frame = entry.backtrace->frame( i );
+            appendUInt32( m_record, stringId( buf, frame.module ) );
+            appendUInt32( m_record, stringId( buf, frame.function ) );
+            appendUInt64( m_record, frame.functionOffset );
+            appendUInt32( m_record, stringId( buf, frame.sourceFile ) );
+            appendUInt32( m_record, static_cast<unsigned int>( frame.lineNumber ) );
+        }
+    }
+    endRecord( m_record, start );
+
+    buf.insert( buf.end(), m_record.begin(), m_record.end() );
+}
+
+void BinarySerializer::serialize( const ProcessShutdownEvent &ev, vector<char> &buf )
+{
+    if ( !m_streamStarted ) {
+        startStream( buf );
+    }
+
+    static const string myProcessName = Configuration::currentProcessName();
+    const unsigned int processNameId = stringId( buf, myProcessName );
+
+    const size_t start = beginRecord( buf, BinaryFormat::ShutdownEventRecord );
+    appendUInt32( buf, ev.process->id );
+    appendUInt64( buf, ev.process->startTime );
+    appendUInt64( buf, ev.shutdownTime );
+    appendUInt32( buf, processNameId );
+    endRecord( buf, start );
+}
+
+TRACELIB_NAMESPACE_END
@@ -22,6 +22,7 @@
 
 #include "tracelib_config.h"
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -38,11 +39,21 @@ class Serializer
 public:
     virtual ~Serializer();
 
-    virtual std::vector<char> serialize( const TraceEntry &entry ) = 0;
-    virtual std::vector<char> serialize( const ProcessShutdownEvent &ev ) = 0;
+    /* Appends the serialized data to 'buf'; the caller reuses the buffer
+     * so that serializing doesn't need to allocate memory.
+     */
+    virtual void serialize( const TraceEntry &entry, std::vector<char> &buf ) = 0;
+    virtual void serialize( const ProcessShutdownEvent &ev, std::vector<char> &buf ) = 0;
 
     virtual void setStorageConfiguration( const StorageConfiguration &cfg ) { }
 
+    /* Called when the output starts a new stream (e.g. after reconnecting),
+     * serializers which keep per-stream state have to send it again.
+     */
+    virtual void restartStream() { }
+
+    virtual bool isBinary() const { return false; }
+
 protected:
     Serializer();
 
@@ -57,11 +68,11 @@ public:
     PlaintextSerializer();
 
     void setTimestampsShown( bool timestamps );
-    virtual std::vector<char> serialize( const TraceEntry &entry );
-    virtual std::vector<char> serialize( const ProcessShutdownEvent &ev );
+    virtual void serialize( const TraceEntry &entry, std::vector<char> &buf );
+    virtual void serialize( const ProcessShutdownEvent &ev, std::vector<char> &buf );
 
 private:
-    std::string convertVariableValue( const VariableValue &v ) const;
+    void appendVariableValue( std::vector<char> &buf, const VariableValue &v ) const;
 
     bool m_showTimestamp;
 };
@@ -73,20 +84,50 @@ public:
 
     void setBeautifiedOutput( bool beautifiedOutput );
 
-    virtual std::vector<char> serialize( const TraceEntry &entry );
-    virtual std::vector<char> serialize( const ProcessShutdownEvent &ev );
+    virtual void serialize( const TraceEntry &entry, std::vector<char> &buf );
+    virtual void serialize( const ProcessShutdownEvent &ev, std::vector<char> &buf );
 
     virtual void setStorageConfiguration( const StorageConfiguration &cfg ) {
         m_cfg = cfg;
     }
 
 private:
-    std::string convertVariable( const char *name, const VariableValue &v ) const;
+    void appendIndent( std::vector<char> &buf, int level ) const;
+    void appendVariable( std::vector<char> &buf, const char *name, const VariableValue &v ) const;
 
     bool m_beautifiedOutput;
     StorageConfiguration m_cfg;
 };
 
+class BinarySerializer : public Serializer
+{
+public:
+    BinarySerializer();
+
+    virtual void serialize( const TraceEntry &entry, std::vector<char> &buf );
+    virtual void serialize( const ProcessShutdownEvent &ev, std::vector<char> &buf );
+
+    virtual void setStorageConfiguration( const StorageConfiguration &cfg );
+    virtual void restartStream();
+    virtual bool isBinary() const { return true; }
+
+private:
+    void startStream( std::vector<char> &buf );
+    void sendTraceKeys( std::vector<char> &buf, const std::vector<TraceKey> &keys );
+    void sendStorageConfiguration( std::vector<char> &buf );
+    unsigned int stringId( std::vector<char> &buf, const std::string &s );
+    unsigned int stringId( std::vector<char> &buf, const char *s );
+
+    std::map<std::string, unsigned int> m_stringIds;
+    std::vector<const std::string *> m_strings;
+    std::map<const char *, unsigned int> m_literalIds;
+    std::vector<char> m_record;
+    bool m_streamStarted;
+    std::vector<TraceKey> m_sentTraceKeys;
+    bool m_storageConfigurationSent;
+    StorageConfiguration m_cfg;
+};
+
 TRACELIB_NAMESPACE_END
 
 #endif // !defined(TRACELIB_SERIALIZER_H)
@@ -0,0 +1,83 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_THREAD_H
+#define TRACELIB_THREAD_H
+
+#include "tracelib_config.h"
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct ThreadHandle;
+struct ThreadLocalStorageHandle;
+
+/* Subclasses need to make sure that run() returns and call wait() in their
+ * own destructor; the thread must not outlive the object it runs on.
+ */
+class Thread
+{
+    friend struct ThreadHandle;
+
+public:
+    virtual ~Thread();
+
+    bool start();
+    void wait();
+    bool isRunning() const;
+
+    static void sleep( unsigned int milliSeconds );
+
+protected:
+    Thread();
+
+    virtual void run() = 0;
+
+private:
+    Thread( const Thread &other ); // disabled
+    void operator=( const Thread &rhs ); // disabled
+
+    ThreadHandle *m_handle;
+};
+
+/* A single pointer-sized slot which holds a different value for every
+ * thread. The destructor function (if any) is called with the slot's value
+ * when a thread which stored a non-null value terminates.
+ */
+class ThreadLocalStorage
+{
+public:
+    typedef void (*DestructorFunction)( void *value );
+
+    explicit ThreadLocalStorage( DestructorFunction destructor = 0 );
+    ~ThreadLocalStorage();
+
+    void *value() const;
+    void setValue( void *value );
+
+private:
+    ThreadLocalStorage( const ThreadLocalStorage &other ); // disabled
+    void operator=( const ThreadLocalStorage &rhs ); // disabled
+
+    ThreadLocalStorageHandle *m_handle;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_THREAD_H)
+
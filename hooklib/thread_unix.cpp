@@ -0,0 +1,110 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct ThreadHandle {
+    pthread_t thread;
+    bool running;
+
+    static void exec( Thread *thread ) { thread->run(); }
+};
+
+struct ThreadLocalStorageHandle {
+    pthread_key_t key;
+};
+
+static void *threadProc( void *user_data )
+{
+    ThreadHandle::exec( static_cast<Thread *>( user_data ) );
+    return NULL;
+}
+
+Thread::Thread() : m_handle( new ThreadHandle )
+{
+    m_handle->running = false;
+}
+
+Thread::~Thread()
+{
+    wait();
+    delete m_handle;
+}
+
+bool Thread::start()
+{
+    if ( m_handle->running ) {
+        return true;
+    }
+    m_handle->running = pthread_create( &m_handle->thread, NULL, threadProc, this ) == 0;
+    return m_handle->running;
+}
+
+void Thread::wait()
+{
+    if ( m_handle->running ) {
+        pthread_join( m_handle->thread, NULL );
+        m_handle->running = false;
+    }
+}
+
+bool Thread::isRunning() const
+{
+    return m_handle->running;
+}
+
+void Thread::sleep( unsigned int milliSeconds )
+{
+    timespec ts;
+    ts.tv_sec = milliSeconds / 1000;
+    ts.tv_nsec = ( milliSeconds % 1000 ) * 1000000L;
+    while ( nanosleep( &ts, &ts ) == -1 && errno == EINTR )
+        ;
+}
+
+ThreadLocalStorage::ThreadLocalStorage( DestructorFunction destructor )
+    : m_handle( new ThreadLocalStorageHandle )
+{
+    pthread_key_create( &m_handle->key, destructor );
+}
+
+ThreadLocalStorage::~ThreadLocalStorage()
+{
+    pthread_key_delete( m_handle->key );
+    delete m_handle;
+}
+
+void *ThreadLocalStorage::value() const
+{
+    return pthread_getspecific( m_handle->key );
+}
+
+void ThreadLocalStorage::setValue( void *value )
+{
+    pthread_setspecific( m_handle->key, value );
+}
+
+TRACELIB_NAMESPACE_END
+
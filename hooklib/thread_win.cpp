@@ -0,0 +1,107 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread.h"
+
+#include <windows.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct ThreadHandle {
+    HANDLE thread;
+
+    static void exec( Thread *thread ) { thread->run(); }
+};
+
+struct ThreadLocalStorageHandle {
+    DWORD index;
+};
+
+static DWORD WINAPI threadProc( LPVOID lpParameter )
+{
+    ThreadHandle::exec( static_cast<Thread *>( lpParameter ) );
+    return 0;
+}
+
+Thread::Thread() : m_handle( new ThreadHandle )
+{
+    m_handle->thread = 0;
+}
+
+Thread::~Thread()
+{
+    wait();
+    delete m_handle;
+}
+
+bool Thread::start()
+{
+    if ( m_handle->thread ) {
+        return true;
+    }
+    m_handle->thread = ::CreateThread( NULL, 0, threadProc, this, 0, NULL );
+    return m_handle->thread != 0;
+}
+
+void Thread::wait()
+{
+    if ( m_handle->thread ) {
+        ::WaitForSingleObject( m_handle->thread, INFINITE );
+        ::CloseHandle( m_handle->thread );
+        m_handle->thread = 0;
+    }
+}
+
+bool Thread::isRunning() const
+{
+    return m_handle->thread != 0;
+}
+
+void Thread::sleep( unsigned int milliSeconds )
+{
+    ::Sleep( milliSeconds );
+}
+
+/* Fiber local storage is used instead of TlsAlloc since only the former
+ * supports a callback which is invoked when a thread terminates.
+ */
+ThreadLocalStorage::ThreadLocalStorage( DestructorFunction destructor )
+    : m_handle( new ThreadLocalStorageHandle )
+{
+    m_handle->index = ::FlsAlloc( (PFLS_CALLBACK_FUNCTION)destructor );
+}
+
+ThreadLocalStorage::~ThreadLocalStorage()
+{
+    ::FlsFree( m_handle->index );
+    delete m_handle;
+}
+
+void *ThreadLocalStorage::value() const
+{
+    return ::FlsGetValue( m_handle->index );
+}
+
+void ThreadLocalStorage::setValue( void *value )
+{
+    ::FlsSetValue( m_handle->index, value );
+}
+
+TRACELIB_NAMESPACE_END
+
@@ -21,6 +21,7 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <string.h> // for memset
 #include <sstream>
 #include <iomanip>
 
@@ -37,13 +38,19 @@ using namespace std;
 TRACELIB_NAMESPACE_BEGIN
 
 std::string timeToString( uint64_t t )
+{
+    char timestamp[TimeStringSize];
+    timeToString( t, timestamp );
+    return std::string( timestamp );
+}
+
+void timeToString( uint64_t t, char *timestamp )
 {
     time_t secondsSinceEpoch = t / 1000;
     int mseconds = t % 1000;
-    char timestamp[23] = { '\0' };
-    strftime(timestamp, sizeof(timestamp), "%d.%m.%Y %H:%M:%S", localtime(&secondsSinceEpoch));
+    memset( timestamp, 0, TimeStringSize );
+    strftime(timestamp, TimeStringSize, "%d.%m.%Y %H:%M:%S", localtime(&secondsSinceEpoch));
     snprintf(&timestamp[18], 5, ":%03d", mseconds);
-    return std::string( timestamp );
 }
 
 uint64_t now()
@@ -17,13 +17,22 @@
  * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef TRACELIB_TIMEHELPER_H
+#define TRACELIB_TIMEHELPER_H
+
 #include "tracelib_config.h"
 #include "config.h" // for uint64_t
 #include <string>
 
 TRACELIB_NAMESPACE_BEGIN
 
+static const size_t TimeStringSize = 23;
+
 uint64_t now();
 std::string timeToString( uint64_t );
+// Allocation-free variant, 'buf' must have room for TimeStringSize chars.
+void timeToString( uint64_t t, char *buf );
 
 TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_TIMEHELPER_H)
@@ -18,16 +18,19 @@
  */
 
 #include "trace.h"
+#include "asyncdispatcher.h"
 #include "configuration.h"
 #include "crashhandler.h"
 #include "filter.h"
 #include "output.h"
 #include "serializer.h"
+#include "thread.h"
 #include "tracepoint.h"
 #include "log.h"
 #include "tracelib.h" // for deleteRange
 #include "timehelper.h" // for now
 
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
@@ -36,6 +39,124 @@ using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
 
+/* Remembers which trace point set (if any) matched each trace point under
+ * one particular set of filters. Trace points are identified by their
+ * source location rather than their address. Entries are only ever added,
+ * without locking, so that any number of threads may use a table at once.
+ */
+class DecisionTable
+{
+public:
+    explicit DecisionTable( const string &signature )
+        : m_signature( signature ),
+        m_buckets( new AtomicPointer<Entry>[BucketCount] )
+    {
+    }
+
+    ~DecisionTable() {
+        for ( size_t i = 0; i < BucketCount; ++i ) {
+            Entry *e = m_buckets[i].load();
+            while ( e ) {
+                Entry *next = e->next;
+                delete e;
+                e = next;
+            }
+        }
+        delete [] m_buckets;
+    }
+
+    const string &signature() const { return m_signature; }
+
+    bool lookup( const TracePoint *tracePoint, unsigned int *action ) const {
+        for ( const Entry *e = m_buckets[bucket( tracePoint )].load(); e; e = e->next ) {
+            if ( e->sourceFile == tracePoint->sourceFile &&
+                 e->lineno == tracePoint->lineno &&
+                 e->functionName == tracePoint->functionName &&
+                 e->groupName == tracePoint->groupName ) {
+                *action = e->action;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Concurrent insertions of the same trace point just yield duplicates.
+    void insert( const TracePoint *tracePoint, unsigned int action ) {
+        Entry *e = new Entry;
+        e->sourceFile = tracePoint->sourceFile;
+        e->lineno = tracePoint->lineno;
+        e->functionName = tracePoint->functionName;
+        e->groupName = tracePoint->groupName;
+        e->action = action;
+
+        AtomicPointer<Entry> &head = m_buckets[bucket( tracePoint )];
+        do {
+            e->next = head.load();
+        } while ( !head.testAndSet( e->next, e ) );
+    }
+
+private:
+    DecisionTable( const DecisionTable &other );
+    void operator=( const DecisionTable &rhs );
+
+    static const size_t BucketCount = 16384;
+
+    struct Entry {
+        const char *sourceFile;
+        unsigned int lineno;
+        const char *functionName;
+        const char *groupName;
+        unsigned int action;
+        Entry *next;
+    };
+
+    static size_t bucket( const TracePoint *tracePoint ) {
+        size_t h = (size_t)tracePoint->sourceFile;
+        h = h * 31 + tracePoint->lineno;
+        h = h * 31 + (size_t)tracePoint->functionName;
+        h = h * 31 + (size_t)tracePoint->groupName;
+        h ^= h >> 16;
+        return h % BucketCount;
+    }
+
+    const string m_signature;
+    AtomicPointer<Entry> *m_buckets;
+};
+
+/* At most this many decision tables are kept; the least recently used
+ * one is dropped when another configuration is seen.
+ */
+static const size_t MaximumDecisionTables = 4;
+
+/* An immutable view of one configuration file, shared by all threads which
+ * (re)configure trace points. Replaced as a whole on every reload.
+ */
+struct ConfigurationSnapshot
+{
+    explicit ConfigurationSnapshot( Configuration *configuration_ )
+        : configuration( configuration_ ), decisions( 0 ), generation( 0 ) { }
+    ~ConfigurationSnapshot() {
+        deleteRange( tracePointSets.begin(), tracePointSets.end() );
+        delete configuration;
+    }
+
+    Configuration *configuration;
+    vector<TracePointSet *> tracePointSets;
+    FilterProgram filterProgram; // compiled from tracePointSets
+    DecisionTable *decisions; // owned by Trace::m_decisionTables
+    size_t generation;
+};
+
+/* Generations are unique across all Trace objects so that a trace point
+ * configured by one of them is never mistaken as up to date by another.
+ */
+static AtomicCounter g_nextConfigurationGeneration;
+
+/* Stored in TracePoint::configurationGeneration while a thread is
+ * evaluating the trace point sets for it.
+ */
+static const size_t ConfiguringTracePoint = (size_t)-1;
+
 static void recordCrashInTrace()
 {
     string sourceFile = "<unknown file>";
@@ -55,8 +176,7 @@ static void recordCrashInTrace()
                           functionName.c_str(), 0 );
     TraceEntry te( &tp, "The application crashed at this point!" );
     te.backtrace = bt;
-    getActiveTrace()->addEntry( te );
-
+    getActiveTrace()->addCrashEntry( te );
 }
 
 const struct CrashHandlerInstaller {
@@ -105,6 +225,18 @@ TraceEntry::TraceEntry( const TracePoint *tracePoint_, const char *msg )
 {
 }
 
+TraceEntry::TraceEntry( const TracePoint *tracePoint_, ThreadId threadId_, uint64_t timeStamp_,
+                        size_t stackPosition_, const char *msg )
+    : threadId( threadId_ ),
+    timeStamp( timeStamp_ ),
+    tracePoint( tracePoint_ ),
+    variables( 0 ),
+    backtrace( 0 ),
+    message( msg ),
+    stackPosition( stackPosition_ )
+{
+}
+
 TraceEntry::~TraceEntry()
 {
     // variables are deleted on the caller side of the macros so the delete happens with the
@@ -127,7 +259,6 @@ static LogOutput* checkForLogFileEnvVar( const char* envVar )
 Trace::Trace()
     : m_serializer( 0 ),
     m_output( 0 ),
-    m_configuration( 0 ),
     m_configFileMonitor( 0 ),
     m_log( 0 ),
     m_errorOutput( 0 ),
@@ -166,6 +297,9 @@ Trace::~Trace()
 {
     ShutdownNotifier::self().removeObserver( this );
 
+    // Drains any pending entries, so do this while serializer and output are alive.
+    delete m_dispatcher.fetchAndStore( 0 );
+
     {
         MutexLocker serializerLocker( m_serializerMutex );
         delete m_serializer;
@@ -176,11 +310,8 @@ Trace::~Trace()
         delete m_output;
     }
 
-    {
-        MutexLocker configurationLocker( m_configurationMutex );
-        deleteRange( m_tracePointSets.begin(), m_tracePointSets.end() );
-        delete m_configuration;
-    }
+    delete m_configuration.fetchAndStore( 0 );
+    deleteRange( m_decisionTables.begin(), m_decisionTables.end() );
 
     delete m_configFileMonitor;
     delete m_log;
@@ -192,16 +323,22 @@ void Trace::reloadConfiguration( const string &fileName )
 {
     m_log->writeStatus( "Trace::reloadConfiguration: reading configuration file from '%s'", fileName.c_str() );
     Configuration *cfg = Configuration::fromFile( fileName, m_log );
+
+    /* Entries captured so far belong to the old serializer and output. */
+    flushPendingEntries();
+
+    ConfigurationSnapshot *snapshot = new ConfigurationSnapshot( cfg );
     if ( cfg ) {
+        const DispatchConfiguration &dispatchCfg = cfg->dispatchConfiguration();
+        if ( dispatchCfg.mode == DispatchConfiguration::Asynchronous && !m_dispatcher.load() ) {
+            m_dispatcher.store( new AsyncDispatcher( this, m_log ) );
+        }
+        if ( AsyncDispatcher *dispatcher = m_dispatcher.load() ) {
+            dispatcher->configure( dispatchCfg );
+        }
+
         setSerializer( cfg->configuredSerializer() );
         setOutput( cfg->configuredOutput() );
-        {
-            MutexLocker configurationLocker( m_configurationMutex );
-            deleteRange( m_tracePointSets.begin(), m_tracePointSets.end() );
-            m_tracePointSets = cfg->configuredTracePointSets();
-            delete m_configuration;
-            m_configuration = cfg;
-        }
 
         {
             MutexLocker serializerLocker( m_serializerMutex );
@@ -210,6 +347,8 @@ void Trace::reloadConfiguration( const string &fileName )
             }
         }
 
+        snapshot->tracePointSets = cfg->configuredTracePointSets();
+
         /* If any trace keys are given in the XML file, they also implicitely
          * filter out all those trace entries which do not have any of the
          * specified keys. A feature requested by Siemens.
@@ -217,8 +356,8 @@ void Trace::reloadConfiguration( const string &fileName )
         const vector<TraceKey> traceKeys = cfg->configuredTraceKeys();
         TraceEntry::process.availableTraceKeys = traceKeys;
         if ( !traceKeys.empty() ) {
-            vector<TracePointSet *>::iterator setIt, setEnd = m_tracePointSets.end();
-            for ( setIt = m_tracePointSets.begin(); setIt != setEnd; ++setIt ) {
+            vector<TracePointSet *>::iterator setIt, setEnd = snapshot->tracePointSets.end();
+            for ( setIt = snapshot->tracePointSets.begin(); setIt != setEnd; ++setIt ) {
                 bool haveEnabledTraceKey = false;
                 GroupFilter *groupFilter = new GroupFilter;
                 groupFilter->setMode( GroupFilter::Whitelist );
@@ -235,87 +374,204 @@ void Trace::reloadConfiguration( const string &fileName )
                     newFilter->addFilter( groupFilter );
                     newFilter->addFilter( ( *setIt )->filter() );
                     ( *setIt )->setFilter( newFilter );
+                } else {
+                    delete groupFilter;
                 }
             }
         }
     } else {
+        if ( AsyncDispatcher *dispatcher = m_dispatcher.load() ) {
+            dispatcher->configure( DispatchConfiguration() );
+        }
         setSerializer( 0 );
         setOutput( 0 );
-        {
-            MutexLocker configurationLocker( m_configurationMutex );
-            deleteRange( m_tracePointSets.begin(), m_tracePointSets.end() );
-            m_tracePointSets.clear();
-            delete m_configuration;
-            m_configuration = 0;
-        }
         TraceEntry::process.availableTraceKeys.clear();
     }
-    if( m_configuration ) {
+
+    /* The trace point sets must be complete at this point; trace points
+     * may start evaluating them as soon as they are published.
+     */
+    vector<TracePointSet *>::const_iterator setIt, setEnd = snapshot->tracePointSets.end();
+    for ( setIt = snapshot->tracePointSets.begin(); setIt != setEnd; ++setIt ) {
+        const bool ignored = ( *setIt )->actions() == TracePointSet::IgnoreTracePoint;
+        snapshot->filterProgram.addFilter( ignored ? 0 : ( *setIt )->filter() );
+    }
+    snapshot->filterProgram.finalize();
+
+    string signature = snapshot->filterProgram.signature();
+    for ( setIt = snapshot->tracePointSets.begin(); setIt != setEnd; ++setIt ) {
+        char buf[16];
+        sprintf( buf, "%x,", ( *setIt )->actions() );
+        signature += buf;
+    }
+    publishConfiguration( snapshot, signature );
+
+    if( cfg ) {
         m_log->writeStatus( "Trace::reloadConfiguration: configuration updated with serializer: %s and output: %s",
                             (m_serializer ? "yes" : "no"),
                             (m_output ? "yes" : "no") );
     }
 }
 
-void Trace::configureTracePoint( TracePoint *tracePoint ) const
+/* Makes the given snapshot the current configuration. Trace points notice
+ * the new generation number the next time they are visited and reconfigure
+ * themselves; the old snapshot is deleted as soon as no configureTracePoint()
+ * call is reading it anymore.
+ *
+ * Readers register in one of two counters, picked by the reader epoch. To
+ * find out when the readers which may still see the old snapshot are gone,
+ * the epoch is advanced and the counter of the previous epoch, which no new
+ * reader enters anymore, is waited for to drop to zero. A reader may have
+ * picked its counter just before the epoch changed and only enter it
+ * afterwards, so this is done for both counters. That way readers arriving
+ * all the time cannot keep the old snapshot from being deleted.
+ *
+ * Trace points only need to run the filters again if no earlier snapshot
+ * had the same filter signature, e.g. when merely the output settings
+ * changed.
+ */
+void Trace::publishConfiguration( ConfigurationSnapshot *snapshot, const string &filterSignature )
 {
     MutexLocker configurationLocker( m_configurationMutex );
-    tracePoint->lastUsedConfiguration = m_configuration;
 
-    if ( m_tracePointSets.empty() ) {
-        tracePoint->active = true;
+    vector<DecisionTable *>::iterator it, end = m_decisionTables.end();
+    for ( it = m_decisionTables.begin(); it != end; ++it ) {
+        if ( ( *it )->signature() == filterSignature ) {
+            break;
+        }
+    }
+    if ( it != end ) {
+        snapshot->decisions = *it;
+        m_decisionTables.erase( it );
+    } else {
+        snapshot->decisions = new DecisionTable( filterSignature );
+    }
+    m_decisionTables.insert( m_decisionTables.begin(), snapshot->decisions );
+
+    snapshot->generation = g_nextConfigurationGeneration.fetchAndAdd( 1 ) + 1;
+    ConfigurationSnapshot *oldSnapshot = m_configuration.fetchAndStore( snapshot );
+    m_configurationGeneration.store( snapshot->generation );
+
+    for ( int i = 0; i < 2; ++i ) {
+        const size_t previousEpoch = m_readerEpoch.fetchAndAdd( 1 );
+        while ( m_configurationReaders[previousEpoch & 1].fetchAndAdd( 0 ) != 0 ) {
+            Thread::sleep( 1 );
+        }
+    }
+    delete oldSnapshot;
+
+    // Only the current snapshot can still refer to the first table.
+    while ( m_decisionTables.size() > MaximumDecisionTables ) {
+        delete m_decisionTables.back();
+        m_decisionTables.pop_back();
+    }
+}
+
+void Trace::configureTracePoint( TracePoint *tracePoint ) const
+{
+    /* Only one thread gets to configure a given trace point; any other
+     * thread visiting it meanwhile keeps using the previous settings. If
+     * there are none yet, it waits for them instead of skipping the entry.
+     */
+    const size_t lastGeneration = atomicLoad( &tracePoint->configurationGeneration );
+    if ( lastGeneration == ConfiguringTracePoint ||
+         !atomicTestAndSet( &tracePoint->configurationGeneration, lastGeneration, ConfiguringTracePoint ) ) {
+        while ( !( atomicLoad( &tracePoint->flags ) & TracePoint::Configured ) ) {
+            Thread::sleep( 0 );
+        }
         return;
     }
 
-    tracePoint->active = false;
+    AtomicCounter &readers = m_configurationReaders[m_readerEpoch.load() & 1];
+    readers.fetchAndAdd( 1 );
+    const ConfigurationSnapshot *snapshot = m_configuration.load();
 
-    vector<TracePointSet *>::const_iterator it, end = m_tracePointSets.end();
-    for ( it = m_tracePointSets.begin(); it != end; ++it ) {
-        const unsigned int action = ( *it )->actionForTracePoint( tracePoint );
-        if ( action == TracePointSet::IgnoreTracePoint ) {
-            continue;
+    // Without trace point sets, trace points keep what they yielded before
+    size_t flags = TracePoint::Configured;
+    if ( snapshot->tracePointSets.empty() ) {
+        flags |= TracePoint::Active | ( atomicLoad( &tracePoint->flags ) &
+                                        ( TracePoint::BacktracesEnabled | TracePoint::VariableSnapshotEnabled ) );
+    }
+
+    unsigned int action;
+    if ( !snapshot->decisions->lookup( tracePoint, &action ) ) {
+        const size_t matchingSet = snapshot->filterProgram.match( tracePoint );
+        action = matchingSet == FilterProgram::NoMatch ? TracePointSet::IgnoreTracePoint
+                                                       : snapshot->tracePointSets[matchingSet]->actions();
+        snapshot->decisions->insert( tracePoint, action );
+    }
+    if ( action != TracePointSet::IgnoreTracePoint ) {
+        flags = TracePoint::Configured | TracePoint::Active;
+        if ( ( action & TracePointSet::YieldBacktrace ) == TracePointSet::YieldBacktrace ) {
+            flags |= TracePoint::BacktracesEnabled;
         }
+        if ( ( action & TracePointSet::YieldVariables ) == TracePointSet::YieldVariables ) {
+            flags |= TracePoint::VariableSnapshotEnabled;
+        }
+    }
 
-        tracePoint->active = true;
-        tracePoint->backtracesEnabled = ( action & TracePointSet::YieldBacktrace ) == TracePointSet::YieldBacktrace;
-        tracePoint->variableSnapshotEnabled = ( action & TracePointSet::YieldVariables ) == TracePointSet::YieldVariables;
+    const size_t generation = snapshot->generation;
+    const bool haveTracePointSets = !snapshot->tracePointSets.empty();
+    readers.fetchAndAdd( -1 );
 
-        m_log->writeStatus( "Trace::configureTracePoint: activating trace point at %s:%d (backtraces=%d, variables=%d)", tracePoint->sourceFile, tracePoint->lineno, tracePoint->backtracesEnabled, tracePoint->variableSnapshotEnabled );
+    atomicStore( &tracePoint->flags, flags );
+    atomicStore( &tracePoint->configurationGeneration, generation );
 
+    if ( !haveTracePointSets ) {
         return;
     }
-
-    m_log->writeStatus( "Trace::configureTracePoint: trace point at %s:%d is not active", tracePoint->sourceFile, tracePoint->lineno );
+    if ( flags & TracePoint::Active ) {
+        m_log->writeStatus( "Trace::configureTracePoint: activating trace point at %s:%d (backtraces=%d, variables=%d)", tracePoint->sourceFile, tracePoint->lineno,
+                            ( flags & TracePoint::BacktracesEnabled ) != 0, ( flags & TracePoint::VariableSnapshotEnabled ) != 0 );
+    } else {
+        m_log->writeStatus( "Trace::configureTracePoint: trace point at %s:%d is not active", tracePoint->sourceFile, tracePoint->lineno );
+    }
 }
 
 // configures the trace point if necessary and tells us if it's
 // supposed to be visited.
 bool Trace::advanceVisit( TracePoint *tracePoint ) const
 {
-    if ( tracePoint->lastUsedConfiguration != m_configuration ) {
+    if ( atomicLoad( &tracePoint->configurationGeneration ) != m_configurationGeneration.load() ) {
         configureTracePoint( tracePoint );
     }
 
-    return tracePoint->active && m_serializer && m_output;
+    return ( atomicLoad( &tracePoint->flags ) & TracePoint::Active ) && m_serializer && m_output;
 }
 
 void Trace::visitTracePoint( const TracePoint *tracePoint,
                              const char *msg,
                              VariableSnapshot *variables )
 {
-    {
-        MutexLocker outputLocker( m_outputMutex );
-        if ( !m_output || ( !m_output->canWrite() && !m_output->open() ) ) {
-            return;
+    const size_t flags = atomicLoad( &tracePoint->flags );
+
+    /* In asynchronous mode, only capture the entry here; serializing
+     * and writing it is done by the dispatcher thread. Like for entries
+     * created right here, the stack position is taken in this frame.
+     */
+    AsyncDispatcher *dispatcher = m_dispatcher.load();
+    if ( dispatcher && dispatcher->isEnabled() ) {
+        Backtrace *backtrace = 0;
+        if ( flags & TracePoint::BacktracesEnabled ) {
+            backtrace = new Backtrace( m_backtraceGenerator.generate( 1 /* omit this function in backtrace */ ) );
         }
+        dispatcher->enqueue( tracePoint, reinterpret_cast<size_t>( &backtrace ), msg,
+                             ( flags & TracePoint::VariableSnapshotEnabled ) ? variables : 0,
+                             backtrace );
+        return;
+    }
+
+    if ( !prepareOutput() ) {
+        m_droppedEntries.fetchAndAdd( 1 );
+        return;
     }
 
     TraceEntry entry( tracePoint, msg );
-    if ( tracePoint->backtracesEnabled ) {
+    if ( flags & TracePoint::BacktracesEnabled ) {
         entry.backtrace = new Backtrace( m_backtraceGenerator.generate( 1 /* omit this function in backtrace */ ) );
     }
 
-    if ( tracePoint->variableSnapshotEnabled ) {
+    if ( flags & TracePoint::VariableSnapshotEnabled ) {
         entry.variables = variables;
     }
 
@@ -324,21 +580,133 @@ void Trace::visitTracePoint( const TracePoint *tracePoint,
 
 void Trace::addEntry( const TraceEntry &entry )
 {
-    vector<char> data;
-    {
-        MutexLocker serializerLocker( m_serializerMutex );
-        if ( !m_serializer ) {
-            return;
-        }
-        data = m_serializer->serialize( entry );
+    if ( !prepareOutput() ) {
+        m_droppedEntries.fetchAndAdd( 1 );
+        return;
     }
 
-    if ( !data.empty() ) {
-        MutexLocker outputLocker( m_outputMutex );
-        if ( !m_output || ( !m_output->canWrite() && !m_output->open() ) ) {
+    /* Keep holding the serializer mutex while writing so that the data is
+     * written in the order it was serialized in; serializers which refer
+     * to data sent earlier in the stream rely on that.
+     */
+    MutexLocker serializerLocker( m_serializerMutex );
+    if ( !m_serializer ) {
+        return;
+    }
+
+    /* Let the trace show where entries are missing because the dispatcher
+     * or the output had to drop them.
+     */
+    const size_t dropped = m_droppedEntries.load();
+    if ( dropped > 0 && m_droppedEntries.testAndSet( dropped, 0 ) ) {
+        static TracePoint droppedEntriesTracePoint( TracePointType::Error, __FILE__, __LINE__,
+                                                    "Trace::addEntry", 0 );
+        char msg[128];
+        sprintf( msg, "%lu trace entries were dropped since the output could not keep up",
+                 static_cast<unsigned long>( dropped ) );
+        TraceEntry report( &droppedEntriesTracePoint, msg );
+        if ( !writeEntry( report ) ) {
+            // Report them with the next entry which makes it through
+            m_droppedEntries.fetchAndAdd( dropped );
+        }
+
+        // Writing the report may have required a new stream.
+        if ( !prepareOutput() ) {
+            m_droppedEntries.fetchAndAdd( 1 );
             return;
         }
-        m_output->write( data );
+    }
+
+    if ( !writeEntry( entry ) ) {
+        m_droppedEntries.fetchAndAdd( 1 );
+    }
+}
+
+// Must be called with m_serializerMutex held. Returns false if the entry
+// was discarded since the output could not be written to.
+bool Trace::writeEntry( const TraceEntry &entry )
+{
+    if ( m_restartStream.testAndSet( 1, 0 ) ) {
+        m_serializer->restartStream();
+    }
+    m_serializationBuffer.clear();
+    m_serializer->serialize( entry, m_serializationBuffer );
+    if ( m_serializationBuffer.empty() ) {
+        return true;
+    }
+    return writeData( m_serializationBuffer, entry.tracePoint->type );
+}
+
+void Trace::addDroppedEntries( size_t count )
+{
+    m_droppedEntries.fetchAndAdd( count );
+}
+
+// Makes sure the output can be written to. In case it had to be (re)opened,
+// the serializer is told to start a new stream.
+bool Trace::prepareOutput()
+{
+    MutexLocker outputLocker( m_outputMutex );
+    if ( !m_output ) {
+        return false;
+    }
+    if ( m_output->canWrite() ) {
+        return true;
+    }
+    if ( !m_output->open() ) {
+        return false;
+    }
+    m_restartStream.store( 1 );
+    return true;
+}
+
+bool Trace::writeData( const vector<char> &data, TracePointType::Value type )
+{
+    MutexLocker outputLocker( m_outputMutex );
+    if ( !m_output || !m_output->canWrite() ) {
+        m_restartStream.store( 1 );
+        return false;
+    }
+    m_output->writeEntry( data, type );
+    if ( const size_t dropped = m_output->takeDroppedEntries() ) {
+        m_droppedEntries.fetchAndAdd( dropped );
+    }
+    if ( !m_output->canWrite() ) {
+        m_restartStream.store( 1 );
+    }
+    return true;
+}
+
+/* Writes the given entry after all entries traced so far and makes sure it
+ * leaves the output buffers since the process is about to die. The crash
+ * may have happened on the dispatcher thread while draining the queues, so
+ * the entries queued for it are skipped rather than waited for if need be.
+ */
+void Trace::addCrashEntry( const TraceEntry &entry )
+{
+    if ( AsyncDispatcher *dispatcher = m_dispatcher.load() ) {
+        dispatcher->tryFlush();
+    }
+
+    addEntry( entry );
+
+    MutexLocker outputLocker( m_outputMutex );
+    if ( m_output ) {
+        m_output->flush();
+    }
+}
+
+// Writes out all entries which were traced so far, including those still
+// queued for the dispatcher thread or buffered by the output.
+void Trace::flushPendingEntries()
+{
+    if ( AsyncDispatcher *dispatcher = m_dispatcher.load() ) {
+        dispatcher->flush();
+    }
+
+    MutexLocker outputLocker( m_outputMutex );
+    if ( m_output ) {
+        m_output->flush();
     }
 }
 
@@ -365,20 +733,27 @@ void Trace::handleProcessShutdown()
 {
     m_log->writeStatus( "Trace::handleProcessShutdown: detected process shutdown" );
 
+    flushPendingEntries();
+
     ProcessShutdownEvent ev;
 
-    vector<char> data;
-    {
-        MutexLocker serializerLocker( m_serializerMutex );
-        if ( !m_serializer ) {
-            return;
-        }
-        data = m_serializer->serialize( ev );
+    if ( !prepareOutput() ) {
+        return;
+    }
+
+    MutexLocker serializerLocker( m_serializerMutex );
+    if ( !m_serializer ) {
+        return;
     }
+    if ( m_restartStream.testAndSet( 1, 0 ) ) {
+        m_serializer->restartStream();
+    }
+    vector<char> data;
+    m_serializer->serialize( ev, data );
 
     if ( !data.empty() ) {
         MutexLocker outputLocker( m_outputMutex );
-        if ( !m_output || ( !m_output->canWrite() && !m_output->open() ) ) {
+        if ( !m_output || !m_output->canWrite() ) {
             return;
         }
         m_output->write( data );
@@ -21,12 +21,14 @@
 #define TRACELIB_TRACE_H
 
 #include "tracelib_config.h"
+#include "atomic.h"
 #include "backtrace.h"
 #include "configuration.h" // for TraceKey
 #include "filemodificationmonitor.h"
 #include "getcurrentthreadid.h"
 #include "mutex.h"
 #include "shutdownnotifier.h"
+#include "tracepoint.h"
 #include "variabledumping.h"
 #include "config.h" // for uint64_t
 
@@ -34,6 +36,9 @@
 
 TRACELIB_NAMESPACE_BEGIN
 
+class AsyncDispatcher;
+struct ConfigurationSnapshot;
+class DecisionTable;
 class Filter;
 class Output;
 class Serializer;
@@ -54,6 +59,7 @@ public:
 
     Filter *filter() { return m_filter; }
     void setFilter( Filter *filter ) { m_filter = filter; }
+    unsigned int actions() const { return m_actions; }
 
     unsigned int actionForTracePoint( const TracePoint *tracePoint );
 
@@ -76,6 +82,8 @@ struct TracedProcess
 struct TraceEntry
 {
     TraceEntry( const TracePoint *tracePoint_, const char *msg = 0 );
+    TraceEntry( const TracePoint *tracePoint_, ThreadId threadId_, uint64_t timeStamp_,
+                size_t stackPosition_, const char *msg = 0 );
     ~TraceEntry();
 
     static TracedProcess process;
@@ -110,6 +118,9 @@ public:
                           VariableSnapshot *variables = 0 );
 
     void addEntry( const TraceEntry &e );
+    void addDroppedEntries( size_t count );
+    void addCrashEntry( const TraceEntry &entry );
+    void flushPendingEntries();
 
     void setSerializer( Serializer *serializer );
     void setOutput( Output *output );
@@ -123,14 +134,28 @@ private:
     void operator=( const Trace &trace );
 
     void reloadConfiguration( const std::string &fileName );
+    void publishConfiguration( ConfigurationSnapshot *snapshot, const std::string &filterSignature );
+    bool prepareOutput();
+    bool writeEntry( const TraceEntry &entry );
+    bool writeData( const std::vector<char> &data, TracePointType::Value type );
 
     Serializer *m_serializer;
     Mutex m_serializerMutex;
+    std::vector<char> m_serializationBuffer; // protected by m_serializerMutex
     Output *m_output;
     Mutex m_outputMutex;
-    std::vector<TracePointSet *> m_tracePointSets;
-    Configuration *m_configuration;
-    mutable Mutex m_configurationMutex;
+    AtomicCounter m_restartStream;
+    AtomicCounter m_droppedEntries; // not reported in the trace yet
+    AtomicPointer<AsyncDispatcher> m_dispatcher;
+    AtomicPointer<ConfigurationSnapshot> m_configuration;
+    AtomicCounter m_configurationGeneration;
+    /* configureTracePoint() calls in progress, counted in the slot of the
+     * reader epoch they started in; see publishConfiguration().
+     */
+    AtomicCounter m_readerEpoch;
+    mutable AtomicCounter m_configurationReaders[2];
+    Mutex m_configurationMutex; // serializes publishConfiguration() calls
+    std::vector<DecisionTable *> m_decisionTables; // most recently used first
     BacktraceGenerator m_backtraceGenerator;
     FileModificationMonitor *m_configFileMonitor;
     Log *m_log;
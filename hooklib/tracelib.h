@@ -215,7 +215,7 @@ public:
     }
 
     void flush() {
-        if( m_tracePoint->active ) {
+        if( m_tracePoint->flags & TracePoint::Active ) {
             visitTracePoint( m_tracePoint, m_stream ? m_stream->str().c_str() : "", m_variables );
         }
     }
@@ -4,6 +4,8 @@
 #include "tracelib_config.h"
 #include "dlldefs.h"
 
+#include <stddef.h>
+
 TRACELIB_NAMESPACE_BEGIN
 
 struct TracePointType {
@@ -39,19 +41,22 @@ struct TracePointType {
     }
 };
 
-class Configuration;
-
 struct TracePoint {
+    enum Flag {
+        Configured = 1,
+        Active = 2,
+        BacktracesEnabled = 4,
+        VariableSnapshotEnabled = 8
+    };
+
     TRACELIB_EXPORT TracePoint( TracePointType::Value type_, const char *sourceFile_, unsigned int lineno_, const char *functionName_, const char *groupName_ )
         : type( type_ ),
         sourceFile( sourceFile_ ),
         lineno( lineno_ ),
         functionName( functionName_ ),
         groupName( groupName_ ),
-        lastUsedConfiguration( 0 ),
-        active( false ),
-        backtracesEnabled( false ),
-        variableSnapshotEnabled( false )
+        configurationGeneration( 0 ),
+        flags( 0 )
     {
     }
 
@@ -60,10 +65,14 @@ struct TracePoint {
     const unsigned int lineno;
     const char * const functionName;
     const char * const groupName;
-    const Configuration *lastUsedConfiguration;
-    bool active;
-    bool backtracesEnabled;
-    bool variableSnapshotEnabled;
+    /* Generation of the configuration which 'flags' were computed for; 0
+     * means never.
+     */
+    volatile size_t configurationGeneration;
+    /* Combination of Flag values. Written as a whole before the generation,
+     * so that other threads never see settings of different configurations.
+     */
+    volatile size_t flags;
 };
 
 TRACELIB_NAMESPACE_END
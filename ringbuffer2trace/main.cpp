@@ -0,0 +1,154 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringbufferreader.h"
+
+#include "../hooklib/tracelib.h"
+#include "../server/xmlcontenthandler.h"
+#include "../server/binarycontenthandler.h"
+#include "../server/databasefeeder.h"
+#include "config.h"
+
+#include <cstdio>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QSqlDatabase>
+
+namespace Error
+{
+    const int None = 0;
+    const int CommandLineArgs = 1;
+    const int Open = 2;
+    const int File = 3;
+    const int Transformation = 4;
+}
+
+template <typename ContentHandler>
+static bool feed( ContentHandler &parser, DatabaseFeeder &feeder, const QByteArray &data, QString *errMsg )
+{
+    try {
+        parser.addData( data );
+        parser.continueParsing();
+        feeder.flushPendingEntries();
+    } catch( const SQLTransactionException &ex ) {
+        *errMsg = "Database error: " + QString::fromLatin1( ex.what() ) + ", driver message: " + ex.driverMessage() + "(" + QString::number(ex.driverCode()) + ")";
+        return false;
+    } catch( const std::runtime_error &ex ) {
+        *errMsg = QString::fromLatin1( ex.what() );
+        return false;
+    }
+    return true;
+}
+
+static bool toDatabase( const QString &traceFile, const RingBufferReader &reader, QString *errMsg )
+{
+    const QByteArray data = QByteArray::fromRawData( &reader.traceData()[0],
+                                                     static_cast<int>( reader.traceData().size() ) );
+    if ( !reader.isBinaryData() && !data.trimmed().startsWith( '<' ) ) {
+        *errMsg = "Only data written by the xml or binary serializers can be stored in a trace database; use --dump instead";
+        return false;
+    }
+
+    QSqlDatabase db;
+    if (QFile::exists(traceFile)) {
+        db = Database::open(traceFile, errMsg);
+    } else {
+        db = Database::create(traceFile, errMsg);
+    }
+    if (!db.isValid()) {
+        *errMsg = "Failed to open output trace database " + traceFile + ": " + *errMsg;
+        return false;
+    }
+
+    DatabaseFeeder feeder( db );
+    if ( reader.isBinaryData() ) {
+        BinaryContentHandler binaryparser( &feeder );
+        return feed( binaryparser, feeder, data, errMsg );
+    }
+
+    XmlContentHandler xmlparser( &feeder );
+    xmlparser.addData( "<toplevel_trace_element>" );
+    return feed( xmlparser, feeder, data, errMsg );
+}
+
+int main( int argc, char **argv )
+{
+    QCoreApplication a( argc, argv );
+    a.setApplicationVersion(QLatin1String(TRACELIB_VERSION_STR));
+
+    QCommandLineParser opt;
+    QCommandLineOption dumpOption(QStringList() << "d" << "dump", "Write the extracted trace data as it is to the given file instead of a trace database", "file");
+    opt.setApplicationDescription("Extracts the trace data of a ring buffer output file into a trace database.");
+    opt.addHelpOption();
+    opt.addVersionOption();
+    opt.addOption(dumpOption);
+    opt.addPositionalArgument("ringbuffer-file", "Ring buffer file written by tracelib.");
+    opt.addPositionalArgument(".trace-file", "Trace database output file to write into.");
+    opt.process(a);
+
+    const QStringList args = opt.positionalArguments();
+    if ( args.isEmpty() || ( args.size() < 2 && !opt.isSet( dumpOption ) ) ) {
+        fprintf(stderr, "Missing ring buffer file or output trace database filename\n");
+        opt.showHelp(Error::CommandLineArgs);
+    }
+
+    // Map the file rather than reading it, it may be rather large
+    QFile input( args.at(0) );
+    if ( !input.open( QIODevice::ReadOnly ) ) {
+        fprintf( stderr, "File '%s' cannot be opened for reading.\n", qPrintable( input.fileName() ));
+        return Error::File;
+    }
+    const uchar *contents = input.map( 0, input.size() );
+    if ( !contents ) {
+        fprintf( stderr, "File '%s' cannot be mapped: %s\n", qPrintable( input.fileName() ), qPrintable( input.errorString() ));
+        return Error::File;
+    }
+
+    RingBufferReader reader;
+    if ( !reader.read( reinterpret_cast<const char *>( contents ), static_cast<size_t>( input.size() ) ) ) {
+        fprintf( stderr, "Failed to read ring buffer: %s\n", reader.errorString().c_str() );
+        return Error::Open;
+    }
+    input.close();
+    if ( reader.isTruncated() ) {
+        fprintf( stderr, "Ring buffer ends with an incomplete record, ignoring it.\n" );
+    }
+    if ( reader.recordCount() == 0 ) {
+        fprintf( stderr, "Ring buffer does not contain any trace data.\n" );
+        return Error::None;
+    }
+
+    if ( opt.isSet( dumpOption ) ) {
+        QFile output( opt.value( dumpOption ) );
+        if ( !output.open( QIODevice::WriteOnly | QIODevice::Truncate ) ||
+             output.write( &reader.traceData()[0], reader.traceData().size() ) != static_cast<qint64>( reader.traceData().size() ) ) {
+            fprintf( stderr, "File '%s' cannot be written: %s\n", qPrintable( output.fileName() ), qPrintable( output.errorString() ));
+            return Error::File;
+        }
+        return Error::None;
+    }
+
+    QString errMsg;
+    if ( !toDatabase( args.at(1), reader, &errMsg ) ) {
+        fprintf( stderr, "Transformation error: %s\n", qPrintable( errMsg ));
+        return Error::Transformation;
+    }
+    return Error::None;
+}
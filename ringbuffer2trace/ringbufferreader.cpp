@@ -0,0 +1,119 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringbufferreader.h"
+
+#include "../hooklib/ringbufferformat.h"
+
+#include <string.h>
+
+using namespace std;
+namespace RingBufferFormat = TRACELIB_NAMESPACE_IDENT(RingBufferFormat);
+
+static bool readRecordHeader( const char *dataArea, uint64_t capacity, uint64_t position,
+                              RingBufferFormat::RecordHeader *record )
+{
+    const uint64_t offset = position % capacity;
+    if ( offset + RingBufferFormat::RecordHeaderSize > capacity ) {
+        return false;
+    }
+    memcpy( record, dataArea + offset, sizeof( RingBufferFormat::RecordHeader ) );
+    return record->position == position &&
+           ( record->flags & RingBufferFormat::Committed ) != 0 &&
+           offset + RingBufferFormat::recordSpan( record->size ) <= capacity;
+}
+
+RingBufferReader::RingBufferReader()
+    : m_binaryData( false ),
+    m_recordCount( 0 ),
+    m_truncated( false )
+{
+}
+
+bool RingBufferReader::read( const char *data, size_t size )
+{
+    m_traceData.clear();
+    m_recordCount = 0;
+    m_truncated = false;
+
+    RingBufferFormat::FileHeader header;
+    if ( size < RingBufferFormat::FileHeaderSize ) {
+        m_errorString = "File is too small to be a ring buffer";
+        return false;
+    }
+    memcpy( &header, data, sizeof( header ) );
+    if ( header.magic != RingBufferFormat::Magic ) {
+        m_errorString = "File is not a ring buffer written by tracelib";
+        return false;
+    }
+    if ( header.version != RingBufferFormat::Version ) {
+        m_errorString = "Unsupported ring buffer version";
+        return false;
+    }
+    if ( header.headerSize < RingBufferFormat::FileHeaderSize || header.capacity == 0 ||
+         header.capacity % RingBufferFormat::RecordAlignment != 0 ||
+         size < header.headerSize + header.capacity ) {
+        m_errorString = "Ring buffer file is truncated or corrupt";
+        return false;
+    }
+    m_binaryData = ( header.flags & RingBufferFormat::BinaryData ) != 0;
+
+    const char *dataArea = data + header.headerSize;
+    const uint64_t capacity = header.capacity;
+    const uint64_t head = header.head;
+
+    /* Everything before head - capacity has been overwritten. Find the
+     * first record after that point; a record header is only accepted if
+     * it repeats its own position.
+     */
+    uint64_t position = head > capacity ? head - capacity : 0;
+    position = ( position + RingBufferFormat::RecordAlignment - 1 ) & ~(uint64_t)( RingBufferFormat::RecordAlignment - 1 );
+    RingBufferFormat::RecordHeader record;
+    while ( position < head && !readRecordHeader( dataArea, capacity, position, &record ) ) {
+        position += RingBufferFormat::RecordAlignment;
+    }
+
+    bool inStream = !m_binaryData;
+    while ( position < head ) {
+        const uint64_t offset = position % capacity;
+        if ( offset + RingBufferFormat::RecordHeaderSize > capacity ) {
+            // Too little space left for a record, continue at the beginning.
+            position += capacity - offset;
+            continue;
+        }
+        if ( !readRecordHeader( dataArea, capacity, position, &record ) ) {
+            // Not committed; the process most likely died while writing it.
+            m_truncated = true;
+            break;
+        }
+        if ( ( record.flags & RingBufferFormat::Padding ) == 0 ) {
+            if ( record.flags & RingBufferFormat::StreamStart ) {
+                inStream = true;
+            }
+            if ( inStream ) {
+                const char *payload = dataArea + offset + RingBufferFormat::RecordHeaderSize;
+                m_traceData.insert( m_traceData.end(), payload, payload + record.size );
+                ++m_recordCount;
+            }
+        }
+        position += RingBufferFormat::recordSpan( record.size );
+    }
+    return true;
+}
+
@@ -0,0 +1,54 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RINGBUFFERREADER_H
+#define RINGBUFFERREADER_H
+
+#include <string>
+#include <vector>
+
+/* Extracts the trace data from the contents of a file written by
+ * RingBufferOutput. The records still present in the buffer are
+ * concatenated in the order they were written, yielding the same data a
+ * file output would have written. Binary data starts with the oldest
+ * record which starts a stream, earlier records cannot be decoded anymore.
+ */
+class RingBufferReader
+{
+public:
+    RingBufferReader();
+
+    bool read( const char *data, size_t size );
+
+    const std::vector<char> &traceData() const { return m_traceData; }
+    bool isBinaryData() const { return m_binaryData; }
+    unsigned int recordCount() const { return m_recordCount; }
+    bool isTruncated() const { return m_truncated; }
+    const std::string &errorString() const { return m_errorString; }
+
+private:
+    std::vector<char> m_traceData;
+    bool m_binaryData;
+    unsigned int m_recordCount;
+    bool m_truncated;
+    std::string m_errorString;
+};
+
+#endif // !defined(RINGBUFFERREADER_H)
+
@@ -48,7 +48,9 @@ def main():
             "examples",
             "convertdb",
             "trace2xml",
-            "xml2trace"
+            "trace2columns",
+            "xml2trace",
+            "ringbuffer2trace"
             ]
 
     cppcheck_args = [ "cppcheck",
@@ -0,0 +1,286 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binarycontenthandler.h"
+
+#include "../hooklib/binaryformat.h"
+
+#include <QDataStream>
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace BinaryFormat = TRACELIB_NAMESPACE_IDENT(BinaryFormat);
+
+BinaryContentHandler::BinaryContentHandler( XmlParseEventsHandler *handler )
+    : m_handler( handler ),
+    m_haveStreamHeader( false )
+{
+}
+
+/* XML data always starts with a '<' while a binary stream starts with
+ * the size of the stream header record.
+ */
+bool BinaryContentHandler::isBinaryData( const QByteArray &data )
+{
+    return !data.isEmpty() && data.at( 0 ) != '<';
+}
+
+void BinaryContentHandler::addData( const QByteArray &data )
+{
+    m_buffer.append( data );
+}
+
+void BinaryContentHandler::continueParsing()
+{
+    int pos = 0;
+    while ( m_buffer.size() - pos >= static_cast<int>( BinaryFormat::RecordHeaderSize ) ) {
+        const uchar *header = reinterpret_cast<const uchar *>( m_buffer.constData() + pos );
+        const quint32 size = header[0] | ( header[1] << 8 ) | ( header[2] << 16 ) | ( quint32( header[3] ) << 24 );
+        const quint8 type = header[4];
+        if ( size > BinaryFormat::MaximumRecordSize ) {
+            m_buffer.remove( 0, pos );
+            throw runtime_error( "Oversized record in binary trace data" );
+        }
+        if ( static_cast<quint32>( m_buffer.size() - pos ) - BinaryFormat::RecordHeaderSize < size ) {
+            break;
+        }
+
+        const QByteArray payload = QByteArray::fromRawData( m_buffer.constData() + pos + BinaryFormat::RecordHeaderSize, size );
+        pos += BinaryFormat::RecordHeaderSize + size;
+
+        QDataStream stream( payload );
+        stream.setByteOrder( QDataStream::LittleEndian );
+        try {
+            handleRecord( type, stream );
+        } catch ( ... ) {
+            m_buffer.remove( 0, pos );
+            throw;
+        }
+        if ( stream.status() != QDataStream::Ok ) {
+            m_buffer.remove( 0, pos );
+            throw runtime_error( "Truncated record in binary trace data" );
+        }
+    }
+    m_buffer.remove( 0, pos );
+}
+
+void BinaryContentHandler::handleRecord( quint8 type, QDataStream &stream )
+{
+    if ( type == BinaryFormat::StreamHeaderRecord ) {
+        handleStreamHeader( stream );
+        return;
+    }
+
+    if ( !m_haveStreamHeader ) {
+        throw runtime_error( "Binary trace data does not start with a stream header" );
+    }
+
+    switch ( type ) {
+        case BinaryFormat::StringRecord: {
+            quint32 id;
+            stream >> id;
+            m_strings.insert( id, readString( stream ) );
+            break;
+        }
+        case BinaryFormat::TraceKeysRecord: {
+            quint32 count;
+            stream >> count;
+            m_traceKeys.clear();
+            for ( quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i ) {
+                quint8 enabled;
+                quint32 nameId;
+                stream >> enabled >> nameId;
+                TraceKey key;
+                key.enabled = enabled != 0;
+                key.name = lookupString( nameId );
+                m_traceKeys.append( key );
+            }
+            break;
+        }
+        case BinaryFormat::StorageConfigurationRecord: {
+            quint64 maximumSize;
+            quint16 shrinkBy;
+            quint32 archiveDirId;
+            stream >> maximumSize >> shrinkBy >> archiveDirId;
+            StorageConfiguration cfg;
+            cfg.maximumSize = maximumSize;
+            cfg.shrinkBy = shrinkBy;
+            cfg.archiveDir = lookupString( archiveDirId );
+            m_handler->applyStorageConfiguration( cfg );
+            break;
+        }
+        case BinaryFormat::TraceEntryRecord:
+            handleTraceEntry( stream );
+            break;
+        case BinaryFormat::ShutdownEventRecord: {
+            quint32 pid;
+            quint64 startTime, stopTime;
+            quint32 nameId;
+            stream >> pid >> startTime >> stopTime >> nameId;
+            ProcessShutdownEvent ev;
+            ev.pid = pid;
+            ev.startTime = QDateTime::fromMSecsSinceEpoch( startTime );
+            ev.stopTime = QDateTime::fromMSecsSinceEpoch( stopTime );
+            ev.name = lookupString( nameId );
+            m_handler->handleShutdownEvent( ev );
+            break;
+        }
+        default:
+            // Unknown records are skipped so that newer tracelibs can add some.
+            break;
+    }
+}
+
+void BinaryContentHandler::handleStreamHeader( QDataStream &stream )
+{
+    quint32 magic;
+    quint16 version;
+    stream >> magic >> version;
+    if ( magic != BinaryFormat::Magic ) {
+        throw runtime_error( "Invalid binary trace data" );
+    }
+    if ( version > BinaryFormat::Version ) {
+        throw runtime_error( "Unsupported binary trace data version" );
+    }
+    m_strings.clear();
+    m_traceKeys.clear();
+    m_haveStreamHeader = true;
+}
+
+void BinaryContentHandler::handleTraceEntry( QDataStream &stream )
+{
+    quint32 pid, processNameId, groupId, lineno, fileId, functionId;
+    quint64 processStartTime, tid, timestamp, stackPosition;
+    quint8 type, flags;
+    stream >> pid >> processStartTime >> tid >> timestamp >> stackPosition
+           >> processNameId >> groupId >> type >> lineno >> fileId >> functionId
+           >> flags;
+
+    TraceEntry entry;
+    entry.pid = pid;
+    entry.processStartTime = QDateTime::fromMSecsSinceEpoch( processStartTime );
+    entry.processName = lookupString( processNameId );
+    entry.tid = tid;
+    entry.timestamp = QDateTime::fromMSecsSinceEpoch( timestamp );
+    entry.type = type;
+    entry.path = lookupString( fileId );
+    entry.lineno = lineno;
+    entry.groupName = lookupString( groupId );
+    entry.function = lookupString( functionId );
+    entry.stackPosition = stackPosition;
+    entry.traceKeys = m_traceKeys;
+
+    if ( flags & BinaryFormat::HasMessage ) {
+        entry.message = readString( stream );
+    }
+
+    if ( flags & BinaryFormat::HasVariables ) {
+        quint16 count;
+        stream >> count;
+        for ( quint16 i = 0; i < count && stream.status() == QDataStream::Ok; ++i ) {
+            quint32 nameId;
+            quint8 varType;
+            stream >> nameId >> varType;
+
+            Variable var;
+            var.name = lookupString( nameId );
+            var.type = static_cast<TRACELIB_NAMESPACE_IDENT(VariableType)::Value>( varType );
+            switch ( var.type ) {
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::String:
+                    var.value = readString( stream );
+                    break;
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::Number: {
+                    quint8 isSigned;
+                    quint64 number;
+                    stream >> isSigned >> number;
+                    var.value = isSigned ? QString::number( static_cast<qint64>( number ) )
+                                         : QString::number( number );
+                    break;
+                }
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::Float: {
+                    quint64 bits;
+                    stream >> bits;
+                    double d;
+                    memcpy( &d, &bits, sizeof( d ) );
+                    var.value = QString::number( d, 'g', 6 );
+                    break;
+                }
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::Boolean: {
+                    quint8 b;
+                    stream >> b;
+                    var.value = QString::number( b != 0 ? 1 : 0 );
+                    break;
+                }
+                default:
+                    throw runtime_error( "Unknown variable type in binary trace data" );
+            }
+            entry.variables.append( var );
+        }
+    }
+
+    if ( flags & BinaryFormat::HasBacktrace ) {
+        quint16 depth;
+        stream >> depth;
+        for ( quint16 i = 0; i < depth && stream.status() == QDataStream::Ok; ++i ) {
+            quint32 moduleId, functionId, fileId, lineNumber;
+            quint64 functionOffset;
+            stream >> moduleId >> functionId >> functionOffset >> fileId >> lineNumber;
+
+            StackFrame frame;
+            frame.module = lookupString( moduleId );
+            frame.function = lookupString( functionId );
+            frame.functionOffset = functionOffset;
+            frame.sourceFile = lookupString( fileId );
+            frame.lineNumber = lineNumber;
+            entry.backtrace.append( frame );
+        }
+    }
+
+    if ( stream.status() == QDataStream::Ok ) {
+        m_handler->handleTraceEntry( entry );
+    }
+}
+
+QString BinaryContentHandler::readString( QDataStream &stream ) const
+{
+    quint32 len;
+    stream >> len;
+    if ( stream.status() != QDataStream::Ok || len > static_cast<quint32>( stream.device()->bytesAvailable() ) ) {
+        stream.setStatus( QDataStream::ReadPastEnd );
+        return QString();
+    }
+    const QByteArray utf8 = stream.device()->read( len );
+    return QString::fromUtf8( utf8.constData(), utf8.size() );
+}
+
+QString BinaryContentHandler::lookupString( quint32 id ) const
+{
+    if ( id == BinaryFormat::NoString ) {
+        return QString();
+    }
+    QHash<quint32, QString>::ConstIterator it = m_strings.find( id );
+    if ( it == m_strings.end() ) {
+        throw runtime_error( "Reference to undefined string in binary trace data" );
+    }
+    return it.value();
+}
+
@@ -0,0 +1,63 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACER_BINARYCONTENTHANDLER_H
+#define TRACER_BINARYCONTENTHANDLER_H
+
+#include "xmlcontenthandler.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+class QDataStream;
+
+/* Decodes the stream written by tracelib's binary serializer (see
+ * hooklib/binaryformat.h) and reports the contained events just like
+ * XmlContentHandler does. String ids are only valid within a stream,
+ * so a separate instance is needed per connection.
+ */
+class BinaryContentHandler
+{
+public:
+    BinaryContentHandler( XmlParseEventsHandler *handler );
+
+    static bool isBinaryData( const QByteArray &data );
+
+    void addData( const QByteArray &data );
+
+    void continueParsing();
+
+private:
+    void handleRecord( quint8 type, QDataStream &stream );
+    void handleStreamHeader( QDataStream &stream );
+    void handleTraceEntry( QDataStream &stream );
+    QString readString( QDataStream &stream ) const;
+    QString lookupString( quint32 id ) const;
+
+    XmlParseEventsHandler *m_handler;
+    QByteArray m_buffer;
+    bool m_haveStreamHeader;
+    QHash<quint32, QString> m_strings;
+    QList<TraceKey> m_traceKeys;
+};
+
+#endif // TRACER_BINARYCONTENTHANDLER_H
+
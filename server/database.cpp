@@ -23,7 +23,9 @@
 #include <stdexcept>
 #include <QDataStream>
 #include <QDebug>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
@@ -79,7 +81,44 @@ QVariant Transaction::insert( const QString &statement )
     return m_query.lastInsertId();
 }
 
-const int Database::expectedVersion = 5;
+/* Variants for statements which were prepared (and bound) by the caller;
+ * the query is finished afterwards so that it can be executed again
+ * without keeping the statement active in between.
+ */
+QVariant Transaction::exec( QSqlQuery &query )
+{
+    if ( !query.exec() ) {
+        m_commitChanges = false;
+        throw SQLTransactionException( QString( "Failed to store entry in database: executing SQL command '%1' failed: %2" )
+                                        .arg( query.lastQuery() ).arg( query.lastError().text() ),
+                                       query.lastError().text(),
+                                       query.lastError().number() );
+    }
+    QVariant result;
+    if ( query.next() ) {
+        result = query.value( 0 );
+    }
+    query.finish();
+    return result;
+}
+
+QVariant Transaction::insert( QSqlQuery &query )
+{
+    if ( !query.exec() ) {
+        m_commitChanges = false;
+        throw SQLTransactionException( QString( "Failed to store entry in database: executing SQL command '%1' failed: %2" )
+                                        .arg( query.lastQuery() ).arg( query.lastError().text() ),
+                                       query.lastError().text(),
+                                       query.lastError().number() );
+    }
+
+    assert( query.driver()->hasFeature( QSqlDriver::LastInsertId ) );
+    const QVariant id = query.lastInsertId();
+    query.finish();
+    return id;
+}
+
+const int Database::expectedVersion = 6;
 
 static const char * const schemaStatements[] = {
     "CREATE TABLE schema_downgrade (from_version INTEGER,"
@@ -126,7 +165,12 @@ static const char * const schemaStatements[] = {
     " line INTEGER);",
     "CREATE TABLE trace_point_group(id INTEGER PRIMARY KEY AUTOINCREMENT,"
     " name TEXT,"
-    " UNIQUE(name));"
+    " UNIQUE(name));",
+    "CREATE INDEX trace_entry_trace_point_idx ON trace_entry(trace_point_id, traced_thread_id);",
+    "CREATE INDEX trace_entry_traced_thread_idx ON trace_entry(traced_thread_id);",
+    "CREATE INDEX trace_entry_timestamp_idx ON trace_entry(timestamp);",
+    "CREATE INDEX variable_trace_entry_idx ON variable(trace_entry_id);",
+    "CREATE INDEX stackframe_trace_entry_idx ON stackframe(trace_entry_id, depth);"
 };
 
 static const char * const downgradeStatementsInsert[] = {
@@ -135,8 +179,13 @@ static const char * const downgradeStatementsInsert[] = {
     "INSERT INTO schema_downgrade VALUES(2, 'NOT IMPLEMENTED');",
     "INSERT INTO schema_downgrade VALUES(3, 'NOT IMPLEMENTED');",
     "INSERT INTO schema_downgrade VALUES(4, 'NOT IMPLEMENTED');",
-    "INSERT INTO schema_downgrade VALUES(5, 'NOT IMPLEMENTED');"
-
+    "INSERT INTO schema_downgrade VALUES(5, 'NOT IMPLEMENTED');",
+    "INSERT INTO schema_downgrade VALUES(6, '"
+    "DROP INDEX trace_entry_trace_point_idx;"
+    "DROP INDEX trace_entry_traced_thread_idx;"
+    "DROP INDEX trace_entry_timestamp_idx;"
+    "DROP INDEX variable_trace_entry_idx;"
+    "DROP INDEX stackframe_trace_entry_idx;');"
 };
 
 int Database::currentVersion( QSqlDatabase db, QString *errMsg )
@@ -258,6 +307,23 @@ QSqlDatabase Database::openAnyVersion(const QString &fileName,
     return openOrCreate(fileName, errMsg);
 }
 
+/* Qt requires a connection to be used only by the thread which opened it,
+ * so threads working on the trace database open their own one.
+ */
+QSqlDatabase Database::clone(QSqlDatabase db,
+                             const QString &connectionName,
+                             QString *errMsg)
+{
+    QSqlDatabase copy = QSqlDatabase::cloneDatabase(db, connectionName);
+    if (!copy.open()) {
+        *errMsg = copy.lastError().text();
+        copy = QSqlDatabase();
+        QSqlDatabase::removeDatabase(connectionName);
+        return QSqlDatabase();
+    }
+    return copy;
+}
+
 static QString downgradeStatementsForVersion(QSqlDatabase db,
                                              int version)
 {
@@ -281,9 +347,13 @@ static void downgradeVersion(QSqlDatabase db, int version)
     QString sql = downgradeStatementsForVersion(db, version);
     db.transaction();
     QSqlQuery query(db);
-    if (!query.exec(sql)) {
-        db.rollback();
-        throw Qruntime_error(query.lastError().text());
+    // The driver only executes the first statement of a string
+    const QStringList statements = sql.split(';', QString::SkipEmptyParts);
+    for (int i = 0; i < statements.size(); ++i) {
+        if (!query.exec(statements[i])) {
+            db.rollback();
+            throw Qruntime_error(query.lastError().text());
+        }
     }
     // even remove the downgrade statements to make the conversion
     // perfect. remember that they are being used to designate the
@@ -373,6 +443,31 @@ static bool upgradeToVersion5(QSqlDatabase db, QString *errMsg)
     return true;
 }
 
+static bool upgradeToVersion6(QSqlDatabase db, QString *errMsg)
+{
+    // Indexes for the joins done by the GUI and when archiving entries
+    const char* const statements[] = {
+	"BEGIN TRANSACTION;",
+	"CREATE INDEX trace_entry_trace_point_idx ON trace_entry(trace_point_id, traced_thread_id);",
+	"CREATE INDEX trace_entry_traced_thread_idx ON trace_entry(traced_thread_id);",
+	"CREATE INDEX trace_entry_timestamp_idx ON trace_entry(timestamp);",
+	"CREATE INDEX variable_trace_entry_idx ON variable(trace_entry_id);",
+	"CREATE INDEX stackframe_trace_entry_idx ON stackframe(trace_entry_id, depth);",
+	// Lets the query planner know how selective the indexes are
+	"ANALYZE;",
+	downgradeStatementsInsert[6],
+	"COMMIT;" };
+    QSqlQuery query(db);
+    for (unsigned i = 0; i < sizeof(statements)/sizeof(char*); ++i) {
+	if (!query.exec(statements[i])) {
+	    *errMsg = query.lastError().text();
+	    query.exec("ROLLBACK;");
+	    return false;
+	}
+    }
+    return true;
+}
+
 static bool upgradeVersion(QSqlDatabase db, int version,
 			   QString *errMsg)
 {
@@ -382,6 +477,8 @@ static bool upgradeVersion(QSqlDatabase db, int version,
     case 4:
     return upgradeToVersion5(db, errMsg);
 	break;
+    case 5:
+	return upgradeToVersion6(db, errMsg);
     default:
 	*errMsg = QObject::tr("Automatic upgrade to version %1 is not implemented");
 	return false;
@@ -425,10 +522,147 @@ bool Database::isValidFileName(const QString &fileName,
     return true;
 }
 
-QList<StackFrame> Database::backtraceForEntry(QSqlDatabase db,
-                                              unsigned int entryId)
+// SQLite allows ten attached databases unless compiled differently
+const int Database::MaximumSegments = 8;
+
+// Tables of which the rows are stored in segment files
+static const char * const segmentTables[] = {
+    "trace_entry",
+    "variable",
+    "stackframe"
+};
+
+static QStringList attachedSegments(QSqlDatabase db)
+{
+    QStringList schemas;
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    if (q.exec("PRAGMA database_list;")) {
+        while (q.next()) {
+            const QString name = q.value(1).toString();
+            if (name.startsWith("segment_")) {
+                schemas.append(name);
+            }
+        }
+    }
+    return schemas;
+}
+
+bool Database::attachSegments(QSqlDatabase db, QString *errMsg)
+{
+    assert(errMsg != NULL);
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+
+    // Forget the segments attached before, some might have been dropped
+    for (unsigned i = 0; i < sizeof(segmentTables) / sizeof(segmentTables[0]); ++i) {
+        query.exec(QString("DROP VIEW IF EXISTS temp.%1;").arg(segmentTables[i]));
+    }
+    const QStringList previousSchemas = attachedSegments(db);
+    for (int i = 0; i < previousSchemas.size(); ++i) {
+        if (!query.exec(QString("DETACH DATABASE %1;").arg(previousSchemas[i]))) {
+            *errMsg = QObject::tr("Failed to detach segment %1: %2")
+                .arg(previousSchemas[i])
+                .arg(query.lastError().text());
+            return false;
+        }
+    }
+
+    // Databases which were never split into segments lack the catalog
+    if (!query.exec("SELECT name FROM sqlite_master WHERE type='table' AND name='segment';")) {
+        *errMsg = query.lastError().text();
+        return false;
+    }
+    if (!query.next()) {
+        return true;
+    }
+    query.finish();
+
+    if (!query.exec(QString("SELECT id, file_name FROM segment ORDER BY id DESC LIMIT %1;").arg(MaximumSegments))) {
+        *errMsg = query.lastError().text();
+        return false;
+    }
+    const QDir databaseDir = QFileInfo(db.databaseName()).dir();
+    QStringList schemas;
+    QStringList fileNames;
+    while (query.next()) {
+        const QString fileName = databaseDir.filePath(query.value(1).toString());
+        // ATTACH would create an empty database in place of a missing one
+        if (QFile::exists(fileName)) {
+            schemas.prepend(QString("segment_%1").arg(query.value(0).toLongLong()));
+            fileNames.prepend(fileName);
+        }
+    }
+    query.finish();
+
+    for (int i = 0; i < schemas.size(); ++i) {
+        if (!query.exec(QString("ATTACH DATABASE %1 AS %2;")
+                        .arg(formatValue(db, fileNames[i]))
+                        .arg(schemas[i]))) {
+            *errMsg = QObject::tr("Failed to attach segment %1: %2")
+                .arg(fileNames[i])
+                .arg(query.lastError().text());
+            return false;
+        }
+    }
+
+    /* Temporary views take precedence over the tables of the same name in
+     * the database, so queries don't need to know about segments at all.
+     */
+    if (schemas.isEmpty()) {
+        return true;
+    }
+    for (unsigned i = 0; i < sizeof(segmentTables) / sizeof(segmentTables[0]); ++i) {
+        QString statement = QString("CREATE TEMP VIEW %1 AS SELECT * FROM main.%1")
+            .arg(segmentTables[i]);
+        for (int j = 0; j < schemas.size(); ++j) {
+            statement += QString(" UNION ALL SELECT * FROM %1.%2")
+                .arg(schemas[j]).arg(segmentTables[i]);
+        }
+        statement += ";";
+        if (!query.exec(statement)) {
+            *errMsg = QObject::tr("Failed to execute '%1': %2")
+                .arg(statement)
+                .arg(query.lastError().text());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Database::hasTextIndex(QSqlDatabase db)
+{
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    return q.exec(textIndexStatement()) && q.next();
+}
+
+QString Database::textIndexStatement()
+{
+    return "SELECT name FROM main.sqlite_master WHERE type='table' AND name='entry_text';";
+}
+
+QString Database::segmentFileName(const QString &fileName, qlonglong segmentId)
+{
+    const QFileInfo fi(fileName);
+    return QString("%1/%2-segments/%3.trace")
+        .arg(fi.absolutePath())
+        .arg(fi.completeBaseName())
+        .arg(segmentId);
+}
+
+static QVector<QVariant> currentRow(const QSqlQuery &q, int numFields)
+{
+    QVector<QVariant> row(numFields);
+    for (int i = 0; i < numFields; ++i) {
+        row[i] = q.value(i);
+    }
+    return row;
+}
+
+QString Database::backtraceStatement(unsigned int entryId)
 {
-    const QString statement = QString(
+    return QString(
                       "SELECT"
                       " module_name,"
                       " function_name,"
@@ -441,6 +675,23 @@ QList<StackFrame> Database::backtraceForEntry(QSqlDatabase db,
                       " trace_entry_id=%1 "
                       "ORDER BY"
                       " depth" ).arg( entryId );
+}
+
+StackFrame Database::stackFrame(const QVector<QVariant> &row)
+{
+    StackFrame f;
+    f.module = row[0].toString();
+    f.function = row[1].toString();
+    f.functionOffset = row[2].toUInt();
+    f.sourceFile = row[3].toString();
+    f.lineNumber = row[4].toUInt();
+    return f;
+}
+
+QList<StackFrame> Database::backtraceForEntry(QSqlDatabase db,
+                                              unsigned int entryId)
+{
+    const QString statement = backtraceStatement( entryId );
 
     QSqlQuery q( db );
     q.setForwardOnly( true );
@@ -453,25 +704,24 @@ QList<StackFrame> Database::backtraceForEntry(QSqlDatabase db,
 
     QList<StackFrame> frames;
     while ( q.next() ) {
-        StackFrame f;
-        f.module = q.value( 0 ).toString();
-        f.function = q.value( 1 ).toString();
-        f.functionOffset = q.value( 2 ).toUInt();
-        f.sourceFile = q.value( 3 ).toString();
-        f.lineNumber = q.value( 4 ).toUInt();
-        frames.append( f );
+        frames.append( stackFrame( currentRow( q, 5 ) ) );
     }
 
     return frames;
 }
 
-QStringList Database::seenGroupIds(QSqlDatabase db)
+QString Database::seenGroupIdsStatement()
 {
-    const QString statement = QString(
+    return QString(
                       "SELECT"
                       " name "
                       "FROM"
                       " trace_point_group;" );
+}
+
+QStringList Database::seenGroupIds(QSqlDatabase db)
+{
+    const QString statement = seenGroupIdsStatement();
 
     QSqlQuery q( db );
     q.setForwardOnly( true );
@@ -507,31 +757,44 @@ void Database::trimTo(QSqlDatabase db, size_t nMostRecent)
      * with a WHERE clause.
      */
     if ( nMostRecent == 0 ) {
+        const bool textIndex = hasTextIndex( db );
+
         Transaction transaction( db );
-        transaction.exec( "DELETE FROM trace_entry;" );
+        transaction.exec( "DELETE FROM main.trace_entry;" );
 
         // Resets all AUTOINCREMENT fields in trace_entry to zero
-        transaction.exec( "DELETE FROM sqlite_sequence WHERE name='trace_entry';" );
-
-        transaction.exec( "DELETE FROM trace_point;" );
-        transaction.exec( "DELETE FROM function_name;" );
-        transaction.exec( "DELETE FROM path_name;" );
-        transaction.exec( "DELETE FROM process;" );
-        transaction.exec( "DELETE FROM traced_thread;" );
-        transaction.exec( "DELETE FROM variable;" );
-        transaction.exec( "DELETE FROM stackframe;" );
+        transaction.exec( "DELETE FROM main.sqlite_sequence WHERE name='trace_entry';" );
+
+        transaction.exec( "DELETE FROM main.trace_point;" );
+        transaction.exec( "DELETE FROM main.function_name;" );
+        transaction.exec( "DELETE FROM main.path_name;" );
+        transaction.exec( "DELETE FROM main.process;" );
+        transaction.exec( "DELETE FROM main.traced_thread;" );
+        transaction.exec( "DELETE FROM main.variable;" );
+        transaction.exec( "DELETE FROM main.stackframe;" );
+        if ( textIndex ) {
+            transaction.exec( "DELETE FROM main.entry_text;" );
+        }
 #if 0 // cache for the user's convenenience
-        transaction.exec( "DELETE FROM trace_point_group;" );
+        transaction.exec( "DELETE FROM main.trace_point_group;" );
 #endif
+
+        const QStringList schemas = attachedSegments( db );
+        QStringList::ConstIterator it, end = schemas.end();
+        for ( it = schemas.begin(); it != end; ++it ) {
+            for ( unsigned i = 0; i < sizeof( segmentTables ) / sizeof( segmentTables[0] ); ++i ) {
+                transaction.exec( QString( "DELETE FROM %1.%2;" ).arg( *it ).arg( segmentTables[i] ) );
+            }
+        }
         return;
     }
     qWarning() << "Server::trimTo: deleting all but the n most recent trace "
                   "entries not implemented yet!";
 }
 
-QList<TracedApplicationInfo> Database::tracedApplications(QSqlDatabase db)
+QString Database::tracedApplicationsStatement()
 {
-    const QString statement = QString(
+    return QString(
                       "SELECT"
                       " name,"
                       " pid,"
@@ -539,6 +802,23 @@ QList<TracedApplicationInfo> Database::tracedApplications(QSqlDatabase db)
                       " end_time "
                       "FROM"
                       " process;" );
+}
+
+TracedApplicationInfo Database::tracedApplication(const QVector<QVariant> &row)
+{
+    TracedApplicationInfo info;
+    bool ok;
+    info.pid = row[1].toUInt( &ok );
+    assert( ok );
+    info.startTime = QDateTime::fromMSecsSinceEpoch( row[2].toLongLong() );
+    info.stopTime = QDateTime::fromMSecsSinceEpoch( row[3].toLongLong() );
+    info.name = row[0].toString();
+    return info;
+}
+
+QList<TracedApplicationInfo> Database::tracedApplications(QSqlDatabase db)
+{
+    const QString statement = tracedApplicationsStatement();
 
     QSqlQuery q( db );
     q.setForwardOnly( true );
@@ -551,15 +831,7 @@ QList<TracedApplicationInfo> Database::tracedApplications(QSqlDatabase db)
 
     QList<TracedApplicationInfo> l;
     while ( q.next() ) {
-        TracedApplicationInfo info;
-        bool ok;
-        info.pid = q.value( 1 ).toUInt( &ok );
-        assert( ok );
-        info.startTime = QDateTime::fromMSecsSinceEpoch( q.value( 2 ).toLongLong() );
-        info.stopTime = QDateTime::fromMSecsSinceEpoch( q.value( 3 ).toLongLong() );
-        info.name = q.value( 0 ).toString();
-
-        l.append( info );
+        l.append( tracedApplication( currentRow( q, 4 ) ) );
     }
     return l;
 }
@@ -580,12 +852,13 @@ QDataStream &operator<<( QDataStream &stream, const TraceEntry &entry )
         << entry.variables
         << entry.backtrace
         << (quint64)entry.stackPosition
-        << entry.traceKeys;
+        << entry.traceKeys
+        << (quint32)entry.id;
 }
 
 QDataStream &operator>>( QDataStream &stream, TraceEntry &entry )
 {
-    quint32 pid, tid, lineno;
+    quint32 id, pid, tid, lineno;
     quint8 type;
     quint64 stackPosition;
 
@@ -603,8 +876,10 @@ QDataStream &operator>>( QDataStream &stream, TraceEntry &entry )
         >> entry.variables
         >> entry.backtrace
         >> stackPosition
-        >> entry.traceKeys;
+        >> entry.traceKeys
+        >> id;
 
+    entry.id = id;
     entry.pid = pid;
     entry.tid = tid;
     entry.lineno = lineno;
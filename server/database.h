@@ -24,6 +24,8 @@
 #include <QSqlDriver>
 #include <QSqlField>
 #include <QSqlQuery>
+#include <QVariant>
+#include <QVector>
 
 #include "../hooklib/tracelib.h" // for VariableType
 
@@ -65,6 +67,8 @@ QDataStream &operator>>( QDataStream &stream, TraceKey &key );
 
 struct TraceEntry
 {
+    // Row id in the database, assigned when the entry is stored
+    unsigned int id;
     unsigned int pid;
     QDateTime processStartTime;
     QString processName;
@@ -132,6 +136,9 @@ public:
     QVariant exec( const QString &statement );
     QVariant insert( const QString &statement );
 
+    QVariant exec( QSqlQuery &query );
+    QVariant insert( QSqlQuery &query );
+
 private:
     Transaction( const Transaction &other );
     void operator=( const Transaction &rhs );
@@ -153,6 +160,10 @@ public:
                                QString *errMsg);
     static QSqlDatabase openAnyVersion(const QString &fileName,
 				       QString *errMsg);
+    // Opens another connection to an already opened database
+    static QSqlDatabase clone(QSqlDatabase db,
+                              const QString &connectionName,
+                              QString *errMsg);
 
     static bool downgrade(QSqlDatabase db, QString *errMsg);
     static bool upgrade(QSqlDatabase db, QString *errMsg);
@@ -160,6 +171,23 @@ public:
     static bool isValidFileName(const QString &fileName,
                                 QString *errMsg);
 
+    /* Trace entries may be stored in segment files listed in the
+     * 'segment' table rather than in the database itself. Readers attach
+     * them, which makes the trace_entry, variable and stackframe tables
+     * include the entries of all segments. SQLite limits the number of
+     * attached databases, hence the number of segments is limited, too.
+     */
+    static const int MaximumSegments;
+    static bool attachSegments(QSqlDatabase db, QString *errMsg);
+    static QString segmentFileName(const QString &fileName, qlonglong segmentId);
+
+    /* The server may maintain the 'entry_text' full-text index of the
+     * message, function, file and variable values of all entries, segments
+     * included; its rowid is the id of the entry. It requires FTS5 with the
+     * trigram tokenizer, i.e. SQLite 3.34 or newer.
+     */
+    static bool hasTextIndex(QSqlDatabase db);
+
     static QList<StackFrame> backtraceForEntry(QSqlDatabase db,
                                                unsigned int entryId);
     static QStringList seenGroupIds(QSqlDatabase db);
@@ -169,6 +197,16 @@ public:
     static void trimTo(QSqlDatabase db, size_t nMostRecent);
     static QList<TracedApplicationInfo> tracedApplications(QSqlDatabase db);
 
+    /* The statements run by the functions above, for running them in the
+     * background instead; each result row is converted the same way.
+     */
+    static QString textIndexStatement();
+    static QString backtraceStatement(unsigned int entryId);
+    static StackFrame stackFrame(const QVector<QVariant> &row);
+    static QString seenGroupIdsStatement();
+    static QString tracedApplicationsStatement();
+    static TracedApplicationInfo tracedApplication(const QVector<QVariant> &row);
+
     // Special cased since QSql* will loose the milliseconds of a QDateTime value
     static inline QString formatValue(QSqlDatabase db, const QDateTime &v)
     {
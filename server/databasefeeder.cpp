@@ -22,10 +22,15 @@
 #include "database.h"
 #include "lru_cache.h"
 
+#include <QDateTime>
+#include <QDebug>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QStringList>
 #include <QVariant>
 
 #include <cassert>
@@ -33,11 +38,86 @@
 
 using namespace std;
 
-static bool getGroupId( QSqlDatabase db, Transaction *transaction, const QString &name, unsigned int *id )
+/* All statements needed for storing trace entries in one database, so
+ * that they are parsed once instead of for every single entry.
+ */
+class InsertStatements
+{
+public:
+    // Trace entries are stored in the tables of the given schema
+    explicit InsertStatements( QSqlDatabase db, const QString &entrySchema = QString( "main" ) )
+        : selectGroup( db ), insertGroup( db ),
+        selectPath( db ), insertPath( db ),
+        selectFunction( db ), insertFunction( db ),
+        selectProcess( db ), insertProcess( db ),
+        selectThread( db ), insertThread( db ),
+        selectTracePoint( db ), insertTracePoint( db ),
+        insertTraceEntry( db ), insertVariable( db ), insertStackFrame( db ),
+        insertEntryText( db )
+    {
+        prepare( &selectGroup, "SELECT id FROM trace_point_group WHERE name=?;" );
+        prepare( &insertGroup, "INSERT INTO trace_point_group VALUES(NULL, ?);" );
+        prepare( &selectPath, "SELECT id FROM path_name WHERE name=?;" );
+        prepare( &insertPath, "INSERT INTO path_name VALUES(NULL, ?);" );
+        prepare( &selectFunction, "SELECT id FROM function_name WHERE name=?;" );
+        prepare( &insertFunction, "INSERT INTO function_name VALUES(NULL, ?);" );
+        prepare( &selectProcess, "SELECT id FROM process WHERE pid=? AND start_time=?;" );
+        prepare( &insertProcess, "INSERT INTO process VALUES(NULL, ?, ?, ?, 0);" );
+        prepare( &selectThread, "SELECT id FROM traced_thread WHERE process_id=? AND tid=?;" );
+        prepare( &insertThread, "INSERT INTO traced_thread VALUES(NULL, ?, ?);" );
+        prepare( &selectTracePoint, "SELECT id FROM trace_point WHERE type=? AND path_id=? AND line=? AND function_id=? AND group_id=?;" );
+        prepare( &insertTracePoint, "INSERT INTO trace_point VALUES(NULL, ?, ?, ?, ?, ?);" );
+        prepare( &insertTraceEntry, QString( "INSERT INTO %1.trace_entry VALUES(NULL, ?, ?, ?, ?, ?);" ).arg( entrySchema ) );
+        prepare( &insertVariable, QString( "INSERT INTO %1.variable VALUES(?, ?, ?, ?);" ).arg( entrySchema ) );
+        prepare( &insertStackFrame, QString( "INSERT INTO %1.stackframe VALUES(?, ?, ?, ?, ?, ?, ?);" ).arg( entrySchema ) );
+        // Only executed if the full-text index exists
+        prepare( &insertEntryText, "INSERT INTO main.entry_text(rowid, message, function, file, variables) VALUES(?, ?, ?, ?, ?);" );
+    }
+
+    QSqlQuery selectGroup;
+    QSqlQuery insertGroup;
+    QSqlQuery selectPath;
+    QSqlQuery insertPath;
+    QSqlQuery selectFunction;
+    QSqlQuery insertFunction;
+    QSqlQuery selectProcess;
+    QSqlQuery insertProcess;
+    QSqlQuery selectThread;
+    QSqlQuery insertThread;
+    QSqlQuery selectTracePoint;
+    QSqlQuery insertTracePoint;
+    QSqlQuery insertTraceEntry;
+    QSqlQuery insertVariable;
+    QSqlQuery insertStackFrame;
+    QSqlQuery insertEntryText;
+
+private:
+    InsertStatements( const InsertStatements &other );
+    void operator=( const InsertStatements &rhs );
+
+    // Errors show up when executing the statement, with a proper exception.
+    static void prepare( QSqlQuery *query, const char *statement ) {
+        prepare( query, QString::fromLatin1( statement ) );
+    }
+    static void prepare( QSqlQuery *query, const QString &statement ) {
+        query->setForwardOnly( true );
+        query->prepare( statement );
+    }
+};
+
+// Special cased since QSql* will loose the milliseconds of a QDateTime value
+static inline QVariant timeValue( const QDateTime &v )
+{
+    return QVariant::fromValue( v.toMSecsSinceEpoch() );
+}
+
+static bool getGroupId( InsertStatements *statements, Transaction *transaction, const QString &name, unsigned int *id )
 {
-    QVariant v = transaction->exec( QString( "SELECT id FROM trace_point_group WHERE name=%1;" ).arg( Database::formatValue( db, name ) ) );
+    statements->selectGroup.bindValue( 0, name );
+    QVariant v = transaction->exec( statements->selectGroup );
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO trace_point_group VALUES(NULL, %1);" ).arg( Database::formatValue( db, name ) ) );
+        statements->insertGroup.bindValue( 0, name );
+        v = transaction->insert( statements->insertGroup );
     }
 
     if ( !id ) {
@@ -51,19 +131,19 @@ static bool getGroupId( QSqlDatabase db, Transaction *transaction, const QString
 
 class TraceKeyCache {
 public:
-    void update( QSqlDatabase db, Transaction *transaction,
+    void update( InsertStatements *statements, Transaction *transaction,
          const QString &groupName,
          const QList<TraceKey> &traceKeys ) {
         QList<TraceKey>::ConstIterator it, end = traceKeys.end();
         for ( it = traceKeys.begin(); it != end; ++it ) {
             if ( m_map.find( (*it).name ) == m_map.end() ) {
-                registerGroupName( db, transaction, (*it).name );
+                registerGroupName( statements, transaction, (*it).name );
             }
         }
         // in case the entry comes with a name not listed in the
         // AUT-side configuration file
         if ( !groupName.isNull() && m_map.find( groupName ) == m_map.end() ) {
-            registerGroupName( db, transaction, groupName );
+            registerGroupName( statements, transaction, groupName );
         }
     }
     void clear() {
@@ -77,10 +157,10 @@ public:
         return (*it).second;
     }
 private:
-    void registerGroupName( QSqlDatabase db, Transaction *transaction, const QString &name )
+    void registerGroupName( InsertStatements *statements, Transaction *transaction, const QString &name )
     {
         unsigned int id;
-        if ( !getGroupId( db, transaction, name, &id ) ) {
+        if ( !getGroupId( statements, transaction, name, &id ) ) {
             throw runtime_error( "Read non-numeric trace point group id from database - corrupt database?" );
         }
         m_map[name] = id;
@@ -116,15 +196,17 @@ private:
 
 class PathCache : public StorageCache<QString, unsigned int> {
 public:
-    unsigned int store( QSqlDatabase db, Transaction *transaction,
+    unsigned int store( InsertStatements *statements, Transaction *transaction,
             const QString &path )
     {
     unsigned int *cachedId = checkCache( path );
     if ( cachedId )
         return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM path_name WHERE name=%1;" ).arg( Database::formatValue( db, path ) ) );
+    statements->selectPath.bindValue( 0, path );
+    QVariant v = transaction->exec( statements->selectPath );
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO path_name VALUES(NULL, %1);" ).arg( Database::formatValue( db, path ) ) );
+        statements->insertPath.bindValue( 0, path );
+        v = transaction->insert( statements->insertPath );
     }
     bool ok;
     unsigned int pathId = v.toUInt( &ok );
@@ -138,15 +220,17 @@ public:
 
 class FunctionCache : public StorageCache<QString, unsigned int> {
 public:
-    unsigned int store( QSqlDatabase db, Transaction *transaction,
+    unsigned int store( InsertStatements *statements, Transaction *transaction,
             const QString &function )
     {
     unsigned int *cachedId = checkCache( function );
     if ( cachedId )
         return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM function_name WHERE name=%1;" ).arg( Database::formatValue( db, function ) ) );
+    statements->selectFunction.bindValue( 0, function );
+    QVariant v = transaction->exec( statements->selectFunction );
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO function_name VALUES(NULL, %1);" ).arg( Database::formatValue( db, function ) ) );
+        statements->insertFunction.bindValue( 0, function );
+        v = transaction->insert( statements->insertFunction );
     }
     bool ok;
     unsigned int functionId = v.toUInt( &ok );
@@ -162,7 +246,7 @@ class ProcessCache : public StorageCache<std::pair<QString, unsigned int>,
                      unsigned int>
 {
 public:
-    unsigned int store( QSqlDatabase db, Transaction *transaction,
+    unsigned int store( InsertStatements *statements, Transaction *transaction,
             const QString &processName,
             unsigned int pid,
             const QDateTime &processStartTime )
@@ -171,9 +255,14 @@ public:
     unsigned int *cachedId = checkCache( key );
     if ( cachedId )
         return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM process WHERE pid=%1 AND start_time=%2;" ).arg( pid ).arg( Database::formatValue( db, processStartTime ) ) );
+    statements->selectProcess.bindValue( 0, pid );
+    statements->selectProcess.bindValue( 1, timeValue( processStartTime ) );
+    QVariant v = transaction->exec( statements->selectProcess );
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO process VALUES(NULL, %1, %2, %3, 0);" ).arg( Database::formatValue( db, processName ) ).arg( pid ).arg( Database::formatValue( db, processStartTime ) ) );
+        statements->insertProcess.bindValue( 0, processName );
+        statements->insertProcess.bindValue( 1, pid );
+        statements->insertProcess.bindValue( 2, timeValue( processStartTime ) );
+        v = transaction->insert( statements->insertProcess );
     }
     bool ok;
     unsigned int processId = v.toUInt( &ok );
@@ -189,7 +278,7 @@ class ThreadCache : public StorageCache<std::pair<unsigned int, unsigned int>,
                     unsigned int>
 {
 public:
-    unsigned int store( QSqlDatabase db, Transaction *transaction,
+    unsigned int store( InsertStatements *statements, Transaction *transaction,
             unsigned int processId,
             unsigned int tid )
     {
@@ -198,9 +287,13 @@ public:
     if ( cachedId )
         return *cachedId;
 
-    QVariant v = transaction->exec( QString( "SELECT id FROM traced_thread WHERE process_id=%1 AND tid=%2;" ).arg( processId ).arg( tid ) );
+    statements->selectThread.bindValue( 0, processId );
+    statements->selectThread.bindValue( 1, tid );
+    QVariant v = transaction->exec( statements->selectThread );
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO traced_thread VALUES(NULL, %1, %2);" ).arg( processId ).arg( tid ) );
+        statements->insertThread.bindValue( 0, processId );
+        statements->insertThread.bindValue( 1, tid );
+        v = transaction->insert( statements->insertThread );
     }
     bool ok;
     unsigned int threadId = v.toUInt( &ok );
@@ -212,11 +305,11 @@ public:
     }
 } threadCache;
 
-static unsigned int storeGroup( QSqlDatabase db, Transaction *transaction,
+static unsigned int storeGroup( InsertStatements *statements, Transaction *transaction,
                 const QString &groupName,
                 const QList<TraceKey> &traceKeys )
 {
-    traceKeyCache.update( db, transaction, groupName, traceKeys );
+    traceKeyCache.update( statements, transaction, groupName, traceKeys );
 
     unsigned int groupId = 0;
     if ( !groupName.isNull() ) {
@@ -249,7 +342,7 @@ class TracePointCache : public StorageCache<TracePointTuple,
                         unsigned int>
 {
 public:
-    unsigned int store( QSqlDatabase db, Transaction *transaction,
+    unsigned int store( InsertStatements *statements, Transaction *transaction,
             unsigned int type,
             unsigned int pathId,
             unsigned long lineno,
@@ -265,9 +358,17 @@ public:
     unsigned int *cachedId = checkCache( key );
     if ( cachedId )
         return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM trace_point WHERE type=%1 AND path_id=%2 AND line=%3 AND function_id=%4 AND group_id=%5;" ).arg( type ).arg( pathId ).arg( lineno ).arg( functionId ).arg( groupId ) );
+    QSqlQuery *queries[] = { &statements->selectTracePoint, &statements->insertTracePoint };
+    for ( int i = 0; i < 2; ++i ) {
+        queries[i]->bindValue( 0, type );
+        queries[i]->bindValue( 1, pathId );
+        queries[i]->bindValue( 2, qulonglong( lineno ) );
+        queries[i]->bindValue( 3, functionId );
+        queries[i]->bindValue( 4, groupId );
+    }
+    QVariant v = transaction->exec( statements->selectTracePoint );
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO trace_point VALUES(NULL, %1, %2, %3, %4, %5);" ).arg( type ).arg( pathId ).arg( lineno ).arg( functionId ).arg( groupId ) );
+        v = transaction->insert( statements->insertTracePoint );
     }
     bool ok;
     unsigned int tracepointId = v.toUInt( &ok );
@@ -279,75 +380,116 @@ public:
     }
 } tracePointCache;
 
-static unsigned int storeTraceEntry( QSqlDatabase db, Transaction *transaction,
+/* The cached ids are only valid as long as the rows they refer to exist,
+ * i.e. they need to be forgotten whenever rows get deleted or a
+ * transaction is rolled back.
+ */
+static void clearCaches()
+{
+    tracePointCache.clear();
+    functionCache.clear();
+    pathCache.clear();
+    traceKeyCache.clear();
+    threadCache.clear();
+    processCache.clear();
+}
+
+static unsigned int storeTraceEntry( InsertStatements *statements, Transaction *transaction,
                      unsigned int threadId,
                      const QDateTime &timestamp,
                      unsigned int pointId,
                      const QString &message,
                      unsigned long stackPosition )
 {
-    return transaction->insert( QString( "INSERT INTO trace_entry VALUES(NULL, " + QString::number( threadId )
-                                         + ", " + Database::formatValue( db, timestamp )
-                                         + ", " + QString::number( pointId )
-                                         + ", " + Database::formatValue( db, message )
-                                         + ", " + QString::number( stackPosition )
-                                         + ")" ) ).toUInt();
+    QSqlQuery &q = statements->insertTraceEntry;
+    q.bindValue( 0, threadId );
+    q.bindValue( 1, timeValue( timestamp ) );
+    q.bindValue( 2, pointId );
+    q.bindValue( 3, message );
+    q.bindValue( 4, qulonglong( stackPosition ) );
+    return transaction->insert( q ).toUInt();
 }
 
-static void storeVariables( QSqlDatabase db, Transaction *transaction,
+static void storeVariables( InsertStatements *statements, Transaction *transaction,
                 unsigned int traceentryId,
                 const QList<Variable> &variables )
 {
+    QSqlQuery &q = statements->insertVariable;
     QList<Variable>::ConstIterator it, end = variables.end();
     for ( it = variables.begin(); it != end; ++it ) {
-        transaction->exec( QString( "INSERT INTO variable VALUES(" + QString::number( traceentryId )
-                                    + ", " + Database::formatValue( db, it->name )
-                                    + ", " + Database::formatValue( db, it->value )
-                                    + ", " + QString::number( it->type )
-                                    + ")" ) );
+        q.bindValue( 0, traceentryId );
+        q.bindValue( 1, it->name );
+        q.bindValue( 2, it->value );
+        q.bindValue( 3, int( it->type ) );
+        transaction->exec( q );
     }
 }
 
-static void storeBacktrace( QSqlDatabase db, Transaction *transaction,
+static void storeBacktrace( InsertStatements *statements, Transaction *transaction,
                 unsigned int traceentryId,
                 const QList<StackFrame> &backtrace )
 
 {
+    QSqlQuery &q = statements->insertStackFrame;
     unsigned int depthCount = 0;
     QList<StackFrame>::ConstIterator it, end = backtrace.end();
     for ( it = backtrace.begin(); it != end; ++it, ++depthCount ) {
-        transaction->exec( QString( "INSERT INTO stackframe VALUES(" + QString::number( traceentryId )
-                                    + ", " + QString::number( depthCount )
-                                    + ", " + Database::formatValue( db, it->module )
-                                    + ", " + Database::formatValue( db, it->function )
-                                    + ", " + QString::number( it->functionOffset )
-                                    + ", " + Database::formatValue( db, it->sourceFile )
-                                    + ", " + QString::number( it->lineNumber )
-                                    + ")" ) );
+        q.bindValue( 0, traceentryId );
+        q.bindValue( 1, depthCount );
+        q.bindValue( 2, it->module );
+        q.bindValue( 3, it->function );
+        q.bindValue( 4, qulonglong( it->functionOffset ) );
+        q.bindValue( 5, it->sourceFile );
+        q.bindValue( 6, qulonglong( it->lineNumber ) );
+        transaction->exec( q );
+    }
+}
+
+static void storeEntryText( InsertStatements *statements, Transaction *transaction,
+                unsigned int traceentryId,
+                const TraceEntry &e )
+{
+    QStringList values;
+    QList<Variable>::ConstIterator it, end = e.variables.end();
+    for ( it = e.variables.begin(); it != end; ++it ) {
+        values.append( it->value );
     }
+
+    QSqlQuery &q = statements->insertEntryText;
+    q.bindValue( 0, traceentryId );
+    q.bindValue( 1, e.message );
+    q.bindValue( 2, e.function );
+    q.bindValue( 3, e.path );
+    q.bindValue( 4, values.join( "\n" ) );
+    transaction->exec( q );
 }
 
-static void storeEntry( QSqlDatabase db, Transaction *transaction, const TraceEntry &e )
+static unsigned int storeEntry( InsertStatements *statements, Transaction *transaction, const TraceEntry &e,
+                                bool indexText )
 {
-    unsigned int pathId = pathCache.store( db, transaction, e.path );
-    unsigned int functionId = functionCache.store( db, transaction, e.function );
-    unsigned int processId = processCache.store( db, transaction, e.processName,
+    unsigned int pathId = pathCache.store( statements, transaction, e.path );
+    unsigned int functionId = functionCache.store( statements, transaction, e.function );
+    unsigned int processId = processCache.store( statements, transaction, e.processName,
                          e.pid, e.processStartTime );
-    unsigned int threadId = threadCache.store( db, transaction, processId, e.tid );
-    unsigned int groupId = storeGroup( db, transaction,
+    unsigned int threadId = threadCache.store( statements, transaction, processId, e.tid );
+    unsigned int groupId = storeGroup( statements, transaction,
                        e.groupName,
                        e.traceKeys );
-    unsigned int tracepointId = tracePointCache.store( db, transaction,
+    unsigned int tracepointId = tracePointCache.store( statements, transaction,
                                e.type, pathId, e.lineno,
                                functionId, groupId );
-    unsigned int traceentryId = storeTraceEntry( db, transaction,
+    unsigned int traceentryId = storeTraceEntry( statements, transaction,
                          threadId,
                          e.timestamp,
                          tracepointId,
                          e.message,
                          e.stackPosition );
-    storeVariables( db, transaction, traceentryId, e.variables );
-    storeBacktrace( db, transaction, traceentryId, e.backtrace );
+    storeVariables( statements, transaction, traceentryId, e.variables );
+    storeBacktrace( statements, transaction, traceentryId, e.backtrace );
+    if ( indexText ) {
+        storeEntryText( statements, transaction, traceentryId, e );
+    }
+    return traceentryId;
 }
 
 static QString archiveFileName( const QString &archiveDirName, const QString &currentFileName )
@@ -362,181 +504,126 @@ static QString archiveFileName( const QString &archiveDirName, const QString &cu
         .arg( QFileInfo( currentFileName ).fileName() );
 }
 
-static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QString &archiveDir )
+/* Attaches an archive database to a connection for as long as it lives;
+ * needs to be created outside of any transaction.
+ */
+class AttachedArchive
 {
-    if ( percentage == 0 ) {
-        return;
-    }
-
-    if ( percentage > 100 ) {
-        percentage = 100;
-    }
-
-    Transaction transaction( db );
-    qulonglong numCopy = 0;
+public:
+    AttachedArchive( QSqlDatabase db, const QString &fileName )
+        : m_db( db )
     {
-        QVariant v = transaction.exec( QString( "SELECT ROUND(COUNT(id) / 100.0 * %1) FROM trace_entry;" ).arg( percentage ) );
-        bool ok;
-        numCopy = v.toULongLong( &ok );
-        if ( !ok ) {
-            throw runtime_error( "Failed to count number of entries to archive" );
+        QSqlQuery q( m_db );
+        if ( !q.exec( QString( "ATTACH DATABASE %1 AS archive;" ).arg( Database::formatValue( m_db, fileName ) ) ) ) {
+            throw runtime_error( QString( "Cannot archive trace data: failed to attach archive database %1: %2" ).arg( fileName ).arg( q.lastError().text() ).toUtf8().constData() );
         }
     }
 
-    QString connName;
+    ~AttachedArchive()
     {
-        QSqlDatabase archiveDB;
-        {
-            if ( !QDir().mkpath( archiveDir ) ) {
-                throw runtime_error( QString( "Failed to create archive database: creating archive directory %1 failed" ).arg( archiveDir ).toUtf8().constData() );
-            }
+        QSqlQuery q( m_db );
+        q.exec( "DETACH DATABASE archive;" );
+    }
 
-            const QString fn = archiveFileName( archiveDir, db.databaseName() );
-            QString errorMsg;
-            archiveDB = Database::create( fn, &errorMsg );
-            if ( !archiveDB.isValid() ) {
-                throw runtime_error( QString( "Failed to create database in %1: %2" ).arg( fn ).arg( errorMsg ).toUtf8().constData() );
-            }
-        }
-        connName = archiveDB.connectionName();
+private:
+    AttachedArchive( const AttachedArchive &other );
+    void operator=( const AttachedArchive &rhs );
 
-        {
-            QString query = QString( "SELECT"
-                            " trace_entry.id,"
-                            " process.pid,"
-                            " process.start_time,"
-                            " process.name,"
-                            " traced_thread.tid,"
-                            " trace_entry.timestamp,"
-                            " trace_point.type,"
-                            " path_name.name,"
-                            " trace_point.line,"
-                            " trace_point.group_id,"
-                            " function_name.name,"
-                            " trace_entry.message, "
-                            " trace_entry.stack_position "
-                            "FROM"
-                            " trace_entry,"
-                            " trace_point,"
-                            " path_name,"
-                            " function_name,"
-                            " process,"
-                            " traced_thread "
-                            "WHERE"
-                            " trace_entry.trace_point_id = trace_point.id "
-                            "AND"
-                            " trace_point.function_id = function_name.id "
-                            "AND"
-                            " trace_point.path_id = path_name.id "
-                            "AND"
-                            " trace_entry.traced_thread_id = traced_thread.id "
-                            "AND"
-                            " traced_thread.process_id = process.id "
-                            "ORDER BY"
-                            " trace_entry.id "
-                            "LIMIT"
-                            " %1" ).arg( numCopy );
-
-            QSqlQuery q( db );
-            q.setForwardOnly( true );
-            if ( !q.exec( query ) ) {
-                throw runtime_error( QString( "Cannot archive trace data: failed to extract entry data: %1" ).arg( q.lastError().text() ).toUtf8().constData() );
-            }
+    QSqlDatabase m_db;
+};
 
-            Transaction archiveTransaction( archiveDB );
-            while ( q.next() ) {
-                qulonglong id = q.value( 0 ).toULongLong();
-
-                TraceEntry e;
-                e.pid = q.value( 1 ).toUInt();
-                e.processStartTime = QDateTime::fromMSecsSinceEpoch( q.value( 2 ).toLongLong() );
-                e.processName = q.value( 3 ).toString();
-                e.tid = q.value( 4 ).toUInt();
-                e.timestamp = QDateTime::fromMSecsSinceEpoch( q.value( 5 ).toLongLong() );
-                e.type = q.value( 6 ).toUInt();
-                e.path = q.value( 7 ).toString();
-                e.lineno = q.value( 8 ).toULongLong();
-
-                const int groupId = q.value( 9 ).toInt();
-                if ( groupId != 0 ) {
-                    QSqlQuery gq( db );
-                    gq.setForwardOnly( true );
-                    if ( gq.exec( QString( "SELECT name FROM trace_point_group WHERE id = %1" ).arg( groupId ) ) ) {
-                        if ( gq.next() ) {
-                            e.groupName = gq.value( 0 ).toString();
-                        }
-                    }
-                }
+const int DatabaseFeeder::DefaultBatchSize = 1000;
+const int DatabaseFeeder::DefaultBatchDelay = 100;
+const int DatabaseFeeder::MaximumWalPages = 16384;
+const int DatabaseFeeder::ArchiveChunkSize = 10000;
 
-                e.function = q.value( 10 ).toString();
-                e.message = q.value( 11 ).toString();
-                e.stackPosition = q.value( 12 ).toULongLong();
-                e.backtrace = Database::backtraceForEntry( db, id );
-
-                {
-                    QSqlQuery vq( db );
-                    vq.setForwardOnly( true );
-                    if ( vq.exec( QString( "SELECT "
-                                    " name,"
-                                    " type,"
-                                    " value "
-                                    "FROM "
-                                    " variable "
-                                    "WHERE"
-                                    " trace_entry_id = %1" ).arg( id ) ) ) {
-                        while ( vq.next() ) {
-                            Variable v;
-                            v.name = vq.value( 0 ).toString();
-                            v.type = (TRACELIB_NAMESPACE_IDENT(VariableType)::Value)( vq.value( 1 ).toInt() );
-                            v.value = vq.value( 2 ).toString();
-                            e.variables.append( v );
-                        }
-                    }
-                }
-                ::storeEntry( archiveDB, &archiveTransaction, e );
-            }
+DatabaseFeeder::DatabaseFeeder( QSqlDatabase db )
+    : m_db( db )
+    , m_shrinkBy( 0 )
+    , m_maximumSize( StorageConfiguration::UnlimitedTraceSize )
+    , m_statements( 0 )
+    , m_maximumBatchSize( DefaultBatchSize )
+    , m_maximumBatchDelay( DefaultBatchDelay )
+    , m_uncheckpointedChanges( false )
+    , m_entriesToArchive( 0 )
+    , m_segmentStartTime( 0 )
+    , m_segmentEntries( 0 )
+    , m_textIndexEnabled( false )
+{
+    assert( m_db.isValid() );
+    m_db.exec( "PRAGMA synchronous=OFF;");
+    m_statements = new InsertStatements( m_db );
+}
+
+DatabaseFeeder::~DatabaseFeeder()
+{
+    try {
+        flushPendingEntries();
+        while ( isArchiving() ) {
+            continueArchiving();
         }
+    } catch ( const runtime_error &e ) {
+        qWarning() << "Failed to store pending trace entries:" << e.what();
     }
+    delete m_statements;
+}
 
-    {
-        transaction.exec( QString( "DELETE FROM trace_entry WHERE id IN (SELECT id FROM trace_entry ORDER BY id LIMIT %1);" ).arg( numCopy ) );
-
-        transaction.exec( QString( "DELETE FROM trace_point WHERE id NOT IN (SELECT trace_point_id FROM trace_entry);" ) );
-        tracePointCache.clear();
-
-        transaction.exec( QString( "DELETE FROM function_name WHERE id NOT IN (SELECT function_id FROM trace_point);" ) );
-        functionCache.clear();
-
-        transaction.exec( QString( "DELETE FROM path_name WHERE id NOT IN (SELECT path_id FROM trace_point);" ) );
-        pathCache.clear();
+void DatabaseFeeder::setBatchLimits( int maximumSize, int maximumDelay )
+{
+    m_maximumBatchSize = maximumSize;
+    m_maximumBatchDelay = maximumDelay;
+}
 
-        transaction.exec( QString( "DELETE FROM trace_point_group WHERE id NOT IN (SELECT group_id FROM trace_point);" ) );
-        traceKeyCache.clear();
+void DatabaseFeeder::applyTuning( const DatabaseTuning &tuning )
+{
+    // Applied to segment files as well when they are attached
+    m_tuning = tuning;
+    // Negative values are interpreted as KiB instead of pages by sqlite
+    m_db.exec( QString( "PRAGMA cache_size=-%1;" ).arg( tuning.cacheSize ) );
+    m_db.exec( QString( "PRAGMA mmap_size=%1;" ).arg( tuning.memoryMapSize ) );
+}
 
-        transaction.exec( QString( "DELETE FROM traced_thread WHERE id NOT IN (SELECT traced_thread_id FROM trace_entry);" ) );
-        threadCache.clear();
+bool DatabaseFeeder::enableWriteAheadLog()
+{
+    QSqlQuery q = m_db.exec( "PRAGMA journal_mode=WAL;" );
+    if ( !q.next() || q.value( 0 ).toString().compare( "wal", Qt::CaseInsensitive ) != 0 ) {
+        return false;
+    }
+    q.finish();
 
-        transaction.exec( QString( "DELETE FROM process WHERE id NOT IN (SELECT process_id FROM traced_thread);" ) );
-        processCache.clear();
+    m_db.exec( QString( "PRAGMA wal_autocheckpoint=%1;" ).arg( MaximumWalPages ) );
+    return true;
+}
 
-        transaction.exec( QString( "DELETE FROM variable WHERE trace_entry_id NOT IN (SELECT id FROM trace_entry);" ) );
-        transaction.exec( QString( "DELETE FROM stackframe WHERE trace_entry_id NOT IN (SELECT id FROM trace_entry);" ) );
-    }
-    QSqlDatabase::removeDatabase( connName );
+void DatabaseFeeder::checkpoint()
+{
+    // PASSIVE never waits for readers, it copies whatever it can
+    m_db.exec( "PRAGMA wal_checkpoint(PASSIVE);" );
+    m_uncheckpointedChanges = false;
 }
 
-DatabaseFeeder::DatabaseFeeder( QSqlDatabase db )
-    : m_db( db )
-    , m_shrinkBy( 0 )
-    , m_maximumSize( StorageConfiguration::UnlimitedTraceSize )
+void DatabaseFeeder::updateStatistics()
 {
-    assert( m_db.isValid() );
-    m_db.exec( "PRAGMA synchronous=OFF;");
+    m_db.exec( "PRAGMA optimize;" );
 }
 
 void DatabaseFeeder::trimDb()
 {
+    flushPendingEntries();
+    // Nothing left to archive
+    m_entriesToArchive = 0;
     Database::trimTo( m_db, 0 );
+    clearCaches();
+    m_uncheckpointedChanges = true;
+
+    if ( !m_segments.isEmpty() ) {
+        // Nuked entries are gone for good, nothing is archived
+        detachSegment();
+        while ( !m_segments.isEmpty() ) {
+            removeSegment( m_segments.takeFirst(), false );
+        }
+        startSegment();
+    }
 }
 
 // Definition taken from http://www.sqlite.org/c_interface.html
@@ -544,24 +631,231 @@ void DatabaseFeeder::trimDb()
 
 void DatabaseFeeder::handleTraceEntry( const TraceEntry &e )
 {
+    if ( m_pendingEntries.isEmpty() ) {
+        m_batchTimer.start();
+    }
+    m_pendingEntries.append( e );
+
+    if ( m_pendingEntries.size() >= m_maximumBatchSize ||
+         m_batchTimer.elapsed() >= m_maximumBatchDelay ) {
+        flushPendingEntries();
+    }
+}
+
+void DatabaseFeeder::flushPendingEntries()
+{
+    if ( m_pendingEntries.isEmpty() ) {
+        return;
+    }
+
+    // Take the entries so that a failing batch is not attempted over and over
+    QList<TraceEntry> entries;
+    entries.swap( m_pendingEntries );
+    m_uncheckpointedChanges = true;
+
+    if ( !m_segments.isEmpty() && needsNewSegment() ) {
+        try {
+            startSegment();
+        } catch ( const runtime_error &e ) {
+            // Keep storing entries in whatever database is attached
+            qWarning() << "Failed to start new segment:" << e.what();
+            m_segmentStartTime = QDateTime::currentMSecsSinceEpoch();
+            m_segmentEntries = 0;
+        }
+    }
+
     try {
-        Transaction transaction( m_db );
-        ::storeEntry( m_db, &transaction, e );
+        storeEntries( &entries );
     } catch ( const SQLTransactionException &ex ) {
+        /* The rollback invalidated whatever ids were cached while storing
+         * the batch.
+         */
+        clearCaches();
+
         if ( ex.driverCode() == SQLITE_FULL ) {
-            archiveEntries( m_db, m_shrinkBy, m_archiveDir );
+            /* Archive just enough to make room for the batch; the rest of
+             * the archive pass happens in further calls to
+             * continueArchiving().
+             */
+            if ( !isArchiving() ) {
+                beginArchiving();
+            }
+            if ( continueArchiving() == 0 ) {
+                throw;
+            }
 
-            archivedEntries();
+            m_pendingEntries = entries + m_pendingEntries;
+            flushPendingEntries();
+            return;
+        }
 
-            handleTraceEntry( e );
-        } else {
+        /* Store the entries one by one so that a single bad entry
+         * doesn't take the rest of the batch down with it.
+         */
+        QList<TraceEntry> stored;
+        bool failed = false;
+        QList<TraceEntry>::Iterator it, end = entries.end();
+        for ( it = entries.begin(); it != end; ++it ) {
+            try {
+                Transaction transaction( m_db );
+                it->id = ::storeEntry( m_statements, &transaction, *it, m_textIndexEnabled );
+                stored.append( *it );
+            } catch ( const SQLTransactionException & ) {
+                clearCaches();
+                failed = true;
+            }
+        }
+        if ( !stored.isEmpty() ) {
+            m_segmentEntries += stored.size();
+            storedEntries( stored );
+        }
+        if ( failed ) {
             throw;
         }
+        return;
+    }
+    m_segmentEntries += entries.size();
+    storedEntries( entries );
+
+    if ( !m_segments.isEmpty() ) {
+        dropOldSegments();
+    }
+}
+
+void DatabaseFeeder::beginArchiving()
+{
+    if ( m_shrinkBy == 0 ) {
+        throw runtime_error( "Cannot archive trace data: no storage configuration received" );
+    }
+
+    {
+        QSqlQuery q( m_db );
+        q.setForwardOnly( true );
+        if ( !q.exec( QString( "SELECT ROUND(COUNT(id) / 100.0 * %1) FROM trace_entry;" ).arg( m_shrinkBy ) ) || !q.next() ) {
+            throw runtime_error( "Failed to count number of entries to archive" );
+        }
+        bool ok;
+        m_entriesToArchive = q.value( 0 ).toULongLong( &ok );
+        if ( !ok ) {
+            throw runtime_error( "Failed to count number of entries to archive" );
+        }
+    }
+
+    if ( !QDir().mkpath( m_archiveDir ) ) {
+        throw runtime_error( QString( "Failed to create archive database: creating archive directory %1 failed" ).arg( m_archiveDir ).toUtf8().constData() );
+    }
+
+    // Only used for creating the schema, entries are copied via ATTACH
+    m_archiveFileName = archiveFileName( m_archiveDir, m_db.databaseName() );
+    {
+        QString errorMsg;
+        QSqlDatabase archiveDB = Database::create( m_archiveFileName, &errorMsg );
+        if ( !archiveDB.isValid() ) {
+            m_entriesToArchive = 0;
+            throw runtime_error( QString( "Failed to create database in %1: %2" ).arg( m_archiveFileName ).arg( errorMsg ).toUtf8().constData() );
+        }
+        archiveDB.close();
+    }
+    QSqlDatabase::removeDatabase( m_archiveFileName );
+}
+
+qulonglong DatabaseFeeder::continueArchiving()
+{
+    if ( !isArchiving() ) {
+        return 0;
+    }
+
+    const qulonglong chunkSize = qMin<qulonglong>( m_entriesToArchive, ArchiveChunkSize );
+    qulonglong numArchived = 0;
+    try {
+        AttachedArchive archive( m_db, m_archiveFileName );
+        Transaction transaction( m_db );
+
+        const QVariant lastId = transaction.exec( QString( "SELECT MAX(id) FROM (SELECT id FROM main.trace_entry ORDER BY id LIMIT %1);" ).arg( chunkSize ) );
+        if ( !lastId.isNull() ) {
+            const QString last = lastId.toString();
+            numArchived = transaction.exec( QString( "SELECT COUNT(*) FROM main.trace_entry WHERE id <= %1;" ).arg( last ) ).toULongLong();
+
+            /* Rows keep their ids in the archive; the entries refer to
+             * them, and rows shared with earlier chunks are copied once.
+             */
+            const char * const statements[] = {
+                "INSERT OR IGNORE INTO archive.traced_thread SELECT * FROM main.traced_thread"
+                " WHERE id IN (SELECT DISTINCT traced_thread_id FROM main.trace_entry WHERE id <= %1);",
+                // Catches process end times updated since an earlier chunk
+                "INSERT OR REPLACE INTO archive.process SELECT * FROM main.process"
+                " WHERE id IN (SELECT process_id FROM archive.traced_thread);",
+                "INSERT OR IGNORE INTO archive.trace_point SELECT * FROM main.trace_point"
+                " WHERE id IN (SELECT DISTINCT trace_point_id FROM main.trace_entry WHERE id <= %1);",
+                "INSERT OR IGNORE INTO archive.path_name SELECT * FROM main.path_name"
+                " WHERE id IN (SELECT path_id FROM archive.trace_point);",
+                "INSERT OR IGNORE INTO archive.function_name SELECT * FROM main.function_name"
+                " WHERE id IN (SELECT function_id FROM archive.trace_point);",
+                "INSERT OR IGNORE INTO archive.trace_point_group SELECT * FROM main.trace_point_group"
+                " WHERE id IN (SELECT group_id FROM archive.trace_point);",
+                "INSERT INTO archive.trace_entry SELECT * FROM main.trace_entry WHERE id <= %1;",
+                "INSERT INTO archive.variable SELECT * FROM main.variable WHERE trace_entry_id <= %1;",
+                "INSERT INTO archive.stackframe SELECT * FROM main.stackframe WHERE trace_entry_id <= %1;",
+                "DELETE FROM main.variable WHERE trace_entry_id <= %1;",
+                "DELETE FROM main.stackframe WHERE trace_entry_id <= %1;",
+                "DELETE FROM main.trace_entry WHERE id <= %1;"
+            };
+            for ( unsigned int i = 0; i < sizeof( statements ) / sizeof( statements[0] ); ++i ) {
+                transaction.exec( QString( statements[i] ).arg( last ) );
+            }
+            // The archive is not indexed, searching it means scanning it
+            if ( m_textIndexEnabled ) {
+                transaction.exec( QString( "DELETE FROM main.entry_text WHERE rowid <= %1;" ).arg( last ) );
+            }
+        }
+    } catch ( const runtime_error & ) {
+        // Don't try over and over again
+        m_entriesToArchive = 0;
+        throw;
+    }
+    m_uncheckpointedChanges = true;
+
+    if ( numArchived == 0 || numArchived >= m_entriesToArchive ) {
+        m_entriesToArchive = 0;
+        finishArchiving();
+    } else {
+        m_entriesToArchive -= numArchived;
+    }
+    return numArchived;
+}
+
+void DatabaseFeeder::finishArchiving()
+{
+    {
+        Transaction transaction( m_db );
+        transaction.exec( "DELETE FROM trace_point WHERE id NOT IN (SELECT trace_point_id FROM trace_entry);" );
+        transaction.exec( "DELETE FROM function_name WHERE id NOT IN (SELECT function_id FROM trace_point);" );
+        transaction.exec( "DELETE FROM path_name WHERE id NOT IN (SELECT path_id FROM trace_point);" );
+        transaction.exec( "DELETE FROM trace_point_group WHERE id NOT IN (SELECT group_id FROM trace_point);" );
+        transaction.exec( "DELETE FROM traced_thread WHERE id NOT IN (SELECT traced_thread_id FROM trace_entry);" );
+        transaction.exec( "DELETE FROM process WHERE id NOT IN (SELECT process_id FROM traced_thread);" );
+    }
+    clearCaches();
+
+    archivedEntries();
+}
+
+// Records the ids the entries got in the database
+void DatabaseFeeder::storeEntries( QList<TraceEntry> *entries )
+{
+    Transaction transaction( m_db );
+    QList<TraceEntry>::Iterator it, end = entries->end();
+    for ( it = entries->begin(); it != end; ++it ) {
+        it->id = ::storeEntry( m_statements, &transaction, *it, m_textIndexEnabled );
     }
 }
 
 void DatabaseFeeder::handleShutdownEvent( const ProcessShutdownEvent &ev )
 {
+    // Entries of the process need to be stored before its end is recorded
+    flushPendingEntries();
+
+    m_uncheckpointedChanges = true;
     Transaction transaction( m_db );
     transaction.exec( QString( "UPDATE process SET end_time=%1 WHERE pid=%2 AND start_time=%3;" ).arg( Database::formatValue( m_db, ev.stopTime ) ).arg( ev.pid ).arg( Database::formatValue( m_db, ev.startTime ) ) );
 }
@@ -575,6 +869,8 @@ T clamp( T v, T lowerBound, T upperBound ) {
 
 void DatabaseFeeder::applyStorageConfiguration( const StorageConfiguration &cfg )
 {
+    flushPendingEntries();
+
     const unsigned short shrinkBy = clamp<unsigned short>( cfg.shrinkBy, 1, 100 );
     if ( m_maximumSize == cfg.maximumSize &&
          m_shrinkBy == shrinkBy &&
@@ -582,6 +878,20 @@ void DatabaseFeeder::applyStorageConfiguration( const StorageConfiguration &cfg
         return;
     }
 
+    // The size is limited by dropping segments, see dropOldSegments()
+    if ( !m_segments.isEmpty() ) {
+        if ( cfg.maximumSize != StorageConfiguration::UnlimitedTraceSize &&
+             shrinkBy * Database::MaximumSegments < 100 ) {
+            qWarning() << "Segments are completed at" << shrinkBy << "percent of the maximum trace size"
+                       << "but no more than" << Database::MaximumSegments << "segments are kept;"
+                       << "only" << shrinkBy * Database::MaximumSegments << "percent of the maximum size will be used";
+        }
+        m_maximumSize = cfg.maximumSize;
+        m_shrinkBy = shrinkBy;
+        m_archiveDir = cfg.archiveDir;
+        return;
+    }
+
     if ( cfg.maximumSize == StorageConfiguration::UnlimitedTraceSize ) {
         /* XXX Don't hardcode this default value, might change if sqlite3 was
          * compiled with different settings.
@@ -637,3 +947,401 @@ void DatabaseFeeder::applyStorageConfiguration( const StorageConfiguration &cfg
     m_shrinkBy = shrinkBy;
     m_archiveDir = cfg.archiveDir;
 }
+
+// Includes the changes which were not checkpointed yet
+static qint64 databaseFileSize( const QString &fileName )
+{
+    return QFileInfo( fileName ).size() + QFileInfo( fileName + "-wal" ).size();
+}
+
+void DatabaseFeeder::enableSegments( const SegmentConfiguration &cfg )
+{
+    flushPendingEntries();
+
+    {
+        Transaction transaction( m_db );
+        transaction.exec( "CREATE TABLE IF NOT EXISTS segment (id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                          " file_name TEXT,"
+                          " start_time INTEGER);" );
+        // Rows the entries of removed segments referred to, see pruneLookupTables()
+        transaction.exec( "CREATE TEMP TABLE IF NOT EXISTS removed_trace_point (id INTEGER PRIMARY KEY);" );
+        transaction.exec( "CREATE TEMP TABLE IF NOT EXISTS removed_traced_thread (id INTEGER PRIMARY KEY);" );
+    }
+
+    m_segmentation = cfg;
+    m_segments.clear();
+
+    const QDir databaseDir = QFileInfo( m_db.databaseName() ).dir();
+    qint64 lastStartTime = 0;
+    {
+        QSqlQuery q( m_db );
+        q.setForwardOnly( true );
+        if ( !q.exec( "SELECT id, file_name, start_time FROM segment ORDER BY id;" ) ) {
+            throw runtime_error( QString( "Failed to read segment catalog: %1" ).arg( q.lastError().text() ).toUtf8().constData() );
+        }
+        while ( q.next() ) {
+            Segment segment;
+            segment.id = q.value( 0 ).toLongLong();
+            segment.fileName = databaseDir.filePath( q.value( 1 ).toString() );
+            m_segments.append( segment );
+            lastStartTime = q.value( 2 ).toLongLong();
+        }
+    }
+
+    // Continue with the segment entries were stored in most recently
+    if ( !m_segments.isEmpty() && QFile::exists( m_segments.last().fileName ) ) {
+        attachSegment( m_segments.last().fileName );
+        m_segmentStartTime = lastStartTime;
+
+        QSqlQuery q( m_db );
+        q.setForwardOnly( true );
+        m_segmentEntries = 0;
+        if ( q.exec( "SELECT COUNT(*) FROM current_segment.trace_entry;" ) && q.next() ) {
+            m_segmentEntries = q.value( 0 ).toULongLong();
+        }
+        return;
+    }
+    startSegment();
+}
+
+// Adds the entries stored in the given schema to the full-text index
+static void indexEntries( Transaction *transaction, const QString &schema )
+{
+    transaction->exec( QString( "INSERT INTO main.entry_text(rowid, message, function, file, variables)"
+                                " SELECT e.id, e.message, function_name.name, path_name.name,"
+                                " (SELECT group_concat(value, char(10)) FROM %1.variable WHERE trace_entry_id = e.id)"
+                                " FROM %1.trace_entry AS e, main.trace_point, main.function_name, main.path_name"
+                                " WHERE trace_point.id = e.trace_point_id"
+                                " AND function_name.id = trace_point.function_id"
+                                " AND path_name.id = trace_point.path_id;" ).arg( schema ) );
+}
+
+void DatabaseFeeder::enableTextIndex()
+{
+    flushPendingEntries();
+    if ( Database::hasTextIndex( m_db ) ) {
+        m_textIndexEnabled = true;
+        return;
+    }
+
+    QStringList segmentFileNames;
+    {
+        // Databases which were never split into segments lack the catalog
+        QSqlQuery q( m_db );
+        q.setForwardOnly( true );
+        if ( q.exec( "SELECT file_name FROM segment ORDER BY id;" ) ) {
+            const QDir databaseDir = QFileInfo( m_db.databaseName() ).dir();
+            while ( q.next() ) {
+                const QString fileName = databaseDir.filePath( q.value( 0 ).toString() );
+                if ( QFile::exists( fileName ) ) {
+                    segmentFileNames.append( fileName );
+                }
+            }
+        }
+    }
+
+    /* Readers rely on the index covering all entries once it exists, so
+     * it is dropped again if filling it fails half way.
+     */
+    try {
+        {
+            Transaction transaction( m_db );
+            transaction.exec( "CREATE VIRTUAL TABLE main.entry_text USING fts5(message, function, file, variables, tokenize='trigram');" );
+            indexEntries( &transaction, "main" );
+        }
+        QStringList::ConstIterator it, end = segmentFileNames.end();
+        for ( it = segmentFileNames.begin(); it != end; ++it ) {
+            AttachedArchive attachedSegment( m_db, *it );
+            Transaction transaction( m_db );
+            indexEntries( &transaction, "archive" );
+        }
+    } catch ( const runtime_error & ) {
+        m_db.exec( "DROP TABLE IF EXISTS main.entry_text;" );
+        throw;
+    }
+    m_uncheckpointedChanges = true;
+
+    // The statement inserting into the index could not be prepared before
+    delete m_statements;
+    m_statements = 0;
+    m_statements = new InsertStatements( m_db, m_segments.isEmpty() ? QString( "main" ) : QString( "current_segment" ) );
+    m_textIndexEnabled = true;
+}
+
+bool DatabaseFeeder::needsNewSegment() const
+{
+    if ( m_segmentEntries == 0 ) {
+        return false;
+    }
+    if ( m_segmentation.entries > 0 && m_segmentEntries >= m_segmentation.entries ) {
+        return true;
+    }
+    if ( m_segmentation.hours > 0 &&
+         QDateTime::currentMSecsSinceEpoch() - m_segmentStartTime >= qint64( m_segmentation.hours ) * 60 * 60 * 1000 ) {
+        return true;
+    }
+    if ( m_maximumSize != StorageConfiguration::UnlimitedTraceSize ) {
+        // Dropping the segment later on frees shrinkBy percent of the maximum size
+        const qint64 maximumSegmentSize = qint64( m_maximumSize ) / 100 * m_shrinkBy;
+        return databaseFileSize( m_segments.last().fileName ) >= maximumSegmentSize;
+    }
+    return false;
+}
+
+void DatabaseFeeder::startSegment()
+{
+    // Entry ids keep increasing across segments, readers rely on that
+    qlonglong lastEntryId = 0;
+    {
+        const char * const statements[] = {
+            "SELECT seq FROM main.sqlite_sequence WHERE name='trace_entry';",
+            "SELECT seq FROM current_segment.sqlite_sequence WHERE name='trace_entry';"
+        };
+        QSqlQuery q( m_db );
+        q.setForwardOnly( true );
+        for ( unsigned int i = 0; i < sizeof( statements ) / sizeof( statements[0] ); ++i ) {
+            if ( q.exec( statements[i] ) && q.next() ) {
+                lastEntryId = qMax( lastEntryId, q.value( 0 ).toLongLong() );
+            }
+            q.finish();
+        }
+    }
+
+    detachSegment();
+
+    // Readers skip segments listed in the catalog but not created yet
+    const qint64 startTime = QDateTime::currentMSecsSinceEpoch();
+    Segment segment;
+    {
+        Transaction transaction( m_db );
+        segment.id = transaction.insert( QString( "INSERT INTO segment VALUES(NULL, '', %1);" ).arg( startTime ) ).toLongLong();
+        segment.fileName = Database::segmentFileName( m_db.databaseName(), segment.id );
+        const QString relativeFileName = QFileInfo( m_db.databaseName() ).dir().relativeFilePath( segment.fileName );
+        transaction.exec( QString( "UPDATE segment SET file_name=%1 WHERE id=%2;" ).arg( Database::formatValue( m_db, relativeFileName ) ).arg( segment.id ) );
+    }
+
+    QString errorMsg;
+    bool created = QDir().mkpath( QFileInfo( segment.fileName ).absolutePath() );
+    if ( created ) {
+        QSqlDatabase segmentDB = Database::create( segment.fileName, &errorMsg );
+        created = segmentDB.isValid();
+        segmentDB.close();
+    } else {
+        errorMsg = QString( "creating directory %1 failed" ).arg( QFileInfo( segment.fileName ).absolutePath() );
+    }
+    QSqlDatabase::removeDatabase( segment.fileName );
+    if ( !created ) {
+        Transaction transaction( m_db );
+        transaction.exec( QString( "DELETE FROM segment WHERE id=%1;" ).arg( segment.id ) );
+        throw runtime_error( QString( "Failed to create segment database %1: %2" ).arg( segment.fileName ).arg( errorMsg ).toUtf8().constData() );
+    }
+
+    attachSegment( segment.fileName );
+    {
+        Transaction transaction( m_db );
+        transaction.exec( QString( "INSERT INTO current_segment.sqlite_sequence VALUES('trace_entry', %1);" ).arg( lastEntryId ) );
+    }
+
+    m_segments.append( segment );
+    m_segmentStartTime = startTime;
+    m_segmentEntries = 0;
+    m_uncheckpointedChanges = true;
+    segmentsChanged();
+
+    dropOldSegments();
+}
+
+void DatabaseFeeder::attachSegment( const QString &fileName )
+{
+    // Statements need to be prepared again for the attached tables
+    delete m_statements;
+    m_statements = 0;
+
+    QSqlQuery q( m_db );
+    if ( !q.exec( QString( "ATTACH DATABASE %1 AS current_segment;" ).arg( Database::formatValue( m_db, fileName ) ) ) ) {
+        m_statements = new InsertStatements( m_db );
+        throw runtime_error( QString( "Failed to attach segment database %1: %2" ).arg( fileName ).arg( q.lastError().text() ).toUtf8().constData() );
+    }
+
+    m_db.exec( "PRAGMA current_segment.synchronous=OFF;" );
+    m_db.exec( QString( "PRAGMA current_segment.cache_size=-%1;" ).arg( m_tuning.cacheSize ) );
+    m_db.exec( QString( "PRAGMA current_segment.mmap_size=%1;" ).arg( m_tuning.memoryMapSize ) );
+    {
+        QSqlQuery journalMode = m_db.exec( "PRAGMA main.journal_mode;" );
+        if ( journalMode.next() && journalMode.value( 0 ).toString().compare( "wal", Qt::CaseInsensitive ) == 0 ) {
+            journalMode.finish();
+            m_db.exec( "PRAGMA current_segment.journal_mode=WAL;" );
+        }
+    }
+
+    m_statements = new InsertStatements( m_db, "current_segment" );
+}
+
+void DatabaseFeeder::detachSegment()
+{
+    delete m_statements;
+    m_statements = 0;
+
+    // Leaves a single, complete file behind for readers and the archive
+    m_db.exec( "PRAGMA current_segment.wal_checkpoint(TRUNCATE);" );
+    m_db.exec( "DETACH DATABASE current_segment;" );
+
+    m_statements = new InsertStatements( m_db );
+}
+
+void DatabaseFeeder::dropOldSegments()
+{
+    qint64 totalSize = databaseFileSize( m_db.databaseName() );
+    QList<Segment>::ConstIterator it, end = m_segments.end();
+    for ( it = m_segments.begin(); it != end; ++it ) {
+        totalSize += databaseFileSize( it->fileName );
+    }
+
+    // The segment entries are stored in is never dropped
+    bool dropped = false;
+    while ( m_segments.size() > 1 &&
+            ( m_segments.size() > Database::MaximumSegments ||
+              ( m_maximumSize != StorageConfiguration::UnlimitedTraceSize &&
+                totalSize > qint64( m_maximumSize ) ) ) ) {
+        if ( m_segments.size() > Database::MaximumSegments &&
+             ( m_maximumSize == StorageConfiguration::UnlimitedTraceSize ||
+               totalSize <= qint64( m_maximumSize ) ) ) {
+            qWarning() << "Dropping segment" << m_segments.first().fileName
+                       << "since no more than" << Database::MaximumSegments << "segments are kept";
+        }
+        const Segment oldest = m_segments.takeFirst();
+        totalSize -= databaseFileSize( oldest.fileName );
+        removeSegment( oldest, true );
+        dropped = true;
+    }
+
+    if ( dropped ) {
+        pruneLookupTables();
+        archivedEntries();
+    }
+}
+
+void DatabaseFeeder::removeSegment( const Segment &segment, bool archive )
+{
+    {
+        Transaction transaction( m_db );
+        transaction.exec( QString( "DELETE FROM segment WHERE id=%1;" ).arg( segment.id ) );
+    }
+
+    if ( QFile::exists( segment.fileName ) ) {
+        AttachedArchive attachedSegment( m_db, segment.fileName );
+        Transaction transaction( m_db );
+        transaction.exec( "INSERT OR IGNORE INTO temp.removed_trace_point SELECT DISTINCT trace_point_id FROM archive.trace_entry;" );
+        transaction.exec( "INSERT OR IGNORE INTO temp.removed_traced_thread SELECT DISTINCT traced_thread_id FROM archive.trace_entry;" );
+        // Entries stored before segments were enabled are older but still there
+        if ( m_textIndexEnabled ) {
+            transaction.exec( "DELETE FROM main.entry_text WHERE rowid BETWEEN"
+                              " (SELECT MIN(id) FROM archive.trace_entry) AND (SELECT MAX(id) FROM archive.trace_entry);" );
+        }
+    }
+
+    /* Note that segments still opened by readers cannot be moved or
+     * removed on Windows; they are left behind in that case.
+     */
+    if ( archive && !m_archiveDir.isEmpty() ) {
+        if ( !QDir().mkpath( m_archiveDir ) ) {
+            qWarning() << "Failed to archive segment" << segment.fileName
+                       << ": creating archive directory" << m_archiveDir << "failed";
+            return;
+        }
+        const QString archiveName = archiveFileName( m_archiveDir, m_db.databaseName() );
+        if ( !QFile::rename( segment.fileName, archiveName ) ) {
+            qWarning() << "Failed to move segment" << segment.fileName << "to" << archiveName;
+            return;
+        }
+        QFile::remove( segment.fileName + "-shm" );
+
+        // Make the archive usable on its own
+        AttachedArchive archive( m_db, archiveName );
+        Transaction transaction( m_db );
+        const char * const statements[] = {
+            "INSERT OR IGNORE INTO archive.traced_thread SELECT * FROM main.traced_thread"
+            " WHERE id IN (SELECT DISTINCT traced_thread_id FROM archive.trace_entry);",
+            "INSERT OR IGNORE INTO archive.process SELECT * FROM main.process"
+            " WHERE id IN (SELECT process_id FROM archive.traced_thread);",
+            "INSERT OR IGNORE INTO archive.trace_point SELECT * FROM main.trace_point"
+            " WHERE id IN (SELECT DISTINCT trace_point_id FROM archive.trace_entry);",
+            "INSERT OR IGNORE INTO archive.path_name SELECT * FROM main.path_name"
+            " WHERE id IN (SELECT path_id FROM archive.trace_point);",
+            "INSERT OR IGNORE INTO archive.function_name SELECT * FROM main.function_name"
+            " WHERE id IN (SELECT function_id FROM archive.trace_point);",
+            "INSERT OR IGNORE INTO archive.trace_point_group SELECT * FROM main.trace_point_group"
+            " WHERE id IN (SELECT group_id FROM archive.trace_point);"
+        };
+        for ( unsigned int i = 0; i < sizeof( statements ) / sizeof( statements[0] ); ++i ) {
+            transaction.exec( statements[i] );
+        }
+        return;
+    }
+
+    if ( !QFile::remove( segment.fileName ) ) {
+        qWarning() << "Failed to remove segment" << segment.fileName;
+    }
+    QFile::remove( segment.fileName + "-wal" );
+    QFile::remove( segment.fileName + "-shm" );
+}
+
+/* Removes the trace points and threads only the entries of removed
+ * segments referred to, followed by whatever names and processes are left
+ * unused. Entries of the main database and of all remaining segments are
+ * checked, not just those of the attached one.
+ */
+void DatabaseFeeder::pruneLookupTables()
+{
+    const char * const unreferencedStatements[] = {
+        "DELETE FROM temp.removed_trace_point WHERE EXISTS"
+        " (SELECT 1 FROM %1.trace_entry WHERE trace_point_id = removed_trace_point.id);",
+        "DELETE FROM temp.removed_traced_thread WHERE EXISTS"
+        " (SELECT 1 FROM %1.trace_entry WHERE traced_thread_id = removed_traced_thread.id);"
+    };
+    // Starting a new segment may have failed after detaching the last one
+    bool currentSegmentAttached = false;
+    {
+        QSqlQuery q( m_db );
+        q.setForwardOnly( true );
+        currentSegmentAttached = q.exec( "SELECT 1 FROM pragma_database_list WHERE name='current_segment';" ) && q.next();
+    }
+
+    QStringList schemas;
+    schemas << "main";
+    if ( currentSegmentAttached ) {
+        schemas << "current_segment";
+    }
+    QStringList::ConstIterator schema, schemasEnd = schemas.end();
+    for ( schema = schemas.begin(); schema != schemasEnd; ++schema ) {
+        Transaction transaction( m_db );
+        for ( unsigned int i = 0; i < sizeof( unreferencedStatements ) / sizeof( unreferencedStatements[0] ); ++i ) {
+            transaction.exec( QString( unreferencedStatements[i] ).arg( *schema ) );
+        }
+    }
+    const int numDetachedSegments = currentSegmentAttached ? m_segments.size() - 1 : m_segments.size();
+    for ( int i = 0; i < numDetachedSegments; ++i ) {
+        if ( !QFile::exists( m_segments[i].fileName ) ) {
+            continue;
+        }
+        AttachedArchive attachedSegment( m_db, m_segments[i].fileName );
+        Transaction transaction( m_db );
+        for ( unsigned int j = 0; j < sizeof( unreferencedStatements ) / sizeof( unreferencedStatements[0] ); ++j ) {
+            transaction.exec( QString( unreferencedStatements[j] ).arg( "archive" ) );
+        }
+    }
+
+    {
+        Transaction transaction( m_db );
+        transaction.exec( "DELETE FROM main.trace_point WHERE id IN (SELECT id FROM temp.removed_trace_point);" );
+        transaction.exec( "DELETE FROM main.traced_thread WHERE id IN (SELECT id FROM temp.removed_traced_thread);" );
+        transaction.exec( "DELETE FROM main.function_name WHERE id NOT IN (SELECT function_id FROM main.trace_point);" );
+        transaction.exec( "DELETE FROM main.path_name WHERE id NOT IN (SELECT path_id FROM main.trace_point);" );
+        transaction.exec( "DELETE FROM main.trace_point_group WHERE id NOT IN (SELECT group_id FROM main.trace_point);" );
+        transaction.exec( "DELETE FROM main.process WHERE id NOT IN (SELECT process_id FROM main.traced_thread);" );
+        transaction.exec( "DELETE FROM temp.removed_trace_point;" );
+        transaction.exec( "DELETE FROM temp.removed_traced_thread;" );
+    }
+    clearCaches();
+    m_uncheckpointedChanges = true;
+}
@@ -22,10 +22,98 @@
 
 #include "xmlcontenthandler.h"
 
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+
+class InsertStatements;
+
+struct DatabaseTuning
+{
+    // Page cache size in KiB
+    static const int DefaultCacheSize = 16384;
+
+    DatabaseTuning()
+        : cacheSize( DefaultCacheSize ),
+          memoryMapSize( 0 ),
+          textIndex( false )
+    { }
+
+    int cacheSize;
+    // Bytes of the database file accessed via memory mapping; 0 disables it
+    qint64 memoryMapSize;
+    // Create the full-text index if needed; an existing one is always maintained
+    bool textIndex;
+};
+
+/* Trace entries can be split into segment files, one per the given number
+ * of hours or entries; a value of 0 doesn't limit the segment in that
+ * respect.
+ */
+struct SegmentConfiguration
+{
+    SegmentConfiguration()
+        : hours( 0 ),
+          entries( 0 )
+    { }
+
+    bool isEnabled() const { return hours > 0 || entries > 0; }
+
+    int hours;
+    qulonglong entries;
+};
+
 class DatabaseFeeder : public XmlParseEventsHandler
 {
 public:
+    // Maximum number of trace entries stored in a single transaction
+    static const int DefaultBatchSize;
+    // Maximum time in milliseconds a trace entry stays queued
+    static const int DefaultBatchDelay;
+
     DatabaseFeeder( QSqlDatabase db );
+    virtual ~DatabaseFeeder();
+
+    void setBatchLimits( int maximumSize, int maximumDelay );
+
+    // Stores all queued trace entries in the database
+    void flushPendingEntries();
+
+    void applyTuning( const DatabaseTuning &tuning );
+
+    /* Switches the database to write-ahead logging, so that readers and
+     * the writer don't block each other. Checkpoints are left to
+     * checkpoint() unless the log grows beyond MaximumWalPages.
+     */
+    static const int MaximumWalPages;
+    bool enableWriteAheadLog();
+
+    /* Archiving happens in chunks of ArchiveChunkSize entries, so that
+     * storing new entries can go on in between.
+     */
+    static const int ArchiveChunkSize;
+    bool isArchiving() const { return m_entriesToArchive > 0; }
+    // Returns the number of entries moved to the archive
+    qulonglong continueArchiving();
+
+    // Copies the changes committed so far from the log into the database
+    void checkpoint();
+    // Refreshes the statistics used by the query planner if needed
+    void updateStatistics();
+    bool hasUncheckpointedChanges() const { return m_uncheckpointedChanges; }
+
+    /* Stores new entries in segment files from now on. Retention then drops
+     * the oldest segment file (moving it to the archive directory, if any)
+     * instead of archiving entries, and segments are never grown beyond
+     * shrinkBy percent of the maximum size.
+     */
+    void enableSegments( const SegmentConfiguration &cfg );
+
+    /* Adds every entry stored from now on to the full-text index (see
+     * Database::hasTextIndex()), creating and filling it first if needed.
+     */
+    void enableTextIndex();
+
 protected:
     virtual void handleTraceEntry( const TraceEntry & );
     virtual void applyStorageConfiguration( const StorageConfiguration & );
@@ -33,13 +121,53 @@ protected:
 
     // Needed for the server to send out notifications to the GUI when entries are archived
     virtual void archivedEntries() {}
+    // Called after the given entries were committed to the database
+    virtual void storedEntries( const QList<TraceEntry> & ) {}
+    // Called after a segment file was started, readers need to attach it
+    virtual void segmentsChanged() {}
     // Needed for the server subclass to nuke the database
     void trimDb();
 private:
+    DatabaseFeeder( const DatabaseFeeder &other );
+    void operator=( const DatabaseFeeder &rhs );
+
+    void storeEntries( QList<TraceEntry> *entries );
+    void beginArchiving();
+    void finishArchiving();
+
+    struct Segment
+    {
+        qlonglong id;
+        QString fileName;
+    };
+
+    bool needsNewSegment() const;
+    void startSegment();
+    void attachSegment( const QString &fileName );
+    void detachSegment();
+    void dropOldSegments();
+    void removeSegment( const Segment &segment, bool archive );
+    void pruneLookupTables();
+
     QSqlDatabase m_db;
     unsigned short m_shrinkBy;
     unsigned long m_maximumSize;
     QString m_archiveDir;
+    InsertStatements *m_statements;
+    QList<TraceEntry> m_pendingEntries;
+    QElapsedTimer m_batchTimer;
+    int m_maximumBatchSize;
+    int m_maximumBatchDelay;
+    bool m_uncheckpointedChanges;
+    QString m_archiveFileName;
+    qulonglong m_entriesToArchive;
+    DatabaseTuning m_tuning;
+    SegmentConfiguration m_segmentation;
+    // Oldest first, the last one is the one entries are stored in
+    QList<Segment> m_segments;
+    qint64 m_segmentStartTime;
+    qulonglong m_segmentEntries;
+    bool m_textIndexEnabled;
 };
 
 #endif // TRACER_DATABASEFEEDER_H
@@ -0,0 +1,307 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "databasewriter.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include <stdexcept>
+
+using namespace std;
+
+const int DatabaseWriter::DefaultQueueCapacity = 10000;
+const int DatabaseWriter::IdleCheckpointDelay = 1000;
+
+class WriterFeeder : public DatabaseFeeder
+{
+public:
+    WriterFeeder( QSqlDatabase db, DatabaseWriter *writer )
+        : DatabaseFeeder( db ),
+        m_writer( writer )
+    {
+    }
+
+    void execute( const DatabaseWriter::Command &command )
+    {
+        switch ( command.type ) {
+            case DatabaseWriter::Command::StoreTraceEntry:
+                handleTraceEntry( command.entry );
+                break;
+            case DatabaseWriter::Command::StoreShutdownEvent:
+                handleShutdownEvent( command.shutdownEvent );
+                emit m_writer->processShutdown( command.shutdownEvent );
+                break;
+            case DatabaseWriter::Command::ApplyStorageConfiguration:
+                applyStorageConfiguration( command.storageConfiguration );
+                break;
+            case DatabaseWriter::Command::TrimDatabase:
+                trimDb();
+                emit m_writer->databaseTrimmed();
+                break;
+        }
+    }
+
+protected:
+    virtual void archivedEntries()
+    {
+        emit m_writer->entriesArchived();
+    }
+
+    virtual void storedEntries( const QList<TraceEntry> &entries )
+    {
+        m_writer->recordStoredEntries( entries.size() );
+        emit m_writer->entriesStored( entries );
+    }
+
+    virtual void segmentsChanged()
+    {
+        emit m_writer->segmentsChanged();
+    }
+
+private:
+    DatabaseWriter *m_writer;
+};
+
+DatabaseWriter::DatabaseWriter( QSqlDatabase db, const DatabaseTuning &tuning,
+                                QObject *parent )
+    : QThread( parent ),
+    m_db( db ),
+    m_tuning( tuning ),
+    m_queueCapacity( DefaultQueueCapacity ),
+    m_stopRequested( false )
+{
+    qRegisterMetaType<TraceEntry>( "TraceEntry" );
+    qRegisterMetaType<QList<TraceEntry> >( "QList<TraceEntry>" );
+    qRegisterMetaType<ProcessShutdownEvent>( "ProcessShutdownEvent" );
+}
+
+DatabaseWriter::~DatabaseWriter()
+{
+    stop();
+}
+
+void DatabaseWriter::setQueueCapacity( int capacity )
+{
+    QMutexLocker locker( &m_mutex );
+    m_queueCapacity = capacity;
+    m_queueNotFull.wakeAll();
+}
+
+void DatabaseWriter::setSegmentConfiguration( const SegmentConfiguration &cfg )
+{
+    m_segmentation = cfg;
+}
+
+void DatabaseWriter::addTraceEntry( const TraceEntry &e )
+{
+    Command command( Command::StoreTraceEntry );
+    command.entry = e;
+    enqueue( command );
+}
+
+void DatabaseWriter::addShutdownEvent( const ProcessShutdownEvent &ev )
+{
+    Command command( Command::StoreShutdownEvent );
+    command.shutdownEvent = ev;
+    enqueue( command );
+}
+
+void DatabaseWriter::addStorageConfiguration( const StorageConfiguration &cfg )
+{
+    Command command( Command::ApplyStorageConfiguration );
+    command.storageConfiguration = cfg;
+    enqueue( command );
+}
+
+void DatabaseWriter::trimDatabase()
+{
+    enqueue( Command( Command::TrimDatabase ) );
+}
+
+void DatabaseWriter::stop()
+{
+    {
+        QMutexLocker locker( &m_mutex );
+        m_stopRequested = true;
+        m_queueNotEmpty.wakeAll();
+        m_queueNotFull.wakeAll();
+    }
+    wait();
+}
+
+DatabaseWriter::Statistics DatabaseWriter::statistics() const
+{
+    QMutexLocker locker( &m_mutex );
+    Statistics s = m_statistics;
+    s.queueDepth = m_queue.size();
+    return s;
+}
+
+void DatabaseWriter::enqueue( const Command &command )
+{
+    QMutexLocker locker( &m_mutex );
+    if ( m_queue.size() >= m_queueCapacity && !m_stopRequested ) {
+        QElapsedTimer timer;
+        timer.start();
+        ++m_statistics.blockedProducers;
+        while ( m_queue.size() >= m_queueCapacity && !m_stopRequested ) {
+            m_queueNotFull.wait( &m_mutex );
+        }
+        m_statistics.blockedMilliseconds += timer.elapsed();
+    }
+    // Nobody would take the command off the queue anymore
+    if ( m_stopRequested ) {
+        dropCommand( command );
+        return;
+    }
+
+    m_queue.enqueue( command );
+    if ( command.type == Command::StoreTraceEntry ) {
+        ++m_statistics.queuedEntries;
+    }
+    if ( m_queue.size() > m_statistics.maximumQueueDepth ) {
+        m_statistics.maximumQueueDepth = m_queue.size();
+    }
+    m_queueNotEmpty.wakeOne();
+}
+
+// Needs to be called with m_mutex locked
+void DatabaseWriter::dropCommand( const Command &command )
+{
+    if ( command.type != Command::StoreTraceEntry ) {
+        return;
+    }
+    if ( m_statistics.droppedEntries++ == 0 ) {
+        qWarning() << "Dropping trace entries since the database writer is not running anymore";
+    }
+}
+
+void DatabaseWriter::recordStoredEntries( int count )
+{
+    QMutexLocker locker( &m_mutex );
+    m_statistics.storedEntries += count;
+}
+
+void DatabaseWriter::run()
+{
+    const QString connectionName = m_db.connectionName() + "-writer";
+    {
+        QString errMsg;
+        QSqlDatabase db = Database::clone( m_db, connectionName, &errMsg );
+        if ( !db.isValid() ) {
+            qWarning() << "Failed to open database for storing trace data:" << errMsg;
+            {
+                QMutexLocker locker( &m_mutex );
+                m_stopRequested = true;
+                while ( !m_queue.isEmpty() ) {
+                    dropCommand( m_queue.dequeue() );
+                }
+                m_queueNotFull.wakeAll();
+            }
+            emit failed( errMsg );
+            return;
+        }
+
+        WriterFeeder feeder( db, this );
+        feeder.applyTuning( m_tuning );
+        if ( !feeder.enableWriteAheadLog() ) {
+            qWarning() << "Failed to enable write-ahead logging for" << db.databaseName()
+                       << "- readers of the database may block storing trace data";
+        }
+        if ( m_tuning.textIndex || Database::hasTextIndex( db ) ) {
+            try {
+                feeder.enableTextIndex();
+            } catch ( const runtime_error &e ) {
+                qWarning() << "Failed to maintain full-text index of trace entries:" << e.what();
+            }
+        }
+        if ( m_segmentation.isEnabled() ) {
+            try {
+                feeder.enableSegments( m_segmentation );
+            } catch ( const runtime_error &e ) {
+                qWarning() << "Failed to store trace data in segments:" << e.what();
+            }
+        }
+
+        QElapsedTimer idleTimer;
+        idleTimer.start();
+        while ( true ) {
+            QQueue<Command> commands;
+            bool stopRequested;
+            {
+                QMutexLocker locker( &m_mutex );
+                /* Give the feeder a chance to store a partial batch in case
+                 * no more data arrives for a while.
+                 */
+                if ( m_queue.isEmpty() && !m_stopRequested && !feeder.isArchiving() ) {
+                    m_queueNotEmpty.wait( &m_mutex, DatabaseFeeder::DefaultBatchDelay );
+                }
+                commands.swap( m_queue );
+                stopRequested = m_stopRequested;
+                m_queueNotFull.wakeAll();
+            }
+
+            const bool idle = commands.isEmpty();
+            if ( !idle ) {
+                idleTimer.restart();
+            }
+            while ( !commands.isEmpty() ) {
+                try {
+                    feeder.execute( commands.dequeue() );
+                } catch ( const runtime_error &e ) {
+                    qWarning() << e.what();
+                }
+            }
+
+            if ( idle || stopRequested ) {
+                try {
+                    feeder.flushPendingEntries();
+                } catch ( const runtime_error &e ) {
+                    qWarning() << e.what();
+                }
+            }
+            if ( stopRequested ) {
+                break;
+            }
+
+            // Archive passes are interleaved with storing new entries
+            if ( feeder.isArchiving() ) {
+                try {
+                    feeder.continueArchiving();
+                } catch ( const runtime_error &e ) {
+                    qWarning() << e.what();
+                }
+                continue;
+            }
+
+            /* Checkpointing while traced applications are quiet keeps the
+             * log small without competing with storing entries; the same
+             * goes for keeping the query planner statistics up to date.
+             */
+            if ( idle && feeder.hasUncheckpointedChanges() &&
+                 idleTimer.elapsed() >= IdleCheckpointDelay ) {
+                feeder.checkpoint();
+                feeder.updateStatistics();
+            }
+        }
+    }
+    QSqlDatabase::removeDatabase( connectionName );
+}
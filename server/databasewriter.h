@@ -0,0 +1,136 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACER_DATABASEWRITER_H
+#define TRACER_DATABASEWRITER_H
+
+#include "database.h"
+#include "databasefeeder.h"
+#include "xmlcontenthandler.h"
+
+#include <QList>
+#include <QMetaType>
+#include <QMutex>
+#include <QQueue>
+#include <QSqlDatabase>
+#include <QThread>
+#include <QWaitCondition>
+
+/* Stores trace data in a thread of its own so that slow disk I/O doesn't
+ * hold up reading from the traced applications or notifying GUIs. Data is
+ * passed through a bounded queue; producers are blocked while it is full.
+ */
+class DatabaseWriter : public QThread
+{
+    Q_OBJECT
+public:
+    // Maximum number of queued trace entries and events
+    static const int DefaultQueueCapacity;
+    // Milliseconds without incoming data after which a checkpoint is done
+    static const int IdleCheckpointDelay;
+
+    struct Statistics
+    {
+        Statistics()
+            : queueDepth( 0 ), maximumQueueDepth( 0 ),
+            queuedEntries( 0 ), storedEntries( 0 ), droppedEntries( 0 ),
+            blockedProducers( 0 ), blockedMilliseconds( 0 )
+        { }
+
+        int queueDepth;
+        int maximumQueueDepth;
+        quint64 queuedEntries;
+        quint64 storedEntries;
+        // Entries which arrived after the writer stopped or failed
+        quint64 droppedEntries;
+        // How often and how long producers waited for a full queue
+        quint64 blockedProducers;
+        quint64 blockedMilliseconds;
+    };
+
+    DatabaseWriter( QSqlDatabase db, const DatabaseTuning &tuning,
+                    QObject *parent = 0 );
+    ~DatabaseWriter();
+
+    void setQueueCapacity( int capacity );
+    // Needs to be called before the thread is started
+    void setSegmentConfiguration( const SegmentConfiguration &cfg );
+
+    void addTraceEntry( const TraceEntry &e );
+    void addShutdownEvent( const ProcessShutdownEvent &ev );
+    void addStorageConfiguration( const StorageConfiguration &cfg );
+    void trimDatabase();
+
+    // Stores all queued data and terminates the thread
+    void stop();
+
+    Statistics statistics() const;
+
+signals:
+    void entriesStored( const QList<TraceEntry> &entries );
+    void processShutdown( const ProcessShutdownEvent &ev );
+    void entriesArchived();
+    void databaseTrimmed();
+    void segmentsChanged();
+    // The database could not be opened for writing; nothing gets stored
+    void failed( const QString &errorString );
+
+protected:
+    virtual void run();
+
+private:
+    friend class WriterFeeder;
+
+    struct Command
+    {
+        enum Type {
+            StoreTraceEntry,
+            StoreShutdownEvent,
+            ApplyStorageConfiguration,
+            TrimDatabase
+        };
+
+        Command( Type type_ = StoreTraceEntry ) : type( type_ ) { }
+
+        Type type;
+        TraceEntry entry;
+        ProcessShutdownEvent shutdownEvent;
+        StorageConfiguration storageConfiguration;
+    };
+
+    void enqueue( const Command &command );
+    void dropCommand( const Command &command );
+    void recordStoredEntries( int count );
+
+    QSqlDatabase m_db;
+    DatabaseTuning m_tuning;
+    SegmentConfiguration m_segmentation;
+    mutable QMutex m_mutex;
+    QWaitCondition m_queueNotEmpty;
+    QWaitCondition m_queueNotFull;
+    QQueue<Command> m_queue;
+    int m_queueCapacity;
+    bool m_stopRequested;
+    Statistics m_statistics;
+};
+
+Q_DECLARE_METATYPE( TraceEntry )
+Q_DECLARE_METATYPE( ProcessShutdownEvent )
+
+#endif // TRACER_DATABASEWRITER_H
@@ -21,13 +21,21 @@
 #define TRACE_DATAGRAMTYPES_H
 
 #define MagicServerProtocolCookie (quint32)0x22021990
+/* Version 2 frames datagrams with a 32 bit length and sends stored trace
+ * entries in batches. Version 3 adds the database id of every entry.
+ */
+#define ServerProtocolVersion (quint32)3
 
 enum ServerDatagramType {
     TraceFileNameDatagram,
     TraceEntryDatagram,
     ProcessShutdownEventDatagram,
     DatabaseNukeDatagram,
-    DatabaseNukeFinishedDatagram
+    DatabaseNukeFinishedDatagram,
+    SegmentsChangedDatagram,
+    TraceEntriesDatagram,
+    // Number of entries not sent to a GUI which didn't keep up
+    TraceEntriesSkippedDatagram
 };
 
 #endif // !defined(TRACE_DATAGRAMTYPES_H)
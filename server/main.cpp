@@ -91,11 +91,28 @@ int main( int argc, char **argv )
                                   "port", QString::number(TRACELIB_DEFAULT_PORT));
     QCommandLineOption guiportOption(QStringList() << "g" << "guiport", "Listening Port for the trace gui to connect to.",
                                      "guiport", QString::number(TRACELIB_DEFAULT_PORT + 1));
+    QCommandLineOption statisticsOption(QStringList() << "s" << "statistics", "Print statistics about the queue of entries waiting to be stored every given number of seconds.",
+                                        "seconds");
+    QCommandLineOption cacheSizeOption(QStringList() << "cache-size", "Size of the database page cache in KiB.",
+                                       "kib", QString::number(DatabaseTuning::DefaultCacheSize));
+    QCommandLineOption mmapSizeOption(QStringList() << "mmap-size", "Size of the database file region accessed via memory mapping in MiB, 0 disables memory mapping.",
+                                      "mib", "0");
+    QCommandLineOption segmentHoursOption(QStringList() << "segment-hours", QString("Store trace entries in a new segment file every given number of hours. At most %1 segments are kept.").arg(Database::MaximumSegments),
+                                          "hours");
+    QCommandLineOption segmentEntriesOption(QStringList() << "segment-entries", QString("Store trace entries in a new segment file every given number of entries. At most %1 segments are kept.").arg(Database::MaximumSegments),
+                                            "entries");
+    QCommandLineOption textIndexOption(QStringList() << "text-index", "Maintain a full-text index of messages, functions, files and variable values for searching in the GUI. Requires SQLite 3.34 or newer.");
     opt.addHelpOption();
     opt.addVersionOption();
     opt.setApplicationDescription("Listens for trace library connections to store trace entries into a database");
     opt.addOption(portOption);
     opt.addOption(guiportOption);
+    opt.addOption(statisticsOption);
+    opt.addOption(cacheSizeOption);
+    opt.addOption(mmapSizeOption);
+    opt.addOption(segmentHoursOption);
+    opt.addOption(segmentEntriesOption);
+    opt.addOption(textIndexOption);
     opt.addPositionalArgument(".trace_file", "Trace database to store the trace entries into");
     opt.process(app);
 
@@ -124,6 +141,66 @@ int main( int argc, char **argv )
 		 << "' given." << endl;
 	    return Error::CommandLineArgs;
     }
+    int statisticsInterval = 0;
+    if (opt.isSet(statisticsOption)) {
+        statisticsInterval = opt.value(statisticsOption).toInt(&ok);
+        if (!ok || statisticsInterval <= 0) {
+            cout << "Invalid statistics interval '"
+                 << opt.value(statisticsOption).toLocal8Bit().constData()
+                 << "' given." << endl;
+            return Error::CommandLineArgs;
+        }
+    }
+    DatabaseTuning tuning;
+    tuning.cacheSize = opt.value(cacheSizeOption).toInt(&ok);
+    if (!ok || tuning.cacheSize <= 0) {
+        cout << "Invalid cache size '"
+             << opt.value(cacheSizeOption).toLocal8Bit().constData()
+             << "' given." << endl;
+        return Error::CommandLineArgs;
+    }
+    const int mmapSize = opt.value(mmapSizeOption).toInt(&ok);
+    if (!ok || mmapSize < 0) {
+        cout << "Invalid memory map size '"
+             << opt.value(mmapSizeOption).toLocal8Bit().constData()
+             << "' given." << endl;
+        return Error::CommandLineArgs;
+    }
+    tuning.memoryMapSize = qint64(mmapSize) * 1024 * 1024;
+    tuning.textIndex = opt.isSet(textIndexOption);
+    SegmentConfiguration segmentation;
+    if (opt.isSet(segmentHoursOption)) {
+        segmentation.hours = opt.value(segmentHoursOption).toInt(&ok);
+        if (!ok || segmentation.hours <= 0) {
+            cout << "Invalid number of hours per segment '"
+                 << opt.value(segmentHoursOption).toLocal8Bit().constData()
+                 << "' given." << endl;
+            return Error::CommandLineArgs;
+        }
+    }
+    if (opt.isSet(segmentEntriesOption)) {
+        segmentation.entries = opt.value(segmentEntriesOption).toULongLong(&ok);
+        if (!ok || segmentation.entries == 0) {
+            cout << "Invalid number of entries per segment '"
+                 << opt.value(segmentEntriesOption).toLocal8Bit().constData()
+                 << "' given." << endl;
+            return Error::CommandLineArgs;
+        }
+    }
+    if (segmentation.isEnabled()) {
+        cout << "Warning: no more than " << Database::MaximumSegments << " segments are kept,"
+             << " so only about the last";
+        if (segmentation.hours > 0) {
+            cout << " " << qint64(segmentation.hours) * Database::MaximumSegments << " hours";
+        }
+        if (segmentation.hours > 0 && segmentation.entries > 0) {
+            cout << " or";
+        }
+        if (segmentation.entries > 0) {
+            cout << " " << segmentation.entries * Database::MaximumSegments << " entries";
+        }
+        cout << " of trace data are retained." << endl;
+    }
     if (port == guiport) {
 	cout << "Trace port and GUI port have to be different." << endl;
 	return Error::CommandLineArgs;
@@ -142,7 +219,8 @@ int main( int argc, char **argv )
         return Error::Database;
     }
 
-    Server server(traceFile, database, port, guiport);
+    Server server(traceFile, database, port, guiport, tuning, segmentation);
+    server.setStatisticsInterval(statisticsInterval);
 
     return app.exec();
 }
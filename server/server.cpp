@@ -22,7 +22,9 @@
 #include "database.h"
 #include "datagramtypes.h"
 
+#include <QCoreApplication>
 #include <QDataStream>
+#include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
@@ -33,8 +35,66 @@
 
 using namespace std;
 
-ClientSocket::ClientSocket( QObject *parent )
-    : QTcpSocket( parent )
+ConnectionParser::ConnectionParser( DatabaseWriter *writer )
+    : m_writer( writer ),
+    m_xmlHandler( 0 ),
+    m_binaryHandler( 0 )
+{
+}
+
+ConnectionParser::~ConnectionParser()
+{
+    delete m_xmlHandler;
+    delete m_binaryHandler;
+}
+
+/* Returns false if the data is invalid; nothing after it can be decoded,
+ * so the connection should be dropped then.
+ */
+bool ConnectionParser::addData( const QByteArray &data )
+{
+    if ( !m_xmlHandler && !m_binaryHandler ) {
+        if ( BinaryContentHandler::isBinaryData( data ) ) {
+            m_binaryHandler = new BinaryContentHandler( this );
+        } else {
+            m_xmlHandler = new XmlContentHandler( this );
+            m_xmlHandler->addData( "<toplevel_trace_element>" );
+        }
+    }
+
+    try {
+        if ( m_binaryHandler ) {
+            m_binaryHandler->addData( data );
+            m_binaryHandler->continueParsing();
+        } else {
+            m_xmlHandler->addData( data );
+            m_xmlHandler->continueParsing();
+        }
+    } catch ( const runtime_error &e ) {
+        qWarning() << e.what();
+        return false;
+    }
+    return true;
+}
+
+void ConnectionParser::handleTraceEntry( const TraceEntry &e )
+{
+    m_writer->addTraceEntry( e );
+}
+
+void ConnectionParser::applyStorageConfiguration( const StorageConfiguration &cfg )
+{
+    m_writer->addStorageConfiguration( cfg );
+}
+
+void ConnectionParser::handleShutdownEvent( const ProcessShutdownEvent &ev )
+{
+    m_writer->addShutdownEvent( ev );
+}
+
+ClientSocket::ClientSocket( DatabaseWriter *writer, QObject *parent )
+    : QTcpSocket( parent ),
+    m_parser( writer )
 {
     connect( this, SIGNAL( readyRead() ),
              this, SLOT( handleIncomingData() ) );
@@ -42,25 +102,29 @@ ClientSocket::ClientSocket( QObject *parent )
 
 void ClientSocket::handleIncomingData()
 {
+    /* Parsing happens right here in the networking thread; while the
+     * writer queue is full, this blocks reading from the application.
+     */
     const QByteArray data = readAll();
     assert( !data.isEmpty() );
-    emit dataReceived( data );
+    if ( !m_parser.addData( data ) ) {
+        abort();
+    }
 }
 
-NetworkingThread::NetworkingThread( int socketDescriptor, QObject *parent )
+NetworkingThread::NetworkingThread( int socketDescriptor, DatabaseWriter *writer,
+                                    QObject *parent )
     : QThread( parent ),
     m_socketDescriptor( socketDescriptor ),
+    m_writer( writer ),
     m_clientSocket( 0 )
 {
 }
 
 void NetworkingThread::run()
 {
-    m_clientSocket = new ClientSocket;
+    m_clientSocket = new ClientSocket( m_writer );
     m_clientSocket->setSocketDescriptor( m_socketDescriptor );
-    connect( m_clientSocket, SIGNAL( dataReceived( const QByteArray & ) ),
-             this, SIGNAL( dataReceived( const QByteArray & ) ),
-             Qt::QueuedConnection );
     connect( m_clientSocket, SIGNAL( disconnected() ),
              this, SLOT( quit() ),
              Qt::QueuedConnection  );
@@ -68,9 +132,9 @@ void NetworkingThread::run()
     delete m_clientSocket;
 }
 
-ServerSocket::ServerSocket( Server *server )
+ServerSocket::ServerSocket( Server *server, DatabaseWriter *writer )
     : QTcpServer( server ),
-    m_server( server )
+    m_writer( writer )
 {
 }
 
@@ -89,19 +153,56 @@ ServerSocket::~ServerSocket()
 void ServerSocket::incomingConnection( int socketDescriptor )
 {
     NetworkingThread *thread = new NetworkingThread( socketDescriptor,
+                                                     m_writer,
                                                      this );
     m_networkingThreads.push_back( thread );
-    connect( thread, SIGNAL( dataReceived( const QByteArray & ) ),
-             m_server, SLOT( handleIncomingData( const QByteArray & ) ) );
     connect( thread, SIGNAL( finished() ),
              thread, SLOT( deleteLater() ) );
     thread->start();
 }
 
+// duplicated in gui/mainwindow.cpp
+template <typename DatagramType, typename ValueType>
+QByteArray serializeDatagram( DatagramType type, const ValueType *v )
+{
+    QByteArray payload;
+    {
+        QDataStream stream( &payload, QIODevice::WriteOnly );
+        stream.setVersion( QDataStream::Qt_4_0 );
+        stream << MagicServerProtocolCookie << ServerProtocolVersion << (quint8)type;
+        if ( v ) {
+            stream << *v;
+        }
+    }
+
+    QByteArray data;
+    {
+        QDataStream stream( &data, QIODevice::WriteOnly );
+        stream.setVersion( QDataStream::Qt_4_0 );
+        stream << (quint32)payload.size();
+        data.append( payload );
+    }
+
+    return data;
+}
+
+QByteArray serializeGUIClientData( ServerDatagramType type ) {
+    return serializeDatagram( type, (int *)0 );
+}
+
+template <typename T>
+QByteArray serializeGUIClientData( ServerDatagramType type, const T &v ) {
+    return serializeDatagram( type, &v );
+}
+
+const qint64 GUIConnection::HighWaterMark = 4 * 1024 * 1024;
+
 GUIConnection::GUIConnection( Server *server, QTcpSocket *sock )
     : QObject( server ),
     m_server( server ),
-    m_sock( sock )
+    m_sock( sock ),
+    m_nextPayloadSize( 0 ),
+    m_skippedEntries( 0 )
 {
     connect( m_sock, SIGNAL( readyRead() ), SLOT( handleIncomingData() ) );
     connect( m_sock, SIGNAL( disconnected() ), SLOT( handleDisconnect() ) );
@@ -112,6 +213,24 @@ void GUIConnection::write( const QByteArray &data )
     m_sock->write( data );
 }
 
+void GUIConnection::writeTraceEntries( const QByteArray &data, int numEntries )
+{
+    if ( m_sock->bytesToWrite() > HighWaterMark ) {
+        m_skippedEntries += numEntries;
+        return;
+    }
+
+    /* The skipped entries are in the database already, so the GUI will
+     * pick up this batch as well when catching up.
+     */
+    if ( m_skippedEntries > 0 ) {
+        m_sock->write( serializeGUIClientData( TraceEntriesSkippedDatagram, quint32( m_skippedEntries + numEntries ) ) );
+        m_skippedEntries = 0;
+        return;
+    }
+    m_sock->write( data );
+}
+
 // Mostly duplicated in gui/mainwindow.cpp (ServerSocket::handleIncomingData)
 void GUIConnection::handleIncomingData()
 {
@@ -119,15 +238,14 @@ void GUIConnection::handleIncomingData()
     stream.setVersion(QDataStream::Qt_4_0);
 
     while (true) {
-        static quint16 nextPayloadSize = 0;
-        if (nextPayloadSize == 0) {
-            if (m_sock->bytesAvailable() < sizeof(nextPayloadSize)) {
+        if (m_nextPayloadSize == 0) {
+            if (m_sock->bytesAvailable() < sizeof(m_nextPayloadSize)) {
                 return;
             }
-            stream >> nextPayloadSize;
+            stream >> m_nextPayloadSize;
         }
 
-        if (m_sock->bytesAvailable() < nextPayloadSize) {
+        if (m_sock->bytesAvailable() < m_nextPayloadSize) {
             return;
         }
 
@@ -140,7 +258,11 @@ void GUIConnection::handleIncomingData()
 
         quint32 protocolVersion;
         stream >> protocolVersion;
-        assert(protocolVersion == 1);
+        if (protocolVersion != ServerProtocolVersion) {
+            qWarning() << "Disconnecting GUI using unsupported protocol version" << protocolVersion;
+            m_sock->disconnectFromHost();
+            return;
+        }
 
         quint8 datagramType;
         stream >> datagramType;
@@ -149,7 +271,7 @@ void GUIConnection::handleIncomingData()
                 emit databaseNukeRequested();
                 break;
         }
-        nextPayloadSize = 0;
+        m_nextPayloadSize = 0;
     }
 }
 
@@ -163,107 +285,134 @@ void GUIConnection::handleDisconnect()
 Server::Server( const QString &traceFile,
                 QSqlDatabase database,
                 unsigned short port, unsigned short guiPort,
+                const DatabaseTuning &tuning,
+                const SegmentConfiguration &segmentation,
                 QObject *parent )
     : QObject( parent ),
-      DatabaseFeeder( database ),
       m_tcpServer( 0 ),
-      m_xmlHandler( this )
+      m_statisticsTimer( 0 )
 {
     QFileInfo fi( traceFile );
     m_traceFile = QDir::toNativeSeparators( fi.canonicalFilePath() );
 
-    m_tcpServer = new ServerSocket( this );
+    /* Received data is parsed by the networking threads and stored by the
+     * database writer thread; the main thread only takes care of the GUI
+     * connections.
+     */
+    m_writer = new DatabaseWriter( database, tuning, this );
+    m_writer->setSegmentConfiguration( segmentation );
+    connect( m_writer, SIGNAL( entriesStored( const QList<TraceEntry> & ) ),
+             SLOT( handleStoredEntries( const QList<TraceEntry> & ) ) );
+    connect( m_writer, SIGNAL( processShutdown( const ProcessShutdownEvent & ) ),
+             SLOT( handleProcessShutdown( const ProcessShutdownEvent & ) ) );
+    connect( m_writer, SIGNAL( entriesArchived() ), SLOT( handleArchivedEntries() ) );
+    connect( m_writer, SIGNAL( databaseTrimmed() ), SLOT( handleDatabaseTrimmed() ) );
+    connect( m_writer, SIGNAL( segmentsChanged() ), SLOT( handleSegmentsChanged() ) );
+    connect( m_writer, SIGNAL( failed( const QString & ) ),
+             SLOT( handleWriterFailure( const QString & ) ) );
+    m_writer->start();
+
+    m_tcpServer = new ServerSocket( this, m_writer );
     m_tcpServer->listen( QHostAddress::Any, port );
 
     m_guiServer = new QTcpServer( this );
     connect( m_guiServer, SIGNAL( newConnection() ), SLOT( handleNewGUIConnection() ) );
     m_guiServer->listen( QHostAddress::LocalHost, guiPort );
-
-    m_xmlHandler.addData( "<toplevel_trace_element>" );
 }
 
-// duplicated in gui/mainwindow.cpp
-template <typename DatagramType, typename ValueType>
-QByteArray serializeDatagram( DatagramType type, const ValueType *v )
+Server::~Server()
 {
-    QByteArray payload;
-    {
-        static const quint32 ProtocolVersion = 1;
-
-        QDataStream stream( &payload, QIODevice::WriteOnly );
-        stream.setVersion( QDataStream::Qt_4_0 );
-        stream << MagicServerProtocolCookie << ProtocolVersion << (quint8)type;
-        if ( v ) {
-            stream << *v;
-        }
+    // Stop receiving data before storing whatever was received so far
+    delete m_tcpServer;
+    m_tcpServer = 0;
+    m_writer->stop();
+
+    const quint64 droppedEntries = m_writer->statistics().droppedEntries;
+    if ( droppedEntries > 0 ) {
+        qWarning() << "Dropped" << droppedEntries << "trace entries which could not be stored";
     }
-
-    QByteArray data;
-    {
-        QDataStream stream( &data, QIODevice::WriteOnly );
-        stream.setVersion( QDataStream::Qt_4_0 );
-        stream << (quint16)payload.size();
-        data.append( payload );
-    }
-
-    return data;
 }
 
-QByteArray serializeGUIClientData( ServerDatagramType type ) {
-    return serializeDatagram( type, (int *)0 );
-}
+void Server::setStatisticsInterval( int seconds )
+{
+    if ( seconds <= 0 ) {
+        delete m_statisticsTimer;
+        m_statisticsTimer = 0;
+        return;
+    }
 
-template <typename T>
-QByteArray serializeGUIClientData( ServerDatagramType type, const T &v ) {
-    return serializeDatagram( type, &v );
+    if ( !m_statisticsTimer ) {
+        m_statisticsTimer = new QTimer( this );
+        connect( m_statisticsTimer, SIGNAL( timeout() ), SLOT( printStatistics() ) );
+    }
+    m_statisticsTimer->start( seconds * 1000 );
 }
 
-void Server::handleTraceEntry( const TraceEntry &entry )
+void Server::writeToGUIs( const QByteArray &data )
 {
-    DatabaseFeeder::handleTraceEntry( entry );
-
-    QByteArray serializedEntry = serializeGUIClientData( TraceEntryDatagram, entry );
-
     QList<GUIConnection *>::Iterator it, end = m_guiConnections.end();
     for ( it = m_guiConnections.begin(); it != end; ++it ) {
-        ( *it )->write( serializedEntry );
+        ( *it )->write( data );
     }
-
-    emit traceEntryReceived( entry );
 }
 
-void Server::handleShutdownEvent( const ProcessShutdownEvent &ev )
+void Server::handleStoredEntries( const QList<TraceEntry> &entries )
 {
-    DatabaseFeeder::handleShutdownEvent( ev );
-
-    QByteArray serializedEvent = serializeGUIClientData( ProcessShutdownEventDatagram, ev );
+    // One datagram per batch stored by the writer, serialized only once
+    if ( !m_guiConnections.isEmpty() ) {
+        const QByteArray data = serializeGUIClientData( TraceEntriesDatagram, entries );
+        QList<GUIConnection *>::Iterator it, end = m_guiConnections.end();
+        for ( it = m_guiConnections.begin(); it != end; ++it ) {
+            ( *it )->writeTraceEntries( data, entries.size() );
+        }
+    }
 
-    QList<GUIConnection *>::Iterator it, end = m_guiConnections.end();
-    for ( it = m_guiConnections.begin(); it != end; ++it ) {
-        ( *it )->write( serializedEvent );
+    QList<TraceEntry>::ConstIterator it, end = entries.end();
+    for ( it = entries.begin(); it != end; ++it ) {
+        emit traceEntryReceived( *it );
     }
+}
 
+void Server::handleProcessShutdown( const ProcessShutdownEvent &ev )
+{
+    writeToGUIs( serializeGUIClientData( ProcessShutdownEventDatagram, ev ) );
     emit processShutdown( ev );
 }
 
-void Server::handleIncomingData( const QByteArray &xmlData )
+void Server::handleArchivedEntries()
 {
-    try {
-        m_xmlHandler.addData( xmlData );
-        m_xmlHandler.continueParsing();
-    } catch ( const runtime_error &e ) {
-        qWarning() << e.what();
-    }
+    writeToGUIs( serializeGUIClientData( DatabaseNukeFinishedDatagram ) );
 }
 
-void Server::archivedEntries()
+void Server::handleDatabaseTrimmed()
 {
-    QByteArray serializedEntry = serializeGUIClientData( DatabaseNukeFinishedDatagram );
+    writeToGUIs( serializeGUIClientData( DatabaseNukeFinishedDatagram ) );
+}
 
-    QList<GUIConnection *>::Iterator it, end = m_guiConnections.end();
-    for ( it = m_guiConnections.begin(); it != end; ++it ) {
-        ( *it )->write( serializedEntry );
-    }
+void Server::handleSegmentsChanged()
+{
+    writeToGUIs( serializeGUIClientData( SegmentsChangedDatagram ) );
+}
+
+void Server::handleWriterFailure( const QString &errorString )
+{
+    // Accepting trace data which can never be stored would only hide the problem
+    qWarning() << "Shutting down since trace data cannot be stored:" << errorString;
+    delete m_tcpServer;
+    m_tcpServer = 0;
+    QCoreApplication::exit( 1 );
+}
+
+void Server::printStatistics()
+{
+    const DatabaseWriter::Statistics s = m_writer->statistics();
+    qDebug() << "Writer queue depth:" << s.queueDepth
+             << "(maximum" << s.maximumQueueDepth << ")"
+             << "entries queued:" << s.queuedEntries
+             << "stored:" << s.storedEntries
+             << "dropped:" << s.droppedEntries
+             << "producers blocked:" << s.blockedProducers
+             << "times," << s.blockedMilliseconds << "ms";
 }
 
 void Server::handleNewGUIConnection()
@@ -283,13 +432,6 @@ void Server::guiDisconnected( GUIConnection *c )
 
 void Server::nukeDatabase()
 {
-    trimDb();
-
-    QByteArray serializedEntry = serializeGUIClientData( DatabaseNukeFinishedDatagram );
-
-    QList<GUIConnection *>::Iterator it, end = m_guiConnections.end();
-    for ( it = m_guiConnections.begin(); it != end; ++it ) {
-        ( *it )->write( serializedEntry );
-    }
+    // GUIs are notified once the writer actually trimmed the database
+    m_writer->trimDatabase();
 }
-
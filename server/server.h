@@ -27,39 +27,68 @@
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QThread>
+#include <QTimer>
 #include <QXmlStreamReader>
 
+#include "binarycontenthandler.h"
 #include "database.h"
 #include "xmlcontenthandler.h"
-#include "databasefeeder.h"
+#include "databasewriter.h"
+
+/* Decodes the data received from one traced application and hands the
+ * resulting entries and events to the database writer. Each connection
+ * has its own parser, so partial data of one application never gets
+ * mixed up with data of another one.
+ */
+class ConnectionParser : public XmlParseEventsHandler
+{
+public:
+    ConnectionParser( DatabaseWriter *writer );
+    ~ConnectionParser();
+
+    bool addData( const QByteArray &data );
+
+protected:
+    virtual void handleTraceEntry( const TraceEntry &e );
+    virtual void applyStorageConfiguration( const StorageConfiguration &cfg );
+    virtual void handleShutdownEvent( const ProcessShutdownEvent &ev );
+
+private:
+    ConnectionParser( const ConnectionParser &other );
+    void operator=( const ConnectionParser &rhs );
+
+    DatabaseWriter *m_writer;
+    // Only one of them is created, depending on the first data received
+    XmlContentHandler *m_xmlHandler;
+    BinaryContentHandler *m_binaryHandler;
+};
 
 class ClientSocket : public QTcpSocket
 {
     Q_OBJECT
 public:
-    ClientSocket( QObject *parent = 0 );
-
-signals:
-    void dataReceived( const QByteArray &data );
+    ClientSocket( DatabaseWriter *writer, QObject *parent = 0 );
 
 private slots:
     void handleIncomingData();
+
+private:
+    ConnectionParser m_parser;
 };
 
 class NetworkingThread : public QThread
 {
     Q_OBJECT
 public:
-    NetworkingThread( int socketDescriptor, QObject *parent = 0 );
-
-signals:
-    void dataReceived( const QByteArray &data );
+    NetworkingThread( int socketDescriptor, DatabaseWriter *writer,
+                      QObject *parent = 0 );
 
 protected:
     virtual void run();
 
 private:
     int m_socketDescriptor;
+    DatabaseWriter *m_writer;
     ClientSocket *m_clientSocket;
 };
 
@@ -68,14 +97,14 @@ class Server;
 class ServerSocket : public QTcpServer
 {
 public:
-    ServerSocket( Server *server );
+    ServerSocket( Server *server, DatabaseWriter *writer );
     ~ServerSocket();
 
 protected:
     virtual void incomingConnection( int socketDescriptor );
 
 private:
-    Server *m_server;
+    DatabaseWriter *m_writer;
     QList<NetworkingThread *> m_networkingThreads;
 };
 
@@ -85,9 +114,16 @@ class GUIConnection : public QObject
 {
     Q_OBJECT
 public:
+    /* Trace entries are not sent while more than this number of bytes are
+     * waiting to be written to the GUI; it is told how many entries it
+     * missed instead.
+     */
+    static const qint64 HighWaterMark;
+
     GUIConnection( Server *server, QTcpSocket *sock );
 
     void write( const QByteArray &data );
+    void writeTraceEntries( const QByteArray &data, int numEntries );
 
 signals:
     void databaseNukeRequested();
@@ -100,18 +136,23 @@ private slots:
 private:
     Server *m_server;
     QTcpSocket *m_sock;
+    quint32 m_nextPayloadSize;
+    quint32 m_skippedEntries;
 };
 
-class Server : public QObject, public DatabaseFeeder
+class Server : public QObject
 {
     Q_OBJECT
 public:
     Server( const QString &traceFile,
             QSqlDatabase database, unsigned short port, unsigned short guiPort,
+            const DatabaseTuning &tuning = DatabaseTuning(),
+            const SegmentConfiguration &segmentation = SegmentConfiguration(),
             QObject *parent = 0 );
+    ~Server();
 
-public slots:
-    void handleIncomingData(const QByteArray &data);
+    // Prints the writer queue statistics every given number of seconds
+    void setStatisticsInterval( int seconds );
 
 signals:
     void traceEntryReceived( const TraceEntry &e );
@@ -121,19 +162,23 @@ private slots:
     void handleNewGUIConnection();
     void nukeDatabase();
     void guiDisconnected( GUIConnection *c );
+    void handleStoredEntries( const QList<TraceEntry> &entries );
+    void handleProcessShutdown( const ProcessShutdownEvent &ev );
+    void handleArchivedEntries();
+    void handleDatabaseTrimmed();
+    void handleSegmentsChanged();
+    void handleWriterFailure( const QString &errorString );
+    void printStatistics();
 
 private:
-    void handleDatagram( const QByteArray &datagram );
-    void handleTraceEntry( const TraceEntry &e );
-    void handleShutdownEvent( const ProcessShutdownEvent &ev );
-    void archivedEntries();
+    void writeToGUIs( const QByteArray &data );
 
     QTcpServer *m_guiServer;
     ServerSocket *m_tcpServer;
-    XmlContentHandler m_xmlHandler;
-    bool m_receivedData;
+    DatabaseWriter *m_writer;
     QString m_traceFile;
     QList<GUIConnection *> m_guiConnections;
+    QTimer *m_statisticsTimer;
 };
 
 #endif // !defined(TRACE_SERVER_H)
@@ -0,0 +1,254 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the latency of the queries done by the GUI and when archiving
+ * entries on a trace database with and without the secondary indexes
+ * added in schema version 6, followed by the time trace2columns takes to
+ * export all entries.
+ *
+ * Usage: bench_database [number of entries, defaults to 10000000]
+ */
+
+#include "../server/database.h"
+#include "../trace2columns/columnexporter.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QThread>
+#include <QVariant>
+
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+static const char * const indexNames[] = {
+    "trace_entry_trace_point_idx",
+    "trace_entry_traced_thread_idx",
+    "trace_entry_timestamp_idx",
+    "variable_trace_entry_idx",
+    "stackframe_trace_entry_idx"
+};
+
+static const char * const indexStatements[] = {
+    "CREATE INDEX trace_entry_trace_point_idx ON trace_entry(trace_point_id, traced_thread_id);",
+    "CREATE INDEX trace_entry_traced_thread_idx ON trace_entry(traced_thread_id);",
+    "CREATE INDEX trace_entry_timestamp_idx ON trace_entry(timestamp);",
+    "CREATE INDEX variable_trace_entry_idx ON variable(trace_entry_id);",
+    "CREATE INDEX stackframe_trace_entry_idx ON stackframe(trace_entry_id, depth);",
+    "ANALYZE;"
+};
+
+static bool exec( QSqlDatabase db, const QString &statement )
+{
+    QSqlQuery q( db );
+    q.setForwardOnly( true );
+    if ( !q.exec( statement ) ) {
+        cout << "Failed to execute '" << statement.toLocal8Bit().constData()
+             << "': " << q.lastError().text().toLocal8Bit().constData() << endl;
+        return false;
+    }
+    while ( q.next() ) {
+    }
+    return true;
+}
+
+static bool populate( QSqlDatabase db, qlonglong numEntries )
+{
+    // 4 processes with 8 threads each, 1000 trace points in 100 files
+    const QString statements[] = {
+        "INSERT INTO process WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 4)"
+        " SELECT x, 'app' || x, 1000 + x, 0, 0 FROM c;",
+        "INSERT INTO traced_thread WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 32)"
+        " SELECT x, (x - 1) / 8 + 1, 2000 + x FROM c;",
+        "INSERT INTO path_name WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 100)"
+        " SELECT x, '/src/file' || x || '.cpp' FROM c;",
+        "INSERT INTO function_name WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 1000)"
+        " SELECT x, 'function' || x FROM c;",
+        "INSERT INTO trace_point WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 1000)"
+        " SELECT x, x % 8, x % 100 + 1, x, x, 0 FROM c;",
+        QString( "INSERT INTO trace_entry WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < %1)"
+                 " SELECT x, (x * 7) % 32 + 1, 1400000000000 + x, (x * 13) % 1000 + 1, 'message ' || x, x % 10 FROM c;" ).arg( numEntries ),
+        // Every 10th entry has a variable, every 100th a backtrace
+        "INSERT INTO variable SELECT id, 'var', 'value ' || id, 1 FROM trace_entry WHERE id % 10 = 0;",
+        "INSERT INTO stackframe WITH RECURSIVE d(depth) AS (SELECT 0 UNION ALL SELECT depth+1 FROM d WHERE depth < 2)"
+        " SELECT id, depth, 'module', 'function', 0, 'file.cpp', 1 FROM trace_entry, d WHERE id % 100 = 0;"
+    };
+
+    if ( !exec( db, "BEGIN TRANSACTION;" ) ) {
+        return false;
+    }
+    for ( unsigned int i = 0; i < sizeof( statements ) / sizeof( statements[0] ); ++i ) {
+        if ( !exec( db, statements[i] ) ) {
+            return false;
+        }
+    }
+    return exec( db, "COMMIT;" );
+}
+
+struct Query
+{
+    const char *name;
+    QStringList statements;
+};
+
+static QList<Query> queries( qlonglong numEntries )
+{
+    QList<Query> result;
+
+    Query backtraces = { "backtrace (100 entries)", QStringList() };
+    Query variables = { "variables (100 entries)", QStringList() };
+    for ( int i = 1; i <= 100; ++i ) {
+        const qlonglong id = i * numEntries / 100;
+        backtraces.statements << QString( "SELECT module_name, function_name, offset, file_name, line"
+                                          " FROM stackframe WHERE trace_entry_id=%1 ORDER BY depth" ).arg( id );
+        variables.statements << QString( "SELECT name, type, value FROM variable"
+                                         " WHERE trace_entry_id = %1" ).arg( id );
+    }
+    result << backtraces << variables;
+
+    Query function = { "entries of one function", QStringList()
+        << "SELECT DISTINCT trace_entry.id FROM trace_entry, trace_point"
+           " WHERE trace_entry.trace_point_id = trace_point.id AND trace_point.function_id = 42"
+           " ORDER BY trace_entry.id" };
+    Query thread = { "entries of one thread", QStringList()
+        << "SELECT DISTINCT trace_entry.id FROM trace_entry, traced_thread, process"
+           " WHERE trace_entry.traced_thread_id = traced_thread.id AND traced_thread.process_id = process.id"
+           " AND process.pid = 1001 AND traced_thread.tid = 2001 ORDER BY trace_entry.id" };
+    Query timeRange = { "entries in a time range", QStringList()
+        << QString( "SELECT DISTINCT trace_entry.id FROM trace_entry"
+                    " WHERE trace_entry.timestamp BETWEEN %1 AND %2 ORDER BY trace_entry.id" )
+           .arg( 1400000000000LL + numEntries / 2 ).arg( 1400000000000LL + numEntries / 2 + 10000 ) };
+    Query watchTree = { "watch tree latest entries", QStringList()
+        << "SELECT MAX(id) FROM trace_entry GROUP BY trace_point_id, traced_thread_id" };
+    Query archive = { "archive cleanup", QStringList()
+        << "SELECT COUNT(*) FROM trace_point WHERE id NOT IN (SELECT trace_point_id FROM trace_entry)"
+        << "SELECT COUNT(*) FROM traced_thread WHERE id NOT IN (SELECT traced_thread_id FROM trace_entry)" };
+    result << function << thread << timeRange << watchTree << archive;
+
+    return result;
+}
+
+static bool runQueries( QSqlDatabase db, const QList<Query> &queries, QList<qint64> *timings )
+{
+    QList<Query>::ConstIterator it, end = queries.end();
+    for ( it = queries.begin(); it != end; ++it ) {
+        QElapsedTimer timer;
+        timer.start();
+        for ( int i = 0; i < it->statements.size(); ++i ) {
+            if ( !exec( db, it->statements[i] ) ) {
+                return false;
+            }
+        }
+        timings->append( timer.elapsed() );
+    }
+    return true;
+}
+
+int main( int argc, char **argv )
+{
+    QCoreApplication app( argc, argv );
+
+    qlonglong numEntries = 10000000;
+    if ( argc > 1 ) {
+        bool ok;
+        numEntries = QString::fromLocal8Bit( argv[1] ).toLongLong( &ok );
+        if ( !ok || numEntries < 100 ) {
+            cout << "Usage: " << argv[0] << " [number of entries]" << endl;
+            return 1;
+        }
+    }
+
+    const QString fileName = "bench_database.trace";
+    QFile::remove( fileName );
+
+    QString errMsg;
+    QSqlDatabase db = Database::create( fileName, &errMsg );
+    if ( !db.isValid() ) {
+        cout << "Failed to create database: " << errMsg.toLocal8Bit().constData() << endl;
+        return 1;
+    }
+
+    // Start out like a version 5 database
+    for ( unsigned int i = 0; i < sizeof( indexNames ) / sizeof( indexNames[0] ); ++i ) {
+        if ( !exec( db, QString( "DROP INDEX %1;" ).arg( indexNames[i] ) ) ) {
+            return 1;
+        }
+    }
+
+    cout << "Populating database with " << numEntries << " entries..." << endl;
+    QElapsedTimer timer;
+    timer.start();
+    if ( !populate( db, numEntries ) ) {
+        return 1;
+    }
+    cout << "Populated database in " << timer.elapsed() << "ms" << endl;
+
+    const QList<Query> benchmarkQueries = queries( numEntries );
+    QList<qint64> before, after;
+    if ( !runQueries( db, benchmarkQueries, &before ) ) {
+        return 1;
+    }
+
+    timer.restart();
+    for ( unsigned int i = 0; i < sizeof( indexStatements ) / sizeof( indexStatements[0] ); ++i ) {
+        if ( !exec( db, indexStatements[i] ) ) {
+            return 1;
+        }
+    }
+    cout << "Created indexes in " << timer.elapsed() << "ms" << endl;
+
+    if ( !runQueries( db, benchmarkQueries, &after ) ) {
+        return 1;
+    }
+
+    cout << left << setw( 28 ) << "query" << right
+         << setw( 12 ) << "before (ms)" << setw( 12 ) << "after (ms)" << endl;
+    for ( int i = 0; i < benchmarkQueries.size(); ++i ) {
+        cout << left << setw( 28 ) << benchmarkQueries[i].name << right
+             << setw( 12 ) << before[i] << setw( 12 ) << after[i] << endl;
+    }
+
+    const QString columnsFileName = "bench_database.col";
+    QFile columnsFile( columnsFileName );
+    if ( !columnsFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+        cout << "Failed to open " << columnsFileName.toLocal8Bit().constData() << endl;
+        return 1;
+    }
+    ColumnExporter exporter( db );
+    exporter.setNumberOfThreads( QThread::idealThreadCount() );
+    exporter.setCompressionLevel( 1 );
+    timer.restart();
+    if ( !exporter.exportTo( &columnsFile ) ) {
+        cout << "Failed to export columns: " << exporter.errorString().toLocal8Bit().constData() << endl;
+        return 1;
+    }
+    columnsFile.close();
+    cout << "Exported " << exporter.numExportedEntries() << " entries to columns using "
+         << QThread::idealThreadCount() << " thread(s) in " << timer.elapsed() << "ms" << endl;
+
+    db.close();
+    QFile::remove( columnsFileName );
+    QFile::remove( fileName );
+    return 0;
+}
@@ -0,0 +1,400 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "asyncdispatcher.h"
+#include "log.h"
+#include "output.h"
+#include "serializer.h"
+#include "thread.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+TRACELIB_NAMESPACE_BEGIN
+
+// Writes nothing but the message of each entry, or "-" if there is none.
+class MessageSerializer : public Serializer
+{
+public:
+    virtual void serialize( const TraceEntry &entry, vector<char> &buf ) {
+        if ( entry.message ) {
+            buf.insert( buf.end(), entry.message, entry.message + strlen( entry.message ) );
+        } else {
+            buf.push_back( '-' );
+        }
+    }
+    virtual void serialize( const ProcessShutdownEvent &ev, vector<char> &buf ) { }
+};
+
+/* Keeps everything written to it. Optionally calls tryFlush() on the given
+ * dispatcher from within the first write, i.e. on the thread draining the
+ * queues.
+ */
+class RecordingOutput : public Output
+{
+public:
+    RecordingOutput() : m_dispatcher( 0 ), m_tryFlushCalled( false ), m_tryFlushResult( false ) { }
+
+    virtual void write( const vector<char> &data ) {
+        if ( m_dispatcher && !m_tryFlushCalled ) {
+            m_tryFlushCalled = true;
+            m_tryFlushResult = m_dispatcher->tryFlush();
+        }
+        MutexLocker locker( m_mutex );
+        m_records.push_back( string( data.begin(), data.end() ) );
+    }
+
+    vector<string> records() {
+        MutexLocker locker( m_mutex );
+        return m_records;
+    }
+
+    void setTryFlushDispatcher( AsyncDispatcher *dispatcher ) { m_dispatcher = dispatcher; }
+    bool tryFlushCalled() const { return m_tryFlushCalled; }
+    bool tryFlushResult() const { return m_tryFlushResult; }
+
+private:
+    Mutex m_mutex;
+    vector<string> m_records;
+    AsyncDispatcher *m_dispatcher;
+    bool m_tryFlushCalled;
+    bool m_tryFlushResult;
+};
+
+static TracePoint g_tracePoint( TracePointType::Log, __FILE__, __LINE__, "test_asyncdispatcher", 0 );
+
+static DispatchConfiguration dispatchConfiguration( DispatchConfiguration::Mode mode, unsigned long queueSize )
+{
+    DispatchConfiguration cfg;
+    cfg.mode = mode;
+    cfg.queueSize = queueSize;
+    cfg.flushInterval = 1;
+    return cfg;
+}
+
+static void enqueueMessage( AsyncDispatcher *dispatcher, int producer, int sequence )
+{
+    char msg[32];
+    sprintf( msg, "%d %d", producer, sequence );
+    dispatcher->enqueue( &g_tracePoint, reinterpret_cast<size_t>( msg ), msg, 0, 0 );
+}
+
+static void testRingWraparound()
+{
+    TraceEntryQueue queue( 3 ); // rounded up to 4 entries
+
+    size_t pushed = 0;
+    size_t popped = 0;
+    bool inOrder = true;
+    bool hadRoom = true;
+    // Keeps one entry in the ring between rounds, so it fills up differently every time
+    for ( int round = 0; round < 10; ++round ) {
+        for ( int i = 0; i < ( round == 0 ? 4 : 3 ); ++i ) {
+            CapturedTraceEntry *entry = queue.beginPush();
+            hadRoom = hadRoom && entry;
+            if ( !entry ) {
+                break;
+            }
+            entry->backtrace = 0;
+            entry->stackPosition = pushed++;
+            queue.commitPush();
+        }
+        for ( int i = 0; i < 3; ++i ) {
+            const CapturedTraceEntry *entry = queue.front();
+            inOrder = inOrder && entry && entry->stackPosition == popped;
+            queue.pop();
+            ++popped;
+        }
+    }
+    while ( const CapturedTraceEntry *entry = queue.front() ) {
+        inOrder = inOrder && entry->stackPosition == popped;
+        queue.pop();
+        ++popped;
+    }
+
+    verify( "ring has room for as many entries as requested", true, hadRoom );
+    verify( "entries leave the ring in the order they were pushed", true, inOrder );
+    verify( "all pushed entries are popped", pushed, popped );
+    verify( "ring wrapped around several times", true, pushed > 12 );
+    verify( "no entries dropped while there was room", size_t( 0 ), queue.takeDroppedEntries() );
+}
+
+static void testFullRingDrops()
+{
+    TraceEntryQueue queue( 4 );
+    for ( int i = 0; i < 4; ++i ) {
+        CapturedTraceEntry *entry = queue.beginPush();
+        entry->backtrace = 0;
+        queue.commitPush();
+    }
+    verify( "full ring refuses entries", true, queue.beginPush() == 0 );
+    verify( "full ring keeps refusing entries", true, queue.beginPush() == 0 );
+    verify( "refused entries are counted", size_t( 2 ), queue.takeDroppedEntries() );
+    verify( "dropped entries are reported once", size_t( 0 ), queue.takeDroppedEntries() );
+    queue.pop();
+    verify( "ring takes entries again after a pop", true, queue.beginPush() != 0 );
+
+    // Dropped entries show up in the trace
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+    Trace trace;
+    RecordingOutput *output = new RecordingOutput;
+    trace.setSerializer( new MessageSerializer );
+    trace.setOutput( output );
+    {
+        AsyncDispatcher dispatcher( &trace, &log );
+        // Synchronous mode starts no thread, so nothing drains the queue meanwhile
+        dispatcher.configure( dispatchConfiguration( DispatchConfiguration::Synchronous, 4 ) );
+        for ( int i = 0; i < 10; ++i ) {
+            enqueueMessage( &dispatcher, 0, i );
+        }
+        dispatcher.flush();
+        verify( "entries which fit are dispatched", size_t( 4 ), output->records().size() );
+
+        enqueueMessage( &dispatcher, 0, 10 );
+        dispatcher.flush();
+    }
+    const vector<string> records = output->records();
+    verify( "drops are reported before the next entry", size_t( 6 ), records.size() );
+    if ( records.size() == 6 ) {
+        verify( "report names the number of dropped entries", true,
+                records[4].find( "6 trace entries were dropped" ) == 0 );
+        verify( "next entry follows the report", string( "0 10" ), records[5] );
+    }
+}
+
+static void enqueueText( AsyncDispatcher *dispatcher, const string &text )
+{
+    dispatcher->enqueue( &g_tracePoint, 0, text.c_str(), 0, 0 );
+}
+
+/* The text of all pending entries of a queue shares one buffer; once it is
+ * full, messages are cut off rather than dropped. Payloads of all sizes
+ * need to survive the buffer wrapping around.
+ */
+static void testPayloadArea()
+{
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+    Trace trace;
+    RecordingOutput *output = new RecordingOutput;
+    trace.setSerializer( new MessageSerializer );
+    trace.setOutput( output );
+
+    AsyncDispatcher dispatcher( &trace, &log );
+    dispatcher.configure( dispatchConfiguration( DispatchConfiguration::Synchronous, 8 ) );
+
+    // The smallest buffer holds the longest text of four entries
+    for ( int i = 0; i < 8; ++i ) {
+        enqueueText( &dispatcher, string( 300, 'a' + i ) );
+    }
+    dispatcher.flush();
+    vector<string> records = output->records();
+    verify( "entries are kept when the text buffer is full", size_t( 8 ), records.size() );
+    if ( records.size() == 8 ) {
+        bool cutOffAtCapacity = true;
+        for ( int i = 0; i < 4; ++i ) {
+            cutOffAtCapacity = cutOffAtCapacity && records[i] == string( CapturedTraceEntry::TextCapacity - 1, 'a' + i );
+        }
+        verify( "long messages are cut off at the text capacity", true, cutOffAtCapacity );
+        verify( "messages are cut off when the text buffer is full", string( "-" ), records[4] );
+    }
+
+    vector<string> expected;
+    for ( int i = 0; i < 200; ++i ) {
+        expected.push_back( string( ( i * 37 ) % 200 + 1, 'a' + i % 26 ) );
+        enqueueText( &dispatcher, expected.back() );
+        if ( i % 3 == 2 ) {
+            dispatcher.flush();
+        }
+    }
+    dispatcher.flush();
+    records = output->records();
+    verify( "all entries arrive", size_t( 208 ), records.size() );
+    if ( records.size() == 208 ) {
+        verify( "messages survive the text buffer wrapping around", true,
+                equal( expected.begin(), expected.end(), records.begin() + 8 ) );
+    }
+}
+
+class Producer : public Thread
+{
+public:
+    static const int EntryCount = 2000;
+
+    Producer( AsyncDispatcher *dispatcher, int id ) : m_dispatcher( dispatcher ), m_id( id ) { }
+    ~Producer() { wait(); }
+
+    size_t produced() const { return m_produced.load(); }
+
+protected:
+    virtual void run() {
+        for ( int i = 0; i < EntryCount; ++i ) {
+            enqueueMessage( m_dispatcher, m_id, i );
+            m_produced.store( i + 1 );
+            if ( i % 100 == 0 ) {
+                Thread::sleep( 1 );
+            }
+        }
+    }
+
+private:
+    AsyncDispatcher *m_dispatcher;
+    const int m_id;
+    AtomicCounter m_produced;
+};
+
+/* Returns the number of entries per producer found in the records; 'inOrder'
+ * is cleared if any producer's entries are missing or out of order.
+ */
+static vector<int> entriesPerProducer( const vector<string> &records, int producerCount, bool *inOrder )
+{
+    vector<int> counts( producerCount, 0 );
+    *inOrder = true;
+    for ( size_t i = 0; i < records.size(); ++i ) {
+        int producer, sequence;
+        if ( sscanf( records[i].c_str(), "%d %d", &producer, &sequence ) != 2 ||
+             producer < 0 || producer >= producerCount ) {
+            *inOrder = false;
+            continue;
+        }
+        if ( sequence != counts[producer] ) {
+            *inOrder = false;
+        }
+        counts[producer] = sequence + 1;
+    }
+    return counts;
+}
+
+static void testOrderingAndShutdownFlush()
+{
+    static const int ProducerCount = 4;
+
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+    Trace trace;
+    RecordingOutput *output = new RecordingOutput;
+    trace.setSerializer( new MessageSerializer );
+    trace.setOutput( output );
+
+    AsyncDispatcher *dispatcher = new AsyncDispatcher( &trace, &log );
+    dispatcher->configure( dispatchConfiguration( DispatchConfiguration::Asynchronous, 4096 ) );
+
+    vector<Producer *> producers;
+    for ( int i = 0; i < ProducerCount; ++i ) {
+        producers.push_back( new Producer( dispatcher, i ) );
+        producers.back()->start();
+    }
+
+    // Flush while the producers are busy, like a process shutdown would
+    bool started = false;
+    while ( !started ) {
+        Thread::sleep( 1 );
+        started = true;
+        for ( int i = 0; i < ProducerCount; ++i ) {
+            started = started && producers[i]->produced() >= 100;
+        }
+    }
+    vector<size_t> producedBeforeFlush;
+    for ( int i = 0; i < ProducerCount; ++i ) {
+        producedBeforeFlush.push_back( producers[i]->produced() );
+    }
+    dispatcher->flush();
+
+    bool inOrder;
+    vector<int> counts = entriesPerProducer( output->records(), ProducerCount, &inOrder );
+    bool flushedAll = true;
+    for ( int i = 0; i < ProducerCount; ++i ) {
+        flushedAll = flushedAll && static_cast<size_t>( counts[i] ) >= producedBeforeFlush[i];
+    }
+    verify( "flush writes everything queued before it", true, flushedAll );
+    verify( "entries flushed while producing are in order", true, inOrder );
+
+    for ( int i = 0; i < ProducerCount; ++i ) {
+        delete producers[i];
+    }
+    delete dispatcher;
+
+    counts = entriesPerProducer( output->records(), ProducerCount, &inOrder );
+    verify( "entries of each thread are written in order", true, inOrder );
+    bool complete = true;
+    for ( int i = 0; i < ProducerCount; ++i ) {
+        complete = complete && counts[i] == Producer::EntryCount;
+    }
+    verify( "shutdown writes all remaining entries", true, complete );
+}
+
+static void testTryFlushOnDrainThread()
+{
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+    Trace trace;
+    RecordingOutput *output = new RecordingOutput;
+    trace.setSerializer( new MessageSerializer );
+    trace.setOutput( output );
+
+    AsyncDispatcher dispatcher( &trace, &log );
+    verify( "tryFlush() drains when nobody else does", true, dispatcher.tryFlush() );
+    dispatcher.configure( dispatchConfiguration( DispatchConfiguration::Asynchronous, 16 ) );
+
+    output->setTryFlushDispatcher( &dispatcher );
+    enqueueMessage( &dispatcher, 0, 0 );
+    dispatcher.flush();
+
+    verify( "output was called back on the drain thread", true, output->tryFlushCalled() );
+    verify( "tryFlush() gives up on the drain thread", false, output->tryFlushResult() );
+    verify( "entry is written after tryFlush() returned", size_t( 1 ), output->records().size() );
+}
+
+TRACELIB_NAMESPACE_END
+
+int main()
+{
+    // Don't let the traces created by the tests pick up any configuration
+    setenv( "TRACELIB_CONFIG_FILE", "test_asyncdispatcher-nonexistent.xml", 1 );
+
+    TRACELIB_NAMESPACE_IDENT(testRingWraparound)();
+    TRACELIB_NAMESPACE_IDENT(testFullRingDrops)();
+    TRACELIB_NAMESPACE_IDENT(testPayloadArea)();
+    TRACELIB_NAMESPACE_IDENT(testOrderingAndShutdownFlush)();
+    TRACELIB_NAMESPACE_IDENT(testTryFlushOnDrainThread)();
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
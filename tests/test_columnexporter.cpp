@@ -0,0 +1,412 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Exports a small generated trace database with ColumnExporter and reads
+ * the result back according to the format described in columnexporter.h.
+ */
+
+#include "../server/database.h"
+#include "../trace2columns/columnexporter.h"
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QList>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVariant>
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+static void verify( const char *what, const QString &expected, const QString &actual )
+{
+    verify( what, expected.toStdString(), actual.toStdString() );
+}
+
+static const char *g_fileName = "test_columnexporter.trace";
+
+// Entries, each trace point is used by every NumTracePoints'th entry
+static const int NumEntries = 25;
+static const int NumTracePoints = 5;
+static const int RowGroupSize = 4;
+
+static const char * const g_processNames[] = { "app1", "app2" };
+static const char * const g_fileNames[] = { "/src/a.cpp", "/src/b.cpp", "/src/c.cpp" };
+static const char * const g_functionNames[] = { "f1", "f2", "f3", "f4" };
+static const char * const g_keyNames[] = { "key1", "key2" };
+
+static bool exec( QSqlDatabase db, const QString &statement )
+{
+    QSqlQuery q( db );
+    if ( !q.exec( statement ) ) {
+        cout << "Failed to execute '" << statement.toStdString() << "': "
+             << q.lastError().text().toStdString() << endl;
+        return false;
+    }
+    return true;
+}
+
+// What the export is expected to contain for the entry with the given id
+static int threadOfEntry( int id ) { return id % 3 + 1; }
+static int processOfThread( int thread ) { return thread == 3 ? 2 : 1; }
+static int tracePointOfEntry( int id ) { return id % NumTracePoints + 1; }
+static int fileOfTracePoint( int tracePoint ) { return tracePoint % 3 + 1; }
+static int functionOfTracePoint( int tracePoint ) { return tracePoint % 4 + 1; }
+// The last trace point has no key
+static int keyOfTracePoint( int tracePoint ) { return tracePoint == NumTracePoints ? 0 : tracePoint % 2 + 1; }
+static bool entryHasVariable( int id ) { return id % 3 == 0; }
+
+static bool populate( QSqlDatabase db )
+{
+    QStringList statements;
+    statements << "BEGIN TRANSACTION;";
+    for ( int i = 0; i < 2; ++i ) {
+        statements << QString( "INSERT INTO process VALUES(%1, '%2', %3, %4, %5);" )
+                      .arg( i + 1 ).arg( g_processNames[i] ).arg( 1000 + i )
+                      .arg( 1400000000000LL + i ).arg( 1400000001000LL + i );
+    }
+    for ( int thread = 1; thread <= 3; ++thread ) {
+        statements << QString( "INSERT INTO traced_thread VALUES(%1, %2, %3);" )
+                      .arg( thread ).arg( processOfThread( thread ) ).arg( 2000 + thread );
+    }
+    for ( int i = 0; i < 3; ++i ) {
+        statements << QString( "INSERT INTO path_name VALUES(%1, '%2');" ).arg( i + 1 ).arg( g_fileNames[i] );
+    }
+    for ( int i = 0; i < 4; ++i ) {
+        statements << QString( "INSERT INTO function_name VALUES(%1, '%2');" ).arg( i + 1 ).arg( g_functionNames[i] );
+    }
+    for ( int i = 0; i < 2; ++i ) {
+        statements << QString( "INSERT INTO trace_point_group VALUES(%1, '%2');" ).arg( i + 1 ).arg( g_keyNames[i] );
+    }
+    for ( int tp = 1; tp <= NumTracePoints; ++tp ) {
+        statements << QString( "INSERT INTO trace_point VALUES(%1, %2, %3, %4, %5, %6);" )
+                      .arg( tp ).arg( tp % 8 ).arg( fileOfTracePoint( tp ) ).arg( 10 * tp )
+                      .arg( functionOfTracePoint( tp ) ).arg( keyOfTracePoint( tp ) );
+    }
+    for ( int id = 1; id <= NumEntries; ++id ) {
+        statements << QString( "INSERT INTO trace_entry VALUES(%1, %2, %3, %4, 'message %1', %5);" )
+                      .arg( id ).arg( threadOfEntry( id ) ).arg( 1400000000000LL + 10 * id )
+                      .arg( tracePointOfEntry( id ) ).arg( 100 * id );
+        if ( entryHasVariable( id ) ) {
+            statements << QString( "INSERT INTO variable VALUES(%1, 'var', 'value %1', 1);" ).arg( id );
+        }
+    }
+    statements << "COMMIT;";
+
+    for ( int i = 0; i < statements.size(); ++i ) {
+        if ( !exec( db, statements[i] ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Section
+{
+    quint8 kind;
+    quint32 numRows;
+    QList<QByteArray> columns; // uncompressed
+};
+
+static bool readSection( QDataStream &stream, Section *section )
+{
+    quint32 numColumns;
+    stream >> section->kind >> section->numRows >> numColumns;
+    section->columns.clear();
+    for ( quint32 i = 0; i < numColumns && stream.status() == QDataStream::Ok; ++i ) {
+        quint32 size;
+        stream >> size;
+        QByteArray compressed( int( size ), '\0' );
+        if ( stream.readRawData( compressed.data(), int( size ) ) != int( size ) ) {
+            return false;
+        }
+        section->columns.append( qUncompress( compressed ) );
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+template <typename T>
+static QList<T> fixedColumn( const Section &section, int column )
+{
+    QList<T> values;
+    if ( column >= section.columns.size() ) {
+        return values;
+    }
+    QDataStream stream( section.columns[column] );
+    stream.setByteOrder( QDataStream::LittleEndian );
+    for ( quint32 i = 0; i < section.numRows; ++i ) {
+        T value;
+        stream >> value;
+        values.append( value );
+    }
+    if ( stream.status() != QDataStream::Ok || !stream.atEnd() ) {
+        values.clear();
+    }
+    return values;
+}
+
+static QStringList stringColumn( const Section &section, int column )
+{
+    QStringList values;
+    if ( column >= section.columns.size() ) {
+        return values;
+    }
+    const QByteArray &data = section.columns[column];
+    QDataStream stream( data );
+    stream.setByteOrder( QDataStream::LittleEndian );
+    QList<quint32> offsets;
+    for ( quint32 i = 0; i <= section.numRows; ++i ) {
+        quint32 offset;
+        stream >> offset;
+        offsets.append( offset );
+    }
+    if ( stream.status() != QDataStream::Ok ) {
+        return values;
+    }
+    const int charactersStart = int( section.numRows + 1 ) * 4;
+    if ( offsets.last() != quint32( data.size() - charactersStart ) ) {
+        return values;
+    }
+    for ( quint32 i = 0; i < section.numRows; ++i ) {
+        values.append( QString::fromUtf8( data.mid( charactersStart + offsets[i], offsets[i + 1] - offsets[i] ) ) );
+    }
+    return values;
+}
+
+static QStringList names( const char * const *begin, int count )
+{
+    QStringList result;
+    for ( int i = 0; i < count; ++i ) {
+        result.append( QString::fromLatin1( begin[i] ) );
+    }
+    return result;
+}
+
+static void verifyDictionaries( const QList<Section> &dictionaries )
+{
+    verify( "four dictionaries", 4, dictionaries.size() );
+    if ( dictionaries.size() != 4 ) {
+        return;
+    }
+
+    const Section &processes = dictionaries[0];
+    verify( "processes come first", quint8( 'P' ), processes.kind );
+    verify( "process columns", 4, processes.columns.size() );
+    verify( "process names", names( g_processNames, 2 ).join( "," ),
+            stringColumn( processes, 0 ).join( "," ) );
+    verify( "process ids", true, fixedColumn<quint32>( processes, 1 ) == QList<quint32>() << 1000 << 1001 );
+    verify( "process start times", true,
+            fixedColumn<qint64>( processes, 2 ) == QList<qint64>() << 1400000000000LL << 1400000000001LL );
+    verify( "process end times", true,
+            fixedColumn<qint64>( processes, 3 ) == QList<qint64>() << 1400000001000LL << 1400000001001LL );
+
+    verify( "files come second", quint8( 'F' ), dictionaries[1].kind );
+    verify( "file names", names( g_fileNames, 3 ).join( "," ), stringColumn( dictionaries[1], 0 ).join( "," ) );
+    verify( "functions come third", quint8( 'N' ), dictionaries[2].kind );
+    verify( "function names", names( g_functionNames, 4 ).join( "," ), stringColumn( dictionaries[2], 0 ).join( "," ) );
+    verify( "trace keys come last", quint8( 'K' ), dictionaries[3].kind );
+    verify( "trace key names", names( g_keyNames, 2 ).join( "," ), stringColumn( dictionaries[3], 0 ).join( "," ) );
+}
+
+// Entries and variables refer to dictionary rows by index, i.e. database id - 1
+static void verifyEntries( const Section &entries, int *nextId, int *numBadEntries )
+{
+    const QList<quint32> ids = fixedColumn<quint32>( entries, 0 );
+    const QList<qint64> timestamps = fixedColumn<qint64>( entries, 1 );
+    const QList<quint32> processes = fixedColumn<quint32>( entries, 2 );
+    const QList<quint32> threads = fixedColumn<quint32>( entries, 3 );
+    const QList<quint32> files = fixedColumn<quint32>( entries, 4 );
+    const QList<quint32> lines = fixedColumn<quint32>( entries, 5 );
+    const QList<quint32> functions = fixedColumn<quint32>( entries, 6 );
+    const QList<quint8> types = fixedColumn<quint8>( entries, 7 );
+    const QList<qint32> keys = fixedColumn<qint32>( entries, 8 );
+    const QStringList messages = stringColumn( entries, 9 );
+    const QList<quint64> stackPositions = fixedColumn<quint64>( entries, 10 );
+
+    verify( "entry columns", 11, entries.columns.size() );
+    const int numRows = int( entries.numRows );
+    if ( ids.size() != numRows || timestamps.size() != numRows || processes.size() != numRows ||
+         threads.size() != numRows || files.size() != numRows || lines.size() != numRows ||
+         functions.size() != numRows || types.size() != numRows || keys.size() != numRows ||
+         messages.size() != numRows || stackPositions.size() != numRows ) {
+        verify( "entry columns have one value per row", true, false );
+        return;
+    }
+
+    for ( int i = 0; i < numRows; ++i ) {
+        const int id = ( *nextId )++;
+        const int tracePoint = tracePointOfEntry( id );
+        const int thread = threadOfEntry( id );
+        const bool ok = ids[i] == quint32( id ) &&
+                        timestamps[i] == 1400000000000LL + 10 * id &&
+                        processes[i] == quint32( processOfThread( thread ) - 1 ) &&
+                        threads[i] == quint32( 2000 + thread ) &&
+                        files[i] == quint32( fileOfTracePoint( tracePoint ) - 1 ) &&
+                        lines[i] == quint32( 10 * tracePoint ) &&
+                        functions[i] == quint32( functionOfTracePoint( tracePoint ) - 1 ) &&
+                        types[i] == quint8( tracePoint % 8 ) &&
+                        keys[i] == qint32( keyOfTracePoint( tracePoint ) - 1 ) &&
+                        messages[i] == QString( "message %1" ).arg( id ) &&
+                        stackPositions[i] == quint64( 100 * id );
+        if ( !ok ) {
+            cout << "Unexpected values for entry " << id << endl;
+            ++*numBadEntries;
+        }
+    }
+}
+
+static void verifyVariables( const Section &variables, int firstId, int lastId, int *numVariables )
+{
+    verify( "variable columns", 4, variables.columns.size() );
+    const QList<quint32> entryIds = fixedColumn<quint32>( variables, 0 );
+    const QStringList varNames = stringColumn( variables, 1 );
+    const QStringList values = stringColumn( variables, 2 );
+    const QList<quint8> types = fixedColumn<quint8>( variables, 3 );
+
+    int expectedRows = 0;
+    for ( int id = firstId; id <= lastId; ++id ) {
+        if ( entryHasVariable( id ) ) {
+            ++expectedRows;
+        }
+    }
+    verify( "variables of a row group follow it", expectedRows, int( variables.numRows ) );
+    if ( entryIds.size() != expectedRows || varNames.size() != expectedRows ||
+         values.size() != expectedRows || types.size() != expectedRows ) {
+        return;
+    }
+
+    int row = 0;
+    for ( int id = firstId; id <= lastId; ++id ) {
+        if ( !entryHasVariable( id ) ) {
+            continue;
+        }
+        const bool ok = entryIds[row] == quint32( id ) && varNames[row] == "var" &&
+                        values[row] == QString( "value %1" ).arg( id ) && types[row] == 1;
+        verify( "variable values", true, ok );
+        ++row;
+    }
+    *numVariables += row;
+}
+
+static void testExport( int numThreads )
+{
+    QFile::remove( g_fileName );
+    QString errMsg;
+    QSqlDatabase db = Database::create( g_fileName, &errMsg );
+    if ( !db.isValid() ) {
+        verify( "database can be created", string(), errMsg.toStdString() );
+        return;
+    }
+    if ( !populate( db ) ) {
+        verify( "database can be populated", true, false );
+        return;
+    }
+
+    QBuffer buffer;
+    buffer.open( QIODevice::WriteOnly );
+    {
+        ColumnExporter exporter( db );
+        exporter.setNumberOfThreads( numThreads );
+        exporter.setRowGroupSize( RowGroupSize );
+        verify( "export succeeds", true, exporter.exportTo( &buffer ) );
+        verify( "error message", string(), exporter.errorString().toStdString() );
+        verify( "number of exported entries", qulonglong( NumEntries ), exporter.numExportedEntries() );
+    }
+    buffer.close();
+    db.close();
+    QFile::remove( g_fileName );
+
+    const QByteArray data = buffer.data();
+    QDataStream stream( data );
+    stream.setByteOrder( QDataStream::LittleEndian );
+
+    char magic[8];
+    quint32 version = 0;
+    verify( "magic is complete", 8, stream.readRawData( magic, 8 ) );
+    stream >> version;
+    verify( "magic", string( "TRACECOL" ), string( magic, 8 ) );
+    verify( "format version", ColumnExporter::FormatVersion, version );
+
+    QList<Section> dictionaries;
+    int nextId = 1;
+    int numBadEntries = 0;
+    int numVariables = 0;
+    bool haveEndMarker = false;
+    bool variablesFollowEntries = true;
+    Section section;
+    while ( !stream.atEnd() && readSection( stream, &section ) ) {
+        if ( section.kind == 0 ) {
+            verify( "end marker has no rows", quint32( 0 ), section.numRows );
+            verify( "end marker has no columns", 0, section.columns.size() );
+            haveEndMarker = true;
+            break;
+        }
+        if ( section.kind == 'E' ) {
+            const int firstId = nextId;
+            verifyEntries( section, &nextId, &numBadEntries );
+            Section variables;
+            if ( !readSection( stream, &variables ) || variables.kind != 'V' ) {
+                variablesFollowEntries = false;
+                break;
+            }
+            verifyVariables( variables, firstId, nextId - 1, &numVariables );
+            continue;
+        }
+        verify( "dictionaries precede the entries", 1, nextId );
+        dictionaries.append( section );
+    }
+
+    verifyDictionaries( dictionaries );
+    verify( "each entry section is followed by variables", true, variablesFollowEntries );
+    verify( "entries are exported once in ascending order", NumEntries + 1, nextId );
+    verify( "entries have the values of the database", 0, numBadEntries );
+    verify( "all variables are exported", NumEntries / 3, numVariables );
+    verify( "file ends with an end marker", true, haveEndMarker );
+    verify( "nothing follows the end marker", true, stream.atEnd() );
+}
+
+int main( int argc, char **argv )
+{
+    QCoreApplication app( argc, argv );
+
+    // Row groups are written in order no matter which thread encoded them
+    testExport( 1 );
+    testExport( 3 );
+
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
@@ -29,11 +29,16 @@
 #include <sys/socket.h>
 #include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <algorithm>
 #include <iostream>
 #include <string>
 
@@ -91,6 +96,72 @@ static void *fakeServerProc( void *user_data )
     return NULL;
 }
 
+// Accepts a connection but only starts reading after a second, so that
+// the client's queue fills up.
+static void *stallingServerProc( void *user_data )
+{
+    std::string *output = (std::string *)user_data;
+
+    struct sockaddr_in server;
+    int opt = 1;
+    int server_sock = socket( AF_INET, SOCK_STREAM, 0 );
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = INADDR_ANY;
+    server.sin_port = htons( TRACELIB_DEFAULT_PORT );
+    setsockopt( server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof ( opt ) );
+    if ( bind( server_sock, (const sockaddr*)&server, sizeof ( server ) ) ||
+         listen( server_sock, 5 ) ) {
+        perror( "bind/listen" );
+        close( server_sock );
+        return NULL;
+    }
+    int fd = accept( server_sock, NULL, NULL );
+    close( server_sock );
+
+    sleep( 1 );
+    do {
+        char buf[65536];
+        int nr = read( fd, buf, sizeof ( buf ) );
+        if ( nr <= 0 && errno != EINTR )
+            break;
+        if ( nr > 0 )
+            output->append( buf, nr );
+    } while ( true );
+    close( fd );
+
+    return NULL;
+}
+
+// Accepts a connection, never reads from it and resets it after half a
+// second, so that the client loses the data it still had queued.
+static void *resettingServerProc( void * )
+{
+    struct sockaddr_in server;
+    int opt = 1;
+    int server_sock = socket( AF_INET, SOCK_STREAM, 0 );
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = INADDR_ANY;
+    server.sin_port = htons( TRACELIB_DEFAULT_PORT );
+    setsockopt( server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof ( opt ) );
+    if ( bind( server_sock, (const sockaddr*)&server, sizeof ( server ) ) ||
+         listen( server_sock, 5 ) ) {
+        perror( "bind/listen" );
+        close( server_sock );
+        return NULL;
+    }
+    int fd = accept( server_sock, NULL, NULL );
+    close( server_sock );
+
+    usleep( 500000 );
+    struct linger reset;
+    reset.l_onoff = 1;
+    reset.l_linger = 0;
+    setsockopt( fd, SOL_SOCKET, SO_LINGER, &reset, sizeof ( reset ) );
+    close( fd );
+
+    return NULL;
+}
+
 TRACELIB_NAMESPACE_BEGIN
 
 class FileObserver : public FileModificationMonitorObserver
@@ -288,12 +359,295 @@ static void testCommunication()
 
 }
 
+static NetworkOutput *connectToStallingServer( Log *log, const NetworkQueuePolicy &policy,
+                                               bool binaryData,
+                                               pthread_t *serverThread, std::string *output )
+{
+    pthread_create( serverThread, NULL, stallingServerProc, output );
+    usleep( 100000 );
+
+    NetworkOutput *net = new NetworkOutput( log, "127.0.0.1", TRACELIB_DEFAULT_PORT, policy );
+    net->setBinaryData( binaryData );
+    net->open();
+    usleep( 100000 );
+    return net;
+}
+
+static void testQueueLimits()
+{
+    NullLogOutput log_output;
+    Log error_log( &log_output, &log_output );
+    const size_t entrySize = 16384;
+    const std::vector<char> debugEntry( entrySize, 'd' );
+    const std::vector<char> errorEntry( entrySize, 'E' );
+
+    {
+        std::string output;
+        pthread_t server_thread;
+        NetworkQueuePolicy policy;
+        policy.maximumSize = 1024 * 1024;
+        policy.overflowPolicy = NetworkQueuePolicy::DropNewest;
+        NetworkOutput *net = connectToStallingServer( &error_log, policy, false, &server_thread, &output );
+        for ( int i = 0; i < 2000; ++i ) {
+            net->writeEntry( debugEntry, TracePointType::Debug );
+        }
+        const size_t dropped = net->takeDroppedEntries();
+        verify( "dropNewest drops entries once the queue is full",
+                true,
+                dropped > 0 );
+        verify( "dropped entries are reported only once",
+                (size_t)0,
+                net->takeDroppedEntries() );
+        delete net;
+        pthread_join( server_thread, NULL );
+        verify( "dropNewest sends all entries which were not dropped",
+                ( 2000 - dropped ) * entrySize,
+                output.size() );
+    }
+
+    {
+        std::string output;
+        pthread_t server_thread;
+        NetworkQueuePolicy policy;
+        policy.maximumSize = 4 * 1024 * 1024;
+        policy.overflowPolicy = NetworkQueuePolicy::DropLowSeverity;
+        NetworkOutput *net = connectToStallingServer( &error_log, policy, false, &server_thread, &output );
+        for ( int i = 0; i < 2000; ++i ) {
+            net->writeEntry( i % 20 == 0 ? errorEntry : debugEntry,
+                             i % 20 == 0 ? TracePointType::Error : TracePointType::Debug );
+        }
+        usleep( 100000 ); // the event thread drops entries asynchronously
+        const size_t dropped = net->takeDroppedEntries();
+        delete net;
+        pthread_join( server_thread, NULL );
+        verify( "dropLowSeverity drops entries once the queue is full",
+                true,
+                dropped > 0 );
+        verify( "dropLowSeverity keeps error entries",
+                (size_t)100 * entrySize,
+                (size_t)std::count( output.begin(), output.end(), 'E' ) );
+        verify( "dropLowSeverity sends all entries which were not dropped",
+                ( 2000 - dropped ) * entrySize,
+                output.size() );
+    }
+
+    {
+        std::string output;
+        pthread_t server_thread;
+        NetworkQueuePolicy policy;
+        policy.maximumEntries = 8;
+        policy.overflowPolicy = NetworkQueuePolicy::Block;
+        NetworkOutput *net = connectToStallingServer( &error_log, policy, false, &server_thread, &output );
+        for ( int i = 0; i < 2000; ++i ) {
+            net->writeEntry( debugEntry, TracePointType::Debug );
+        }
+        verify( "block does not drop entries",
+                (size_t)0,
+                net->takeDroppedEntries() );
+        delete net;
+        pthread_join( server_thread, NULL );
+        verify( "block sends all entries",
+                2000 * entrySize,
+                output.size() );
+    }
+
+    {
+        std::string output;
+        pthread_t server_thread;
+        NetworkQueuePolicy policy;
+        policy.maximumEntries = 8;
+        policy.overflowPolicy = NetworkQueuePolicy::DropOldest;
+        NetworkOutput *net = connectToStallingServer( &error_log, policy, true, &server_thread, &output );
+        bool restartRequested = false;
+        for ( int i = 0; i < 2000 && !restartRequested; ++i ) {
+            net->writeEntry( debugEntry, TracePointType::Debug );
+            usleep( 100 );
+            restartRequested = !net->canWrite();
+        }
+        verify( "dropping binary data requires a new stream",
+                true,
+                restartRequested );
+        verify( "open() starts a new stream",
+                true,
+                net->open() && net->canWrite() );
+        delete net;
+        pthread_join( server_thread, NULL );
+    }
+}
+
+// Entries which were still queued when the connection broke were dropped, too.
+static void testDroppedOnConnectionLoss()
+{
+    NullLogOutput log_output;
+    Log error_log( &log_output, &log_output );
+    const std::vector<char> entry( 16384, 'd' );
+
+    // Writing to the reset connection must not kill the test
+    signal( SIGPIPE, SIG_IGN );
+
+    pthread_t server_thread;
+    pthread_create( &server_thread, NULL, resettingServerProc, NULL );
+    usleep( 100000 );
+
+    NetworkQueuePolicy policy;
+    policy.maximumSize = 0;
+    NetworkOutput *net = new NetworkOutput( &error_log, "127.0.0.1", TRACELIB_DEFAULT_PORT, policy );
+    net->setBinaryData( true );
+    net->open();
+    usleep( 100000 );
+
+    bool failed = false;
+    for ( int i = 0; i < 5000 && !failed; ++i ) {
+        net->writeEntry( entry, TracePointType::Debug );
+        usleep( 1000 );
+        failed = !net->canWrite();
+    }
+    verify( "reset connection makes the output fail",
+            true,
+            failed );
+    verify( "entries queued when the connection broke are dropped",
+            true,
+            net->takeDroppedEntries() > 0 );
+    delete net;
+    pthread_join( server_thread, NULL );
+}
+
+struct ReadObserver : public FileEventObserver
+{
+    int count;
+
+    ReadObserver() : count( 0 ) {}
+
+    void handleEvent( EventContext *ctx, Event *event )
+    {
+        FileEvent *fe = (FileEvent *)event;
+        if ( FileEvent::FileRead == fe->watch ) {
+            char c;
+            while ( read( fe->fd, &c, 1 ) == 1 )
+                ;
+            ++count;
+            RemoveIOObserverTask( fe->fd, this, FileEvent::FileRead ).exec( ctx );
+        }
+    }
+};
+
+// File descriptors beyond FD_SETSIZE could not be watched with select()
+static void testHighFileDescriptors()
+{
+    const int highFd = FD_SETSIZE + 100;
+    rlimit limit;
+    if ( getrlimit( RLIMIT_NOFILE, &limit ) != 0 || limit.rlim_cur <= (rlim_t)highFd ) {
+        cout << "Skipping testHighFileDescriptors, file descriptor limit too low" << endl;
+        return;
+    }
+
+    int fds[2];
+    if ( pipe( fds ) != 0 || dup2( fds[0], highFd ) != highFd ) {
+        verify( "create file descriptor beyond FD_SETSIZE", true, false );
+        return;
+    }
+    close( fds[0] );
+
+    ReadObserver observer;
+    AddIOObserverTask addObserver( highFd, &observer, FileEvent::FileRead );
+    EventThreadUnix::self()->sendTask( &addObserver );
+    write( fds[1], "x", 1 );
+    usleep( 100000 );
+    verify( "observer notified about file descriptor beyond FD_SETSIZE",
+            1,
+            observer.count );
+
+    close( highFd );
+    close( fds[1] );
+}
+
+class CountingTask : public Task
+{
+public:
+    CountingTask( int *counter ) : m_counter( counter ) {}
+
+    void *exec( EventContext * )
+    {
+        ++*m_counter;
+        return m_counter;
+    }
+
+private:
+    int *m_counter; // only modified in the event thread
+};
+
+static const int g_postersCount = 4;
+static const int g_postsPerPoster = 50000;
+
+static void *posterProc( void *user_data )
+{
+    int *counter = (int *)user_data;
+    for ( int i = 0; i < g_postsPerPoster; ++i ) {
+        EventThreadUnix::self()->postTask( new CountingTask( counter ) );
+    }
+    return NULL;
+}
+
+static double secondsSince( const timeval &start )
+{
+    timeval now, diff;
+    gettimeofday( &now, NULL );
+    timersub( &now, &start, &diff );
+    return diff.tv_sec + diff.tv_usec / 1000000.0;
+}
+
+// Measures how many tasks per second can be handed to the event thread.
+static void benchmarkTasks()
+{
+    int counter = 0;
+    (void)EventThreadUnix::self();
+
+    timeval start;
+    gettimeofday( &start, NULL );
+    pthread_t posters[g_postersCount];
+    for ( int i = 0; i < g_postersCount; ++i ) {
+        pthread_create( &posters[i], NULL, posterProc, &counter );
+    }
+    for ( int i = 0; i < g_postersCount; ++i ) {
+        pthread_join( posters[i], NULL );
+    }
+    // Runs after all posted tasks
+    CountingTask last( &counter );
+    EventThreadUnix::self()->sendTask( &last );
+    const double postSeconds = secondsSince( start );
+    verify( "all posted tasks were run",
+            g_postersCount * g_postsPerPoster + 1,
+            counter );
+
+    const int sendCount = 20000;
+    counter = 0;
+    gettimeofday( &start, NULL );
+    for ( int i = 0; i < sendCount; ++i ) {
+        CountingTask task( &counter );
+        EventThreadUnix::self()->sendTask( &task );
+    }
+    const double sendSeconds = secondsSince( start );
+    verify( "all sent tasks were run",
+            sendCount,
+            counter );
+
+    printf( "postTask: %d tasks from %d threads in %.3fs (%.0f tasks/s)\n",
+            g_postersCount * g_postsPerPoster, g_postersCount, postSeconds,
+            g_postersCount * g_postsPerPoster / postSeconds );
+    printf( "sendTask: %d round trips in %.3fs (%.0f round trips/s)\n",
+            sendCount, sendSeconds, sendCount / sendSeconds );
+}
+
 TRACELIB_NAMESPACE_END
 
 int main()
 {
     TRACELIB_NAMESPACE_IDENT(testCommunication)();
     TRACELIB_NAMESPACE_IDENT(testTimers)();
+    TRACELIB_NAMESPACE_IDENT(testQueueLimits)();
+    TRACELIB_NAMESPACE_IDENT(testDroppedOnConnectionLoss)();
+    TRACELIB_NAMESPACE_IDENT(testHighFileDescriptors)();
+    TRACELIB_NAMESPACE_IDENT(benchmarkTasks)();
     cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
     return g_failureCount;
 }
@@ -0,0 +1,182 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log.h"
+#include "output.h"
+#include "filerotator.h"
+#include "thread.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+static const char *g_fileName = "test_fileoutput.out";
+
+static long fileSize( const string &fileName = g_fileName )
+{
+    FILE *f = fopen( fileName.c_str(), "rb" );
+    if ( !f ) {
+        return -1;
+    }
+    fseek( f, 0, SEEK_END );
+    const long size = ftell( f );
+    fclose( f );
+    return size;
+}
+
+TRACELIB_NAMESPACE_BEGIN
+
+static void testFileOutput()
+{
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+
+    const vector<char> entry( 99, 'x' ); // 100 bytes including the newline
+
+    {
+        FileOutput output( &log, g_fileName );
+        verify( "unbuffered output can write before open()", false, output.canWrite() );
+        output.open();
+        output.write( entry );
+        verify( "unbuffered output writes every entry", 100L, fileSize() );
+    }
+
+    {
+        FileFlushPolicy policy;
+        policy.bufferSize = 250;
+        policy.flushOnError = false;
+        FileOutput output( &log, g_fileName, policy );
+        output.open();
+        output.write( entry );
+        verify( "entries are buffered until buffer size is reached", 0L, fileSize() );
+        output.writeEntry( entry, TracePointType::Error );
+        verify( "no flush on error entries if disabled", 0L, fileSize() );
+        output.write( entry );
+        verify( "buffered data is written once it exceeds buffer size", 300L, fileSize() );
+        output.write( entry );
+        output.flush();
+        verify( "explicit flush writes buffered data", 400L, fileSize() );
+        output.write( entry );
+    }
+    verify( "destructor writes buffered data", 500L, fileSize() );
+
+    {
+        FileFlushPolicy policy;
+        policy.bufferSize = 1000;
+        FileOutput output( &log, g_fileName, policy );
+        output.open();
+        output.writeEntry( entry, TracePointType::Error );
+        verify( "error entries flush buffered data", 100L, fileSize() );
+    }
+
+    {
+        FileFlushPolicy policy;
+        policy.flushInterval = 50;
+        FileOutput output( &log, g_fileName, policy );
+        output.open();
+        output.write( entry );
+        verify( "flush interval implies buffering", 0L, fileSize() );
+        for ( int i = 0; i < 100 && fileSize() == 0; ++i ) {
+            Thread::sleep( 20 );
+        }
+        verify( "buffered data is written after flush interval", 100L, fileSize() );
+    }
+
+    {
+        FileFlushPolicy policy;
+        policy.bufferSize = 1000;
+        FileOutput output( &log, g_fileName, policy );
+        output.setBinaryData( true );
+        output.open();
+        output.write( entry );
+        output.flush();
+        verify( "binary data is written without newlines", 99L, fileSize() );
+    }
+
+    remove( g_fileName );
+}
+
+static void testRotation()
+{
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+
+    const vector<char> entry( 99, 'x' );
+    const string fileName = g_fileName;
+
+    for ( int compress = 0; compress < 2; ++compress ) {
+        const string suffix = compress ? ".gz" : "";
+        {
+            FileRotationPolicy policy;
+            policy.maximumSize = 250;
+            policy.generations = 2;
+            policy.compress = compress != 0;
+            FileOutput output( &log, g_fileName, FileFlushPolicy(), policy );
+            for ( int i = 0; i < 9; ++i ) {
+                if ( !output.canWrite() ) {
+                    output.open();
+                }
+                output.write( entry );
+            }
+            verify( "output is closed after reaching maximum size", false, output.canWrite() );
+            verify( "rotated file is moved away", -1L, fileSize() );
+        }
+        verify( "first generation is kept", true, fileSize( fileName + ".1" + suffix ) > 0 );
+        verify( "second generation is kept", true, fileSize( fileName + ".2" + suffix ) > 0 );
+        verify( "older generations are removed", -1L, fileSize( fileName + ".3" + suffix ) );
+        if ( compress ) {
+            verify( "compressed files replace uncompressed ones", -1L, fileSize( fileName + ".1" ) );
+        } else {
+            verify( "files are rotated after reaching maximum size", 300L, fileSize( fileName + ".1" ) );
+        }
+        remove( ( fileName + ".1" + suffix ).c_str() );
+        remove( ( fileName + ".2" + suffix ).c_str() );
+
+        // Compression is optional, depending on the build
+        if ( !FileRotator::supportsCompression() ) {
+            break;
+        }
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
+int main()
+{
+    TRACELIB_NAMESPACE_IDENT(testFileOutput)();
+    TRACELIB_NAMESPACE_IDENT(testRotation)();
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
@@ -20,7 +20,11 @@
 #include "tracelib.h"
 #include "filter.h"
 
+#include <cstdio>
+#include <ctime>
 #include <iostream>
+#include <string>
+#include <vector>
 
 using namespace std;
 
@@ -166,12 +170,214 @@ static void testGroupFilter()
     verify( "f2 (blacklisting) on noGroupTP2", false, f2.acceptsTracePoint( &noGroupTP2 ) );
 }
 
+static PathFilter *pathFilter( MatchingMode matchingMode, const char *path )
+{
+    PathFilter *f = new PathFilter;
+    f->setPath( matchingMode, path );
+    return f;
+}
+
+static FunctionFilter *functionFilter( MatchingMode matchingMode, const char *function )
+{
+    FunctionFilter *f = new FunctionFilter;
+    f->setFunction( matchingMode, function );
+    return f;
+}
+
+static GroupFilter *groupFilter( GroupFilter::Mode mode, const char *group1, const char *group2 = 0 )
+{
+    GroupFilter *f = new GroupFilter;
+    f->setMode( mode );
+    f->addGroupName( group1 );
+    if ( group2 ) {
+        f->addGroupName( group2 );
+    }
+    return f;
+}
+
+/* Builds a configuration resembling a real one: a few sets mixing all
+ * kinds of filters, including several patterns which get combined.
+ */
+static void createFilters( vector<Filter *> *filters )
+{
+    ConjunctionFilter *ioFilter = new ConjunctionFilter;
+    ioFilter->addFilter( pathFilter( WildcardMatch, "*/io/*.cpp" ) );
+    ioFilter->addFilter( groupFilter( GroupFilter::Blacklist, "Verbose" ) );
+    filters->push_back( ioFilter );
+
+    DisjunctionFilter *mainFilter = new DisjunctionFilter;
+    mainFilter->addFilter( pathFilter( StrictMatch, "/src/main.cpp" ) );
+    mainFilter->addFilter( functionFilter( StrictMatch, "Parser::parse" ) );
+    mainFilter->addFilter( functionFilter( RegExpMatch, "Net.*::(send|receive)" ) );
+    mainFilter->addFilter( pathFilter( RegExpMatch, ".*/(gui|widgets)/.*\\.cpp" ) );
+    filters->push_back( mainFilter );
+
+    filters->push_back( 0 );
+
+    ConjunctionFilter *keyFilter = new ConjunctionFilter;
+    keyFilter->addFilter( groupFilter( GroupFilter::Whitelist, "ConsoleIO", "" ) );
+    keyFilter->addFilter( functionFilter( WildcardMatch, "*::on?*" ) );
+    filters->push_back( keyFilter );
+
+    DisjunctionFilter *backrefFilter = new DisjunctionFilter;
+    backrefFilter->addFilter( functionFilter( RegExpMatch, "(\\w+)::\\1" ) );
+    backrefFilter->addFilter( new DisjunctionFilter );
+    filters->push_back( backrefFilter );
+}
+
+static void createTracePoints( vector<TracePoint *> *tracePoints, vector<string> *strings, size_t count )
+{
+    static const char * const dirs[] = { "/src/io", "/src/gui", "/src/net", "/src/widgets", "/src" };
+    static const char * const functions[] = { "Parser::parse", "NetSocket::send", "Widget::onClick", "Foo::Foo", "main", "Widget::on" };
+    static const char * const groups[] = { "Verbose", "ConsoleIO", "", 0 };
+
+    strings->reserve( count * 2 );
+    for ( size_t i = 0; i < count; ++i ) {
+        char buf[64];
+        sprintf( buf, "%s/%s%lu.cpp", dirs[i % 5], i % 7 == 0 ? "main" : "file", (unsigned long)( i % 7 == 0 ? 0 : i ) );
+        strings->push_back( buf );
+        if ( string( buf ) == "/src/main0.cpp" ) {
+            strings->back() = "/src/main.cpp";
+        }
+        tracePoints->push_back( new TracePoint( TracePointType::Log, strings->back().c_str(), 1,
+                                                functions[i % 6], groups[i % 4] ) );
+    }
+}
+
+static size_t firstAcceptingFilter( const vector<Filter *> &filters, const TracePoint *tp )
+{
+    for ( size_t i = 0; i < filters.size(); ++i ) {
+        if ( filters[i] && filters[i]->acceptsTracePoint( tp ) ) {
+            return i;
+        }
+    }
+    return FilterProgram::NoMatch;
+}
+
+static void testFilterProgram()
+{
+    vector<Filter *> filters;
+    createFilters( &filters );
+
+    FilterProgram program;
+    for ( size_t i = 0; i < filters.size(); ++i ) {
+        program.addFilter( filters[i] );
+    }
+    program.finalize();
+
+    vector<TracePoint *> tracePoints;
+    vector<string> strings;
+    createTracePoints( &tracePoints, &strings, 420 );
+
+    size_t mismatches = 0;
+    size_t matches = 0;
+    for ( size_t i = 0; i < tracePoints.size(); ++i ) {
+        const size_t expected = firstAcceptingFilter( filters, tracePoints[i] );
+        if ( program.match( tracePoints[i] ) != expected ) {
+            ++mismatches;
+        }
+        if ( expected != FilterProgram::NoMatch ) {
+            ++matches;
+        }
+    }
+    verify( "program agrees with filter trees", (size_t)0, mismatches );
+    verify( "some trace points match", true, matches > 0 );
+    verify( "not all trace points match", true, matches < tracePoints.size() );
+
+    /* Patterns exercising the extraction of required literals. */
+    static const char * const patterns[] = { "ab*c", "a?bc", "x{2}yz", "(foo|bar)baz", "foo|qux", "[a-z]+\\.cpp",
+                                             "(?i)MAIN\\.cpp", "a\\.b+", "*.c?p", "ma*n.?pp",
+                                             "\\x41b\\.cpp", "\\101b\\.cpp", "\\cAb", "\\p{Lu}b\\.cpp",
+                                             "x[[:alpha:]]foo\\.cpp", "x[5[:alpha:]]foo\\.cpp", 0 };
+    static const char * const subjects[] = { "ac", "abbbc", "bc", "xxyz", "yz", "foobaz", "barbaz", "qux", "main.cpp",
+                                              "Main.cpp", "a.bbb", "a.b", "x.cpp", "x.cxp", "man.cpp", "mn.cpp",
+                                              "Ab.cpp", "\001b", "xafoo.cpp", 0 };
+    for ( int i = 0; patterns[i]; ++i ) {
+        for ( int mode = 0; mode < 2; ++mode ) {
+            PathFilter *f = pathFilter( mode == 0 ? RegExpMatch : WildcardMatch, patterns[i] );
+            FilterProgram patternProgram;
+            patternProgram.addFilter( f );
+            patternProgram.finalize();
+            for ( int j = 0; subjects[j]; ++j ) {
+                TracePoint tp( TracePointType::Log, subjects[j], 1, "f", 0 );
+                const string what = string( "pattern '" ) + patterns[i] + "' on '" + subjects[j] + "'";
+                verify( what.c_str(), f->acceptsTracePoint( &tp ), patternProgram.match( &tp ) == 0 );
+            }
+            delete f;
+        }
+    }
+
+    FilterProgram emptyProgram;
+    emptyProgram.finalize();
+    verify( "empty program matches nothing", FilterProgram::NoMatch, emptyProgram.match( tracePoints[0] ) );
+
+    deleteRange( tracePoints.begin(), tracePoints.end() );
+    deleteRange( filters.begin(), filters.end() );
+}
+
+static void benchmarkFilterProgram()
+{
+    vector<Filter *> filters;
+    createFilters( &filters );
+    for ( int i = 0; i < 20; ++i ) {
+        char buf[64];
+        sprintf( buf, "*/module%d/*.cpp", i );
+        filters.push_back( pathFilter( WildcardMatch, buf ) );
+        sprintf( buf, ".*/component%d/.*", i );
+        filters.push_back( pathFilter( RegExpMatch, buf ) );
+    }
+
+    FilterProgram program;
+    for ( size_t i = 0; i < filters.size(); ++i ) {
+        program.addFilter( filters[i] );
+    }
+    program.finalize();
+
+    /* Most trace points in an application are not matched by any set, so
+     * all filters need to be evaluated for them.
+     */
+    static const char * const functions[] = { "Model::data", "Model::rowCount", "Job::run", "Widget::update" };
+    vector<TracePoint *> tracePoints;
+    vector<string> strings;
+    strings.reserve( 20000 );
+    for ( size_t i = 0; i < 20000; ++i ) {
+        char buf[64];
+        sprintf( buf, "/src/core%lu/file%lu.cpp", (unsigned long)( i % 50 ), (unsigned long)i );
+        strings.push_back( buf );
+        tracePoints.push_back( new TracePoint( TracePointType::Log, strings.back().c_str(), 1,
+                                               functions[i % 4], i % 2 ? "Verbose" : 0 ) );
+    }
+
+    clock_t start = clock();
+    size_t treeMatches = 0;
+    for ( size_t i = 0; i < tracePoints.size(); ++i ) {
+        treeMatches += firstAcceptingFilter( filters, tracePoints[i] );
+    }
+    const double treeSeconds = double( clock() - start ) / CLOCKS_PER_SEC;
+
+    start = clock();
+    size_t programMatches = 0;
+    for ( size_t i = 0; i < tracePoints.size(); ++i ) {
+        programMatches += program.match( tracePoints[i] );
+    }
+    const double programSeconds = double( clock() - start ) / CLOCKS_PER_SEC;
+
+    verify( "benchmark results agree", treeMatches, programMatches );
+    printf( "configuring %lu trace points: filter trees %.3fs, filter program %.3fs\n",
+            (unsigned long)tracePoints.size(), treeSeconds, programSeconds );
+
+    deleteRange( tracePoints.begin(), tracePoints.end() );
+    deleteRange( filters.begin(), filters.end() );
+}
+
 TRACELIB_NAMESPACE_END
 
 int main()
 {
     TRACELIB_NAMESPACE_IDENT(testPathFilter)();
     TRACELIB_NAMESPACE_IDENT(testGroupFilter)();
+    TRACELIB_NAMESPACE_IDENT(testFilterProgram)();
+    TRACELIB_NAMESPACE_IDENT(benchmarkFilterProgram)();
     cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
     return g_failureCount;
 }
@@ -0,0 +1,318 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs queries on a generated trace database with a QueryWorker, the way
+ * the models of the GUI do.
+ */
+
+#include "test_queryworker.h"
+
+#include "../server/database.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+static const char *g_fileName = "test_queryworker.trace";
+
+static const int NumEntries = 2000;
+static const int NumSegmentEntries = 100;
+
+static const char *g_countStatement = "SELECT COUNT(*) FROM trace_entry;";
+// Yields NumEntries * NumEntries rows, which takes a while to step through
+static const char *g_slowStatement = "SELECT a.id, b.id FROM trace_entry a, trace_entry b;";
+// Takes far longer before even the first row is available
+static const char *g_slowFirstStepStatement = "SELECT COUNT(*) FROM trace_entry a, trace_entry b, trace_entry c;";
+
+static bool exec( QSqlDatabase db, const QString &statement )
+{
+    QSqlQuery q( db );
+    if ( !q.exec( statement ) ) {
+        cout << "Failed to execute '" << statement.toStdString() << "': "
+             << q.lastError().text().toStdString() << endl;
+        return false;
+    }
+    return true;
+}
+
+static bool insertEntries( QSqlDatabase db, int firstId, int count )
+{
+    if ( !exec( db, "BEGIN TRANSACTION;" ) ) {
+        return false;
+    }
+    QSqlQuery q( db );
+    q.prepare( "INSERT INTO trace_entry VALUES(?, 1, ?, 1, ?, 0);" );
+    for ( int id = firstId; id < firstId + count; ++id ) {
+        q.addBindValue( id );
+        q.addBindValue( 1400000000000LL + id );
+        q.addBindValue( QString( "message %1" ).arg( id ) );
+        if ( !q.exec() ) {
+            cout << "Failed to insert entry " << id << ": " << q.lastError().text().toStdString() << endl;
+            exec( db, "ROLLBACK;" );
+            return false;
+        }
+    }
+    return exec( db, "COMMIT;" );
+}
+
+static void processEventsFor( int msecs )
+{
+    QElapsedTimer timer;
+    timer.start();
+    while ( timer.elapsed() < msecs ) {
+        QCoreApplication::processEvents();
+        QThread::msleep( 1 );
+    }
+}
+
+// Returns false if the query neither finished nor failed in time
+static bool waitForQuery( const QueryRecorder &recorder, int queryId )
+{
+    QElapsedTimer timer;
+    timer.start();
+    while ( !recorder.hasFinished( queryId ) && !recorder.hasFailed( queryId ) ) {
+        if ( timer.elapsed() > 10000 ) {
+            return false;
+        }
+        QCoreApplication::processEvents();
+        QThread::msleep( 1 );
+    }
+    return true;
+}
+
+static int countOf( const QueryWorker::Rows &rows )
+{
+    if ( rows.size() != 1 || rows.first().size() != 1 ) {
+        return -1;
+    }
+    return rows.first().first().toInt();
+}
+
+// Once it answered a query, the worker starts the next one right away
+static void waitUntilIdle( QueryWorker *worker, QueryRecorder *recorder )
+{
+    verify( "worker answers queries", true, waitForQuery( *recorder, worker->submit( g_countStatement ) ) );
+}
+
+static void testCancelRunningQuery( QSqlDatabase db )
+{
+    QueryWorker worker( db );
+    QueryRecorder recorder( &worker );
+    worker.start();
+    waitUntilIdle( &worker, &recorder );
+
+    const int slowId = worker.submit( g_slowStatement );
+    const int countId = worker.submit( g_countStatement );
+    QThread::msleep( 100 );
+    worker.cancel( slowId );
+
+    verify( "query queued behind the cancelled one finishes", true, waitForQuery( recorder, countId ) );
+    verify( "query queued behind the cancelled one has results", NumEntries, countOf( recorder.results( countId ) ) );
+    verify( "cancelled query reports no results", false, recorder.hasFinished( slowId ) );
+    verify( "cancelled query reports no failure", false, recorder.hasFailed( slowId ) );
+}
+
+static void testInterruptRunningQuery( QSqlDatabase db )
+{
+    QueryWorker worker( db );
+    QueryRecorder recorder( &worker );
+    worker.start();
+    waitUntilIdle( &worker, &recorder );
+    if ( !worker.canInterrupt() ) {
+        cout << "Skipping testInterruptRunningQuery: queries cannot be interrupted" << endl;
+        return;
+    }
+
+    const int slowId = worker.submit( g_slowFirstStepStatement );
+    const int countId = worker.submit( g_countStatement );
+    QThread::msleep( 100 );
+    worker.cancel( slowId );
+
+    verify( "query queued behind the interrupted one finishes", true, waitForQuery( recorder, countId ) );
+    verify( "query queued behind the interrupted one has results", NumEntries, countOf( recorder.results( countId ) ) );
+    verify( "interrupted query reports no results", false, recorder.hasFinished( slowId ) );
+    verify( "interrupted query reports no failure", false, recorder.hasFailed( slowId ) );
+}
+
+/* The filter changes once while the query for the old filter is running and
+ * once after its results were sent already; only the results for the
+ * current filter may be taken.
+ */
+static void testStaleIdsIgnored( QSqlDatabase db )
+{
+    QueryWorker worker( db );
+    QueryRecorder recorder( &worker );
+    worker.start();
+    waitUntilIdle( &worker, &recorder );
+
+    const int runningId = worker.submit( g_slowStatement );
+    recorder.await( runningId );
+    QThread::msleep( 100 );
+    worker.cancel( runningId );
+    const int evenId = worker.submit( "SELECT id FROM trace_entry WHERE id % 2 = 0 ORDER BY id;" );
+    recorder.await( evenId );
+
+    verify( "query for the new filter finishes", true, waitForQuery( recorder, evenId ) );
+    verify( "results of the cancelled query never arrive", false, recorder.hasFinished( runningId ) );
+    verify( "results for the new filter are taken", NumEntries / 2, recorder.acceptedRows().size() );
+
+    const int sentId = worker.submit( "SELECT id FROM trace_entry WHERE id % 3 = 0 ORDER BY id;" );
+    recorder.await( sentId );
+    // No events are processed meanwhile, so the results wait in the event queue
+    QThread::msleep( 200 );
+    worker.cancel( sentId );
+    const int fifthId = worker.submit( "SELECT id FROM trace_entry WHERE id % 5 = 0 ORDER BY id;" );
+    recorder.await( fifthId );
+
+    verify( "query for the newest filter finishes", true, waitForQuery( recorder, fifthId ) );
+    verify( "results sent before the filter changed arrive", true, recorder.hasFinished( sentId ) );
+    verify( "results sent before the filter changed are ignored", 1, recorder.numIgnored() );
+    verify( "results for the newest filter are taken", NumEntries / 5, recorder.acceptedRows().size() );
+    if ( !recorder.acceptedRows().isEmpty() ) {
+        verify( "taken results match the newest filter", 5, recorder.acceptedRows().first().first().toInt() );
+    }
+}
+
+static void testSubmitAfterStop( QSqlDatabase db )
+{
+    QueryWorker worker( db );
+    QueryRecorder recorder( &worker );
+    worker.start();
+    waitUntilIdle( &worker, &recorder );
+
+    worker.stop();
+    verify( "stopped worker has terminated", true, worker.isFinished() );
+
+    const int queryId = worker.submit( g_countStatement );
+    worker.attachSegments();
+    processEventsFor( 200 );
+    verify( "query submitted after stop() reports no results", false, recorder.hasFinished( queryId ) );
+    verify( "query submitted after stop() reports no failure", false, recorder.hasFailed( queryId ) );
+}
+
+/* The segment is created while the worker runs; its entries show up once
+ * the worker attached the segments again.
+ */
+static void testAttachSegments( QSqlDatabase db )
+{
+    QueryWorker worker( db );
+    QueryRecorder recorder( &worker );
+    worker.start();
+    waitUntilIdle( &worker, &recorder );
+
+    const QString segmentFileName = Database::segmentFileName( db.databaseName(), 1 );
+    verify( "segment directory can be created", true,
+            QDir().mkpath( QFileInfo( segmentFileName ).absolutePath() ) );
+    QString errMsg;
+    {
+        QSqlDatabase segmentDB = Database::create( segmentFileName, &errMsg );
+        verify( "segment can be created", string(), errMsg.toStdString() );
+        if ( !segmentDB.isValid() ) {
+            return;
+        }
+        verify( "segment can be populated", true, insertEntries( segmentDB, NumEntries + 1, NumSegmentEntries ) );
+        segmentDB.close();
+    }
+    QSqlDatabase::removeDatabase( segmentFileName );
+
+    const QString relativeFileName = QFileInfo( db.databaseName() ).dir().relativeFilePath( segmentFileName );
+    verify( "segment can be listed", true,
+            exec( db, "CREATE TABLE segment (id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                      " file_name TEXT,"
+                      " start_time INTEGER);" ) &&
+            exec( db, QString( "INSERT INTO segment VALUES(1, %1, 0);" )
+                      .arg( Database::formatValue( db, relativeFileName ) ) ) );
+
+    const int beforeId = worker.submit( g_countStatement );
+    verify( "query before attaching finishes", true, waitForQuery( recorder, beforeId ) );
+    verify( "segment is not seen before attaching", NumEntries, countOf( recorder.results( beforeId ) ) );
+
+    worker.attachSegments();
+    const int afterId = worker.submit( g_countStatement );
+    verify( "query after attaching finishes", true, waitForQuery( recorder, afterId ) );
+    verify( "segment rows are seen after attaching", NumEntries + NumSegmentEntries,
+            countOf( recorder.results( afterId ) ) );
+
+    const int lastId = worker.submit( "SELECT message FROM trace_entry WHERE id = ?;",
+                                      QList<QVariant>() << NumEntries + NumSegmentEntries );
+    verify( "query for a segment row finishes", true, waitForQuery( recorder, lastId ) );
+    const QueryWorker::Rows rows = recorder.results( lastId );
+    verify( "segment row is found", 1, rows.size() );
+    if ( rows.size() == 1 ) {
+        verify( "segment row has its values", QString( "message %1" ).arg( NumEntries + NumSegmentEntries ).toStdString(),
+                rows.first().first().toString().toStdString() );
+    }
+
+    worker.stop();
+    QDir( QFileInfo( segmentFileName ).absolutePath() ).removeRecursively();
+}
+
+int main( int argc, char **argv )
+{
+    QCoreApplication app( argc, argv );
+
+    QFile::remove( g_fileName );
+    {
+        QString errMsg;
+        QSqlDatabase db = Database::create( g_fileName, &errMsg );
+        if ( !db.isValid() ) {
+            cout << "Failed to create database: " << errMsg.toStdString() << endl;
+            return 1;
+        }
+        if ( !insertEntries( db, 1, NumEntries ) ) {
+            return 1;
+        }
+
+        testCancelRunningQuery( db );
+        testInterruptRunningQuery( db );
+        testStaleIdsIgnored( db );
+        testSubmitAfterStop( db );
+        // Last, since it lists a segment in the database
+        testAttachSegments( db );
+        db.close();
+    }
+    QSqlDatabase::removeDatabase( g_fileName );
+    QFile::remove( g_fileName );
+
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
@@ -0,0 +1,84 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEST_QUERYWORKER_H
+#define TEST_QUERYWORKER_H
+
+#include "../gui/queryworker.h"
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+
+/* Records the outcome of every query like the receivers in the GUI do:
+ * all results are kept, but only those of the query which is waited for
+ * are accepted.
+ */
+class QueryRecorder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QueryRecorder(QueryWorker *worker)
+        : m_awaitedId(-1), m_numIgnored(0)
+    {
+        connect(worker, SIGNAL(queryFinished(int, const QueryWorker::Rows &)),
+                SLOT(handleQueryResults(int, const QueryWorker::Rows &)));
+        connect(worker, SIGNAL(queryFailed(int, const QString &)),
+                SLOT(handleQueryFailure(int, const QString &)));
+    }
+
+    void await(int queryId) { m_awaitedId = queryId; }
+    bool isWaiting() const { return m_awaitedId != -1; }
+
+    bool hasFinished(int queryId) const { return m_results.contains(queryId); }
+    bool hasFailed(int queryId) const { return m_failedIds.contains(queryId); }
+    QueryWorker::Rows results(int queryId) const { return m_results.value(queryId); }
+
+    const QueryWorker::Rows &acceptedRows() const { return m_acceptedRows; }
+    int numIgnored() const { return m_numIgnored; }
+
+private slots:
+    void handleQueryResults(int queryId, const QueryWorker::Rows &rows)
+    {
+        m_results.insert(queryId, rows);
+        if (queryId != m_awaitedId) {
+            ++m_numIgnored;
+            return;
+        }
+        m_awaitedId = -1;
+        m_acceptedRows = rows;
+    }
+
+    void handleQueryFailure(int queryId, const QString &)
+    {
+        m_failedIds.append(queryId);
+        if (queryId == m_awaitedId) {
+            m_awaitedId = -1;
+        }
+    }
+
+private:
+    int m_awaitedId;
+    int m_numIgnored;
+    QHash<int, QueryWorker::Rows> m_results;
+    QList<int> m_failedIds;
+    QueryWorker::Rows m_acceptedRows;
+};
+
+#endif // !defined(TEST_QUERYWORKER_H)
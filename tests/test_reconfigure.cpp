@@ -0,0 +1,261 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "configuration.h"
+#include "thread.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+static const char *g_fileName = "test_reconfigure.xml";
+
+TRACELIB_NAMESPACE_BEGIN
+
+// Makes the trace read a configuration with one trace point set for this process.
+static void reload( Trace *trace, const string &tracePointSet )
+{
+    {
+        ofstream f( g_fileName );
+        f << "<tracelibConfiguration><process><name>"
+          << Configuration::currentProcessName()
+          << "</name>" << tracePointSet << "</process></tracelibConfiguration>";
+    }
+    trace->handleFileModification( g_fileName, FileModificationMonitorObserver::FileModified );
+}
+
+static bool isActive( const TracePoint &tracePoint )
+{
+    return ( tracePoint.flags & TracePoint::Active ) != 0;
+}
+
+static string pathSet( const char *path, const char *attributes = "" )
+{
+    return string( "<tracepointset " ) + attributes + "><pathfilter matchingmode=\"strict\">" +
+           path + "</pathfilter></tracepointset>";
+}
+
+class Visitor : public Thread
+{
+public:
+    Visitor( const Trace *trace, vector<TracePoint *> *tracePoints )
+        : m_trace( trace ), m_tracePoints( tracePoints ) { }
+    ~Visitor() { wait(); }
+
+    void stop() { m_stopped.store( 1 ); }
+    size_t visits() const { return m_visits.load(); }
+
+protected:
+    virtual void run() {
+        while ( !m_stopped.load() ) {
+            for ( size_t i = 0; i < m_tracePoints->size(); ++i ) {
+                m_trace->advanceVisit( ( *m_tracePoints )[i] );
+            }
+            m_visits.fetchAndAdd( 1 );
+        }
+    }
+
+private:
+    const Trace *m_trace;
+    vector<TracePoint *> *m_tracePoints;
+    AtomicCounter m_stopped;
+    AtomicCounter m_visits;
+};
+
+/* Alternates between two configurations while threads keep visiting the
+ * trace points; each visit may reconfigure a trace point and read the
+ * snapshot which the reload replaces.
+ */
+static void testReloadWhileVisiting()
+{
+    static const size_t TracePointCount = 64;
+    static const int VisitorCount = 4;
+
+    Trace trace;
+    vector<TracePoint *> tracePoints;
+    for ( size_t i = 0; i < TracePointCount; ++i ) {
+        tracePoints.push_back( new TracePoint( TracePointType::Log, i % 2 ? "odd.cpp" : "even.cpp",
+                                               (unsigned int)i, "testReloadWhileVisiting", 0 ) );
+    }
+
+    vector<Visitor *> visitors;
+    for ( int i = 0; i < VisitorCount; ++i ) {
+        visitors.push_back( new Visitor( &trace, &tracePoints ) );
+        visitors.back()->start();
+    }
+
+    for ( int i = 0; i < 50; ++i ) {
+        const size_t visitsBefore = visitors[0]->visits();
+        reload( &trace, pathSet( i % 2 ? "odd.cpp" : "even.cpp" ) );
+        // Let the visitors reconfigure the trace points before the next reload
+        while ( visitors[0]->visits() < visitsBefore + 2 ) {
+            Thread::sleep( 1 );
+        }
+    }
+
+    for ( int i = 0; i < VisitorCount; ++i ) {
+        visitors[i]->stop();
+        delete visitors[i];
+    }
+
+    // The last configuration selected the trace points in odd.cpp
+    bool configured = true;
+    for ( size_t i = 0; i < TracePointCount; ++i ) {
+        trace.advanceVisit( tracePoints[i] );
+        configured = configured && isActive( *tracePoints[i] ) == ( i % 2 == 1 );
+    }
+    verify( "trace points follow the last configuration", true, configured );
+
+    for ( size_t i = 0; i < TracePointCount; ++i ) {
+        delete tracePoints[i];
+    }
+}
+
+class FirstVisitor : public Thread
+{
+public:
+    FirstVisitor( const Trace *trace, vector<TracePoint *> *tracePoints, int visitorCount, AtomicCounter *arrivals )
+        : m_trace( trace ), m_tracePoints( tracePoints ), m_visitorCount( visitorCount ), m_arrivals( arrivals ) { }
+    ~FirstVisitor() { wait(); }
+
+    size_t inactiveVisits() const { return m_inactiveVisits.load(); }
+
+protected:
+    virtual void run() {
+        for ( size_t i = 0; i < m_tracePoints->size(); ++i ) {
+            // All visitors reach each trace point at the same time
+            m_arrivals->fetchAndAdd( 1 );
+            while ( m_arrivals->load() < ( i + 1 ) * m_visitorCount ) {
+                Thread::sleep( 0 );
+            }
+            TracePoint *tracePoint = ( *m_tracePoints )[i];
+            m_trace->advanceVisit( tracePoint );
+            if ( !isActive( *tracePoint ) ) {
+                m_inactiveVisits.fetchAndAdd( 1 );
+            }
+        }
+    }
+
+private:
+    const Trace *m_trace;
+    vector<TracePoint *> *m_tracePoints;
+    const size_t m_visitorCount;
+    AtomicCounter *m_arrivals;
+    AtomicCounter m_inactiveVisits;
+};
+
+/* Threads reaching a trace point for the first time at once must all see
+ * it configured, not only the one which got to configure it.
+ */
+static void testConcurrentFirstVisits()
+{
+    static const size_t TracePointCount = 500;
+    static const int VisitorCount = 4;
+
+    Trace trace;
+    reload( &trace, pathSet( "first.cpp" ) );
+    vector<TracePoint *> tracePoints;
+    for ( size_t i = 0; i < TracePointCount; ++i ) {
+        tracePoints.push_back( new TracePoint( TracePointType::Log, "first.cpp", (unsigned int)i,
+                                               "testConcurrentFirstVisits", 0 ) );
+    }
+
+    AtomicCounter arrivals;
+    vector<FirstVisitor *> visitors;
+    for ( int i = 0; i < VisitorCount; ++i ) {
+        visitors.push_back( new FirstVisitor( &trace, &tracePoints, VisitorCount, &arrivals ) );
+        visitors.back()->start();
+    }
+
+    size_t inactiveVisits = 0;
+    for ( int i = 0; i < VisitorCount; ++i ) {
+        visitors[i]->wait();
+        inactiveVisits += visitors[i]->inactiveVisits();
+        delete visitors[i];
+    }
+    verify( "first visits see the trace point configured", size_t( 0 ), inactiveVisits );
+
+    for ( size_t i = 0; i < TracePointCount; ++i ) {
+        delete tracePoints[i];
+    }
+}
+
+/* Decisions are cached by source location, so a trace point whose file name
+ * changes behind the cache's back tells whether its trace point sets were
+ * evaluated again.
+ */
+static void testDecisionCache()
+{
+    Trace trace;
+    char sourceFile[] = "cache_a.cpp";
+    TracePoint tp( TracePointType::Log, sourceFile, __LINE__, "testDecisionCache", 0 );
+
+    reload( &trace, pathSet( "cache_a.cpp" ) );
+    trace.advanceVisit( &tp );
+    verify( "trace point matching the filter is active", true, isActive( tp ) );
+
+    strcpy( sourceFile, "cache_b.cpp" );
+
+    reload( &trace, pathSet( "cache_a.cpp" ) );
+    trace.advanceVisit( &tp );
+    verify( "identical reload reuses the cached decision", true, isActive( tp ) );
+
+    reload( &trace, pathSet( "cache_a.cpp", "backtraces=\"yes\"" ) );
+    trace.advanceVisit( &tp );
+    verify( "changed configuration evaluates the filters again", false, isActive( tp ) );
+
+    reload( &trace, pathSet( "cache_a.cpp" ) );
+    trace.advanceVisit( &tp );
+    verify( "earlier configuration reuses its cached decisions", true, isActive( tp ) );
+}
+
+TRACELIB_NAMESPACE_END
+
+int main()
+{
+    // Only the configurations written by the tests are loaded
+    setenv( "TRACELIB_CONFIG_FILE", "test_reconfigure-nonexistent.xml", 1 );
+
+    TRACELIB_NAMESPACE_IDENT(testReloadWhileVisiting)();
+    TRACELIB_NAMESPACE_IDENT(testConcurrentFirstVisits)();
+    TRACELIB_NAMESPACE_IDENT(testDecisionCache)();
+    remove( g_fileName );
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
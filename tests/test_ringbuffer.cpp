@@ -0,0 +1,154 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log.h"
+#include "output.h"
+#include "../ringbuffer2trace/ringbufferreader.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+static const char *g_fileName = "test_ringbuffer.out";
+
+static vector<char> toVector( const string &s )
+{
+    return vector<char>( s.begin(), s.end() );
+}
+
+static bool readRingBuffer( RingBufferReader *reader )
+{
+    ifstream f( g_fileName, ios::binary );
+    const vector<char> contents( ( istreambuf_iterator<char>( f ) ), istreambuf_iterator<char>() );
+    return !contents.empty() && reader->read( &contents[0], contents.size() );
+}
+
+TRACELIB_NAMESPACE_BEGIN
+
+static void testTextData()
+{
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+
+    {
+        RingBufferOutput output( &log, g_fileName, 4096 );
+        verify( "output can write before open()", false, output.canWrite() );
+        verify( "output can be opened", true, output.open() );
+        for ( int i = 0; i < 1000; ++i ) {
+            ostringstream str;
+            str << "entry " << i;
+            output.write( toVector( str.str() ) );
+        }
+        verify( "text data never requires a new stream", true, output.canWrite() );
+        output.write( vector<char>( 4096, 'x' ) );
+    }
+
+    RingBufferReader reader;
+    verify( "ring buffer can be read", true, readRingBuffer( &reader ) );
+    verify( "text data is recognized", false, reader.isBinaryData() );
+    verify( "ring buffer is complete", false, reader.isTruncated() );
+    verify( "buffer holds the most recent data only", true,
+            reader.recordCount() > 0 && reader.recordCount() < 1000 );
+    verify( "data does not exceed buffer size", true, reader.traceData().size() < 4096 );
+
+    // The extracted data consists of the last records in the right order.
+    istringstream str( string( reader.traceData().begin(), reader.traceData().end() ) );
+    string line;
+    int expected = 1000 - reader.recordCount();
+    bool inOrder = true;
+    while ( getline( str, line ) ) {
+        ostringstream expectedLine;
+        expectedLine << "entry " << expected++;
+        inOrder = inOrder && line == expectedLine.str();
+    }
+    verify( "records are extracted in order", true, inOrder );
+    verify( "last record is extracted", 1000, expected );
+}
+
+static void testBinaryData()
+{
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+
+    {
+        RingBufferOutput output( &log, g_fileName, 4096 );
+        output.setBinaryData( true );
+        int restarts = 0;
+        for ( int i = 0; i < 1000; ++i ) {
+            // Mimic Trace, which starts a new stream after reopening.
+            string record = "entry;";
+            if ( !output.canWrite() ) {
+                output.open();
+                ++restarts;
+                record = "start;";
+            }
+            output.write( toVector( record ) );
+        }
+        verify( "binary data requires new streams", true, restarts > 1 );
+    }
+
+    RingBufferReader reader;
+    verify( "binary ring buffer can be read", true, readRingBuffer( &reader ) );
+    verify( "binary data is recognized", true, reader.isBinaryData() );
+    const string data( reader.traceData().begin(), reader.traceData().end() );
+    verify( "binary data starts with a stream", string( "start;" ), data.substr( 0, 6 ) );
+    verify( "binary data contains no newlines", string::npos, data.find( '\n' ) );
+}
+
+static void testInvalidFile()
+{
+    {
+        ofstream f( g_fileName, ios::binary );
+        f << "this is not a ring buffer, it's just some text which is long enough "
+             "to contain a header";
+    }
+    RingBufferReader reader;
+    verify( "files without magic are rejected", false, readRingBuffer( &reader ) );
+}
+
+TRACELIB_NAMESPACE_END
+
+int main()
+{
+    TRACELIB_NAMESPACE_IDENT(testTextData)();
+    TRACELIB_NAMESPACE_IDENT(testBinaryData)();
+    TRACELIB_NAMESPACE_IDENT(testInvalidFile)();
+    remove( g_fileName );
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
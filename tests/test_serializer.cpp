@@ -0,0 +1,308 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tracelib.h"
+#include "backtrace.h"
+#include "log.h"
+#include "output.h"
+#include "serializer.h"
+#include "thread.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+static unsigned long g_allocationCount = 0;
+// Allocations made by other threads, e.g. the event thread, are not counted
+static pthread_t g_tracingThread;
+
+void *operator new( size_t size )
+{
+    if ( pthread_equal( pthread_self(), g_tracingThread ) ) {
+        ++g_allocationCount;
+    }
+    void *p = malloc( size ? size : 1 );
+    if ( !p ) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[]( size_t size )
+{
+    return operator new( size );
+}
+
+void operator delete( void *p )
+{
+    free( p );
+}
+
+void operator delete[]( void *p )
+{
+    free( p );
+}
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* String variables are left out on purpose: VariableValue copies strings
+ * whenever the value is retrieved, that's part of the variable API and
+ * not of the serializers.
+ */
+class FixedVariable : public AbstractVariable
+{
+public:
+    FixedVariable( const char *name, const VariableValue &value ) : m_name( name ), m_value( value ) { }
+
+    virtual const char *name() const { return m_name; }
+    virtual VariableValue value() const { return m_value; }
+
+private:
+    const char *m_name;
+    const VariableValue m_value;
+};
+
+static void testSteadyStateAllocations( const char *what, Serializer *serializer, Output *output )
+{
+    static TracePoint tp( TracePointType::Watch, __FILE__, __LINE__, "void testSteadyStateAllocations()", "SomeGroup" );
+
+    FixedVariable number( "number", VariableValue::numberValue( (vlonglong)-42 ) );
+    FixedVariable flag( "flag", VariableValue::booleanValue( true ) );
+    FixedVariable ratio( "ratio", VariableValue::floatValue( 0.5 ) );
+    VariableSnapshot variables;
+    variables << &number << &flag << &ratio;
+
+    std::vector<StackFrame> frames( 2 );
+    frames[0].module = "test_serializer";
+    frames[0].function = "testSteadyStateAllocations(const char*, Serializer*, Output*)";
+    frames[0].sourceFile = __FILE__;
+    frames[1].module = "test_serializer";
+    frames[1].function = "main";
+    frames[1].sourceFile = __FILE__;
+
+    TraceEntry entry( &tp, "a message which is long enough to not fit into any small string buffer" );
+    entry.variables = &variables;
+    entry.backtrace = new Backtrace( frames );
+
+    StorageConfiguration cfg;
+    cfg.archiveDirectoryName = "/some/directory/for/archived/trace/entries";
+    serializer->setStorageConfiguration( cfg );
+
+    // Let the buffer grow and the serializer and output set up their state
+    std::vector<char> buf;
+    for ( int i = 0; i < 2; ++i ) {
+        buf.clear();
+        serializer->serialize( entry, buf );
+        output->write( buf );
+    }
+
+    const unsigned long allocationsBefore = g_allocationCount;
+    for ( int i = 0; i < 1000; ++i ) {
+        buf.clear();
+        serializer->serialize( entry, buf );
+        output->write( buf );
+    }
+    verify( what, 0ul, g_allocationCount - allocationsBefore );
+    verify( "serialized data is not empty", false, buf.empty() );
+}
+
+static void testSerializers()
+{
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+
+    const char *fileName = "test_serializer.out";
+
+    {
+        PlaintextSerializer serializer;
+        FileOutput output( &log, fileName );
+        output.open();
+        testSteadyStateAllocations( "allocations by plaintext serializer", &serializer, &output );
+    }
+
+    {
+        XMLSerializer serializer;
+        FileOutput output( &log, fileName );
+        output.open();
+        testSteadyStateAllocations( "allocations by beautified XML serializer", &serializer, &output );
+    }
+
+    {
+        XMLSerializer serializer;
+        serializer.setBeautifiedOutput( false );
+        FileOutput output( &log, fileName );
+        output.open();
+        testSteadyStateAllocations( "allocations by XML serializer", &serializer, &output );
+    }
+
+    {
+        BinarySerializer serializer;
+        FileOutput output( &log, fileName );
+        output.setBinaryData( true );
+        output.open();
+        testSteadyStateAllocations( "allocations by binary serializer", &serializer, &output );
+    }
+
+    remove( fileName );
+}
+
+// Accepts a single connection on some free port and counts the bytes received.
+class TcpReceiver : public Thread
+{
+public:
+    TcpReceiver() : m_serverSocket( socket( AF_INET, SOCK_STREAM, 0 ) ), m_port( 0 )
+    {
+        sockaddr_in address;
+        memset( &address, 0, sizeof( address ) );
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        socklen_t addressLength = sizeof( address );
+        if ( bind( m_serverSocket, (const sockaddr *)&address, sizeof( address ) ) == 0 &&
+             listen( m_serverSocket, 1 ) == 0 &&
+             getsockname( m_serverSocket, (sockaddr *)&address, &addressLength ) == 0 ) {
+            m_port = ntohs( address.sin_port );
+        }
+    }
+
+    ~TcpReceiver()
+    {
+        wait();
+        close( m_serverSocket );
+    }
+
+    unsigned short port() const { return m_port; }
+    size_t received() const { return m_received.load(); }
+
+    // Returns false if the given number of bytes did not arrive in time
+    bool waitFor( size_t bytes ) const
+    {
+        for ( int i = 0; i < 5000 && received() < bytes; ++i ) {
+            Thread::sleep( 1 );
+        }
+        return received() >= bytes;
+    }
+
+protected:
+    virtual void run()
+    {
+        const int fd = accept( m_serverSocket, NULL, NULL );
+        if ( fd < 0 ) {
+            return;
+        }
+        char buf[4096];
+        ssize_t nr;
+        while ( ( nr = read( fd, buf, sizeof( buf ) ) ) > 0 ) {
+            m_received.fetchAndAdd( nr );
+        }
+        close( fd );
+    }
+
+private:
+    const int m_serverSocket;
+    unsigned short m_port;
+    AtomicCounter m_received;
+};
+
+/* Entries go through Trace and the tcp output, the way traced applications
+ * write them. Each one is waited for before the next one is added, so that
+ * the output does not need more buffers than it set up already.
+ */
+static void testTcpOutputAllocations()
+{
+    static TracePoint tp( TracePointType::Log, __FILE__, __LINE__, "void testTcpOutputAllocations()", "SomeGroup" );
+
+    TcpReceiver receiver;
+    verify( "receiver is listening", true, receiver.port() != 0 );
+    if ( receiver.port() == 0 || !receiver.start() ) {
+        return;
+    }
+
+    NullLogOutput logOutput;
+    Log log( &logOutput, &logOutput );
+
+    TraceEntry entry( &tp, "a message which is long enough to not fit into any small string buffer" );
+    PlaintextSerializer reference;
+    reference.setTimestampsShown( false );
+    std::vector<char> data;
+    reference.serialize( entry, data );
+
+    {
+        Trace trace;
+        PlaintextSerializer *serializer = new PlaintextSerializer;
+        serializer->setTimestampsShown( false );
+        trace.setSerializer( serializer );
+        trace.setOutput( new NetworkOutput( &log, "127.0.0.1", receiver.port() ) );
+
+        /* A burst of entries makes the output set up a few buffers, so
+         * that one is spare while the previous one is still being released.
+         */
+        size_t expected = 0;
+        for ( int i = 0; i < 16; ++i ) {
+            trace.addEntry( entry );
+            expected += data.size();
+        }
+        receiver.waitFor( expected );
+
+        bool receivedAll = true;
+        const unsigned long allocationsBefore = g_allocationCount;
+        for ( int i = 0; i < 1000 && receivedAll; ++i ) {
+            trace.addEntry( entry );
+            expected += data.size();
+            receivedAll = receiver.waitFor( expected );
+        }
+        verify( "allocations by tcp output", 0ul, g_allocationCount - allocationsBefore );
+        verify( "entries sent through tcp output are received", true, receivedAll );
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
+int main()
+{
+    g_tracingThread = pthread_self();
+    TRACELIB_NAMESPACE_IDENT(testSerializers)();
+    TRACELIB_NAMESPACE_IDENT(testTcpOutputAllocations)();
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
+
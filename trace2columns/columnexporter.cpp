@@ -0,0 +1,491 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "columnexporter.h"
+
+#include "../server/database.h"
+
+#include <QDataStream>
+#include <QIODevice>
+#include <QList>
+#include <QMutexLocker>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+#include <QVariant>
+
+#include <stdexcept>
+
+using namespace std;
+
+const quint32 ColumnExporter::FormatVersion = 1;
+const int ColumnExporter::DefaultRowGroupSize = 65536;
+
+// Encoded row groups allowed per thread, including the one it works on
+static const int RowGroupsInFlightPerThread = 2;
+
+// Fixed size values of a column, before compression
+class ColumnData
+{
+public:
+    ColumnData()
+        : m_stream( &m_data, QIODevice::WriteOnly )
+    {
+        m_stream.setByteOrder( QDataStream::LittleEndian );
+    }
+
+    template <typename T>
+    void append( T value ) { m_stream << value; }
+
+    const QByteArray &data() const { return m_data; }
+
+private:
+    ColumnData( const ColumnData &other );
+    void operator=( const ColumnData &rhs );
+
+    QByteArray m_data;
+    QDataStream m_stream;
+};
+
+class StringColumnData
+{
+public:
+    StringColumnData() { m_offsets.append( quint32( 0 ) ); }
+
+    void append( const QString &s ) {
+        m_characters += s.toUtf8();
+        m_offsets.append( quint32( m_characters.size() ) );
+    }
+
+    QByteArray data() const { return m_offsets.data() + m_characters; }
+
+private:
+    ColumnData m_offsets;
+    QByteArray m_characters;
+};
+
+static QByteArray encodeSection( char kind, quint32 numRows,
+                                 const QList<QByteArray> &columns,
+                                 int compressionLevel )
+{
+    QByteArray section;
+    {
+        QDataStream stream( &section, QIODevice::WriteOnly );
+        stream.setByteOrder( QDataStream::LittleEndian );
+        stream << quint8( kind ) << numRows << quint32( columns.size() );
+
+        QList<QByteArray>::ConstIterator it, end = columns.end();
+        for ( it = columns.begin(); it != end; ++it ) {
+            const QByteArray compressed = qCompress( *it, compressionLevel );
+            stream << quint32( compressed.size() );
+            stream.writeRawData( compressed.constData(), compressed.size() );
+        }
+    }
+    return section;
+}
+
+static runtime_error queryError( const QString &what, const QSqlQuery &q )
+{
+    return runtime_error( QString( "%1: %2" ).arg( what ).arg( q.lastError().text() ).toUtf8().constData() );
+}
+
+// Runs queries which don't depend on any values to bind
+static void exec( QSqlQuery *q, const char *statement, const char *what )
+{
+    q->setForwardOnly( true );
+    if ( !q->exec( QString::fromLatin1( statement ) ) ) {
+        throw queryError( QString::fromLatin1( what ), *q );
+    }
+}
+
+class ExportThread : public QThread
+{
+public:
+    ExportThread( ColumnExporter *exporter, const QString &connectionName )
+        : m_exporter( exporter ),
+        m_connectionName( connectionName )
+    {
+    }
+
+protected:
+    virtual void run();
+
+private:
+    ColumnExporter *m_exporter;
+    QString m_connectionName;
+};
+
+// Connections can only be used by the thread which opened them
+void ExportThread::run()
+{
+    {
+        QString errMsg;
+        QSqlDatabase db = QSqlDatabase::addDatabase( "QSQLITE", m_connectionName );
+        db.setDatabaseName( m_exporter->m_db.databaseName() );
+        db.setConnectOptions( "QSQLITE_OPEN_READONLY" );
+        if ( !db.open() ) {
+            m_exporter->fail( QString( "Failed to open database: %1" ).arg( db.lastError().text() ) );
+        } else if ( !Database::attachSegments( db, &errMsg ) ) {
+            m_exporter->fail( QString( "Failed to attach segments: %1" ).arg( errMsg ) );
+        } else {
+            try {
+                int rowGroup;
+                while ( m_exporter->takeRowGroup( &rowGroup ) ) {
+                    quint32 numEntries = 0;
+                    const QByteArray data = m_exporter->encodeRowGroup( db, rowGroup, &numEntries );
+                    m_exporter->storeRowGroup( rowGroup, data, numEntries );
+                }
+            } catch ( const runtime_error &e ) {
+                m_exporter->fail( QString::fromUtf8( e.what() ) );
+            }
+        }
+    }
+    QSqlDatabase::removeDatabase( m_connectionName );
+}
+
+ColumnExporter::ColumnExporter( QSqlDatabase db )
+    : m_db( db ),
+    m_output( 0 ),
+    m_numThreads( QThread::idealThreadCount() ),
+    m_rowGroupSize( DefaultRowGroupSize ),
+    m_compressionLevel( -1 ),
+    m_firstId( 0 ),
+    m_lastId( 0 ),
+    m_numRowGroups( 0 ),
+    m_nextRowGroup( 0 ),
+    m_nextRowGroupToWrite( 0 ),
+    m_numExportedEntries( 0 ),
+    m_failed( false )
+{
+}
+
+bool ColumnExporter::exportTo( QIODevice *output )
+{
+    m_output = output;
+    m_nextRowGroup = 0;
+    m_nextRowGroupToWrite = 0;
+    m_encodedRowGroups.clear();
+    m_numExportedEntries = 0;
+    m_failed = false;
+    m_errorString.clear();
+    if ( m_numThreads < 1 ) {
+        m_numThreads = 1;
+    }
+
+    {
+        QSqlQuery q( m_db );
+        q.setForwardOnly( true );
+        if ( !q.exec( "SELECT MIN(id), MAX(id) FROM trace_entry;" ) || !q.next() ) {
+            m_errorString = QString( "Failed to determine range of entries: %1" ).arg( q.lastError().text() );
+            return false;
+        }
+        m_firstId = q.value( 0 ).toLongLong();
+        m_lastId = q.value( 1 ).toLongLong();
+        m_numRowGroups = 0;
+        if ( !q.value( 0 ).isNull() ) {
+            m_numRowGroups = int( ( m_lastId - m_firstId ) / m_rowGroupSize + 1 );
+        }
+    }
+
+    QByteArray header( "TRACECOL" );
+    {
+        QDataStream stream( &header, QIODevice::WriteOnly | QIODevice::Append );
+        stream.setByteOrder( QDataStream::LittleEndian );
+        stream << FormatVersion;
+    }
+    if ( !write( header ) ) {
+        return false;
+    }
+
+    try {
+        if ( !writeDictionaries() ) {
+            return false;
+        }
+    } catch ( const runtime_error &e ) {
+        m_errorString = QString::fromUtf8( e.what() );
+        return false;
+    }
+
+    QList<ExportThread *> threads;
+    for ( int i = 0; i < m_numThreads; ++i ) {
+        ExportThread *thread = new ExportThread( this, QString( "trace2columns-%1" ).arg( i ) );
+        thread->start();
+        threads.append( thread );
+    }
+    QList<ExportThread *>::ConstIterator it, end = threads.end();
+    for ( it = threads.begin(); it != end; ++it ) {
+        ( *it )->wait();
+    }
+    qDeleteAll( threads );
+
+    if ( m_failed ) {
+        return false;
+    }
+    return write( encodeSection( 0, 0, QList<QByteArray>(), m_compressionLevel ) );
+}
+
+/* The dictionaries are small compared to the entries, so they are read
+ * completely; the ids of their rows are mapped to the indexes written for
+ * them.
+ */
+bool ColumnExporter::writeDictionaries()
+{
+    QHash<quint32, quint32> processIndexes;
+    {
+        QSqlQuery q( m_db );
+        exec( &q, "SELECT id, name, pid, start_time, end_time FROM process ORDER BY id;",
+              "Failed to read processes" );
+        StringColumnData names;
+        ColumnData pids;
+        ColumnData startTimes;
+        ColumnData endTimes;
+        quint32 numRows = 0;
+        while ( q.next() ) {
+            processIndexes.insert( q.value( 0 ).toUInt(), numRows++ );
+            names.append( q.value( 1 ).toString() );
+            pids.append( quint32( q.value( 2 ).toUInt() ) );
+            startTimes.append( qint64( q.value( 3 ).toLongLong() ) );
+            endTimes.append( qint64( q.value( 4 ).toLongLong() ) );
+        }
+        if ( !write( encodeSection( 'P', numRows, QList<QByteArray>() << names.data()
+                                                                      << pids.data()
+                                                                      << startTimes.data()
+                                                                      << endTimes.data(),
+                                    m_compressionLevel ) ) ) {
+            return false;
+        }
+    }
+
+    m_threads.clear();
+    {
+        QSqlQuery q( m_db );
+        exec( &q, "SELECT id, process_id, tid FROM traced_thread;", "Failed to read threads" );
+        while ( q.next() ) {
+            Thread thread;
+            thread.process = processIndexes.value( q.value( 1 ).toUInt() );
+            thread.tid = q.value( 2 ).toUInt();
+            m_threads.insert( q.value( 0 ).toUInt(), thread );
+        }
+    }
+
+    const struct {
+        char kind;
+        const char *statement;
+        const char *what;
+    } nameDictionaries[] = {
+        { 'F', "SELECT id, name FROM path_name ORDER BY id;", "Failed to read file names" },
+        { 'N', "SELECT id, name FROM function_name ORDER BY id;", "Failed to read function names" },
+        { 'K', "SELECT id, name FROM trace_point_group ORDER BY id;", "Failed to read trace keys" }
+    };
+    const int numNameDictionaries = sizeof( nameDictionaries ) / sizeof( nameDictionaries[0] );
+    QHash<quint32, quint32> nameIndexes[numNameDictionaries];
+    for ( int i = 0; i < numNameDictionaries; ++i ) {
+        QSqlQuery q( m_db );
+        exec( &q, nameDictionaries[i].statement, nameDictionaries[i].what );
+        StringColumnData names;
+        quint32 numRows = 0;
+        while ( q.next() ) {
+            nameIndexes[i].insert( q.value( 0 ).toUInt(), numRows++ );
+            names.append( q.value( 1 ).toString() );
+        }
+        if ( !write( encodeSection( nameDictionaries[i].kind, numRows,
+                                    QList<QByteArray>() << names.data(),
+                                    m_compressionLevel ) ) ) {
+            return false;
+        }
+    }
+
+    m_tracePoints.clear();
+    {
+        QSqlQuery q( m_db );
+        exec( &q, "SELECT id, type, path_id, line, function_id, group_id FROM trace_point;",
+              "Failed to read trace points" );
+        while ( q.next() ) {
+            TracePoint tracePoint;
+            tracePoint.type = quint8( q.value( 1 ).toUInt() );
+            tracePoint.file = nameIndexes[0].value( q.value( 2 ).toUInt() );
+            tracePoint.line = q.value( 3 ).toUInt();
+            tracePoint.function = nameIndexes[1].value( q.value( 4 ).toUInt() );
+            // Trace points without a key have a group id of 0
+            QHash<quint32, quint32>::ConstIterator key = nameIndexes[2].constFind( q.value( 5 ).toUInt() );
+            tracePoint.key = key != nameIndexes[2].constEnd() ? qint32( key.value() ) : -1;
+            m_tracePoints.insert( q.value( 0 ).toUInt(), tracePoint );
+        }
+    }
+    return true;
+}
+
+// Expects the mutex to be locked, if the export threads are running
+bool ColumnExporter::write( const QByteArray &data )
+{
+    if ( m_output->write( data ) != data.size() ) {
+        m_failed = true;
+        m_errorString = QString( "Failed to write output: %1" ).arg( m_output->errorString() );
+        return false;
+    }
+    return true;
+}
+
+bool ColumnExporter::takeRowGroup( int *rowGroup )
+{
+    QMutexLocker locker( &m_mutex );
+    while ( !m_failed && m_nextRowGroup < m_numRowGroups &&
+            m_nextRowGroup >= m_nextRowGroupToWrite + RowGroupsInFlightPerThread * m_numThreads ) {
+        m_rowGroupWritten.wait( &m_mutex );
+    }
+    if ( m_failed || m_nextRowGroup >= m_numRowGroups ) {
+        return false;
+    }
+    *rowGroup = m_nextRowGroup++;
+    return true;
+}
+
+void ColumnExporter::storeRowGroup( int rowGroup, const QByteArray &data, quint32 numEntries )
+{
+    QMutexLocker locker( &m_mutex );
+    m_encodedRowGroups.insert( rowGroup, data );
+    m_numExportedEntries += numEntries;
+
+    QMap<int, QByteArray>::Iterator it = m_encodedRowGroups.find( m_nextRowGroupToWrite );
+    while ( !m_failed && it != m_encodedRowGroups.end() ) {
+        if ( !write( it.value() ) ) {
+            break;
+        }
+        m_encodedRowGroups.erase( it );
+        it = m_encodedRowGroups.find( ++m_nextRowGroupToWrite );
+    }
+    m_rowGroupWritten.wakeAll();
+}
+
+void ColumnExporter::fail( const QString &errorString )
+{
+    QMutexLocker locker( &m_mutex );
+    // The first error is the interesting one
+    if ( !m_failed ) {
+        m_failed = true;
+        m_errorString = errorString;
+    }
+    m_rowGroupWritten.wakeAll();
+}
+
+/* Only the trace_entry table is scanned, by id; everything the entries
+ * refer to is looked up in the dictionaries read at first.
+ */
+QByteArray ColumnExporter::encodeRowGroup( QSqlDatabase db, int rowGroup,
+                                           quint32 *numEntries ) const
+{
+    const qint64 firstId = m_firstId + qint64( rowGroup ) * m_rowGroupSize;
+    const qint64 lastId = qMin( firstId + m_rowGroupSize - 1, m_lastId );
+
+    QSqlQuery q( db );
+    q.setForwardOnly( true );
+    q.prepare( "SELECT id, timestamp, traced_thread_id, trace_point_id, message, stack_position"
+               " FROM trace_entry WHERE id BETWEEN ? AND ? ORDER BY id;" );
+    q.addBindValue( firstId );
+    q.addBindValue( lastId );
+    if ( !q.exec() ) {
+        throw queryError( "Failed to read trace entries", q );
+    }
+
+    ColumnData ids;
+    ColumnData timestamps;
+    ColumnData processes;
+    ColumnData threads;
+    ColumnData files;
+    ColumnData lines;
+    ColumnData functions;
+    ColumnData types;
+    ColumnData keys;
+    StringColumnData messages;
+    ColumnData stackPositions;
+    quint32 numRows = 0;
+    while ( q.next() ) {
+        const quint32 id = q.value( 0 ).toUInt();
+        QHash<quint32, Thread>::ConstIterator thread = m_threads.constFind( q.value( 2 ).toUInt() );
+        QHash<quint32, TracePoint>::ConstIterator tracePoint = m_tracePoints.constFind( q.value( 3 ).toUInt() );
+        if ( thread == m_threads.constEnd() || tracePoint == m_tracePoints.constEnd() ) {
+            throw runtime_error( QString( "Trace entry %1 refers to an unknown thread or trace point" ).arg( id ).toUtf8().constData() );
+        }
+
+        ids.append( id );
+        timestamps.append( qint64( q.value( 1 ).toLongLong() ) );
+        processes.append( thread->process );
+        threads.append( thread->tid );
+        files.append( tracePoint->file );
+        lines.append( tracePoint->line );
+        functions.append( tracePoint->function );
+        types.append( tracePoint->type );
+        keys.append( tracePoint->key );
+        messages.append( q.value( 4 ).toString() );
+        stackPositions.append( quint64( q.value( 5 ).toULongLong() ) );
+        ++numRows;
+    }
+    q.finish();
+
+    *numEntries = numRows;
+    if ( numRows == 0 ) {
+        return QByteArray();
+    }
+    return encodeSection( 'E', numRows, QList<QByteArray>() << ids.data()
+                                                            << timestamps.data()
+                                                            << processes.data()
+                                                            << threads.data()
+                                                            << files.data()
+                                                            << lines.data()
+                                                            << functions.data()
+                                                            << types.data()
+                                                            << keys.data()
+                                                            << messages.data()
+                                                            << stackPositions.data(),
+                          m_compressionLevel ) +
+           encodeVariables( db, firstId, lastId );
+}
+
+QByteArray ColumnExporter::encodeVariables( QSqlDatabase db, qint64 firstId,
+                                            qint64 lastId ) const
+{
+    QSqlQuery q( db );
+    q.setForwardOnly( true );
+    q.prepare( "SELECT trace_entry_id, name, value, type FROM variable"
+               " WHERE trace_entry_id BETWEEN ? AND ? ORDER BY trace_entry_id;" );
+    q.addBindValue( firstId );
+    q.addBindValue( lastId );
+    if ( !q.exec() ) {
+        throw queryError( "Failed to read variables", q );
+    }
+
+    ColumnData entryIds;
+    StringColumnData names;
+    StringColumnData values;
+    ColumnData types;
+    quint32 numRows = 0;
+    while ( q.next() ) {
+        entryIds.append( quint32( q.value( 0 ).toUInt() ) );
+        names.append( q.value( 1 ).toString() );
+        values.append( q.value( 2 ).toString() );
+        types.append( quint8( q.value( 3 ).toUInt() ) );
+        ++numRows;
+    }
+
+    return encodeSection( 'V', numRows, QList<QByteArray>() << entryIds.data()
+                                                            << names.data()
+                                                            << values.data()
+                                                            << types.data(),
+                          m_compressionLevel );
+}
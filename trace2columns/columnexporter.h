@@ -0,0 +1,144 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COLUMNEXPORTER_H
+#define COLUMNEXPORTER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QString>
+#include <QWaitCondition>
+
+class QIODevice;
+
+/* Writes the contents of a trace database column by column, so that
+ * analysis tools only need to read (and decompress) the columns they are
+ * interested in. All integers are little endian.
+ *
+ *   File    := "TRACECOL" Version:u32 Section* EndMarker
+ *   Section := Kind:u8 RowCount:u32 ColumnCount:u32 Column*
+ *   Column  := Size:u32 Data
+ *
+ * Column data is compressed with zlib and preceded by the size of the
+ * uncompressed data as a big endian u32 (the format of qCompress()). Once
+ * uncompressed, a column is an array of RowCount fixed size values, or,
+ * for strings, RowCount + 1 u32 offsets followed by the UTF-8 encoded
+ * characters. The end marker is a section of kind 0 without any columns.
+ *
+ * Dictionaries come first, each only once; their rows are referred to by
+ * their index:
+ *   'P' processes:  name:string pid:u32 start_time:i64 end_time:i64
+ *   'F' files:      name:string
+ *   'N' functions:  name:string
+ *   'K' trace keys: name:string
+ *
+ * Entries follow in row groups of ascending ids, each immediately followed
+ * by the variables of its entries (which may be no rows at all):
+ *   'E' entries:   id:u32 timestamp:i64 process:u32 thread:u32 file:u32
+ *                  line:u32 function:u32 type:u8 key:i32 message:string
+ *                  stack_position:u64
+ *   'V' variables: entry_id:u32 name:string value:string type:u8
+ *
+ * Timestamps are milliseconds since the epoch; 'thread' is the thread id
+ * as reported by the operating system and a 'key' of -1 means the entry
+ * has none.
+ *
+ * Row groups are read and encoded by several threads, each using a
+ * connection of its own, and written in order. Only a limited number of
+ * row groups are kept in memory at any time.
+ */
+class ColumnExporter
+{
+public:
+    static const quint32 FormatVersion;
+    static const int DefaultRowGroupSize;
+
+    explicit ColumnExporter( QSqlDatabase db );
+
+    void setNumberOfThreads( int numThreads ) { m_numThreads = numThreads; }
+    void setRowGroupSize( int rowGroupSize ) { m_rowGroupSize = rowGroupSize; }
+    // zlib compression level from 0 (none) to 9 (best), -1 for the default
+    void setCompressionLevel( int level ) { m_compressionLevel = level; }
+
+    bool exportTo( QIODevice *output );
+
+    qulonglong numExportedEntries() const { return m_numExportedEntries; }
+    const QString &errorString() const { return m_errorString; }
+
+private:
+    friend class ExportThread;
+
+    struct TracePoint
+    {
+        quint8 type;
+        quint32 file;
+        quint32 line;
+        quint32 function;
+        qint32 key;
+    };
+
+    struct Thread
+    {
+        quint32 process;
+        quint32 tid;
+    };
+
+    ColumnExporter( const ColumnExporter &other );
+    void operator=( const ColumnExporter &rhs );
+
+    bool writeDictionaries();
+    bool write( const QByteArray &data );
+
+    // Called by the export threads
+    bool takeRowGroup( int *rowGroup );
+    void storeRowGroup( int rowGroup, const QByteArray &data, quint32 numEntries );
+    void fail( const QString &errorString );
+    QByteArray encodeRowGroup( QSqlDatabase db, int rowGroup, quint32 *numEntries ) const;
+    QByteArray encodeVariables( QSqlDatabase db, qint64 firstId, qint64 lastId ) const;
+
+    QSqlDatabase m_db;
+    QIODevice *m_output;
+    int m_numThreads;
+    int m_rowGroupSize;
+    int m_compressionLevel;
+
+    // Database ids mapped to what is written for them
+    QHash<quint32, TracePoint> m_tracePoints;
+    QHash<quint32, Thread> m_threads;
+
+    qint64 m_firstId;
+    // Entries stored while exporting are left out
+    qint64 m_lastId;
+    int m_numRowGroups;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_rowGroupWritten;
+    int m_nextRowGroup;
+    int m_nextRowGroupToWrite;
+    // Encoded row groups waiting for the ones before them
+    QMap<int, QByteArray> m_encodedRowGroups;
+    qulonglong m_numExportedEntries;
+    bool m_failed;
+    QString m_errorString;
+};
+
+#endif // !defined(COLUMNEXPORTER_H)
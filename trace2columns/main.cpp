@@ -0,0 +1,116 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "columnexporter.h"
+#include "../server/database.h"
+#include "config.h"
+
+#include <cstdio>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QSqlDatabase>
+#include <QThread>
+
+namespace Error
+{
+    const int None = 0;
+    const int CommandLineArgs = 1;
+    const int Open = 2;
+    const int File = 3;
+    const int Transformation = 4;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication a(argc, argv);
+    a.setApplicationVersion(QLatin1String(TRACELIB_VERSION_STR));
+
+    QCommandLineParser opt;
+    QCommandLineOption output(QStringList() << "o" << "output", "Output File to write the columns into, if not specified writes to stdout", "file");
+    QCommandLineOption threads(QStringList() << "j" << "threads", "Number of threads reading and compressing trace entries.",
+                               "count", QString::number(QThread::idealThreadCount()));
+    QCommandLineOption rowGroupSize(QStringList() << "row-group-size", "Number of trace entry ids covered by each group of rows.",
+                                    "entries", QString::number(ColumnExporter::DefaultRowGroupSize));
+    QCommandLineOption compressionLevel(QStringList() << "compression-level", "zlib compression level from 0 (none) to 9 (best).",
+                                        "level", "1");
+    opt.addHelpOption();
+    opt.addVersionOption();
+    opt.setApplicationDescription("Converts trace databases into compressed columnar files");
+    opt.addOption(output);
+    opt.addOption(threads);
+    opt.addOption(rowGroupSize);
+    opt.addOption(compressionLevel);
+    opt.addPositionalArgument(".trace-file", "Trace database to convert");
+    opt.process(a);
+
+    if( opt.positionalArguments().isEmpty() ) {
+        fprintf(stderr, "Missing command line argument.\n");
+        opt.showHelp(Error::CommandLineArgs);
+    }
+    bool ok;
+    const int numThreads = opt.value(threads).toInt(&ok);
+    if (!ok || numThreads <= 0) {
+        fprintf(stderr, "Invalid number of threads '%s' given.\n", qPrintable(opt.value(threads)));
+        return Error::CommandLineArgs;
+    }
+    const int numRowGroupEntries = opt.value(rowGroupSize).toInt(&ok);
+    if (!ok || numRowGroupEntries <= 0) {
+        fprintf(stderr, "Invalid row group size '%s' given.\n", qPrintable(opt.value(rowGroupSize)));
+        return Error::CommandLineArgs;
+    }
+    const int level = opt.value(compressionLevel).toInt(&ok);
+    if (!ok || level < 0 || level > 9) {
+        fprintf(stderr, "Invalid compression level '%s' given.\n", qPrintable(opt.value(compressionLevel)));
+        return Error::CommandLineArgs;
+    }
+
+    QString traceFile = opt.positionalArguments().at(0);
+    QString errMsg;
+    QSqlDatabase db = Database::open(traceFile, &errMsg);
+    if (!db.isValid() || !Database::attachSegments(db, &errMsg)) {
+        fprintf(stderr, "Open error: %s\n", qPrintable(errMsg));
+        return Error::Open;
+    }
+
+    QFile outputFile;
+    if (!opt.isSet(output)) {
+        if (!outputFile.open(stdout, QIODevice::WriteOnly)) {
+            fprintf(stderr, "Standard output cannot be opened for writing.\n");
+            return Error::File;
+        }
+    } else {
+        outputFile.setFileName(opt.value(output));
+        if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            fprintf(stderr, "File '%s' cannot be opened for writing.\n", qPrintable(opt.value(output)));
+            return Error::File;
+        }
+    }
+
+    ColumnExporter exporter(db);
+    exporter.setNumberOfThreads(numThreads);
+    exporter.setRowGroupSize(numRowGroupEntries);
+    exporter.setCompressionLevel(level);
+    if (!exporter.exportTo(&outputFile)) {
+        fprintf(stderr, "Transformation error: %s\n", qPrintable(exporter.errorString()));
+        return Error::Transformation;
+    }
+    outputFile.close();
+    return Error::None;
+}
@@ -19,6 +19,7 @@
 
 #include "../hooklib/tracelib.h"
 #include "../server/xmlcontenthandler.h"
+#include "../server/binarycontenthandler.h"
 #include "../server/databasefeeder.h"
 #include "config.h"
 
@@ -37,21 +38,44 @@ namespace Error
     const int Transformation = 4;
 }
 
-static bool fromXml( QSqlDatabase &db, QFile &input, QString *errMsg )
+template <typename ContentHandler>
+static bool feed( ContentHandler &parser, DatabaseFeeder &feeder, QByteArray data, QFile &input, QString *errMsg )
 {
-    DatabaseFeeder feeder( db );
-    XmlContentHandler xmlparser(&feeder );
-    xmlparser.addData( "<toplevel_trace_element>" );
-    while( !input.atEnd() ) {
+    while ( true ) {
         try {
-            xmlparser.addData( input.read( 1 << 16 ) );
-            xmlparser.continueParsing();
+            parser.addData( data );
+            parser.continueParsing();
+            if ( input.atEnd() ) {
+                feeder.flushPendingEntries();
+            }
         } catch( const SQLTransactionException &ex ) {
             *errMsg = "Database error: " + QString::fromLatin1( ex.what() ) + ", driver message: " + ex.driverMessage() + "(" + QString::number(ex.driverCode()) + ")";
             return false;
+        } catch( const std::runtime_error &ex ) {
+            *errMsg = QString::fromLatin1( ex.what() );
+            return false;
+        }
+        if ( input.atEnd() ) {
+            return true;
         }
+        data = input.read( 1 << 16 );
+    }
+}
+
+static bool fromXml( QSqlDatabase &db, QFile &input, QString *errMsg )
+{
+    DatabaseFeeder feeder( db );
+    const QByteArray data = input.read( 1 << 16 );
+
+    // Files written with the binary serializer are accepted as well
+    if ( BinaryContentHandler::isBinaryData( data ) ) {
+        BinaryContentHandler binaryparser( &feeder );
+        return feed( binaryparser, feeder, data, input, errMsg );
     }
-    return true;
+
+    XmlContentHandler xmlparser(&feeder );
+    xmlparser.addData( "<toplevel_trace_element>" );
+    return feed( xmlparser, feeder, data, input, errMsg );
 }
 
 int main( int argc, char **argv )
@@ -60,7 +84,7 @@ int main( int argc, char **argv )
     a.setApplicationVersion(QLatin1String(TRACELIB_VERSION_STR));
 
     QCommandLineParser opt;
-    QCommandLineOption inputOption(QStringList() << "i" << "input", "XML input file to read from, if not specified reads from stdin", "file");
+    QCommandLineOption inputOption(QStringList() << "i" << "input", "XML (or binary) input file to read from, if not specified reads from stdin", "file");
     opt.setApplicationDescription("Converts xml files into trace databases.");
     opt.addHelpOption();
     opt.addVersionOption();